@@ -0,0 +1,113 @@
+#include "bench_main.hpp"
+#include "server/logger.hpp"
+#include "server/server.hpp"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using FsyncPolicy = server::AOFManager::FsyncPolicy;
+
+constexpr unsigned short BASE_PORT = 16400;
+
+// One in-process server per appendfsync policy, each with its own AOF.
+class ServerFixture {
+public:
+    static ServerFixture& get(FsyncPolicy policy) {
+        static std::map<FsyncPolicy, std::unique_ptr<ServerFixture>> fixtures;
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& fixture = fixtures[policy];
+        if (!fixture) {
+            fixture.reset(new ServerFixture(policy));
+        }
+        return *fixture;
+    }
+
+    ~ServerFixture() {
+        server_->stop();
+        if (thread_.joinable()) thread_.join();
+        server_.reset();
+        std::remove(config_.aof_path.c_str());
+    }
+
+    unsigned short port() const { return config_.port; }
+
+private:
+    explicit ServerFixture(FsyncPolicy policy) {
+        // Keeps startup notices out of the benchmark report.
+        server::Logger::instance().setLevel(server::LogLevel::Warning);
+        config_.port = static_cast<unsigned short>(BASE_PORT + static_cast<int>(policy));
+        config_.aof_path = "aof_bench_" + std::to_string(static_cast<int>(policy)) + ".aof";
+        config_.appendfsync = policy;
+        std::remove(config_.aof_path.c_str());
+        server_ = std::make_unique<server::Server>(config_);
+        thread_ = std::thread([this]() { server_->start(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    server::Server::Config config_;
+    std::unique_ptr<server::Server> server_;
+    std::thread thread_;
+};
+
+std::string command(std::initializer_list<std::string> args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return out;
+}
+
+// Each benchmark thread is one client issuing SETs of fresh keys one at a
+// time, so with several threads the writer gets to batch their records.
+void BM_Set(benchmark::State& state, FsyncPolicy policy) {
+    const unsigned short port = ServerFixture::get(policy).port();
+    static std::atomic<uint64_t> next_key{0};
+
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::address::from_string("127.0.0.1"), port});
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    const std::string expected = "+OK\r\n";
+    std::string reply(expected.size(), '\0');
+    std::vector<double> latencies_us;
+    latencies_us.reserve(1 << 16);
+
+    for (auto _ : state) {
+        const std::string request = command({"SET", "key:" + std::to_string(next_key++), "value"});
+        const auto start = std::chrono::steady_clock::now();
+        boost::asio::write(socket, boost::asio::buffer(request));
+        boost::asio::read(socket, boost::asio::buffer(reply));
+        latencies_us.push_back(std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count());
+        if (reply != expected) {
+            state.SkipWithError("unexpected reply");
+            break;
+        }
+    }
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    if (!latencies_us.empty()) {
+        const double p99 = latencies_us[std::min(latencies_us.size() - 1, latencies_us.size() * 99 / 100)];
+        state.counters["p99_us"] = benchmark::Counter(p99, benchmark::Counter::kAvgThreads);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK_CAPTURE(BM_Set, always, FsyncPolicy::Always)->Threads(1)->Threads(8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Set, everysec, FsyncPolicy::EverySec)->Threads(1)->Threads(8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_Set, no, FsyncPolicy::No)->Threads(1)->Threads(8)->UseRealTime();
+
+BENCH_MAIN()
@@ -0,0 +1,193 @@
+#include "bench_main.hpp"
+#include "server_fixture.hpp"
+#include "store/store.hpp"
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+
+// N keys read or written one command at a time against one MGET or MSET
+// covering all of them. Items are keys, so the figures compare directly.
+namespace {
+
+using bench::BENCH_PORT;
+using bench::ServerFixture;
+using bench::command;
+
+const std::string VALUE(100, 'v');
+
+std::vector<std::string> batchKeys(const char* prefix, size_t count) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back(std::string(prefix) + std::to_string(i));
+    }
+    return keys;
+}
+
+class Client {
+public:
+    Client() : socket_(io_context_) {
+        ServerFixture::get();
+        socket_.connect({boost::asio::ip::address::from_string("127.0.0.1"), BENCH_PORT});
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void roundTrip(const std::string& request, std::string& reply) {
+        boost::asio::write(socket_, boost::asio::buffer(request));
+        boost::asio::read(socket_, boost::asio::buffer(reply));
+    }
+
+private:
+    boost::asio::io_context io_context_;
+    boost::asio::ip::tcp::socket socket_;
+};
+
+std::string array(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return out;
+}
+
+void populate(Client& client, const std::vector<std::string>& keys) {
+    std::string reply(std::string("+OK\r\n").size(), '\0');
+    for (const auto& key : keys) {
+        client.roundTrip(command({"SET", key, VALUE}), reply);
+    }
+}
+
+void BM_PerKeyGet(benchmark::State& state) {
+    const auto keys = batchKeys("batch:get:", static_cast<size_t>(state.range(0)));
+    Client client;
+    populate(client, keys);
+    std::vector<std::string> requests;
+    for (const auto& key : keys) {
+        requests.push_back(command({"GET", key}));
+    }
+    const std::string expected = "$" + std::to_string(VALUE.size()) + "\r\n" + VALUE + "\r\n";
+    std::string reply(expected.size(), '\0');
+    for (auto _ : state) {
+        for (const auto& request : requests) {
+            client.roundTrip(request, reply);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    if (reply != expected) state.SkipWithError("unexpected reply");
+}
+
+void BM_MGet(benchmark::State& state) {
+    const auto keys = batchKeys("batch:get:", static_cast<size_t>(state.range(0)));
+    Client client;
+    populate(client, keys);
+    std::vector<std::string> args{"MGET"};
+    args.insert(args.end(), keys.begin(), keys.end());
+    const std::string request = array(args);
+    std::string expected = "*" + std::to_string(keys.size()) + "\r\n";
+    for (size_t i = 0; i < keys.size(); ++i) {
+        expected += "$" + std::to_string(VALUE.size()) + "\r\n" + VALUE + "\r\n";
+    }
+    std::string reply(expected.size(), '\0');
+    for (auto _ : state) {
+        client.roundTrip(request, reply);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    if (reply != expected) state.SkipWithError("unexpected reply");
+}
+
+void BM_PerKeySet(benchmark::State& state) {
+    const auto keys = batchKeys("batch:set:", static_cast<size_t>(state.range(0)));
+    Client client;
+    std::vector<std::string> requests;
+    for (const auto& key : keys) {
+        requests.push_back(command({"SET", key, VALUE}));
+    }
+    std::string reply(std::string("+OK\r\n").size(), '\0');
+    for (auto _ : state) {
+        for (const auto& request : requests) {
+            client.roundTrip(request, reply);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    if (reply != "+OK\r\n") state.SkipWithError("unexpected reply");
+}
+
+// The same writes as one command and one AOF record.
+void BM_MSet(benchmark::State& state) {
+    const auto keys = batchKeys("batch:set:", static_cast<size_t>(state.range(0)));
+    Client client;
+    std::vector<std::string> args{"MSET"};
+    for (const auto& key : keys) {
+        args.push_back(key);
+        args.push_back(VALUE);
+    }
+    const std::string request = array(args);
+    std::string reply(std::string("+OK\r\n").size(), '\0');
+    for (auto _ : state) {
+        client.roundTrip(request, reply);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    if (reply != "+OK\r\n") state.SkipWithError("unexpected reply");
+}
+
+// In the store alone: a lock per key against a lock per shard touched.
+constexpr size_t STORE_KEYS = 100000;
+
+store::Store& populatedStore() {
+    static store::Store store;
+    static const bool populated = [] {
+        for (size_t i = 0; i < STORE_KEYS; ++i) {
+            store.add("key:" + std::to_string(i), VALUE);
+        }
+        return true;
+    }();
+    (void)populated;
+    return store;
+}
+
+std::vector<std::vector<std::string>> storeBatches(size_t batch_size) {
+    std::vector<std::vector<std::string>> batches(1024);
+    size_t next = 0;
+    for (auto& batch : batches) {
+        for (size_t i = 0; i < batch_size; ++i) {
+            batch.push_back("key:" + std::to_string(next++ * 7919 % STORE_KEYS));
+        }
+    }
+    return batches;
+}
+
+void BM_StoreGetLoop(benchmark::State& state) {
+    auto& store = populatedStore();
+    const auto batches = storeBatches(static_cast<size_t>(state.range(0)));
+    size_t i = static_cast<size_t>(state.thread_index()) * 31;
+    for (auto _ : state) {
+        for (const auto& key : batches[i++ % batches.size()]) {
+            benchmark::DoNotOptimize(store.get(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_StoreGetMany(benchmark::State& state) {
+    auto& store = populatedStore();
+    const auto batches = storeBatches(static_cast<size_t>(state.range(0)));
+    std::vector<std::vector<std::string_view>> views;
+    for (const auto& batch : batches) {
+        views.emplace_back(batch.begin(), batch.end());
+    }
+    size_t i = static_cast<size_t>(state.thread_index()) * 31;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.getMany(views[i++ % views.size()]));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}
+
+BENCHMARK(BM_PerKeyGet)->ArgName("keys")->Arg(10)->Arg(100)->UseRealTime();
+BENCHMARK(BM_MGet)->ArgName("keys")->Arg(10)->Arg(100)->UseRealTime();
+BENCHMARK(BM_PerKeySet)->ArgName("keys")->Arg(10)->Arg(100)->UseRealTime();
+BENCHMARK(BM_MSet)->ArgName("keys")->Arg(10)->Arg(100)->UseRealTime();
+BENCHMARK(BM_StoreGetLoop)->ArgName("keys")->Arg(16)->Arg(256)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_StoreGetMany)->ArgName("keys")->Arg(16)->Arg(256)->ThreadRange(1, 4)->UseRealTime();
+
+BENCH_MAIN()
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+namespace bench {
+
+inline int run(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
+
+}
+
+#define BENCH_MAIN() \
+    int main(int argc, char** argv) { return bench::run(argc, argv); }
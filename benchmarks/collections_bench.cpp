@@ -0,0 +1,77 @@
+#include "bench_main.hpp"
+#include "store/store.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+
+// range(0) fields of 8-byte values: up to LISTPACK_MAX_ENTRIES the hash is
+// one list pack, past it a table. bytes_per_field is what each field costs
+// the store.
+std::vector<std::string> fieldNames(size_t count) {
+    std::vector<std::string> fields;
+    for (size_t i = 0; i < count; ++i) {
+        fields.push_back("field:" + std::to_string(i));
+    }
+    return fields;
+}
+
+void fillHash(store::Store& store, const std::vector<std::string>& fields) {
+    std::vector<store::Store::KeyValue> pairs;
+    for (const auto& field : fields) {
+        pairs.emplace_back(field, "value123");
+    }
+    store.hashSet("hash", pairs);
+}
+
+void BM_HashGet(benchmark::State& state) {
+    store::Store store;
+    const auto fields = fieldNames(static_cast<size_t>(state.range(0)));
+    const size_t empty = store.usedMemory();
+    fillHash(store, fields);
+    state.counters["bytes_per_field"] = static_cast<double>(store.usedMemory() - empty) / fields.size();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.hashGet("hash", fields[i++ % fields.size()]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_HashSetExisting(benchmark::State& state) {
+    store::Store store;
+    const auto fields = fieldNames(static_cast<size_t>(state.range(0)));
+    fillHash(store, fields);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.hashSet("hash", {{fields[i++ % fields.size()], "value456"}}));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Ranks are found through the skiplist spans once the sorted set is large.
+void BM_ZSetRange(benchmark::State& state) {
+    store::Store store;
+    const auto members = fieldNames(static_cast<size_t>(state.range(0)));
+    const size_t empty = store.usedMemory();
+    std::vector<std::pair<double, std::string_view>> items;
+    for (size_t i = 0; i < members.size(); ++i) {
+        items.emplace_back(static_cast<double>(i), members[i]);
+    }
+    store.zsetAdd("zset", items);
+    state.counters["bytes_per_member"] = static_cast<double>(store.usedMemory() - empty) / members.size();
+    const auto size = static_cast<int64_t>(members.size());
+    int64_t i = 0;
+    for (auto _ : state) {
+        const int64_t start = i++ % size;
+        benchmark::DoNotOptimize(store.zsetRange("zset", start, start + 9));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_HashGet)->ArgName("fields")->Arg(16)->Arg(128)->Arg(129)->Arg(4096);
+BENCHMARK(BM_HashSetExisting)->ArgName("fields")->Arg(16)->Arg(128)->Arg(129)->Arg(4096);
+BENCHMARK(BM_ZSetRange)->ArgName("members")->Arg(16)->Arg(128)->Arg(129)->Arg(4096);
+
+BENCH_MAIN()
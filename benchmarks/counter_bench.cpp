@@ -0,0 +1,95 @@
+#include "bench_main.hpp"
+#include "store/store.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// Every operator new in the process, so allocs_per_op shows what a counter
+// update allocates.
+static std::atomic<uint64_t> allocations{0};
+
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* block = std::malloc(size)) return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete(void* block, size_t) noexcept { std::free(block); }
+
+namespace {
+
+// range(0) counters shared by every thread: 1 is a single hot key, as a
+// global rate limit would be.
+std::vector<std::string> counterKeys(size_t count) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back("counter:" + std::to_string(i));
+    }
+    return keys;
+}
+
+store::Store& counterStore() {
+    static store::Store store;
+    return store;
+}
+
+void report(benchmark::State& state, uint64_t before) {
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        state.counters["allocs_per_op"] = benchmark::Counter(
+            static_cast<double>(allocations.load(std::memory_order_relaxed) - before),
+            benchmark::Counter::kAvgIterations);
+    }
+}
+
+// What clients did without INCR: read, add, write back. Two lookups and
+// locks, parsing and formatting, and updates from other threads in
+// between are lost.
+void BM_GetSetCounter(benchmark::State& state) {
+    auto& store = counterStore();
+    const auto keys = counterKeys(static_cast<size_t>(state.range(0)));
+    size_t i = static_cast<size_t>(state.thread_index());
+    const uint64_t before = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        const auto& key = keys[i++ % keys.size()];
+        const auto value = store.get(key);
+        const int64_t next = (value ? std::stoll(*value) : 0) + 1;
+        store.upsert(key, std::to_string(next));
+    }
+    report(state, before);
+}
+
+void BM_IncrementBy(benchmark::State& state) {
+    auto& store = counterStore();
+    const auto keys = counterKeys(static_cast<size_t>(state.range(0)));
+    size_t i = static_cast<size_t>(state.thread_index());
+    const uint64_t before = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.incrementBy(keys[i++ % keys.size()], 1));
+    }
+    report(state, before);
+}
+
+void BM_IncrementByFloat(benchmark::State& state) {
+    auto& store = counterStore();
+    const auto keys = counterKeys(static_cast<size_t>(state.range(0)));
+    size_t i = static_cast<size_t>(state.thread_index());
+    const uint64_t before = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.incrementByFloat(keys[i++ % keys.size()], 0.5L));
+    }
+    report(state, before);
+}
+
+}
+
+BENCHMARK(BM_GetSetCounter)->ArgName("keys")->Arg(1)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_IncrementBy)->ArgName("keys")->Arg(1)->Arg(1024)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_IncrementByFloat)->ArgName("keys")->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+BENCH_MAIN()
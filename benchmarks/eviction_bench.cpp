@@ -0,0 +1,134 @@
+#include "bench_main.hpp"
+#include "store/store.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Policy = store::Store::EvictionPolicy;
+
+constexpr size_t KEY_COUNT = 200000;
+constexpr size_t TRACE_LENGTH = 1000000;
+// The cache holds about this fraction of the keys.
+constexpr size_t CACHE_DIVISOR = 10;
+const std::string VALUE(100, 'v');
+
+const std::vector<std::string>& keys() {
+    static const std::vector<std::string> keys = [] {
+        std::vector<std::string> result;
+        result.reserve(KEY_COUNT);
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            result.push_back("key:" + std::to_string(i));
+        }
+        return result;
+    }();
+    return keys;
+}
+
+// Key indexes drawn from a Zipf distribution with exponent alpha, by binary
+// search over its CDF. Ranks are shuffled over the keys so popularity does
+// not follow insertion order or hash position.
+std::vector<uint32_t> zipfTrace(double alpha) {
+    std::vector<double> cdf(KEY_COUNT);
+    double sum = 0;
+    for (size_t rank = 0; rank < KEY_COUNT; ++rank) {
+        sum += 1.0 / std::pow(static_cast<double>(rank + 1), alpha);
+        cdf[rank] = sum;
+    }
+    std::vector<uint32_t> key_of_rank(KEY_COUNT);
+    for (size_t i = 0; i < KEY_COUNT; ++i) key_of_rank[i] = static_cast<uint32_t>(i);
+    std::mt19937_64 rng(42);
+    std::shuffle(key_of_rank.begin(), key_of_rank.end(), rng);
+
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<uint32_t> trace(TRACE_LENGTH);
+    for (auto& request : trace) {
+        const size_t rank = static_cast<size_t>(
+            std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin());
+        request = key_of_rank[std::min(rank, KEY_COUNT - 1)];
+    }
+    return trace;
+}
+
+const std::vector<uint32_t>& trace(int64_t alpha_percent) {
+    static const std::vector<uint32_t> skewed = zipfTrace(0.99);
+    static const std::vector<uint32_t> flatter = zipfTrace(0.8);
+    return alpha_percent == 99 ? skewed : flatter;
+}
+
+// usedMemory() of a store holding a tenth of the keys, so the limit covers
+// the table overhead a cache of that size carries.
+size_t cacheLimit() {
+    static const size_t limit = [] {
+        store::Store sized;
+        const auto& all_keys = keys();
+        for (size_t i = 0; i < KEY_COUNT / CACHE_DIVISOR; ++i) {
+            sized.add(all_keys[i], VALUE, sized.deadlineIn(std::chrono::hours(1)));
+        }
+        return sized.usedMemory();
+    }();
+    return limit;
+}
+
+// A read-through cache over the trace: GET, and on a miss make room and SET
+// the key, with a TTL so the volatile policies may evict it. Reports the hit
+// rate and requests per second.
+void BM_Cache(benchmark::State& state) {
+    const auto policy = static_cast<Policy>(state.range(0));
+    const auto& requests = trace(state.range(1));
+    const auto& all_keys = keys();
+    const size_t limit = cacheLimit();
+
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evicted = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto cache = std::make_unique<store::Store>();
+        store::Store& store = *cache;
+        store::Store::EvictionConfig config;
+        config.maxmemory = limit;
+        config.policy = policy;
+        store.setEvictionConfig(config);
+        state.ResumeTiming();
+
+        for (uint32_t request : requests) {
+            const auto& key = all_keys[request];
+            if (store.get(key)) {
+                ++hits;
+                continue;
+            }
+            ++misses;
+            store.evictIfNeeded();
+            store.add(key, VALUE, store.deadlineIn(std::chrono::hours(1)));
+        }
+        evicted += store.evictedCount();
+
+        state.PauseTiming();
+        cache.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(hits + misses));
+    state.counters["hit_rate"] = static_cast<double>(hits) / static_cast<double>(hits + misses);
+    state.counters["evicted"] = benchmark::Counter(static_cast<double>(evicted),
+                                                   benchmark::Counter::kAvgIterations);
+    state.SetLabel(store::Store::evictionPolicyName(policy));
+}
+
+}
+
+BENCHMARK(BM_Cache)
+    ->ArgNames({"policy", "alpha%"})
+    ->ArgsProduct({{static_cast<int64_t>(Policy::AllKeysLRU), static_cast<int64_t>(Policy::VolatileLRU),
+                    static_cast<int64_t>(Policy::AllKeysLFU), static_cast<int64_t>(Policy::VolatileLFU),
+                    static_cast<int64_t>(Policy::AllKeysRandom), static_cast<int64_t>(Policy::VolatileTTL)},
+                   {99, 80}})
+    ->Unit(benchmark::kMillisecond)
+    ->Iterations(1);
+
+BENCH_MAIN()
@@ -0,0 +1,142 @@
+#include "bench_main.hpp"
+#include "store/store.hpp"
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = store::Store::Clock;
+
+// TTLs are spread uniformly over this window.
+constexpr int64_t MAX_TTL_MS = 100;
+
+// Store time only moves when a benchmark moves it.
+Clock::time_point fake_now = Clock::now();
+
+Clock::time_point fakeClock() { return fake_now; }
+
+const std::vector<std::string>& keys(size_t count) {
+    static std::vector<std::string> keys;
+    while (keys.size() < count) {
+        keys.push_back("key:" + std::to_string(keys.size()));
+    }
+    return keys;
+}
+
+// Fills a store with count keys, each with a TTL of 1..MAX_TTL_MS.
+void populate(store::Store& store, size_t count) {
+    const auto& all_keys = keys(count);
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < count; ++i) {
+        store.add(all_keys[i], "value",
+                  store.deadlineIn(std::chrono::milliseconds(1 + rng() % MAX_TTL_MS)));
+    }
+}
+
+store::Store::ActiveExpireConfig unbounded() {
+    store::Store::ActiveExpireConfig config;
+    config.time_budget = std::chrono::seconds(60);
+    return config;
+}
+
+// The wheel alone: schedule count timers, then tick through them draining
+// each batch as it comes due.
+void BM_TimerWheel(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    const auto& all_keys = keys(count);
+    std::mt19937 rng(42);
+    size_t fired = 0;
+    for (auto _ : state) {
+        store::TimerWheel wheel;
+        for (size_t i = 0; i < count; ++i) {
+            wheel.schedule(all_keys[i], 1 + rng() % MAX_TTL_MS, 0);
+        }
+        for (uint64_t tick = 1; tick <= MAX_TTL_MS; ++tick) {
+            wheel.advance(tick);
+            store::TimerWheel::Handle due;
+            while ((due = wheel.nextDue()) != store::TimerWheel::NONE) {
+                wheel.cancel(due);
+                ++fired;
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(fired));
+}
+
+// Cost of giving a key a TTL: one timer schedule or reschedule.
+void BM_Expire(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    store::Store store(fakeClock);
+    const auto& all_keys = keys(count);
+    for (size_t i = 0; i < count; ++i) {
+        store.add(all_keys[i], "value");
+    }
+    std::mt19937 rng(42);
+    size_t i = 0;
+    for (auto _ : state) {
+        store.expire(all_keys[i++ % count], std::chrono::milliseconds(1 + rng() % 60000));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Reclaims count short-TTL keys by ticking the clock a millisecond at a
+// time with an expire cycle per tick, as the background thread would.
+void BM_ActiveExpiry(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    size_t reclaimed = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = std::make_unique<store::Store>(fakeClock);
+        store->setActiveExpireConfig(unbounded());
+        populate(*store, count);
+        state.ResumeTiming();
+
+        for (int64_t tick = 0; tick <= MAX_TTL_MS; ++tick) {
+            fake_now += std::chrono::milliseconds(1);
+            reclaimed += store->activeExpireCycle();
+        }
+
+        state.PauseTiming();
+        store.reset();
+        state.ResumeTiming();
+    }
+    if (reclaimed != count * state.iterations()) {
+        state.SkipWithError("keys left unexpired");
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(reclaimed));
+}
+
+// The same workload reclaimed by a full keyspace sweep every 10ms.
+void BM_FullScanExpiry(benchmark::State& state) {
+    const size_t count = static_cast<size_t>(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = std::make_unique<store::Store>(fakeClock);
+        populate(*store, count);
+        state.ResumeTiming();
+
+        for (int64_t tick = 0; tick <= MAX_TTL_MS; tick += 10) {
+            fake_now += std::chrono::milliseconds(10);
+            store->cleanupExpired();
+        }
+
+        state.PauseTiming();
+        if (store->size() != 0) {
+            state.SkipWithError("keys left unexpired");
+        }
+        store.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(count * state.iterations()));
+}
+
+}
+
+BENCHMARK(BM_TimerWheel)->Arg(1 << 20)->Arg(4 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Expire)->Arg(1 << 20);
+BENCHMARK(BM_ActiveExpiry)->Arg(1 << 20)->Arg(4 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FullScanExpiry)->Arg(1 << 20)->Arg(4 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+BENCH_MAIN()
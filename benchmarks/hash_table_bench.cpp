@@ -0,0 +1,162 @@
+#include "bench_main.hpp"
+#include "store/flat_map.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// Count live heap bytes so the benchmarks can report memory per key,
+// including allocator-visible overhead such as node and bucket arrays.
+namespace {
+std::atomic<size_t> live_bytes{0};
+}
+
+void* operator new(size_t size) {
+    void* ptr = std::malloc(size + sizeof(std::max_align_t));
+    if (!ptr) throw std::bad_alloc();
+    *static_cast<size_t*>(ptr) = size;
+    live_bytes.fetch_add(size, std::memory_order_relaxed);
+    return static_cast<char*>(ptr) + sizeof(std::max_align_t);
+}
+
+void operator delete(void* ptr) noexcept {
+    if (!ptr) return;
+    void* base = static_cast<char*>(ptr) - sizeof(std::max_align_t);
+    live_bytes.fetch_sub(*static_cast<size_t*>(base), std::memory_order_relaxed);
+    std::free(base);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    operator delete(ptr);
+}
+
+namespace {
+
+// Same shape as the Store's entries.
+struct Entry {
+    std::string value;
+    std::optional<std::chrono::steady_clock::time_point> expiry;
+};
+
+std::vector<std::string> makeKeys(size_t count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    return keys;
+}
+
+void BM_UnorderedMapMemory(benchmark::State& state) {
+    auto keys = makeKeys(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        size_t before = live_bytes.load();
+        std::unordered_map<std::string, Entry> map;
+        for (const auto& key : keys) {
+            map.emplace(key, Entry{"value", std::nullopt});
+        }
+        state.counters["bytes_per_key"] =
+            static_cast<double>(live_bytes.load() - before) / static_cast<double>(keys.size());
+    }
+}
+
+void BM_FlatMapMemory(benchmark::State& state) {
+    auto keys = makeKeys(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        size_t before = live_bytes.load();
+        store::FlatMap<Entry> map;
+        for (const auto& key : keys) {
+            map.tryEmplace(key, Entry{"value", std::nullopt});
+        }
+        state.counters["bytes_per_key"] =
+            static_cast<double>(live_bytes.load() - before) / static_cast<double>(keys.size());
+    }
+}
+
+void BM_UnorderedMapLookup(benchmark::State& state) {
+    auto keys = makeKeys(static_cast<size_t>(state.range(0)));
+    std::unordered_map<std::string, Entry> map;
+    for (const auto& key : keys) {
+        map.emplace(key, Entry{"value", std::nullopt});
+    }
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[pick(rng)]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_FlatMapLookup(benchmark::State& state) {
+    auto keys = makeKeys(static_cast<size_t>(state.range(0)));
+    store::FlatMap<Entry> map;
+    for (const auto& key : keys) {
+        map.tryEmplace(key, Entry{"value", std::nullopt});
+    }
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, keys.size() - 1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[pick(rng)]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Times every insert while the table grows from empty, so a resize shows
+// up as an outlier instead of being averaged away. background runs between
+// inserts, untimed, standing in for the Store's cleanup thread.
+constexpr double INSERT_LATENCY_BOUND_US = 1000.0;
+
+template <typename Insert, typename Background>
+void measureGrowth(benchmark::State& state, Insert&& insert, Background&& background) {
+    auto keys = makeKeys(static_cast<size_t>(state.range(0)));
+    std::vector<uint32_t> latencies_ns(keys.size());
+    for (auto _ : state) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto start = std::chrono::steady_clock::now();
+            insert(keys[i]);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            latencies_ns[i] = static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            background();
+        }
+    }
+    const size_t over_bound = static_cast<size_t>(std::count_if(
+        latencies_ns.begin(), latencies_ns.end(),
+        [](uint32_t ns) { return ns > INSERT_LATENCY_BOUND_US * 1000; }));
+    std::sort(latencies_ns.begin(), latencies_ns.end());
+    state.counters["p99.99_us"] = latencies_ns[latencies_ns.size() * 9999 / 10000] / 1000.0;
+    state.counters["max_us"] = latencies_ns.back() / 1000.0;
+    state.counters["over_bound"] = static_cast<double>(over_bound);
+}
+
+void BM_UnorderedMapGrowthLatency(benchmark::State& state) {
+    std::unordered_map<std::string, Entry> map;
+    measureGrowth(state, [&](const std::string& key) { map.emplace(key, Entry{"value", std::nullopt}); },
+                  []() {});
+}
+
+void BM_FlatMapGrowthLatency(benchmark::State& state) {
+    store::FlatMap<Entry> map;
+    measureGrowth(state, [&](const std::string& key) { map.tryEmplace(key, Entry{"value", std::nullopt}); },
+                  [&]() { auto retired = map.takeRetired(); });
+}
+
+}
+
+BENCHMARK(BM_UnorderedMapMemory)->Arg(100000)->Arg(1000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FlatMapMemory)->Arg(100000)->Arg(1000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_UnorderedMapLookup)->Arg(100000)->Arg(1000000);
+BENCHMARK(BM_FlatMapLookup)->Arg(100000)->Arg(1000000);
+// 50M keys needs roughly 10 GB; pass --benchmark_filter to pick sizes.
+BENCHMARK(BM_UnorderedMapGrowthLatency)->Arg(1000000)->Arg(5000000)->Arg(50000000)
+    ->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FlatMapGrowthLatency)->Arg(1000000)->Arg(5000000)->Arg(50000000)
+    ->Iterations(1)->Unit(benchmark::kMillisecond);
+
+BENCH_MAIN()
@@ -0,0 +1,77 @@
+#include "bench_main.hpp"
+#include "server/logger.hpp"
+#include <fstream>
+#include <string>
+
+namespace {
+
+const std::string KEY = "user:1000:session";
+const std::string VALUE(100, 'v');
+
+// What the command handlers used to do per SET: several lines straight to
+// a stream, each flushed by std::endl, value included.
+void BM_StreamEndl(benchmark::State& state) {
+    std::ofstream out("/dev/null");
+    for (auto _ : state) {
+        out << "Key: '" << KEY << "'" << std::endl;
+        out << "Value: '" << VALUE << "'" << std::endl;
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// The same two lines through the ring. The writer is given time to empty
+// it outside the timed region, so this is the cost of a line that is kept
+// rather than of one dropped off a full ring.
+void BM_LoggerEnqueue(benchmark::State& state) {
+    static server::Logger* logger = nullptr;
+    if (state.thread_index() == 0) {
+        logger = new server::Logger;
+        logger->setFile("/dev/null");
+    }
+    const size_t lines_between_flushes = server::Logger::RING_SIZE / 4 / static_cast<size_t>(state.threads());
+    size_t lines = 0;
+    for (auto _ : state) {
+        logger->log(server::LogLevel::Notice, "Key: '", KEY, "'");
+        logger->log(server::LogLevel::Notice, "Value: '", VALUE, "'");
+        if ((lines += 2) >= lines_between_flushes) {
+            state.PauseTiming();
+            logger->flush();
+            lines = 0;
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+    if (state.thread_index() == 0) {
+        state.counters["dropped"] = static_cast<double>(logger->dropped());
+        delete logger;
+    }
+}
+
+// A level compiled in but switched off at run time: one relaxed load.
+void BM_LoggerFiltered(benchmark::State& state) {
+    server::Logger::instance().setLevel(server::LogLevel::Notice);
+    for (auto _ : state) {
+        SERVER_LOG(Verbose, "Key: '", KEY, "'");
+        SERVER_LOG(Verbose, "Value: '", VALUE, "'");
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Debug lines below SERVER_LOG_LEVEL compile to nothing.
+void BM_LoggerCompiledOut(benchmark::State& state) {
+    for (auto _ : state) {
+        SERVER_LOG(Debug, "Key: '", KEY, "'");
+        SERVER_LOG(Debug, "Value: '", VALUE, "'");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+}
+
+BENCHMARK(BM_StreamEndl);
+BENCHMARK(BM_LoggerEnqueue)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_LoggerFiltered);
+BENCHMARK(BM_LoggerCompiledOut);
+
+BENCH_MAIN()
@@ -0,0 +1,40 @@
+#include "bench_main.hpp"
+#include "server/metrics.hpp"
+#include <chrono>
+
+namespace {
+
+// What every request costs the metrics: one counter bump and one latency
+// sample, from as many threads as serve requests.
+void BM_CountCommand(benchmark::State& state) {
+    auto& metrics = server::Metrics::getInstance();
+    for (auto _ : state) {
+        metrics.incrementCommand(server::Metrics::CommandId::Get);
+        metrics.recordLatency(server::Metrics::CommandId::Get, std::chrono::nanoseconds(1500));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_UpdateMemoryUsage(benchmark::State& state) {
+    auto& metrics = server::Metrics::getInstance();
+    for (auto _ : state) {
+        metrics.updateMemoryUsage(64);
+        metrics.updateMemoryUsage(-64);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+void BM_Scrape(benchmark::State& state) {
+    auto& metrics = server::Metrics::getInstance();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(metrics.getPrometheusMetrics());
+    }
+}
+
+}
+
+BENCHMARK(BM_CountCommand)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_UpdateMemoryUsage)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_Scrape);
+
+BENCH_MAIN()
@@ -0,0 +1,79 @@
+#include "bench_main.hpp"
+#include "server_fixture.hpp"
+#include <boost/asio.hpp>
+#include <string>
+
+namespace {
+
+using bench::BENCH_PORT;
+using bench::ServerFixture;
+using bench::command;
+
+void BM_PipelinedGet(benchmark::State& state) {
+    ServerFixture::get();
+    const size_t depth = static_cast<size_t>(state.range(0));
+
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::address::from_string("127.0.0.1"), BENCH_PORT});
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    std::string reply(64, '\0');
+    boost::asio::write(socket, boost::asio::buffer(command({"SET", "bench:key", "value"})));
+    socket.read_some(boost::asio::buffer(reply));
+
+    std::string batch;
+    for (size_t i = 0; i < depth; ++i) {
+        batch += command({"GET", "bench:key"});
+    }
+    const std::string expected = "$5\r\nvalue\r\n";
+    std::string replies(depth * expected.size(), '\0');
+
+    for (auto _ : state) {
+        boost::asio::write(socket, boost::asio::buffer(batch));
+        boost::asio::read(socket, boost::asio::buffer(replies));
+    }
+
+    if (replies.compare(replies.size() - expected.size(), expected.size(), expected) != 0) {
+        state.SkipWithError("unexpected reply");
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * depth));
+}
+
+// Writes go through the store and the AOF, where the handlers used to
+// trace every step.
+void BM_PipelinedSetDel(benchmark::State& state) {
+    ServerFixture::get();
+    const size_t depth = static_cast<size_t>(state.range(0));
+
+    boost::asio::io_context io_context;
+    boost::asio::ip::tcp::socket socket(io_context);
+    socket.connect({boost::asio::ip::address::from_string("127.0.0.1"), BENCH_PORT});
+    socket.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    std::string batch;
+    for (size_t i = 0; i < depth; ++i) {
+        const std::string key = "bench:write:" + std::to_string(i);
+        batch += command({"SET", key, std::string(100, 'v')});
+        batch += command({"DEL", key});
+    }
+    const std::string expected = "+OK\r\n:1\r\n";
+    std::string replies(depth * expected.size(), '\0');
+
+    for (auto _ : state) {
+        boost::asio::write(socket, boost::asio::buffer(batch));
+        boost::asio::read(socket, boost::asio::buffer(replies));
+    }
+
+    if (replies.compare(replies.size() - expected.size(), expected.size(), expected) != 0) {
+        state.SkipWithError("unexpected reply");
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * depth * 2));
+}
+
+}
+
+BENCHMARK(BM_PipelinedGet)->Arg(1)->Arg(16)->Arg(64)->Arg(256)->UseRealTime();
+BENCHMARK(BM_PipelinedSetDel)->Arg(1)->Arg(16)->Arg(64)->UseRealTime();
+
+BENCH_MAIN()
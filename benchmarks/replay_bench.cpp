@@ -0,0 +1,173 @@
+#include "bench_main.hpp"
+#include "server/aof_manager.hpp"
+#include "server/logger.hpp"
+#include "server/snapshot_manager.hpp"
+#include "store/store.hpp"
+#include <sys/stat.h>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace {
+
+const std::string AOF_PATH = "replay_bench.aof";
+const std::string SNAPSHOT_PATH = "replay_bench.snapshot";
+const std::string HYBRID_PATH = "replay_bench.hybrid.aof";
+
+std::string keyName(size_t i) { return "key:" + std::to_string(i); }
+
+// Writes an AOF holding key_count keys: every key set, a quarter of them
+// deleted and set again, the way a live log accumulates churn. The
+// snapshot holds the same dataset, and the hybrid AOF a rewrite of it
+// followed by a RESP tail touching 1% of the keys.
+void writeFiles(size_t key_count) {
+    static size_t written = 0;
+    if (written == key_count) return;
+    std::remove(AOF_PATH.c_str());
+    std::remove(HYBRID_PATH.c_str());
+    const std::string value(64, 'v');
+    auto emitAll = [&](const server::AOFManager::Emit& emit, const std::function<void()>&) {
+        for (size_t i = 0; i < key_count; ++i) {
+            emit(keyName(i), store::ValueType::String, value, std::nullopt);
+        }
+    };
+    {
+        server::AOFManager aof(AOF_PATH, server::AOFManager::FsyncPolicy::No);
+        for (size_t i = 0; i < key_count; ++i) {
+            aof.logSet(keyName(i), value);
+        }
+        for (size_t i = 0; i < key_count; i += 4) {
+            aof.logDel(keyName(i));
+            aof.logSet(keyName(i), value);
+        }
+    }
+    {
+        server::AOFManager aof(HYBRID_PATH, server::AOFManager::FsyncPolicy::No);
+        aof.setSnapshotSource(emitAll);
+        aof.rewrite();
+        for (size_t i = 0; i < key_count; i += 100) {
+            aof.logDel(keyName(i));
+            aof.logSet(keyName(i), value);
+        }
+    }
+    server::SnapshotManager snapshot(SNAPSHOT_PATH);
+    snapshot.setSource(emitAll);
+    snapshot.save();
+    written = key_count;
+}
+
+double fileSize(const std::string& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<double>(st.st_size) : 0;
+}
+
+// VmHWM from /proc, in bytes.
+double peakRss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stod(line.substr(6)) * 1024;
+        }
+    }
+    return 0;
+}
+
+void resetPeakRss() {
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Times load(store) into a fresh store per iteration. A null store means
+// the handlers discard what they are given, timing the format alone.
+template<typename Load>
+void runLoad(benchmark::State& state, const std::string& path, bool apply, const Load& load) {
+    const size_t key_count = static_cast<size_t>(state.range(0));
+    writeFiles(key_count);
+
+    double peak = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = apply ? std::make_unique<store::Store>() : nullptr;
+        resetPeakRss();
+        state.ResumeTiming();
+
+        if (!load(store.get())) {
+            state.SkipWithError("load failed");
+        }
+
+        state.PauseTiming();
+        peak = std::max(peak, peakRss());
+        if (store && store->size() != key_count) {
+            state.SkipWithError("load lost keys");
+        }
+        store.reset();
+        state.ResumeTiming();
+    }
+    state.counters["keys_per_sec"] = benchmark::Counter(
+        static_cast<double>(key_count * state.iterations()), benchmark::Counter::kIsRate);
+    state.counters["peak_rss"] = benchmark::Counter(peak, benchmark::Counter::kDefaults,
+                                                    benchmark::Counter::kIs1024);
+    state.counters["file_size"] = benchmark::Counter(fileSize(path), benchmark::Counter::kDefaults,
+                                                     benchmark::Counter::kIs1024);
+}
+
+void replayAOF(benchmark::State& state, const std::string& path, bool apply) {
+    const size_t threads = static_cast<size_t>(state.range(1));
+    runLoad(state, path, apply, [&path, threads](store::Store* store) {
+        server::AOFManager aof(path);
+        return aof.replay(
+            [store](std::string_view key, std::string_view value) {
+                if (store) store->add(key, std::string(value));
+            },
+            [store](std::string_view key) { if (store) store->remove(key); },
+            [store](std::string_view key) { if (store) store->persist(key); },
+            [](std::string_view, int64_t) {},
+            threads);
+    });
+}
+
+void loadSnapshot(benchmark::State& state, bool apply) {
+    runLoad(state, SNAPSHOT_PATH, apply, [](store::Store* store) {
+        server::SnapshotManager snapshot(SNAPSHOT_PATH);
+        return snapshot.load([store](std::string_view key, store::ValueType, std::string_view value,
+                                     std::optional<int64_t>) {
+            if (store) store->add(key, std::string(value));
+        });
+    });
+}
+
+void BM_Replay(benchmark::State& state) { replayAOF(state, AOF_PATH, true); }
+void BM_ReplayScan(benchmark::State& state) { replayAOF(state, AOF_PATH, false); }
+void BM_HybridReplay(benchmark::State& state) { replayAOF(state, HYBRID_PATH, true); }
+void BM_HybridScan(benchmark::State& state) { replayAOF(state, HYBRID_PATH, false); }
+void BM_SnapshotLoad(benchmark::State& state) { loadSnapshot(state, true); }
+void BM_SnapshotScan(benchmark::State& state) { loadSnapshot(state, false); }
+
+const std::vector<int64_t> KEY_COUNTS = {1 << 20, 10'000'000};
+
+}
+
+BENCHMARK(BM_Replay)->ArgNames({"keys", "threads"})
+    ->ArgsProduct({KEY_COUNTS, {1, 4}})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_HybridReplay)->ArgNames({"keys", "threads"})
+    ->ArgsProduct({KEY_COUNTS, {1, 4}})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SnapshotLoad)->ArgName("keys")->ArgsProduct({KEY_COUNTS})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ReplayScan)->ArgNames({"keys", "threads"})->ArgsProduct({KEY_COUNTS, {1}})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_HybridScan)->ArgNames({"keys", "threads"})->ArgsProduct({KEY_COUNTS, {1}})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_SnapshotScan)->ArgName("keys")->ArgsProduct({KEY_COUNTS})
+    ->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char** argv) {
+    // Keeps snapshot and rewrite notices out of the benchmark report.
+    server::Logger::instance().setLevel(server::LogLevel::Warning);
+    int result = bench::run(argc, argv);
+    std::remove(AOF_PATH.c_str());
+    std::remove(SNAPSHOT_PATH.c_str());
+    std::remove(HYBRID_PATH.c_str());
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "server/logger.hpp"
+#include "server/server.hpp"
+#include <chrono>
+#include <initializer_list>
+#include <string>
+#include <thread>
+
+namespace bench {
+
+constexpr unsigned short BENCH_PORT = 16379;
+
+// Starts one in-process server shared by every benchmark in a binary.
+class ServerFixture {
+public:
+    static ServerFixture& get() {
+        static ServerFixture fixture;
+        return fixture;
+    }
+
+private:
+    ServerFixture() : server_("127.0.0.1", BENCH_PORT) {
+        // Keeps startup notices out of the benchmark report.
+        server::Logger::instance().setLevel(server::LogLevel::Warning);
+        thread_ = std::thread([this]() { server_.start(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    ~ServerFixture() {
+        server_.stop();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    server::Server server_;
+    std::thread thread_;
+};
+
+inline std::string command(std::initializer_list<std::string> args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return out;
+}
+
+}
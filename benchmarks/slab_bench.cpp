@@ -0,0 +1,148 @@
+#include "bench_main.hpp"
+#include "store/memory.hpp"
+#include "store/slab_allocator.hpp"
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using store::SlabAllocator;
+
+constexpr size_t LIVE_VALUES = 100000;
+const std::string BYTES(4096, 'v');
+
+// Sizes around the 100-byte values the churn workload writes.
+size_t churnSize(std::mt19937& rng) {
+    return 64 + rng() % 97;
+}
+
+// Replaces random values with new ones of a random size, freeing the old
+// value first like a DEL followed by a SET. Each thread churns its own pool,
+// as each shard owns its allocator, so with malloc the threads share an
+// allocator and with slabs they do not.
+void BM_ChurnMalloc(benchmark::State& state) {
+    std::mt19937 rng(42 + state.thread_index());
+    std::vector<std::string> values(LIVE_VALUES);
+    for (auto& value : values) {
+        value.assign(BYTES, 0, churnSize(rng));
+    }
+    for (auto _ : state) {
+        std::string& value = values[rng() % LIVE_VALUES];
+        std::string().swap(value);
+        value.assign(BYTES, 0, churnSize(rng));
+        benchmark::DoNotOptimize(value.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ChurnSlab(benchmark::State& state) {
+    std::mt19937 rng(42 + state.thread_index());
+    SlabAllocator allocator;
+    std::vector<SlabAllocator::Block> values(LIVE_VALUES);
+    for (auto& value : values) {
+        value = allocator.allocate(std::string_view(BYTES).substr(0, churnSize(rng)));
+    }
+    for (auto _ : state) {
+        SlabAllocator::Block& value = values[rng() % LIVE_VALUES];
+        allocator.deallocate(value);
+        value = allocator.allocate(std::string_view(BYTES).substr(0, churnSize(rng)));
+        benchmark::DoNotOptimize(value.data);
+    }
+    for (auto& value : values) {
+        allocator.deallocate(value);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The classic fragmenting pattern: fill with small values, delete three in
+// four at random, then write as many bytes again in larger values that the
+// holes cannot take. Reports bytes held per live byte at the end, and for
+// slabs also after defrag passes over every value.
+struct Phase {
+    std::vector<size_t> sizes;
+    std::vector<bool> keep;
+};
+
+Phase fragmentingPhase() {
+    std::mt19937 rng(42);
+    Phase phase;
+    for (size_t i = 0; i < LIVE_VALUES * 4; ++i) {
+        phase.sizes.push_back(churnSize(rng));
+        phase.keep.push_back(rng() % 4 == 0);
+    }
+    for (size_t i = 0; i < LIVE_VALUES; ++i) {
+        phase.sizes.push_back(200 + rng() % 201);
+        phase.keep.push_back(true);
+    }
+    return phase;
+}
+
+void BM_FragmentationMalloc(benchmark::State& state) {
+    const Phase phase = fragmentingPhase();
+    double frag = 0;
+    for (auto _ : state) {
+        std::vector<std::string> values(phase.sizes.size());
+        const size_t base = store::processMemory().allocator_active;
+        for (size_t i = 0; i < LIVE_VALUES * 4; ++i) {
+            values[i].assign(BYTES, 0, phase.sizes[i]);
+        }
+        for (size_t i = 0; i < LIVE_VALUES * 4; ++i) {
+            if (!phase.keep[i]) std::string().swap(values[i]);
+        }
+        size_t live = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            if (i >= LIVE_VALUES * 4) values[i].assign(BYTES, 0, phase.sizes[i]);
+            live += store::heapBytes(values[i]);
+        }
+        frag = static_cast<double>(store::processMemory().allocator_active - base) / static_cast<double>(live);
+    }
+    state.counters["frag_ratio"] = frag;
+}
+
+void BM_FragmentationSlab(benchmark::State& state) {
+    const Phase phase = fragmentingPhase();
+    double frag = 0;
+    double defragged = 0;
+    double moved = 0;
+    for (auto _ : state) {
+        SlabAllocator allocator;
+        std::vector<SlabAllocator::Block> values(phase.sizes.size());
+        for (size_t i = 0; i < LIVE_VALUES * 4; ++i) {
+            values[i] = allocator.allocate(std::string_view(BYTES).substr(0, phase.sizes[i]));
+        }
+        for (size_t i = 0; i < LIVE_VALUES * 4; ++i) {
+            if (!phase.keep[i]) allocator.deallocate(values[i]);
+        }
+        for (size_t i = LIVE_VALUES * 4; i < values.size(); ++i) {
+            values[i] = allocator.allocate(std::string_view(BYTES).substr(0, phase.sizes[i]));
+        }
+        frag = static_cast<double>(allocator.activeBytes()) / static_cast<double>(allocator.allocatedBytes());
+
+        size_t pass_moved = 1;
+        moved = 0;
+        while (pass_moved > 0) {
+            pass_moved = 0;
+            for (auto& value : values) {
+                pass_moved += allocator.defrag(value);
+            }
+            moved += static_cast<double>(pass_moved);
+        }
+        defragged = static_cast<double>(allocator.activeBytes()) / static_cast<double>(allocator.allocatedBytes());
+        for (auto& value : values) {
+            allocator.deallocate(value);
+        }
+    }
+    state.counters["frag_ratio"] = frag;
+    state.counters["after_defrag"] = defragged;
+    state.counters["moved"] = moved;
+}
+
+}
+
+BENCHMARK(BM_ChurnMalloc)->Threads(1)->Threads(4);
+BENCHMARK(BM_ChurnSlab)->Threads(1)->Threads(4);
+BENCHMARK(BM_FragmentationMalloc)->Unit(benchmark::kMillisecond)->Iterations(1);
+BENCHMARK(BM_FragmentationSlab)->Unit(benchmark::kMillisecond)->Iterations(1);
+
+BENCH_MAIN()
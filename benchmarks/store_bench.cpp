@@ -0,0 +1,116 @@
+#include "bench_main.hpp"
+#include "store/store.hpp"
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr size_t KEY_COUNT = 100000;
+
+const std::vector<std::string>& keys() {
+    static const std::vector<std::string> keys = [] {
+        std::vector<std::string> result;
+        result.reserve(KEY_COUNT);
+        for (size_t i = 0; i < KEY_COUNT; ++i) {
+            result.push_back("key:" + std::to_string(i));
+        }
+        return result;
+    }();
+    return keys;
+}
+
+// One populated store per shard count, shared by every benchmark thread.
+store::Store& populatedStore(size_t shards) {
+    static store::Store single(store::Store::Clock::now, 1);
+    static store::Store sharded(store::Store::Clock::now, store::Store::DEFAULT_SHARD_COUNT);
+    static const bool populated = [] {
+        for (const auto& key : keys()) {
+            single.add(key, "value");
+            sharded.add(key, "value");
+        }
+        return true;
+    }();
+    (void)populated;
+    return shards == 1 ? single : sharded;
+}
+
+void BM_Get(benchmark::State& state) {
+    auto& store = populatedStore(static_cast<size_t>(state.range(0)));
+    const auto& all_keys = keys();
+    size_t i = static_cast<size_t>(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.get(all_keys[i++ % KEY_COUNT]));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_Set(benchmark::State& state) {
+    auto& store = populatedStore(static_cast<size_t>(state.range(0)));
+    const auto& all_keys = keys();
+    const std::string value = "value";
+    size_t i = static_cast<size_t>(state.thread_index()) * 7919;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.update(all_keys[i++ % KEY_COUNT], value));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Overwriting a key. Before SET could overwrite, a client sent DEL and
+// then SET, and SET ... GET needed a GET in front as well: a lookup and a
+// lock round trip for each. set() finds or inserts the key in one probe.
+void reportLookups(benchmark::State& state, int lookups) {
+    state.SetItemsProcessed(state.iterations());
+    state.counters["lookups_per_set"] = lookups;
+}
+
+void BM_OverwriteDelAdd(benchmark::State& state) {
+    auto& store = populatedStore(store::Store::DEFAULT_SHARD_COUNT);
+    const auto& all_keys = keys();
+    const std::string value = "value";
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& key = all_keys[i++ % KEY_COUNT];
+        store.remove(key);
+        benchmark::DoNotOptimize(store.add(key, value));
+    }
+    reportLookups(state, 2);
+}
+
+void BM_OverwriteGetDelAdd(benchmark::State& state) {
+    auto& store = populatedStore(store::Store::DEFAULT_SHARD_COUNT);
+    const auto& all_keys = keys();
+    const std::string value = "value";
+    size_t i = 0;
+    for (auto _ : state) {
+        const auto& key = all_keys[i++ % KEY_COUNT];
+        benchmark::DoNotOptimize(store.get(key));
+        store.remove(key);
+        benchmark::DoNotOptimize(store.add(key, value));
+    }
+    reportLookups(state, 3);
+}
+
+void BM_Upsert(benchmark::State& state) {
+    auto& store = populatedStore(store::Store::DEFAULT_SHARD_COUNT);
+    const auto& all_keys = keys();
+    const std::string value = "value";
+    store::Store::SetOptions options;
+    options.get = state.range(0) != 0;
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.set(all_keys[i++ % KEY_COUNT], value, std::nullopt, options));
+    }
+    reportLookups(state, 1);
+}
+
+}
+
+BENCHMARK(BM_Get)->ArgName("shards")->Arg(1)->Arg(store::Store::DEFAULT_SHARD_COUNT)
+    ->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(BM_Set)->ArgName("shards")->Arg(1)->Arg(store::Store::DEFAULT_SHARD_COUNT)
+    ->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(BM_OverwriteDelAdd);
+BENCHMARK(BM_OverwriteGetDelAdd);
+BENCHMARK(BM_Upsert)->ArgName("get")->Arg(0)->Arg(1);
+
+BENCH_MAIN()
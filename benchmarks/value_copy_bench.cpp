@@ -0,0 +1,100 @@
+#include "bench_main.hpp"
+#include "server_fixture.hpp"
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+// Every operator new in the process, server threads included. The client
+// below allocates nothing once its buffers are built, so the count per
+// operation is what the server allocates for it; each std::string copy of
+// the value shows up as one value's worth of bytes.
+static std::atomic<uint64_t> new_bytes{0};
+
+// GCC sees the replaced operators inlined into their callers and takes the
+// malloc/free pairing below for a mismatch.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    new_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* block = std::malloc(size)) return block;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* block) noexcept { std::free(block); }
+void operator delete(void* block, size_t) noexcept { std::free(block); }
+
+namespace {
+
+using bench::BENCH_PORT;
+using bench::ServerFixture;
+using bench::command;
+
+class Client {
+public:
+    Client() : socket_(io_context_) {
+        ServerFixture::get();
+        socket_.connect({boost::asio::ip::address::from_string("127.0.0.1"), BENCH_PORT});
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+    }
+
+    void roundTrip(const std::string& request, std::string& reply) {
+        boost::asio::write(socket_, boost::asio::buffer(request));
+        boost::asio::read(socket_, boost::asio::buffer(reply));
+    }
+
+private:
+    boost::asio::io_context io_context_;
+    boost::asio::ip::tcp::socket socket_;
+};
+
+void report(benchmark::State& state, uint64_t allocated, size_t value_size) {
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * value_size));
+    state.counters["new_bytes_per_op"] = benchmark::Counter(static_cast<double>(allocated),
+                                                            benchmark::Counter::kAvgIterations);
+    state.counters["value_copies"] = benchmark::Counter(
+        static_cast<double>(allocated) / static_cast<double>(value_size), benchmark::Counter::kAvgIterations);
+}
+
+// DEL then SET of the same key, so every SET creates it.
+void BM_Set(benchmark::State& state) {
+    const size_t value_size = static_cast<size_t>(state.range(0));
+    Client client;
+    const std::string request = command({"DEL", "copy:set"}) +
+                                command({"SET", "copy:set", std::string(value_size, 'v')});
+    std::string reply(std::string(":0\r\n+OK\r\n").size(), '\0');
+    client.roundTrip(request, reply);
+
+    const uint64_t before = new_bytes.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        client.roundTrip(request, reply);
+    }
+    report(state, new_bytes.load(std::memory_order_relaxed) - before, value_size);
+    if (reply != ":1\r\n+OK\r\n") state.SkipWithError("unexpected reply");
+}
+
+void BM_Get(benchmark::State& state) {
+    const size_t value_size = static_cast<size_t>(state.range(0));
+    Client client;
+    const std::string value(value_size, 'v');
+    std::string reply(std::string(":0\r\n+OK\r\n").size(), '\0');
+    client.roundTrip(command({"DEL", "copy:get"}) + command({"SET", "copy:get", value}), reply);
+
+    const std::string request = command({"GET", "copy:get"});
+    const std::string expected = "$" + std::to_string(value_size) + "\r\n" + value + "\r\n";
+    reply.assign(expected.size(), '\0');
+    const uint64_t before = new_bytes.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        client.roundTrip(request, reply);
+    }
+    report(state, new_bytes.load(std::memory_order_relaxed) - before, value_size);
+    if (reply != expected) state.SkipWithError("unexpected reply");
+}
+
+}
+
+BENCHMARK(BM_Set)->RangeMultiplier(8)->Range(128, 4 << 20)->Arg(100)->UseRealTime();
+BENCHMARK(BM_Get)->RangeMultiplier(8)->Range(128, 4 << 20)->Arg(100)->UseRealTime();
+
+BENCH_MAIN()
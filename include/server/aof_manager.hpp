@@ -1,38 +1,234 @@
-#pragma once
-
-#include <string>
-#include <fstream>
-#include <mutex>
-#include <functional>
-#include <optional>
-
-namespace server {
-
-class AOFManager {
-public:
-    explicit AOFManager(const std::string& aof_file_path);
-    
-    ~AOFManager();
-
-    AOFManager(const AOFManager&) = delete;
-    AOFManager& operator=(const AOFManager&) = delete;
-
-    bool logSet(const std::string& key, const std::string& value);
-    bool logDel(const std::string& key);
-    bool logPersist(const std::string& key);
-
-    bool replay(std::function<void(const std::string&, const std::string&)> onSet,
-                std::function<void(const std::string&)> onDel,
-                std::function<void(const std::string&)> onPersist);
-
-    bool isEnabled() const { return aof_file_.is_open(); }
-
-private:
-    std::string aof_file_path_;
-    std::ofstream aof_file_;
-    std::mutex mutex_;
-
-    bool writeCommand(const std::string& command);
-};
-
-}
\ No newline at end of file
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <vector>
+#include "store/collections.hpp"
+
+namespace server {
+
+// Appends mutations to the AOF from a dedicated writer thread. Request
+// threads push records onto a lock-free queue and return; the writer takes
+// everything queued at once and commits it with a single write, fsyncing
+// according to the policy.
+//
+// A rewrite replaces the log with the live keys, as a binary snapshot
+// preamble (see SnapshotManager) or as one SET per string and HSET, RPUSH,
+// SADD or ZADD commands for each collection. The writer keeps a
+// copy of every record queued after the rewrite starts and appends it to
+// the new file before renaming it over the old one, so writers are never
+// held up by it.
+class AOFManager {
+public:
+    // Named after Redis' appendfsync settings.
+    enum class FsyncPolicy {
+        // fdatasync after every batch; replies wait for it (see sync).
+        Always,
+        // fdatasync at most once a second.
+        EverySec,
+        // Leave flushing to the kernel.
+        No
+    };
+
+    // value is a collection's payload (see store::collectionPayload) unless
+    // type is String. expire_at is in Unix milliseconds.
+    using Emit = std::function<void(const std::string& key, store::ValueType type, const std::string& value,
+                                    std::optional<int64_t> expire_at)>;
+    // Calls start once before reading any key, then emit once per live
+    // key. A write logged before start returns must be in what it emits;
+    // one logged after may be too, and must then be logged in a form that
+    // can be replayed over it. Called from the rewrite thread.
+    using SnapshotSource = std::function<void(const Emit& emit, const std::function<void()>& start)>;
+
+    explicit AOFManager(const std::string& aof_file_path,
+                        FsyncPolicy policy = FsyncPolicy::EverySec);
+
+    ~AOFManager();
+
+    AOFManager(const AOFManager&) = delete;
+    AOFManager& operator=(const AOFManager&) = delete;
+
+    // TTLs are logged as absolute Unix milliseconds, so replaying them
+    // later never extends a key's life.
+    bool logSet(std::string_view key, std::string_view value,
+                std::optional<int64_t> expire_at = std::nullopt);
+    bool logDel(const std::string& key);
+    // A multi-key DEL or an MSET goes to the log as one record, replayed
+    // key by key.
+    bool logDel(const std::vector<std::string_view>& keys);
+    bool logMSet(const std::vector<std::pair<std::string_view, std::string_view>>& pairs);
+    // Any other write, such as HSET or RPUSH, as its arguments.
+    bool logCommand(const std::vector<std::string_view>& args);
+    // Replaces the key with a collection, written as a rewrite would write
+    // it, in one record; an empty payload deletes the key.
+    bool logValue(std::string_view key, store::ValueType type, std::string_view payload,
+                  std::optional<int64_t> expire_at = std::nullopt);
+    bool logPersist(const std::string& key);
+    bool logExpireAt(const std::string& key, int64_t expire_at);
+
+    // Runs on_durable on the writer thread once every record logged before
+    // the call has been written, and fsynced under FsyncPolicy::Always.
+    void sync(std::function<void()> on_durable);
+
+    using SetHandler = std::function<void(std::string_view key, std::string_view value)>;
+    using KeyHandler = std::function<void(std::string_view key)>;
+    // expire_at is in Unix milliseconds.
+    using ExpireAtHandler = std::function<void(std::string_view key, int64_t expire_at)>;
+    // Any other command, as its arguments; the key is args[1].
+    using CommandHandler = std::function<void(const std::vector<std::string_view>& args)>;
+
+    // Replays the log from byte offset from through the handlers. A SET
+    // carrying a TTL, and each key with a TTL in a snapshot preamble at the
+    // start of the file, is replayed as onSet followed by onExpireAt. The
+    // collections in a preamble reach onCommand as the commands a rewrite
+    // without one would have logged. With threads > 1 commands
+    // are spread over that many threads by key, each key's commands in
+    // order, so the handlers must be thread-safe. A truncated final command
+    // is ignored; false if the file could not be read or is corrupt.
+    bool replay(SetHandler onSet, KeyHandler onDel, KeyHandler onPersist, ExpireAtHandler onExpireAt,
+                size_t threads = 1, uint64_t from = 0, CommandHandler onCommand = nullptr);
+
+    // A point in the log file, with a checksum of the bytes just before it
+    // so a later run can tell whether the file still has the same history.
+    struct Position {
+        uint64_t offset = 0;
+        uint32_t fence = 0;
+    };
+    // Where the file ends once every record logged before the call has been
+    // written. Waits for the writer.
+    Position position();
+    // Whether the file on disk still runs through position, i.e. has not
+    // been rewritten or truncated since.
+    bool contains(const Position& position) const;
+
+    // Must be set before any rewrite can run.
+    void setSnapshotSource(SnapshotSource source);
+    // Rewrite automatically once the file has grown by percentage since the
+    // last rewrite (or startup) and is at least min_size bytes. 0 disables.
+    void setAutoRewrite(unsigned percentage, uint64_t min_size);
+    // Whether rewrites start the file with a snapshot preamble (the
+    // default) rather than SET commands.
+    void setRewritePreamble(bool enabled) { rewrite_preamble_ = enabled; }
+
+    // Rewrites the log on the calling thread; returns once the new file is
+    // in place. False if it failed or another rewrite is running.
+    bool rewrite();
+    // Starts a rewrite on a background thread. False if one is running.
+    bool rewriteInBackground();
+    bool rewriting() const { return rewriting_.load(); }
+
+    bool isEnabled() const { return fd_.load(std::memory_order_relaxed) >= 0; }
+    FsyncPolicy policy() const { return policy_; }
+    // Records logged so far, for telling whether a batch of commands wrote
+    // anything.
+    uint64_t appended() const { return appended_.load(std::memory_order_relaxed); }
+    // Bytes in the current file, as last written by the writer.
+    uint64_t fileSize() const { return file_size_.load(std::memory_order_relaxed); }
+
+    static std::optional<FsyncPolicy> parsePolicy(const std::string& name);
+
+private:
+    static constexpr std::chrono::seconds EVERYSEC_INTERVAL{1};
+    // Snapshot output is written to the temporary file in chunks this big.
+    static constexpr size_t REWRITE_CHUNK_SIZE = 1 << 20;
+    // Replay drops the pages it has applied after every window this big.
+    static constexpr size_t REPLAY_WINDOW = 64 << 20;
+    // Records this big are written from their own buffer rather than
+    // copied into the batch.
+    static constexpr size_t LARGE_RECORD_SIZE = 64 * 1024;
+    // Bytes before a position covered by its fence.
+    static constexpr size_t FENCE_SIZE = 4096;
+
+    struct Record {
+        enum class Kind {
+            Data,
+            // Runs on_durable once the records before it are committed.
+            Sync,
+            // Records after this one are also copied to the rewrite buffer.
+            RewriteStart,
+            // data names the finished snapshot file, or is empty if the
+            // rewrite failed; on_durable runs after the swap.
+            RewriteFinish
+        };
+        Record* next = nullptr;
+        Kind kind = Kind::Data;
+        std::string data;
+        std::function<void()> on_durable;
+    };
+
+    std::string aof_file_path_;
+    FsyncPolicy policy_;
+    std::atomic<int> fd_{-1};
+
+    // Multi-producer stack of pending records, newest first. The writer
+    // takes it whole and reverses it, so each batch keeps enqueue order.
+    std::atomic<Record*> pending_{nullptr};
+    std::atomic<uint64_t> appended_{0};
+
+    // Only used to park the writer while the queue is empty.
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> writer_idle_{false};
+    std::atomic<bool> stopping_{false};
+    std::thread writer_;
+
+    // Writer thread only. A batch that could not be written stays in
+    // batch_buffer_ and is retried, and the Sync callbacks queued behind it
+    // wait in held_ until it is written.
+    std::string batch_buffer_;
+    uint64_t batch_records_ = 0;
+    bool write_failing_ = false;
+    std::vector<std::function<void()>> held_;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point last_fsync_;
+    bool rewrite_buffering_ = false;
+    std::string rewrite_buffer_;
+    uint64_t rewrite_base_size_ = 0;
+
+    std::atomic<uint64_t> file_size_{0};
+    std::atomic<unsigned> auto_rewrite_percentage_{0};
+    std::atomic<uint64_t> auto_rewrite_min_size_{0};
+    std::atomic<bool> rewrite_preamble_{true};
+
+    // Guards the snapshot source and the background rewrite thread.
+    std::mutex rewrite_mutex_;
+    SnapshotSource snapshot_source_;
+    std::thread rewrite_thread_;
+    std::atomic<bool> rewriting_{false};
+    std::atomic<bool> closing_{false};
+    bool last_rewrite_ok_ = false;
+
+    static std::string encodeCommand(std::initializer_list<std::string_view> args);
+    static std::string encodeCommand(const std::vector<std::string_view>& args);
+
+    bool writeCommand(std::string command);
+    void push(Record* record);
+    void writerLoop();
+    void commit(Record* batch);
+    // Writes the batch, then fsyncs as the policy asks.
+    void flushBatch();
+    bool writeBatch();
+    // Runs the held Sync callbacks once nothing is left unwritten.
+    void releaseHeld();
+    bool finishRewrite(const std::string& temp_path);
+    void maybeStartAutoRewrite();
+    bool startRewriteLocked();
+    bool runRewrite(const SnapshotSource& source);
+    static bool writeAll(int fd, const std::string& data);
+    // As above; written gets the bytes written even if it fails part way.
+    static bool writeAll(int fd, const std::string& data, size_t& written);
+    static std::optional<uint32_t> fenceAt(int fd, uint64_t offset);
+    void fsync();
+};
+
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace server {
+
+// CRC-32C (Castagnoli) of data, continuing from crc so a checksum can be
+// built up over several pieces.
+uint32_t crc32c(std::string_view data, uint32_t crc = 0);
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace server {
+
+// Log-linear latency histogram in the style of HdrHistogram: values below
+// SUB_BUCKETS get a bucket each, and every power of two above that is split
+// into SUB_BUCKETS equal buckets, so any recorded value is known to within
+// 1/SUB_BUCKETS of itself. Recording is a single relaxed increment; readers
+// add histograms up into a Counts.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{1} << SUB_BUCKET_BITS;
+    // Values are nanoseconds; anything from 2^MAX_BITS (about 68s) up
+    // lands in the last bucket.
+    static constexpr unsigned MAX_BITS = 36;
+    static constexpr size_t BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucketFor(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        if (value >> MAX_BITS) {
+            return BUCKETS - 1;
+        }
+        const unsigned shift = 63 - static_cast<unsigned>(__builtin_clzll(value)) - SUB_BUCKET_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_BUCKETS + (value >> shift) - SUB_BUCKETS);
+    }
+
+    // The largest value that falls into bucket.
+    static uint64_t upperBound(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const uint64_t shift = bucket / SUB_BUCKETS - 1;
+        const uint64_t base = SUB_BUCKETS + bucket % SUB_BUCKETS;
+        return ((base + 1) << shift) - 1;
+    }
+
+    struct Counts {
+        std::array<uint64_t, BUCKETS> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // Upper bound of the bucket holding the q-th quantile, or 0 if
+        // nothing was recorded.
+        uint64_t percentile(double q) const {
+            if (count == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count));
+            if (rank >= count) rank = count - 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if (seen > rank) return upperBound(i);
+            }
+            return upperBound(BUCKETS - 1);
+        }
+    };
+
+    void record(uint64_t value) {
+        buckets_[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void addTo(Counts& counts) const {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            const uint64_t n = buckets_[i].load(std::memory_order_relaxed);
+            counts.buckets[i] += n;
+            counts.count += n;
+        }
+        counts.sum += sum_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+};
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace server {
+// Remembers the recent spikes of named events, such as a slow fsync or
+// expire cycle, for LATENCY LATEST and HISTORY. Only samples at or above
+// the threshold are kept, so the common case is one relaxed load. Samples
+// landing in the same second are merged, keeping the worst.
+class LatencyMonitor {
+public:
+    // Samples kept per event, as in Redis.
+    static constexpr size_t HISTORY_LENGTH = 160;
+
+    struct Sample {
+        // Unix seconds.
+        int64_t time = 0;
+        uint64_t latency_ms = 0;
+    };
+
+    struct EventStats {
+        std::string name;
+        Sample latest;
+        uint64_t max_ms = 0;
+    };
+
+    static LatencyMonitor& getInstance() {
+        static LatencyMonitor instance;
+        return instance;
+    }
+
+    // 0 disables monitoring, the default.
+    void setThreshold(std::chrono::milliseconds threshold) { threshold_ms_ = threshold.count(); }
+    std::chrono::milliseconds threshold() const {
+        return std::chrono::milliseconds(threshold_ms_.load(std::memory_order_relaxed));
+    }
+
+    void record(const char* event, std::chrono::nanoseconds duration);
+
+    // Every event with samples, by name.
+    std::vector<EventStats> latest() const;
+    // Oldest first; empty for an unknown event.
+    std::vector<Sample> history(const std::string& event) const;
+    // Forgets the named events, or all of them if none are named. Returns
+    // how many had samples.
+    size_t reset(const std::vector<std::string>& events = {});
+
+    // Times a scope and records it as event.
+    class Timer {
+    public:
+        explicit Timer(const char* event)
+            : event_(event), start_(std::chrono::steady_clock::now()) {}
+        ~Timer() { LatencyMonitor::getInstance().record(event_, std::chrono::steady_clock::now() - start_); }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        const char* event_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+private:
+    struct Event {
+        std::array<Sample, HISTORY_LENGTH> samples{};
+        // Index of the next sample to write.
+        size_t next = 0;
+        size_t size = 0;
+        uint64_t max_ms = 0;
+    };
+
+    LatencyMonitor() = default;
+    LatencyMonitor(const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+
+    std::atomic<int64_t> threshold_ms_{0};
+    mutable std::mutex mutex_;
+    std::map<std::string, Event, std::less<>> events_;
+};
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+// The lowest level compiled in: 0 debug, 1 verbose, 2 notice, 3 warning.
+// SERVER_LOG calls below it are discarded, arguments and all.
+#ifndef SERVER_LOG_LEVEL
+#define SERVER_LOG_LEVEL 1
+#endif
+
+// SERVER_LOG(Notice, "Loaded ", count, " keys") logs the concatenation of
+// its arguments: strings, characters, integers and floating point numbers.
+// Arguments are only evaluated when the level is enabled.
+#define SERVER_LOG(level, ...)                                                            \
+    do {                                                                                  \
+        if constexpr (static_cast<int>(::server::LogLevel::level) >= SERVER_LOG_LEVEL) { \
+            ::server::Logger& server_logger = ::server::Logger::instance();               \
+            if (server_logger.enabled(::server::LogLevel::level)) {                       \
+                server_logger.log(::server::LogLevel::level, __VA_ARGS__);                \
+            }                                                                             \
+        }                                                                                 \
+    } while (false)
+
+namespace server {
+
+// Redis' log levels.
+enum class LogLevel : uint8_t { Debug, Verbose, Notice, Warning };
+
+// Writes log lines in Redis' format from a background thread. Callers
+// format straight into a slot of a bounded lock-free ring and go on, so
+// logging never takes a lock or waits on the output. When the ring is
+// full, lines are dropped and counted instead, and the writer reports how
+// many it missed. Lines longer than LINE_SIZE are cut short.
+class Logger {
+public:
+    // Slots in the ring; a power of two.
+    static constexpr size_t RING_SIZE = 4096;
+    static constexpr size_t LINE_SIZE = 480;
+
+    // The logger SERVER_LOG writes to, on stdout until setFile.
+    static Logger& instance();
+
+    Logger();
+    // Writes out whatever is still queued.
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    static std::optional<LogLevel> parseLevel(std::string_view name);
+
+    void setLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+    LogLevel level() const { return level_.load(std::memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level >= this->level(); }
+
+    // Appends to path from now on. False, leaving the output as it was, if
+    // it cannot be opened.
+    bool setFile(const std::string& path);
+
+    template <typename... Args>
+    void log(LogLevel level, const Args&... args);
+
+    // Returns once every line logged before the call has been written.
+    void flush();
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t RING_MASK = RING_SIZE - 1;
+    static_assert((RING_SIZE & RING_MASK) == 0, "RING_SIZE must be a power of two");
+    // How long the writer sleeps once the ring is empty.
+    static constexpr std::chrono::milliseconds IDLE_WAIT{10};
+
+    // A slot is free for the writer of position p while sequence is p,
+    // holds a line for the reader once it is p + 1, and comes round again
+    // at p + RING_SIZE.
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        // Microseconds since the Unix epoch.
+        int64_t time = 0;
+        LogLevel level = LogLevel::Notice;
+        uint16_t length = 0;
+        // One spare byte for snprintf's terminator.
+        char text[LINE_SIZE + 1];
+    };
+
+    // Appends to a slot's text, dropping whatever does not fit.
+    struct LineWriter {
+        char* data;
+        size_t size = 0;
+
+        void append(std::string_view text) {
+            const size_t count = std::min(text.size(), LINE_SIZE - size);
+            text.copy(data + size, count);
+            size += count;
+        }
+        void append(const char* text) { append(std::string_view(text)); }
+        void append(const std::string& text) { append(std::string_view(text)); }
+        void append(char c) { append(std::string_view(&c, 1)); }
+        void append(bool value) { append(value ? "true" : "false"); }
+        void append(double value) {
+            const int written = std::snprintf(data + size, LINE_SIZE - size + 1, "%g", value);
+            size = std::min(LINE_SIZE, size + static_cast<size_t>(std::max(written, 0)));
+        }
+        template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+        void append(T value) {
+            char digits[24];
+            const auto result = std::to_chars(digits, digits + sizeof(digits), value);
+            append(std::string_view(digits, static_cast<size_t>(result.ptr - digits)));
+        }
+    };
+
+    // The slot for the next line, or nullptr when the ring is full.
+    Slot* claim(uint64_t& position);
+    void run();
+    // Writes out the lines published so far. Returns how many there were.
+    size_t drain(std::string& buffer);
+
+    std::unique_ptr<Slot[]> slots_;
+    // Own cache lines, since every logging thread bumps the first and
+    // only the writer touches the second.
+    alignas(64) std::atomic<uint64_t> write_position_{0};
+    alignas(64) std::atomic<uint64_t> read_position_{0};
+    std::atomic<LogLevel> level_{LogLevel::Notice};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reported_drops_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    uint64_t flush_requests_ = 0;
+    bool stopping_ = false;
+    // Guarded by mutex_.
+    std::FILE* out_ = stdout;
+    std::thread thread_;
+};
+
+template <typename... Args>
+void Logger::log(LogLevel level, const Args&... args) {
+    uint64_t position;
+    Slot* slot = claim(position);
+    if (slot == nullptr) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    slot->time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    slot->level = level;
+    LineWriter line{slot->text};
+    (line.append(args), ...);
+    slot->length = static_cast<uint16_t>(line.size);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+}
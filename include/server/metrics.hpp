@@ -1,45 +1,102 @@
-#pragma once
-#include <atomic>
-#include <string>
-#include <chrono>
-#include <mutex>
-
-namespace server {
-class Metrics {
-public:
-    static Metrics& getInstance() {
-        static Metrics instance;
-        return instance;
-    }
-    void incrementCommand(const std::string& command);
-    uint64_t getCommandCount(const std::string& command);
-    void updateMemoryUsage(int64_t bytes);
-    size_t getMemoryUsage() const;
-    void incrementConnections();
-    void decrementConnections();
-    uint64_t getActiveConnections() const;
-    void incrementAOFWrites();
-    void incrementAOFErrors();
-    uint64_t getAOFWrites() const;
-    uint64_t getAOFErrors() const;
-    std::string getPrometheusMetrics() const;
-
-private:
-    Metrics() = default;
-    ~Metrics() = default;
-    Metrics(const Metrics&) = delete;
-    Metrics& operator=(const Metrics&) = delete;
-    std::atomic<uint64_t> set_commands{0};
-    std::atomic<uint64_t> get_commands{0};
-    std::atomic<uint64_t> del_commands{0};
-    std::atomic<uint64_t> persist_commands{0};
-    std::atomic<uint64_t> expire_commands{0};
-    std::atomic<uint64_t> ttl_commands{0};
-    std::atomic<uint64_t> total_memory_bytes{0};
-    std::atomic<uint64_t> active_connections{0};
-    std::atomic<uint64_t> total_connections{0};
-    std::atomic<uint64_t> aof_writes{0};
-    std::atomic<uint64_t> aof_errors{0};
-    mutable std::mutex mutex_;
-};
-}
\ No newline at end of file
+#pragma once
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "server/histogram.hpp"
+
+namespace server {
+// Process-wide counters. Every thread updates its own cache-line-aligned
+// slot with relaxed atomics, so the hot path never takes a lock or shares
+// a line with another thread; readers add the slots up.
+class Metrics {
+public:
+    // Commands as counted in redis_commands_total. Variants share an ID,
+    // e.g. PEXPIRE counts as EXPIRE and DECRBY as INCR.
+    enum class CommandId : uint8_t { Set, Get, Del, Persist, Expire, Ttl, Incr, Other, Count };
+    static constexpr size_t COMMAND_IDS = static_cast<size_t>(CommandId::Count);
+    // Parts of serving a request that are timed apart from executing it.
+    enum class Stage : uint8_t { Parse, AOFAppend, AOFWrite, AOFFsync, SocketWrite, Count };
+    static constexpr size_t STAGES = static_cast<size_t>(Stage::Count);
+
+    static Metrics& getInstance() {
+        static Metrics instance;
+        return instance;
+    }
+
+    // Resolves an upper-case command name, once per request.
+    static CommandId commandId(std::string_view command);
+    static const char* commandLabel(CommandId id);
+    static const char* stageLabel(Stage stage);
+
+    void incrementCommand(CommandId id);
+    void incrementCommand(const std::string& command) { incrementCommand(commandId(command)); }
+    uint64_t getCommandCount(CommandId id) const;
+    uint64_t getCommandCount(const std::string& command) const { return getCommandCount(commandId(command)); }
+    void recordLatency(CommandId id, std::chrono::nanoseconds latency);
+    // Latency of every command with this ID so far, summed over threads.
+    LatencyHistogram::Counts getLatency(CommandId id) const;
+    void recordStage(Stage stage, std::chrono::nanoseconds duration);
+    LatencyHistogram::Counts getStageLatency(Stage stage) const;
+
+    // Memory figures kept by their owner (the store) and read on scrape.
+    struct MemoryStats {
+        uint64_t used = 0;
+        uint64_t peak = 0;
+        uint64_t rss = 0;
+        // used per shard.
+        std::vector<uint64_t> shards;
+        uint64_t evicted_keys = 0;
+    };
+    using MemoryStatsSource = std::function<MemoryStats()>;
+    // Once set, the memory gauges come from source instead of the totals
+    // passed to updateMemoryUsage; nullptr goes back to those. Returns once
+    // no scrape is using the previous source.
+    void setMemoryStatsSource(MemoryStatsSource source);
+
+    void updateMemoryUsage(int64_t bytes);
+    size_t getMemoryUsage() const;
+    void incrementConnections();
+    void decrementConnections();
+    uint64_t getActiveConnections() const;
+    void incrementAOFWrites(uint64_t count = 1);
+    void incrementAOFErrors();
+    uint64_t getAOFWrites() const;
+    uint64_t getAOFErrors() const;
+    std::string getPrometheusMetrics() const;
+
+private:
+    // Threads are spread round-robin over this many slots; any that share
+    // one still only contend on its atomics.
+    static constexpr size_t SLOTS = 32;
+
+    struct alignas(64) Slot {
+        std::array<std::atomic<uint64_t>, COMMAND_IDS> commands{};
+        std::atomic<int64_t> memory_bytes{0};
+        std::atomic<uint64_t> connections_opened{0};
+        std::atomic<uint64_t> connections_closed{0};
+        std::atomic<uint64_t> aof_writes{0};
+        std::atomic<uint64_t> aof_errors{0};
+        std::array<LatencyHistogram, COMMAND_IDS> latency;
+        std::array<LatencyHistogram, STAGES> stages;
+    };
+
+    Metrics() = default;
+    ~Metrics() = default;
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    Slot& slot();
+    template<typename Field>
+    uint64_t sum(Field field) const;
+
+    std::array<Slot, SLOTS> slots_;
+    mutable std::mutex memory_source_mutex_;
+    MemoryStatsSource memory_source_;
+    std::atomic<size_t> next_slot_{0};
+};
+}
@@ -1,76 +1,142 @@
-#include <string>
-#include <vector>
-#include <variant>
-#include <optional>
-#include <cstdint>
-
-namespace server {
-namespace resp {
-
-struct SimpleString {
-    std::string value;
-    SimpleString(const std::string& s) : value(s) {}
-    SimpleString(std::string&& s) : value(std::move(s)) {}
-    size_t size() const { return value.size(); }
-};
-
-struct Error {
-    std::string value;
-    Error(const std::string& s) : value(s) {}
-    Error(std::string&& s) : value(std::move(s)) {}
-    size_t size() const { return value.size(); }
-};
-
-using Integer = std::int64_t;
-using BulkString = std::optional<std::string>;
-
-class Value;
-using Array = std::vector<Value>;
-
-class Value {
-public:
-    using VariantType = std::variant<SimpleString, Error, Integer, BulkString, Array>;
-    
-    template<typename T>
-    Value(T&& value) : value_(std::forward<T>(value)) {}
-    
-    template<typename T>
-    bool holds_alternative() const { return std::holds_alternative<T>(value_); }
-    
-    template<typename T>
-    const T& get() const { return std::get<T>(value_); }
-    
-    size_t size() const {
-        if (holds_alternative<SimpleString>()) {
-            return get<SimpleString>().size();
-        } else if (holds_alternative<Error>()) {
-            return get<Error>().size();
-        } else if (holds_alternative<BulkString>()) {
-            const auto& bulk = get<BulkString>();
-            return bulk ? bulk->size() : 0;
-        } else if (holds_alternative<Array>()) {
-            return get<Array>().size();
-        }
-        return 0;
-    }
-    
-private:
-    VariantType value_;
-};
-
-class Parser {
-public:
-    static std::optional<Value> parse(const std::string& input);
-    static std::optional<Value> parse(const std::string& input, size_t& pos);
-    static std::string serialize(const Value& value);
-
-private:
-    static std::optional<Value> parseSimpleString(const std::string& input, size_t& pos);
-    static std::optional<Value> parseError(const std::string& input, size_t& pos);
-    static std::optional<Value> parseInteger(const std::string& input, size_t& pos);
-    static std::optional<Value> parseBulkString(const std::string& input, size_t& pos);
-    static std::optional<Value> parseArray(const std::string& input, size_t& pos);
-};
-
-}
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <variant>
+#include <optional>
+#include <cstdint>
+
+namespace server {
+namespace resp {
+
+struct SimpleString {
+    std::string value;
+    SimpleString(const std::string& s) : value(s) {}
+    SimpleString(std::string&& s) : value(std::move(s)) {}
+    size_t size() const { return value.size(); }
+};
+
+struct Error {
+    std::string value;
+    Error(const std::string& s) : value(s) {}
+    Error(std::string&& s) : value(std::move(s)) {}
+    size_t size() const { return value.size(); }
+};
+
+using Integer = std::int64_t;
+using BulkString = std::optional<std::string>;
+
+class Value;
+using Array = std::vector<Value>;
+
+class Value {
+public:
+    using VariantType = std::variant<SimpleString, Error, Integer, BulkString, Array>;
+    
+    template<typename T>
+    Value(T&& value) : value_(std::forward<T>(value)) {}
+    
+    template<typename T>
+    bool holds_alternative() const { return std::holds_alternative<T>(value_); }
+    
+    template<typename T>
+    const T& get() const { return std::get<T>(value_); }
+
+    template<typename T>
+    T& get() { return std::get<T>(value_); }
+    
+    size_t size() const {
+        if (holds_alternative<SimpleString>()) {
+            return get<SimpleString>().size();
+        } else if (holds_alternative<Error>()) {
+            return get<Error>().size();
+        } else if (holds_alternative<BulkString>()) {
+            const auto& bulk = get<BulkString>();
+            return bulk ? bulk->size() : 0;
+        } else if (holds_alternative<Array>()) {
+            return get<Array>().size();
+        }
+        return 0;
+    }
+    
+private:
+    VariantType value_;
+};
+
+class Parser {
+public:
+    static std::optional<Value> parse(const std::string& input);
+    static std::optional<Value> parse(const std::string& input, size_t& pos);
+    static std::string serialize(const Value& value);
+
+    // Bulk strings at least this long are handed over rather than copied.
+    static constexpr size_t MOVE_THRESHOLD = 16 * 1024;
+    // Appends value's encoding to out for a gathered write. Bulk strings of
+    // MOVE_THRESHOLD bytes or more are moved into entries of their own;
+    // everything around them is packed into as few entries as possible.
+    static void serialize(Value&& value, std::vector<std::string>& out);
+
+private:
+    static std::optional<Value> parseSimpleString(const std::string& input, size_t& pos);
+    static std::optional<Value> parseError(const std::string& input, size_t& pos);
+    static std::optional<Value> parseInteger(const std::string& input, size_t& pos);
+    static std::optional<Value> parseBulkString(const std::string& input, size_t& pos);
+    static std::optional<Value> parseArray(const std::string& input, size_t& pos);
+    static void serializeInto(Value&& value, std::string& pending, std::vector<std::string>& out);
+};
+
+// Incremental parser for client requests (RESP arrays of bulk strings).
+// It keeps its state between calls, so bytes that were already examined are
+// never scanned again when more data arrives, and it returns the arguments
+// as views into the caller's buffer instead of copying them.
+class RequestParser {
+public:
+    enum class Status { Complete, Incomplete, Error };
+
+    static constexpr int64_t MAX_ARGS = 1024 * 1024;
+    static constexpr int64_t MAX_BULK_LENGTH = 512 * 1024 * 1024;
+    // Most pendingBytes() asks for at once. A client can declare a 512MB
+    // bulk string in a 20-byte header, so room is made as its bytes arrive.
+    static constexpr size_t MAX_READ_AHEAD = 1024 * 1024;
+
+    // Continues parsing buffer from where the previous call stopped. The
+    // buffer must hold the same bytes as before, optionally with more
+    // appended. On Complete, args() views into buffer until it changes.
+    Status parse(std::string_view buffer);
+
+    const std::vector<std::string_view>& args() const { return args_; }
+
+    // Offset one past the last complete request; bytes before it may be
+    // dropped by the owner.
+    size_t consumed() const { return frame_start_; }
+
+    // Bytes still missing from the bulk string being read, at most
+    // MAX_READ_AHEAD; 0 if unknown.
+    size_t pendingBytes(size_t buffered) const;
+
+    // Tells the parser the owner removed the first n bytes of its buffer.
+    // n must not exceed consumed().
+    void discard(size_t n);
+
+    const std::string& error() const { return error_; }
+
+private:
+    enum class State { ArrayHeader, BulkHeader, BulkData };
+
+    State state_ = State::ArrayHeader;
+    size_t frame_start_ = 0;
+    size_t pos_ = 0;
+    size_t scan_ = 0;
+    int64_t remaining_ = 0;
+    int64_t bulk_length_ = 0;
+    std::vector<std::pair<size_t, size_t>> offsets_;
+    std::vector<std::string_view> args_;
+    std::string error_;
+
+    Status readLength(std::string_view buffer, char type, int64_t& length);
+    Status fail(const char* message);
+};
+
+}
 }
\ No newline at end of file
@@ -1,42 +1,104 @@
-#pragma once
-
-#include <string>
-#include <atomic>
-#include <thread>
-#include <vector>
-#include <boost/asio.hpp>
-#include <boost/asio/error.hpp>
-#include <sstream>
-#include <unordered_map>
-#include "store/store.hpp"
-#include "server/resp.hpp"
-#include "server/aof_manager.hpp"
-
-namespace server {
-class Server {
-public:
-    Server(const std::string& host = "127.0.0.1", unsigned short port = 6379);
-    ~Server();
-
-    void start();
-    void stop();
-
-private:
-    store::Store store_;
-    server::AOFManager aof_manager_;
-    std::string host_;
-    unsigned short port_;
-
-    std::atomic<bool> running_;
-    boost::asio::io_context io_context_;
-    boost::asio::ip::tcp::acceptor acceptor_;
-
-    std::vector<std::thread> threads_;
-
-    void accept_connections();
-    void handle_client(boost::asio::ip::tcp::socket&& socket);
-
-    std::vector<std::string> parseCommand(const std::string& input);
-    resp::Value handleCommand(const resp::Value& command);
-};
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/error.hpp>
+#include <sstream>
+#include <unordered_map>
+#include "store/store.hpp"
+#include "server/resp.hpp"
+#include "server/aof_manager.hpp"
+#include "server/snapshot_manager.hpp"
+#include "server/slowlog.hpp"
+
+namespace server {
+class Session;
+
+class Server {
+public:
+    struct Config {
+        std::string host = "127.0.0.1";
+        unsigned short port = 6379;
+        // 0 runs one I/O thread per hardware core.
+        size_t io_threads = 0;
+        std::string aof_path = "redis.aof";
+        AOFManager::FsyncPolicy appendfsync = AOFManager::FsyncPolicy::EverySec;
+        // Rewrite the AOF once it has grown this much since the last rewrite
+        // and is at least auto_aof_rewrite_min_size bytes. 0 disables.
+        unsigned auto_aof_rewrite_percentage = 100;
+        uint64_t auto_aof_rewrite_min_size = 64 * 1024 * 1024;
+        // Rewrites start the AOF with a binary snapshot instead of SETs.
+        bool aof_use_snapshot_preamble = true;
+        // Written by SAVE and BGSAVE, loaded at startup ahead of the AOF.
+        std::string snapshot_path = "redis.snapshot";
+        // Commands taking at least this many microseconds to execute go to
+        // the SLOWLOG; negative disables it.
+        int64_t slowlog_log_slower_than = 10000;
+        size_t slowlog_max_len = 128;
+        // LATENCY keeps events taking at least this many milliseconds; 0
+        // disables it.
+        uint64_t latency_monitor_threshold = 0;
+        // Writes evict keys by maxmemory_policy once the keyspace holds more
+        // than maxmemory bytes, or fail under noeviction. 0 is no limit.
+        size_t maxmemory = 0;
+        store::Store::EvictionPolicy maxmemory_policy = store::Store::EvictionPolicy::NoEviction;
+        size_t maxmemory_samples = 5;
+        // Relocate values out of sparse slabs in the background once the
+        // slabs waste more than active_defrag_ignore_bytes and
+        // active_defrag_threshold_lower percent.
+        bool activedefrag = false;
+        size_t active_defrag_ignore_bytes = 100 << 20;
+        unsigned active_defrag_threshold_lower = 10;
+    };
+
+    explicit Server(const Config& config);
+    // io_threads == 0 runs one I/O thread per hardware core.
+    Server(const std::string& host = "127.0.0.1", unsigned short port = 6379,
+           size_t io_threads = 0);
+    ~Server();
+
+    void start();
+    void stop();
+
+private:
+    store::Store store_;
+    server::AOFManager aof_manager_;
+    server::SnapshotManager snapshot_manager_;
+    server::SlowLog slowlog_;
+    std::string host_;
+    unsigned short port_;
+
+    size_t io_threads_;
+
+    std::atomic<bool> running_;
+    boost::asio::io_context io_context_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+
+    std::vector<std::thread> threads_;
+
+    friend class Session;
+
+    void accept_connections();
+    void load();
+    void snapshot(const AOFManager::Emit& emit, const std::function<void()>& start);
+
+    std::vector<std::string> parseCommand(const std::string& input);
+    // clock holds when the command was read and is advanced to when it
+    // finished, so callers timing around it need no clock reads of their own.
+    resp::Value handleCommand(const std::vector<std::string_view>& args,
+                              std::chrono::steady_clock::time_point& clock);
+    std::string info(const std::string& section);
+    // HSET, LPUSH, SADD, ZADD and the other collection commands, for
+    // clients and for AOF replay alike. log says whether to log what the
+    // command writes, which replay does not. cmd is upper case.
+    resp::Value handleCollectionCommand(const std::string& cmd, const std::vector<std::string_view>& args,
+                                        bool log);
+    resp::Value handleSlowLog(const std::vector<std::string_view>& args);
+    resp::Value handleLatency(const std::vector<std::string_view>& args);
+};
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "server/resp.hpp"
+
+namespace server {
+class Server;
+
+// One client connection. All I/O is asynchronous: a session is always
+// waiting on exactly one read or one write, so it never occupies a thread
+// while idle and its handlers never run concurrently.
+class Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(boost::asio::ip::tcp::socket socket, Server& server);
+    ~Session();
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    void start();
+
+private:
+    static constexpr size_t READ_CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_IDLE_BUFFER_SIZE = 64 * 1024;
+
+    boost::asio::ip::tcp::socket socket_;
+    Server& server_;
+    // Bytes read from the socket; [0, filled_) is valid. Command arguments
+    // are views into it, so it is only compacted between batches.
+    std::vector<char> read_buffer_;
+    size_t filled_ = 0;
+    resp::RequestParser parser_;
+    bool close_after_write_ = false;
+    // Replies to every command completed by one read, sent as one gathered write.
+    std::vector<std::string> responses_;
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    // When the pending write was started, for the socket write stage.
+    std::chrono::steady_clock::time_point write_started_;
+
+    void do_read();
+    void on_read(const boost::system::error_code& error, size_t bytes_read);
+    void process_commands();
+    void do_write();
+    void on_write(const boost::system::error_code& error);
+};
+}
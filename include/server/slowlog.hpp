@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace server {
+
+// Ring of the most recent commands that took longer than a threshold to
+// execute, for SLOWLOG. Faster commands cost one relaxed load; slow ones
+// take the lock to copy their arguments in.
+class SlowLog {
+public:
+    // Arguments kept per entry, and bytes kept per argument, as in Redis.
+    static constexpr size_t MAX_ARGS = 32;
+    static constexpr size_t MAX_ARG_LENGTH = 128;
+
+    struct Entry {
+        uint64_t id = 0;
+        // Unix seconds.
+        int64_t time = 0;
+        std::chrono::microseconds duration{0};
+        std::vector<std::string> args;
+    };
+
+    // A negative threshold disables the log; 0 logs every command.
+    explicit SlowLog(std::chrono::microseconds threshold = std::chrono::milliseconds(10),
+                     size_t max_length = 128);
+
+    void setThreshold(std::chrono::microseconds threshold) { threshold_us_ = threshold.count(); }
+    std::chrono::microseconds threshold() const {
+        return std::chrono::microseconds(threshold_us_.load(std::memory_order_relaxed));
+    }
+    void setMaxLength(size_t max_length);
+
+    bool isSlow(std::chrono::nanoseconds duration) const {
+        const int64_t threshold = threshold_us_.load(std::memory_order_relaxed);
+        return threshold >= 0 &&
+            std::chrono::duration_cast<std::chrono::microseconds>(duration).count() >= threshold;
+    }
+
+    // Logs the command if it was slow.
+    void record(const std::vector<std::string_view>& args, std::chrono::nanoseconds duration);
+
+    // Newest first.
+    std::vector<Entry> get(size_t count) const;
+    size_t size() const;
+    void reset();
+
+private:
+    std::atomic<int64_t> threshold_us_;
+    mutable std::mutex mutex_;
+    size_t max_length_;
+    // Newest at the front.
+    std::deque<Entry> entries_;
+    uint64_t next_id_ = 0;
+};
+
+}
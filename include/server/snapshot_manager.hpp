@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <atomic>
+#include <thread>
+#include "server/aof_manager.hpp"
+
+namespace server {
+
+// Saves and loads point-in-time binary snapshots of the keyspace.
+//
+// A snapshot records the AOF position it was taken at, so startup can load
+// it and replay only the log written after it. The same format also serves
+// as the preamble of a rewritten AOF. The log itself is left
+// whole and stays sufficient on its own; a snapshot that no longer matches
+// it is ignored.
+//
+// File layout, all integers little-endian, varints LEB128:
+//
+//   header   "RKVSNAP" version:u8 aof_offset:varint aof_fence:u32 crc:u32
+//   block*   size:varint count:varint entries[size bytes] crc:u32
+//   end      0:varint total:varint
+//
+//   entry    type:u8 [expire_at_ms:varint if type & EXPIRING]
+//            key_size:varint key value_size:varint value
+//
+// Each block's crc is the CRC-32C of its entries; the header's covers the
+// bytes before it. Expiry times are absolute Unix milliseconds. An entry's
+// type is its store::ValueType shifted left by one, with EXPIRING in the low
+// bit, and the value of a collection is its payload. Version 1 files, which
+// only hold strings, read the same way.
+class SnapshotManager {
+public:
+    // The same source serves AOF rewrites. Called from the saving thread.
+    using Emit = AOFManager::Emit;
+    using Source = AOFManager::SnapshotSource;
+    using LoadHandler = std::function<void(std::string_view key, store::ValueType type, std::string_view value,
+                                           std::optional<int64_t> expire_at)>;
+
+    // aof, if given, is asked for its position as each save starts reading
+    // keys.
+    explicit SnapshotManager(const std::string& path, AOFManager* aof = nullptr);
+    ~SnapshotManager();
+
+    SnapshotManager(const SnapshotManager&) = delete;
+    SnapshotManager& operator=(const SnapshotManager&) = delete;
+
+    // Must be set before anything can be saved.
+    void setSource(Source source);
+
+    // Saves on the calling thread; returns once the file is in place.
+    // False if it failed or another save is running.
+    bool save();
+    // Starts a save on a background thread. False if one is running.
+    bool saveInBackground();
+    bool saving() const { return saving_.load(); }
+
+    // The AOF position recorded in the file's header, or nullopt if there
+    // is no readable snapshot.
+    std::optional<AOFManager::Position> logPosition() const;
+    // Feeds every entry to handler, checking each block before any of its
+    // entries is handed out. False if the file is missing or corrupt, in
+    // which case a prefix of the entries may have been loaded.
+    bool load(const LoadHandler& handler) const;
+
+    const std::string& path() const { return path_; }
+
+    // Writes a snapshot of source to fd. start, if given, is called as the
+    // source starts reading keys and returns the AOF position to record.
+    static bool write(int fd, const Source& source,
+                      const std::function<AOFManager::Position()>& start = nullptr);
+    // Called after each block with the bytes of data parsed so far.
+    using Progress = std::function<void(size_t parsed)>;
+
+    // Whether data starts like a snapshot.
+    static bool detect(std::string_view data);
+    // Parses the snapshot at the start of data. Returns the bytes it spans,
+    // or nullopt if it is truncated or corrupt.
+    static std::optional<size_t> read(std::string_view data, const LoadHandler& handler,
+                                      AOFManager::Position* position = nullptr,
+                                      const Progress& progress = nullptr);
+
+private:
+    static constexpr char MAGIC[] = "RKVSNAP";
+    static constexpr uint8_t VERSION = 2;
+    static constexpr uint8_t FIRST_VERSION = 1;
+    // Set in an entry's type when an expiry follows.
+    static constexpr uint8_t EXPIRING = 1;
+    // A block is closed once its entries reach this size.
+    static constexpr size_t BLOCK_SIZE = 64 << 10;
+    // Finished blocks are written out in chunks this big.
+    static constexpr size_t WRITE_CHUNK_SIZE = 1 << 20;
+    // Loading drops the pages it has parsed after every window this big.
+    static constexpr size_t LOAD_WINDOW = 64 << 20;
+
+    std::string path_;
+    AOFManager* aof_;
+
+    // Guards the source and the background thread.
+    std::mutex mutex_;
+    Source source_;
+    std::thread save_thread_;
+    std::atomic<bool> saving_{false};
+    std::atomic<bool> closing_{false};
+
+    bool runSave(const Source& source);
+    template<typename Visit>
+    bool mapFile(const Visit& visit) const;
+};
+
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "store/flat_map.hpp"
+
+namespace store {
+
+// The kinds of value a key can hold, as Redis' TYPE names them.
+enum class ValueType : uint8_t { String, Hash, List, Set, ZSet };
+
+const char* valueTypeName(ValueType type);
+
+// Collections this small stay in one ListPack, as with Redis'
+// *-max-listpack-entries and *-max-listpack-value defaults. Past either
+// limit they move to a hash table, deque or skiplist for good.
+constexpr size_t LISTPACK_MAX_ENTRIES = 128;
+constexpr size_t LISTPACK_MAX_VALUE = 64;
+
+// Strings packed one after another in a single buffer, like Redis'
+// listpack. Each entry is its length as a varint, its bytes, and then the
+// length of those two as a varint written backwards, so the buffer can be
+// walked from either end. Entries are addressed by their offset in the
+// buffer; end() is one past the last.
+//
+// A few dozen short strings cost one allocation and a couple of bytes each,
+// where a hash table would spend a slot and often a heap block on every
+// one. Inserts and lookups are linear, which for this many entries is
+// cheaper than hashing.
+class ListPack {
+public:
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    size_t begin() const { return 0; }
+    size_t end() const { return buffer_.size(); }
+
+    std::string_view at(size_t offset) const;
+    size_t next(size_t offset) const;
+    // offset must not be begin().
+    size_t prev(size_t offset) const;
+    // The offset of the first entry from first on equal to value, looking
+    // at every stride-th entry, or end().
+    size_t find(std::string_view value, size_t stride = 1, size_t first = 0) const;
+
+    void insert(size_t offset, std::string_view value);
+    void pushBack(std::string_view value) { insert(end(), value); }
+    // Removes count entries from offset on.
+    void erase(size_t offset, size_t count = 1);
+    void replace(size_t offset, std::string_view value);
+    void clear();
+
+    // Heap bytes of the buffer.
+    size_t bytes() const;
+    // The buffer as it is persisted.
+    const std::string& data() const { return buffer_; }
+    // A list pack over a persisted buffer, or nullopt if it is malformed.
+    static std::optional<ListPack> fromData(std::string_view data);
+
+private:
+    std::string buffer_;
+    size_t count_ = 0;
+};
+
+class HashValue {
+public:
+    HashValue();
+    ~HashValue();
+    HashValue(HashValue&&) noexcept;
+    HashValue& operator=(HashValue&&) noexcept;
+
+    // Returns whether the field is new.
+    bool set(std::string_view field, std::string_view value);
+    std::optional<std::string_view> get(std::string_view field) const;
+    size_t size() const;
+    bool compact() const { return !table_; }
+    size_t bytes() const;
+
+    template <typename F>
+    void forEach(F&& fn) const {
+        if (!table_) {
+            for (size_t offset = pack_.begin(); offset != pack_.end(); offset = pack_.next(pack_.next(offset))) {
+                fn(pack_.at(offset), pack_.at(pack_.next(offset)));
+            }
+            return;
+        }
+        table_->forEach([&](const FlatMap<std::string>::Slot& slot) { fn(slot.key, slot.value); });
+    }
+
+private:
+    void convert();
+
+    // Fields and values alternating.
+    ListPack pack_;
+    std::unique_ptr<FlatMap<std::string>> table_;
+    // Heap bytes of the table's keys and values.
+    size_t element_bytes_ = 0;
+};
+
+class ListValue {
+public:
+    ListValue();
+    ~ListValue();
+    ListValue(ListValue&&) noexcept;
+    ListValue& operator=(ListValue&&) noexcept;
+
+    void push(std::string_view value, bool front);
+    // size() must not be 0.
+    std::string pop(bool front);
+    // Elements start to stop inclusive, from 0; both must be within size().
+    std::vector<std::string> range(size_t start, size_t stop) const;
+    size_t size() const;
+    bool compact() const { return !deque_; }
+    size_t bytes() const;
+
+private:
+    void convert();
+
+    ListPack pack_;
+    std::unique_ptr<std::deque<std::string>> deque_;
+    size_t element_bytes_ = 0;
+};
+
+class SetValue {
+public:
+    SetValue();
+    ~SetValue();
+    SetValue(SetValue&&) noexcept;
+    SetValue& operator=(SetValue&&) noexcept;
+
+    // Returns whether the member is new.
+    bool add(std::string_view member);
+    bool contains(std::string_view member) const;
+    size_t size() const;
+    bool compact() const { return !table_; }
+    size_t bytes() const;
+
+    template <typename F>
+    void forEach(F&& fn) const {
+        if (!table_) {
+            for (size_t offset = pack_.begin(); offset != pack_.end(); offset = pack_.next(offset)) {
+                fn(pack_.at(offset));
+            }
+            return;
+        }
+        table_->forEach([&](const FlatMap<Member>::Slot& slot) { fn(slot.key); });
+    }
+
+private:
+    struct Member {};
+
+    void convert();
+
+    ListPack pack_;
+    std::unique_ptr<FlatMap<Member>> table_;
+    size_t element_bytes_ = 0;
+};
+
+// Members ordered by score, then bytewise, as in Redis: a skiplist whose
+// links record how many members they skip, so finding the member at a
+// rank takes O(log n) like finding a score does.
+class SkipList {
+public:
+    static constexpr int MAX_LEVEL = 32;
+
+    struct Node;
+    struct Link {
+        Node* forward = nullptr;
+        // Members passed by following forward, counting the one reached.
+        size_t span = 0;
+    };
+    // Allocated with its links right behind it.
+    struct Node {
+        std::string member;
+        double score;
+        Node* backward;
+        int level;
+
+        Link* links() { return reinterpret_cast<Link*>(this + 1); }
+        const Link* links() const { return reinterpret_cast<const Link*>(this + 1); }
+        const Node* next() const { return links()[0].forward; }
+    };
+
+    SkipList();
+    ~SkipList();
+    SkipList(const SkipList&) = delete;
+    SkipList& operator=(const SkipList&) = delete;
+
+    // member must not be in the list yet.
+    void insert(double score, std::string_view member);
+    // Returns whether the pair was there.
+    bool erase(double score, std::string_view member);
+    // The node at a rank from 0, or nullptr past the end.
+    const Node* at(size_t rank) const;
+    size_t size() const { return size_; }
+    // Heap bytes of the nodes and their members.
+    size_t bytes() const { return bytes_; }
+
+private:
+    static Node* createNode(int level, double score, std::string_view member);
+    void destroyNode(Node* node);
+    int randomLevel();
+
+    Node* head_;
+    Node* tail_ = nullptr;
+    int level_ = 1;
+    size_t size_ = 0;
+    size_t bytes_ = 0;
+    uint64_t random_state_ = 0x2545f4914f6cdd1dULL;
+};
+
+class ZSetValue {
+public:
+    using ScoredMember = std::pair<std::string, double>;
+
+    ZSetValue();
+    ~ZSetValue();
+    ZSetValue(ZSetValue&&) noexcept;
+    ZSetValue& operator=(ZSetValue&&) noexcept;
+
+    // Adds the member or moves it to a new score. Returns whether it is
+    // new.
+    bool add(double score, std::string_view member);
+    std::optional<double> score(std::string_view member) const;
+    // Members at ranks start to stop inclusive; both must be within
+    // size().
+    std::vector<ScoredMember> range(size_t start, size_t stop) const;
+    size_t size() const;
+    bool compact() const { return !large_; }
+    size_t bytes() const;
+
+private:
+    // The skiplist orders the members; the table finds a member's score.
+    struct Large {
+        SkipList list;
+        FlatMap<double> scores;
+        size_t key_bytes = 0;
+    };
+
+    void convert();
+    void packInsert(double score, std::string_view member);
+
+    // Members and their scores alternating, sorted like the skiplist. A
+    // score is kept as the 8 bytes of its double.
+    ListPack pack_;
+    std::unique_ptr<Large> large_;
+};
+
+using Collection = std::variant<HashValue, ListValue, SetValue, ZSetValue>;
+
+inline ValueType collectionType(const Collection& collection) {
+    return static_cast<ValueType>(collection.index() + 1);
+}
+
+// Heap bytes of the collection's contents, kept up to date as it changes so
+// reading it is O(1).
+size_t collectionBytes(const Collection& collection);
+
+// Elements in a ListPack buffer, as snapshots store them and AOF rewrites
+// replay them: fields and values for a hash, members and score text for a
+// sorted set, and otherwise the elements in order.
+std::string collectionPayload(const Collection& collection);
+// The collection a payload describes, or nullopt if it is malformed or
+// empty.
+std::optional<Collection> collectionFromPayload(ValueType type, std::string_view payload);
+
+}
@@ -0,0 +1,489 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace store {
+
+// Open-addressing hash table keyed by std::string, laid out like a Swiss
+// table: a flat array of slots plus one control byte per slot holding 7 bits
+// of the key's hash. Lookups compare a whole group of 16 control bytes at
+// once (SSE2 when available) and only touch slots whose hash bits match.
+// Keys live directly in the slot, so keys up to the std::string SSO limit
+// cost no allocation of their own.
+//
+// Resizing is incremental, like Redis's dict: growing allocates a second
+// table and every later insert or erase moves a bounded number of slots
+// across (rehashStep lets an idle thread help). Lookups check both tables
+// while a migration is in progress, so no single operation pays for moving
+// the whole table.
+//
+// Lookups accept std::string_view, so callers never build a std::string to
+// probe the table. Pointers to slots stay valid until the next insert or
+// erase.
+template <typename V>
+class FlatMap {
+public:
+    struct Slot {
+        std::string key;
+        V value;
+    };
+
+    // Arrays of a table whose migration has finished. Returning a large
+    // table to the OS takes milliseconds, so the owner can take it with
+    // takeRetired() and let it go outside its lock.
+    class Retired {
+    public:
+        Retired() = default;
+        Retired(int8_t* ctrl, Slot* slots, size_t capacity)
+            : ctrl_(ctrl), slots_(slots), capacity_(capacity) {}
+        Retired(const Retired&) = delete;
+        Retired& operator=(const Retired&) = delete;
+        Retired(Retired&& other) noexcept { *this = std::move(other); }
+        Retired& operator=(Retired&& other) noexcept {
+            std::swap(ctrl_, other.ctrl_);
+            std::swap(slots_, other.slots_);
+            std::swap(capacity_, other.capacity_);
+            return *this;
+        }
+        size_t bytes() const { return capacity_ * (sizeof(Slot) + sizeof(int8_t)); }
+
+        ~Retired() {
+            delete[] ctrl_;
+            if (slots_) std::allocator<Slot>().deallocate(slots_, capacity_);
+        }
+
+    private:
+        int8_t* ctrl_ = nullptr;
+        Slot* slots_ = nullptr;
+        size_t capacity_ = 0;
+    };
+
+    static constexpr size_t GROUP_WIDTH = 16;
+    // Slots migrated per insert or erase. Anything above 2 finishes a
+    // migration before the new table (twice the size) can fill up.
+    static constexpr size_t MIGRATE_STEP = 2 * GROUP_WIDTH;
+
+    FlatMap() = default;
+
+    FlatMap(const FlatMap&) = delete;
+    FlatMap& operator=(const FlatMap&) = delete;
+
+    FlatMap(FlatMap&& other) noexcept { swap(other); }
+
+    FlatMap& operator=(FlatMap&& other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    size_t size() const { return table_.size + old_.size; }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return table_.capacity; }
+    bool rehashing() const { return old_.capacity != 0; }
+
+    // Bytes held by the control and slot arrays of both tables. Heap memory
+    // owned by keys and values is not included.
+    size_t tableBytes() const {
+        return (table_.capacity + old_.capacity) * (sizeof(Slot) + sizeof(int8_t));
+    }
+    // Bytes still held by a retired table nobody has taken.
+    size_t retiredBytes() const { return retired_.bytes(); }
+
+    static size_t hash(std::string_view key) {
+        return std::hash<std::string_view>{}(key);
+    }
+
+    Slot* find(std::string_view key) {
+        return find(key, hash(key));
+    }
+
+    const Slot* find(std::string_view key) const {
+        return const_cast<FlatMap*>(this)->find(key, hash(key));
+    }
+
+    Slot* find(std::string_view key, size_t hash_value) {
+        if (Slot* slot = table_.find(key, hash_value)) return slot;
+        return rehashing() ? old_.find(key, hash_value) : nullptr;
+    }
+
+    // Inserts key with a value built from args unless it is already present.
+    // Returns the slot holding the key and whether it was inserted.
+    template <typename... Args>
+    std::pair<Slot*, bool> tryEmplace(std::string_view key, Args&&... args) {
+        rehashStep(MIGRATE_STEP);
+        const size_t hash_value = hash(key);
+        if (Slot* existing = find(key, hash_value)) {
+            return {existing, false};
+        }
+        if (table_.growth_left == 0) {
+            grow();
+        }
+        Slot* slot = table_.emplace(hash_value, std::string(key), V(std::forward<Args>(args)...));
+        return {slot, true};
+    }
+
+    void erase(Slot* slot) {
+        eraseSlot(slot);
+        rehashStep(MIGRATE_STEP);
+    }
+
+    bool erase(std::string_view key) {
+        Slot* slot = find(key);
+        if (!slot) return false;
+        erase(slot);
+        return true;
+    }
+
+    // Moves up to max_slots slots from the old table. Returns true while a
+    // migration is still pending.
+    bool rehashStep(size_t max_slots) {
+        if (!rehashing()) return false;
+        const size_t end = std::min(migrate_pos_ + max_slots, old_.capacity);
+        for (; migrate_pos_ < end; ++migrate_pos_) {
+            if (!isFull(old_.ctrl[migrate_pos_])) continue;
+            Slot& slot = old_.slots[migrate_pos_];
+            table_.emplace(hash(slot.key), std::move(slot.key), std::move(slot.value));
+            old_.destroySlot(migrate_pos_);
+        }
+        if (migrate_pos_ == old_.capacity) {
+            retired_ = old_.detach();
+            migrate_pos_ = 0;
+            return false;
+        }
+        return true;
+    }
+
+    Retired takeRetired() {
+        return std::move(retired_);
+    }
+
+    // Picks a slot for random sampling from a random number: the first full
+    // slot at or after a position derived from it, in a table chosen in
+    // proportion to its size. Slots after long runs of empty ones come up
+    // more often, which sampling callers can live with. nullptr if empty.
+    Slot* sample(uint64_t random) {
+        if (empty()) return nullptr;
+        Table& table = (random >> 32) % size() < old_.size ? old_ : table_;
+        const size_t start = static_cast<size_t>(random) & (table.capacity - 1);
+        for (size_t i = 0; i < table.capacity; ++i) {
+            const size_t index = (start + i) & (table.capacity - 1);
+            if (isFull(table.ctrl[index])) return &table.slots[index];
+        }
+        return nullptr;
+    }
+
+    // Calls fn on the full slots among up to max_slots positions from cursor
+    // on, over the new table then the old one. Returns the cursor to resume
+    // from, or 0 once the end is reached. A scan spread over several calls
+    // may miss or repeat slots that inserts or erases move in between.
+    template <typename F>
+    size_t scan(size_t cursor, size_t max_slots, F&& fn) {
+        const size_t end = std::min(cursor + max_slots, table_.capacity + old_.capacity);
+        for (; cursor < end; ++cursor) {
+            Table& table = cursor < table_.capacity ? table_ : old_;
+            const size_t index = cursor < table_.capacity ? cursor : cursor - table_.capacity;
+            if (isFull(table.ctrl[index])) fn(table.slots[index]);
+        }
+        return cursor == table_.capacity + old_.capacity ? 0 : cursor;
+    }
+
+    template <typename F>
+    void forEach(F&& fn) {
+        table_.forEach(fn);
+        old_.forEach(fn);
+    }
+
+    template <typename F>
+    void forEach(F&& fn) const {
+        const_cast<Table&>(table_).forEach([&](Slot& slot) { fn(static_cast<const Slot&>(slot)); });
+        const_cast<Table&>(old_).forEach([&](Slot& slot) { fn(static_cast<const Slot&>(slot)); });
+    }
+
+    // Erases every slot for which pred returns true. pred may inspect the
+    // slot but must not touch the table.
+    template <typename F>
+    size_t eraseIf(F&& pred) {
+        return table_.eraseIf(pred) + old_.eraseIf(pred);
+    }
+
+    void clear() {
+        table_.release();
+        old_.release();
+        migrate_pos_ = 0;
+        retired_ = Retired();
+    }
+
+    void reserve(size_t count) {
+        size_t wanted = GROUP_WIDTH;
+        while (wanted * 7 / 8 < count) wanted <<= 1;
+        if (wanted > table_.capacity) startRehash(wanted);
+    }
+
+private:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+
+    static bool isFull(int8_t ctrl) { return ctrl >= 0; }
+    static size_t h1(size_t hash) { return hash >> 7; }
+    static int8_t h2(size_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+    static size_t lowestBit(uint32_t mask) { return static_cast<size_t>(__builtin_ctz(mask)); }
+
+    // Triangular probing over groups visits every group exactly once when
+    // the group count is a power of two.
+    class Probe {
+    public:
+        Probe(size_t hash, size_t mask) : offset_(hash & mask), mask_(mask) {}
+        size_t group() const { return offset_; }
+        void next() {
+            ++index_;
+            offset_ = (offset_ + index_) & mask_;
+        }
+    private:
+        size_t offset_;
+        size_t mask_;
+        size_t index_ = 0;
+    };
+
+    // Sixteen control bytes examined together. Each match returns a bitmask
+    // with bit i set when byte i qualifies.
+    class Group {
+    public:
+        explicit Group(const int8_t* ctrl) {
+#if defined(__SSE2__)
+            ctrl_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#else
+            std::memcpy(ctrl_, ctrl, GROUP_WIDTH);
+#endif
+        }
+
+        uint32_t match(int8_t tag) const {
+#if defined(__SSE2__)
+            return static_cast<uint32_t>(
+                _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(tag), ctrl_)));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+                if (ctrl_[i] == tag) mask |= 1u << i;
+            }
+            return mask;
+#endif
+        }
+
+        uint32_t matchEmpty() const { return match(EMPTY); }
+
+        // Empty and deleted bytes are the only ones with the sign bit set.
+        uint32_t matchEmptyOrDeleted() const {
+#if defined(__SSE2__)
+            return static_cast<uint32_t>(_mm_movemask_epi8(ctrl_));
+#else
+            uint32_t mask = 0;
+            for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+                if (ctrl_[i] < 0) mask |= 1u << i;
+            }
+            return mask;
+#endif
+        }
+
+    private:
+#if defined(__SSE2__)
+        __m128i ctrl_;
+#else
+        int8_t ctrl_[GROUP_WIDTH];
+#endif
+    };
+
+    // One fixed-capacity array of control bytes and slots.
+    struct Table {
+        int8_t* ctrl = nullptr;
+        Slot* slots = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t deleted = 0;
+        size_t growth_left = 0;
+
+        Table() = default;
+        Table(const Table&) = delete;
+        Table& operator=(const Table&) = delete;
+        ~Table() { release(); }
+
+        void allocate(size_t new_capacity) {
+            ctrl = new int8_t[new_capacity];
+            std::memset(ctrl, EMPTY, new_capacity);
+            slots = std::allocator<Slot>().allocate(new_capacity);
+            capacity = new_capacity;
+            size = 0;
+            deleted = 0;
+            growth_left = new_capacity * 7 / 8;
+        }
+
+        void release() {
+            for (size_t i = 0; size > 0 && i < capacity; ++i) {
+                if (isFull(ctrl[i])) {
+                    slots[i].~Slot();
+                    --size;
+                }
+            }
+            delete[] ctrl;
+            if (slots) std::allocator<Slot>().deallocate(slots, capacity);
+            ctrl = nullptr;
+            slots = nullptr;
+            capacity = 0;
+            size = 0;
+            deleted = 0;
+            growth_left = 0;
+        }
+
+        // Hands over the arrays of an empty table.
+        Retired detach() {
+            Retired retired(ctrl, slots, capacity);
+            ctrl = nullptr;
+            slots = nullptr;
+            capacity = 0;
+            size = 0;
+            deleted = 0;
+            growth_left = 0;
+            return retired;
+        }
+
+        size_t groupMask() const { return capacity / GROUP_WIDTH - 1; }
+
+        bool owns(const Slot* slot) const {
+            return slot >= slots && slot < slots + capacity;
+        }
+
+        Slot* find(std::string_view key, size_t hash_value) {
+            if (capacity == 0 || size == 0) return nullptr;
+            const int8_t tag = h2(hash_value);
+            Probe probe(h1(hash_value), groupMask());
+            while (true) {
+                const size_t base = probe.group() * GROUP_WIDTH;
+                Group group(ctrl + base);
+                for (uint32_t match = group.match(tag); match; match &= match - 1) {
+                    Slot* slot = slots + base + lowestBit(match);
+                    if (slot->key.size() == key.size() &&
+                        std::memcmp(slot->key.data(), key.data(), key.size()) == 0) {
+                        return slot;
+                    }
+                }
+                if (group.matchEmpty()) return nullptr;
+                probe.next();
+            }
+        }
+
+        // Places a key known to be absent. The caller ensures growth_left > 0.
+        Slot* emplace(size_t hash_value, std::string&& key, V&& value) {
+            Probe probe(h1(hash_value), groupMask());
+            size_t index;
+            while (true) {
+                const size_t base = probe.group() * GROUP_WIDTH;
+                uint32_t mask = Group(ctrl + base).matchEmptyOrDeleted();
+                if (mask) {
+                    index = base + lowestBit(mask);
+                    break;
+                }
+                probe.next();
+            }
+            if (ctrl[index] == EMPTY) {
+                --growth_left;
+            } else {
+                --deleted;
+            }
+            Slot* slot = slots + index;
+            new (slot) Slot{std::move(key), std::move(value)};
+            ctrl[index] = h2(hash_value);
+            ++size;
+            return slot;
+        }
+
+        void destroySlot(size_t index) {
+            slots[index].~Slot();
+            ctrl[index] = DELETED;
+            --size;
+            ++deleted;
+        }
+
+        template <typename F>
+        void forEach(F& fn) {
+            for (size_t i = 0; i < capacity; ++i) {
+                if (isFull(ctrl[i])) fn(slots[i]);
+            }
+        }
+
+        template <typename F>
+        size_t eraseIf(F& pred) {
+            size_t erased = 0;
+            for (size_t i = 0; i < capacity; ++i) {
+                if (isFull(ctrl[i]) && pred(slots[i])) {
+                    destroySlot(i);
+                    ++erased;
+                }
+            }
+            return erased;
+        }
+    };
+
+    Table table_;
+    Table old_;
+    size_t migrate_pos_ = 0;
+    Retired retired_;
+
+    void eraseSlot(Slot* slot) {
+        Table& table = table_.owns(slot) ? table_ : old_;
+        table.destroySlot(static_cast<size_t>(slot - table.slots));
+    }
+
+    // Starts migrating into a table twice the size, or into a fresh table of
+    // the same size when most of the used-up growth is tombstones.
+    void grow() {
+        if (table_.capacity == 0) {
+            table_.allocate(GROUP_WIDTH);
+        } else if (table_.size < table_.capacity * 7 / 16) {
+            startRehash(table_.capacity);
+        } else {
+            startRehash(table_.capacity * 2);
+        }
+    }
+
+    void startRehash(size_t new_capacity) {
+        // A previous migration that has not drained yet (only possible after
+        // heavy erase churn) is finished first.
+        while (rehashStep(old_.capacity)) {}
+        swapTable(table_, old_);
+        table_.allocate(new_capacity);
+        migrate_pos_ = 0;
+        if (old_.size == 0) old_.release();
+    }
+
+    void swap(FlatMap& other) noexcept {
+        swapTable(table_, other.table_);
+        swapTable(old_, other.old_);
+        std::swap(migrate_pos_, other.migrate_pos_);
+        std::swap(retired_, other.retired_);
+    }
+
+    static void swapTable(Table& a, Table& b) noexcept {
+        std::swap(a.ctrl, b.ctrl);
+        std::swap(a.slots, b.slots);
+        std::swap(a.capacity, b.capacity);
+        std::swap(a.size, b.size);
+        std::swap(a.deleted, b.deleted);
+        std::swap(a.growth_left, b.growth_left);
+    }
+};
+
+}
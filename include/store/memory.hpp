@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace store {
+
+// Heap bytes a string owns, as the allocator sized the block rather than as
+// requested: 0 for strings held inline by the small string optimisation.
+size_t heapBytes(const std::string& value);
+// The same for a block from malloc.
+size_t heapBytes(const void* block);
+
+// Process-wide figures, read from the kernel and the allocator. Reading
+// them walks the allocator's arenas, so they are for reporting, not for
+// hot paths.
+struct ProcessMemory {
+    // Resident set size.
+    size_t rss = 0;
+    // Bytes in live allocations, and bytes the allocator holds from the OS
+    // to serve them. 0 when the allocator cannot say.
+    size_t allocator_allocated = 0;
+    size_t allocator_active = 0;
+};
+
+ProcessMemory processMemory();
+
+}
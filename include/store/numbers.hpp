@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace store {
+
+// Conversions between values and the numbers INCR, INCRBYFLOAT and sorted
+// set scores work on. Redis keeps values that are integers as int64s rather
+// than as text.
+
+// The int64 text spells, if it is one in canonical form: an optional '-',
+// no leading zeros and nothing else, as Redis' string2ll accepts. Only
+// such values are stored as integers, so they read back byte for byte.
+std::optional<int64_t> parseInteger(std::string_view text);
+
+// Room for any int64 in decimal.
+constexpr size_t INTEGER_TEXT_SIZE = 20;
+
+// Numbers from 0 up to this are rendered once, at startup, into a shared
+// table, as Redis shares objects for its small integers. Counters mostly
+// live in this range.
+constexpr int64_t SHARED_INTEGERS = 10000;
+
+// value in decimal: a view into the shared table for small numbers, or
+// into buffer for the rest.
+std::string_view integerText(int64_t value, char (&buffer)[INTEGER_TEXT_SIZE]);
+
+// A finite number in text, as INCRBYFLOAT takes it: what strtold reads,
+// with nothing before or after it.
+std::optional<long double> parseLongDouble(std::string_view text);
+// value in fixed notation with 17 decimals and the trailing zeros
+// dropped, as Redis writes INCRBYFLOAT results.
+std::string longDoubleText(long double value);
+
+// A sorted set score: what strtod reads, with nothing before or after it.
+// Infinities are scores too; NaN is not.
+std::optional<double> parseScore(std::string_view text);
+// The shortest text that reads back as value, as Redis replies with scores:
+// "1.5", "100", "inf".
+std::string scoreText(double value);
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace store {
+
+// Allocates byte strings from fixed-size slabs, each carved into slots of
+// one size class, with a free list per slab. Classes step by 8 bytes from
+// 16 to 32, then by a quarter of each power of two, so a value over 32
+// bytes wastes less than a fifth of its slot. Up to 8 bytes are kept in the
+// block itself, and blocks above MAX_CLASS_SIZE come from malloc. The owner
+// may also tag an inline block to store something of its own in those 8
+// bytes.
+//
+// Allocations fill the fullest slab with room left, so live blocks
+// concentrate in few slabs and emptied slabs go back to malloc. defrag
+// moves blocks out of slabs that fuller slabs could absorb.
+//
+// Not thread-safe: each Store shard owns one and uses it under its lock.
+// The byte counters may be read from any thread.
+class SlabAllocator {
+public:
+    static constexpr size_t SLAB_SIZE = 32 * 1024;
+    static constexpr size_t MAX_CLASS_SIZE = 4096;
+    static constexpr size_t CLASS_COUNT = 31;
+    // Marks blocks that are empty or came from malloc.
+    static constexpr uint32_t NO_SLAB = UINT32_MAX;
+    // Marks blocks whose bytes are stored in place of data.
+    static constexpr uint32_t INLINE = UINT32_MAX - 1;
+    static constexpr size_t INLINE_SIZE = sizeof(char*);
+    // Tagged blocks are inline blocks marked INLINE - tag.
+    static constexpr uint8_t MAX_TAG = 15;
+
+    // A run of bytes the allocator handed out. Plain data: the allocator
+    // does not free blocks on its own except when it is destroyed, so the
+    // owner must return every block from malloc with deallocate.
+    struct Block {
+        char* data = nullptr;
+        uint32_t size = 0;
+        uint32_t slab = NO_SLAB;
+
+        bool isInline() const { return slab >= INLINE - MAX_TAG && slab != NO_SLAB; }
+        // 0 unless the owner tagged the block.
+        uint8_t tag() const { return isInline() ? static_cast<uint8_t>(INLINE - slab) : 0; }
+
+        std::string_view view() const {
+            return {isInline() ? reinterpret_cast<const char*>(&data) : data, size};
+        }
+    };
+
+    // An inline block holding INLINE_SIZE bytes and marked with tag, from 1
+    // to MAX_TAG. Like any inline block it needs no deallocate.
+    static Block tagged(const void* bytes, uint8_t tag);
+
+    SlabAllocator() = default;
+    ~SlabAllocator();
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    // A block holding a copy of bytes.
+    Block allocate(std::string_view bytes);
+    void deallocate(Block& block);
+    // Replaces block's contents, in place when the size class is unchanged.
+    void assign(Block& block, std::string_view bytes);
+
+    // Moves block out of a sparse slab into one at least as full, so
+    // repeated passes empty the sparsest slabs. Returns whether it moved.
+    bool defrag(Block& block);
+
+    // Bytes block takes: its slot, or what malloc reserved for it.
+    size_t bytes(const Block& block) const;
+
+    // Bytes in slots holding blocks, and in all slabs.
+    size_t allocatedBytes() const { return allocated_.load(std::memory_order_relaxed); }
+    size_t activeBytes() const { return active_.load(std::memory_order_relaxed); }
+
+    // The slot size serving size bytes; 0 for blocks kept inline and above
+    // MAX_CLASS_SIZE.
+    static size_t classSize(size_t size);
+
+private:
+    // Slabs with room left that refill considers.
+    static constexpr size_t REFILL_CANDIDATES = 32;
+
+    struct Slab {
+        char* base = nullptr;
+        // Head of the list of freed slots, linked through their first bytes.
+        char* free = nullptr;
+        // Slots never handed out start here.
+        uint32_t untouched = 0;
+        uint32_t live = 0;
+        uint32_t capacity = 0;
+        // Neighbours in the class's list of partly used slabs, or the next
+        // unused entry in slabs_.
+        uint32_t prev = NO_SLAB;
+        uint32_t next = NO_SLAB;
+        uint8_t size_class = 0;
+    };
+
+    struct SizeClass {
+        // Where allocations come from until it fills up.
+        uint32_t current = NO_SLAB;
+        // Slabs other than current with room left.
+        uint32_t partial = NO_SLAB;
+        size_t slabs = 0;
+        size_t live = 0;
+    };
+
+    static size_t classIndex(size_t size);
+    char* allocateSlot(size_t size_class, uint32_t& slab);
+    void freeSlot(uint32_t slab, char* slot);
+    uint32_t refill(size_t size_class);
+    uint32_t newSlab(size_t size_class);
+    void releaseSlab(uint32_t slab);
+    void linkPartial(uint32_t slab);
+    void unlinkPartial(uint32_t slab);
+    void addAllocated(size_t before, size_t after);
+
+    std::vector<Slab> slabs_;
+    uint32_t free_slabs_ = NO_SLAB;
+    std::array<SizeClass, CLASS_COUNT> classes_{};
+    std::atomic<size_t> allocated_{0};
+    std::atomic<size_t> active_{0};
+};
+
+}
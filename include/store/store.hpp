@@ -1,74 +1,539 @@
-#pragma once
-
-#include <string>
-#include <unordered_map>
-#include <vector>
-#include <optional>
-#include <mutex>
-#include <chrono>
-#include <functional>
-#include <thread>
-#include <atomic>
-
-namespace store {
-
-class Store {
-    public:
-        using TimeProvider = std::function<std::chrono::system_clock::time_point()>;
-        using Value = std::string;
-        using Expiry = std::optional<std::chrono::system_clock::time_point>;
-
-        Store(TimeProvider time_provider = std::chrono::system_clock::now)
-            : time_provider_(time_provider), running_(false) {}
-        ~Store() = default;
-
-        size_t calculateMemoryUsage(const std::string& key, const std::string& value);
-        bool add(const std::string& key, const std::string& value);
-
-        bool remove(const std::string& key);
-
-        bool update(const std::string& key, const std::string& value);
-
-        std::optional<std::string> get(const std::string& key);
-        std::vector<std::string> getAll();
-
-        template<typename Rep, typename Period>
-        bool expire(const std::string& key, std::chrono::duration<Rep, Period> ttl) {
-            std::lock_guard<std::recursive_mutex> lock(mutex);
-            if (store.find(key) == store.end()) {
-                return false;
-            }
-            store[key].expiry = get_time_() + ttl;
-            return true;
-        }
-
-        std::optional<std::chrono::seconds> getTTL(const std::string& key);
-
-        bool persist(const std::string& key);
-
-        void cleanupExpired();
-
-        void startCleanupThread(std::chrono::seconds interval);
-        void stopCleanupThread();
-
-        bool setExpiry(const std::string& key, std::chrono::seconds ttl);
-
-    private:
-        struct Entry {
-            Value value;
-            Expiry expiry;
-        };
-
-        void cleanupLoop(std::chrono::seconds interval);
-        std::chrono::system_clock::time_point get_time_() const { return time_provider_(); }
-
-        std::unordered_map<std::string, Entry> store;
-        std::recursive_mutex mutex;
-        TimeProvider time_provider_;
-        std::thread cleanup_thread_;
-        std::atomic<bool> running_;
-
-        bool isExpired(const std::string& key);
-};
-
-}
\ No newline at end of file
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include "store/collections.hpp"
+#include "store/flat_map.hpp"
+#include "store/slab_allocator.hpp"
+#include "store/timer_wheel.hpp"
+
+namespace store {
+
+// Thrown when a command meets a key holding another type of value, before
+// anything has been changed. The message is Redis' reply.
+class WrongType : public std::runtime_error {
+public:
+    WrongType() : std::runtime_error("WRONGTYPE Operation against a key holding the wrong kind of value") {}
+};
+
+class Store {
+    public:
+        // Deadlines are kept on the monotonic clock so wall clock steps
+        // never expire keys early or late.
+        using Clock = std::chrono::steady_clock;
+        using TimeProvider = std::function<Clock::time_point()>;
+        using Value = std::string;
+        using Expiry = std::optional<Clock::time_point>;
+        using KeyValue = std::pair<std::string_view, std::string_view>;
+
+        static constexpr size_t DEFAULT_SHARD_COUNT = 16;
+        // The cleanup thread wakes this often to advance pending rehashes.
+        static constexpr std::chrono::milliseconds BACKGROUND_TICK{100};
+        static constexpr size_t BACKGROUND_REHASH_SLOTS = 4096;
+
+        // Tuning for activeExpireCycle.
+        struct ActiveExpireConfig {
+            // Due keys reclaimed per shard each time its lock is taken.
+            size_t keys_per_loop = 256;
+            // Wall time one cycle may spend before yielding.
+            std::chrono::microseconds time_budget{25000};
+        };
+
+        // Named after Redis' activedefrag settings. A cycle moves values out
+        // of sparse slabs on shards whose value slabs waste more than both
+        // thresholds, so the emptied slabs can be freed.
+        struct ActiveDefragConfig {
+            bool enabled = false;
+            size_t ignore_bytes = 100 << 20;
+            // Percentage of slab bytes holding no value.
+            unsigned threshold_lower = 10;
+            // Values examined per shard each time its lock is taken.
+            size_t keys_per_loop = 256;
+            std::chrono::microseconds time_budget{25000};
+        };
+
+        // Named after Redis' maxmemory-policy settings. The volatile
+        // policies only evict keys that carry a TTL.
+        enum class EvictionPolicy {
+            NoEviction,
+            AllKeysLRU,
+            VolatileLRU,
+            AllKeysLFU,
+            VolatileLFU,
+            AllKeysRandom,
+            VolatileRandom,
+            // Soonest to expire first.
+            VolatileTTL
+        };
+
+        struct EvictionConfig {
+            // Limit on usedMemory(), in bytes; 0 means none.
+            size_t maxmemory = 0;
+            EvictionPolicy policy = EvictionPolicy::NoEviction;
+            // Keys sampled each time the eviction pool is refilled.
+            size_t samples = 5;
+            // How many more hits each step of an LFU counter takes.
+            unsigned lfu_log_factor = 10;
+            // An LFU counter drops by one for every period this long in
+            // which its key is not read.
+            std::chrono::minutes lfu_decay_time{1};
+        };
+
+        // shard_count is rounded up to a power of two.
+        Store(TimeProvider time_provider = Clock::now,
+              size_t shard_count = DEFAULT_SHARD_COUNT);
+        ~Store();
+
+        // Writes take an optional callback that runs under the lock of the
+        // shard the write changed, and only if it changed anything, so a
+        // caller logging writes from it logs those to one key in the order
+        // they were applied.
+        using OnWrite = std::function<void()>;
+
+        // SET's NX and XX.
+        enum class SetCondition { Always, IfAbsent, IfPresent };
+
+        struct SetOptions {
+            SetCondition condition = SetCondition::Always;
+            // Leave an existing key's TTL as it is rather than replacing it
+            // with expiry, which should then be unset.
+            bool keep_ttl = false;
+            // Return the value the key held.
+            bool get = false;
+        };
+
+        struct SetResult {
+            bool written = false;
+            bool created = false;
+            // The old value, if asked for and the key existed.
+            std::optional<std::string> previous;
+            // The key's TTL afterwards, if it exists.
+            Expiry expiry;
+        };
+
+        // Writes the key with one hash lookup, as Redis' SET does. Values
+        // are copied straight from the caller's bytes into the shard's
+        // slabs. Expired keys count as missing.
+        SetResult set(std::string_view key, std::string_view value, Expiry expiry, const SetOptions& options,
+                      const std::function<void(const SetResult&)>& on_write = nullptr);
+
+        // Sets the key whether it exists or not, replacing any TTL with
+        // expiry. Returns whether the key was created.
+        bool upsert(std::string_view key, std::string_view value, Expiry expiry = std::nullopt);
+        // Return whether the key was written.
+        bool setIfAbsent(std::string_view key, std::string_view value, Expiry expiry = std::nullopt);
+        bool setIfPresent(std::string_view key, std::string_view value, Expiry expiry = std::nullopt);
+
+        struct IncrementResult {
+            enum class Status {
+                Ok,
+                // The value is not an integer, or for the float version
+                // not a number.
+                NotNumber,
+                // The result would overflow, or be NaN or infinite.
+                OutOfRange
+            };
+            Status status = Status::Ok;
+            // The new value: incrementBy's number, incrementByFloat's text.
+            int64_t integer = 0;
+            std::string text;
+            // The key's TTL, which increments keep.
+            Expiry expiry;
+        };
+
+        // INCRBY: adds delta to the integer the key holds, starting from 0
+        // if it is missing. The number is kept as an int64, so this neither
+        // parses nor allocates. The key is left alone unless the status is
+        // Ok.
+        IncrementResult incrementBy(std::string_view key, int64_t delta,
+                                    const std::function<void(const IncrementResult&)>& on_write = nullptr);
+        // INCRBYFLOAT, in long double arithmetic as in Redis. The result is
+        // stored as text, or as an integer when it is a whole number.
+        IncrementResult incrementByFloat(std::string_view key, long double delta,
+                                         const std::function<void(const IncrementResult&)>& on_write = nullptr);
+
+        // Same as setIfAbsent.
+        bool add(std::string_view key, std::string_view value, Expiry expiry = std::nullopt);
+
+        bool remove(std::string_view key, const OnWrite& on_write = nullptr);
+
+        // Same as setIfPresent, clearing the TTL.
+        bool update(std::string_view key, std::string_view value);
+
+        // Throws WrongType if the key holds a collection, as do write with
+        // options.get and the increments.
+        std::optional<std::string> get(std::string_view key);
+        std::vector<std::string> getAll();
+
+        // Batch operations visit the keys shard by shard, taking each
+        // shard's lock once however many of the keys it holds. As in Redis,
+        // EXISTS-style counts include a repeated key each time, and of two
+        // pairs for one key the later wins.
+        //
+        // Reads and removals take one shard at a time; the writes lock all
+        // the shards they touch together, so no reader sees half of one.
+        std::vector<std::optional<std::string>> getMany(const std::vector<std::string_view>& keys);
+        // Removes the keys that exist and returns how many there were.
+        // on_remove gets the keys removed from each shard, under its lock.
+        size_t removeMany(const std::vector<std::string_view>& keys,
+                          const std::function<void(const std::vector<std::string_view>& removed)>& on_remove =
+                              nullptr);
+        size_t existsMany(const std::vector<std::string_view>& keys);
+        // Upserts every pair, clearing their TTLs.
+        void setMany(const std::vector<KeyValue>& pairs, const OnWrite& on_write = nullptr);
+        // Sets all of the pairs if none of the keys exists, and none of them
+        // otherwise.
+        bool setManyIfAbsent(const std::vector<KeyValue>& pairs, const OnWrite& on_write = nullptr);
+
+        // Hashes, lists, sets and sorted sets. Each lives behind a pointer
+        // in its entry's value block and starts out as one ListPack (see
+        // collections.hpp). A write creates the key if it is missing, and a
+        // collection left empty is removed. All of them throw WrongType for
+        // a key holding another type.
+        std::optional<ValueType> type(std::string_view key);
+
+        // HSET: returns how many of the fields are new.
+        size_t hashSet(std::string_view key, const std::vector<KeyValue>& pairs, const OnWrite& on_write = nullptr);
+        std::optional<std::string> hashGet(std::string_view key, std::string_view field);
+        std::vector<std::pair<std::string, std::string>> hashGetAll(std::string_view key);
+
+        // Pushes and pops, unlike the other writes, change a key differently
+        // when applied twice, so one a snapshot already holds must not be
+        // replayed over it. While a snapshot has yet to copy the key's
+        // shard, a list write hands on_write the whole list to log instead.
+        struct ListWrite {
+            bool whole = false;
+            // The list's payload, or empty if the write removed it.
+            Value payload;
+            Expiry expiry;
+        };
+        using OnListWrite = std::function<void(const ListWrite& write)>;
+
+        // LPUSH and RPUSH: pushes the values one after another, so LPUSH
+        // leaves the last of them first. Returns the new length.
+        size_t listPush(std::string_view key, const std::vector<std::string_view>& values, bool front,
+                        const OnListWrite& on_write = nullptr);
+        // Up to count elements from one end, or nullopt if the key is
+        // missing.
+        std::optional<std::vector<std::string>> listPop(std::string_view key, size_t count, bool front,
+                                                        const OnListWrite& on_write = nullptr);
+        // Elements start to stop inclusive; negative indexes count from the
+        // end, and the range is clipped to the list, as in LRANGE.
+        std::vector<std::string> listRange(std::string_view key, int64_t start, int64_t stop);
+
+        // SADD: returns how many of the members are new.
+        size_t setAdd(std::string_view key, const std::vector<std::string_view>& members,
+                      const OnWrite& on_write = nullptr);
+        bool setIsMember(std::string_view key, std::string_view member);
+
+        using ScoredMember = ZSetValue::ScoredMember;
+        // ZADD: sets each member's score and returns how many are new.
+        size_t zsetAdd(std::string_view key, const std::vector<std::pair<double, std::string_view>>& items,
+                       const OnWrite& on_write = nullptr);
+        // Members by rank, lowest score first, with LRANGE's indexing.
+        std::vector<ScoredMember> zsetRange(std::string_view key, int64_t start, int64_t stop);
+
+        // Sets a key from what snapshot visited: the value of a string, or
+        // a collection's payload. Returns false if the payload is
+        // malformed.
+        bool restore(std::string_view key, ValueType type, std::string_view value, Expiry expiry = std::nullopt);
+
+        using SnapshotVisitor =
+            std::function<void(const std::string& key, ValueType type, const Value& value, Expiry expiry)>;
+        // Calls visit with every live key, passing collections as their
+        // payload (see collectionPayload). Each shard is copied under its
+        // shared lock and visited after the lock is released, so writers are
+        // held off only while one shard is copied, never by visit itself.
+        // on_start runs before the first copy, once every shard is marked
+        // as waiting for one (see ListWrite); a write logged before it
+        // returns is in the snapshot.
+        void snapshot(const SnapshotVisitor& visit, const std::function<void()>& on_start = nullptr);
+
+        template<typename Rep, typename Period>
+        bool expire(std::string_view key, std::chrono::duration<Rep, Period> ttl) {
+            return setExpiryAt(key, get_time_() +
+                std::chrono::duration_cast<Clock::duration>(ttl));
+        }
+
+        // Expires the key at a wall clock time, which may be in the past.
+        bool expireAt(std::string_view key, std::chrono::system_clock::time_point when,
+                      const OnWrite& on_write = nullptr);
+
+        // Deadline for a TTL starting now, for add. The deadline must fit
+        // Clock, so callers bound ttl first.
+        template<typename Rep, typename Period>
+        Clock::time_point deadlineIn(std::chrono::duration<Rep, Period> ttl) const {
+            return get_time_() + std::chrono::duration_cast<Clock::duration>(ttl);
+        }
+
+        // Converts between deadlines and wall clock times, for persisting
+        // TTLs across restarts.
+        Clock::time_point deadlineAt(std::chrono::system_clock::time_point when) const;
+        std::chrono::system_clock::time_point wallClockAt(Clock::time_point deadline) const;
+
+        // nullopt if the key has no TTL or is missing; exists tells which.
+        // getTTL rounds to the nearest second.
+        std::optional<std::chrono::seconds> getTTL(std::string_view key);
+        std::optional<std::chrono::seconds> getTTL(std::string_view key, bool& exists);
+        std::optional<std::chrono::milliseconds> getPTTL(std::string_view key);
+        std::optional<std::chrono::milliseconds> getPTTL(std::string_view key, bool& exists);
+
+        bool persist(std::string_view key, const OnWrite& on_write = nullptr);
+
+        // Scans every key. Kept for explicit full sweeps; the background
+        // thread uses activeExpireCycle instead.
+        void cleanupExpired();
+
+        // Advances each shard's timer wheel and reclaims the keys that came
+        // due, within the configured time budget. Returns the number of keys
+        // reclaimed. Meant to be driven from a single thread.
+        size_t activeExpireCycle();
+
+        void setActiveExpireConfig(const ActiveExpireConfig& config) { expire_config_ = config; }
+
+        // While loading, no key reads as expired, as in Redis: a log
+        // replayed after a TTL passed must still apply the PERSIST or write
+        // that came before it. Expired keys are reclaimed once it ends.
+        void setLoading(bool loading) { loading_.store(loading, std::memory_order_relaxed); }
+
+        // Relocates values out of sparse slabs on fragmented shards, within
+        // the configured time budget; the background thread runs it when
+        // enabled. Returns the number of values moved.
+        size_t activeDefragCycle();
+        void setActiveDefragConfig(const ActiveDefragConfig& config) { defrag_config_ = config; }
+        const ActiveDefragConfig& activeDefragConfig() const { return defrag_config_; }
+        // Whether a cycle is relocating values now or ran out of time part
+        // way through a shard, which the next cycle resumes.
+        bool activeDefragRunning() const { return defrag_running_.load(std::memory_order_relaxed); }
+        // Values moved, and values examined but left in place.
+        uint64_t defragHits() const { return defrag_hits_.load(std::memory_order_relaxed); }
+        uint64_t defragMisses() const { return defrag_misses_.load(std::memory_order_relaxed); }
+
+        // Set before the store is shared between threads.
+        void setEvictionConfig(const EvictionConfig& config) { eviction_config_ = config; }
+        const EvictionConfig& evictionConfig() const { return eviction_config_; }
+        static std::optional<EvictionPolicy> parseEvictionPolicy(const std::string& name);
+        static const char* evictionPolicyName(EvictionPolicy policy);
+
+        // Evicts keys by the configured policy until usedMemory() is within
+        // maxmemory, passing each evicted key to on_evict. Returns false if
+        // memory is still over the limit because the policy is noeviction
+        // or nothing it may evict is left. Meant to run before writes.
+        bool evictIfNeeded(const std::function<void(const std::string& key)>& on_evict = nullptr);
+        uint64_t evictedCount() const { return evicted_keys_.load(std::memory_order_relaxed); }
+
+        // A key's LFU counter and time since its last read, as the eviction
+        // policies see them; nullopt for missing keys or when the policy
+        // keeps the other kind of stamp.
+        std::optional<uint8_t> accessFrequency(std::string_view key);
+        std::optional<std::chrono::milliseconds> idleTime(std::string_view key);
+
+        // The background thread runs an expire cycle and a rehash step on
+        // every tick.
+        void startCleanupThread(std::chrono::milliseconds tick = BACKGROUND_TICK);
+        void stopCleanupThread();
+
+        bool setExpiry(std::string_view key, std::chrono::seconds ttl);
+
+        size_t shardCount() const { return shard_mask_ + 1; }
+
+        // Entries held, including expired ones not reclaimed yet.
+        size_t size();
+        // Entries that carry a TTL.
+        size_t volatileCount();
+        uint64_t expiredCount() const { return expired_keys_.load(std::memory_order_relaxed); }
+
+        // Memory held by the keyspace, in allocator-sized bytes.
+        struct MemoryStats {
+            // Keys and values.
+            size_t dataset = 0;
+            // Hash table and timer arrays.
+            size_t overhead = 0;
+            // Highest used() seen by the background thread or a call to
+            // memoryStats().
+            size_t peak = 0;
+            // used() of each shard.
+            std::vector<size_t> shards;
+            // Bytes of value slabs holding no value. Not part of used(),
+            // like allocator fragmentation in Redis, so evicting a key
+            // always lowers used().
+            size_t slab_free = 0;
+            size_t slab_active = 0;
+
+            size_t used() const { return dataset + overhead; }
+        };
+        // Reads counters the shards keep up to date, without taking locks.
+        MemoryStats memoryStats();
+        size_t usedMemory() const;
+
+    private:
+        // An entry's last access for the eviction policies: a millisecond
+        // clock for LRU, or for LFU a Morris counter in the low 8 bits and
+        // the minute it was last decayed in the 16 above, as in Redis.
+        // Readers update it under the shared lock, hence the atomic; it
+        // moves with its entry like a plain integer.
+        struct AccessStamp {
+            std::atomic<uint32_t> value{0};
+
+            AccessStamp() = default;
+            AccessStamp(const AccessStamp& other) : value(other.load()) {}
+            AccessStamp& operator=(const AccessStamp& other) {
+                store(other.load());
+                return *this;
+            }
+            uint32_t load() const { return value.load(std::memory_order_relaxed); }
+            void store(uint32_t stamp) { value.store(stamp, std::memory_order_relaxed); }
+        };
+
+        // Tags on a value block whose inline bytes hold an int64 rather than
+        // its decimal text (see storeValue), or a Collection*.
+        static constexpr uint8_t INTEGER_TAG = 1;
+        static constexpr uint8_t COLLECTION_TAG = 2;
+
+        struct Entry {
+            // Allocated from the shard's slabs, which the store frees
+            // explicitly; the map only moves it around. May be tagged.
+            SlabAllocator::Block value;
+            Expiry expiry;
+            // Scheduled in the shard's timers while expiry is set.
+            TimerWheel::Handle timer = TimerWheel::NONE;
+            // Fits in the padding after timer.
+            AccessStamp access;
+        };
+
+        // A candidate for eviction; higher scores go first.
+        struct PoolEntry {
+            uint64_t score = 0;
+            size_t shard = 0;
+            std::string key;
+        };
+        // Candidates kept between evictions, as in Redis.
+        static constexpr size_t EVICTION_POOL_SIZE = 16;
+        static constexpr uint8_t LFU_INIT_VAL = 5;
+
+        // Each shard owns a slice of the keyspace and its own lock. Readers
+        // share the lock. Only the batch writes hold more than one shard
+        // lock at a time, and they take them in index order.
+        struct alignas(64) Shard {
+            std::shared_mutex mutex;
+            SlabAllocator values;
+            FlatMap<Entry> map;
+            // One timer per key that carries a TTL.
+            TimerWheel timers;
+            // Heap bytes of the keys and values, including the timers'
+            // copies of keys, and of the map and timer arrays. Written
+            // under the unique lock, read without it.
+            std::atomic<size_t> data_bytes{0};
+            std::atomic<size_t> table_bytes{0};
+            // Where the next defrag cycle resumes scanning the map.
+            size_t defrag_cursor = 0;
+            // Snapshots that have yet to copy the shard. Changed under the
+            // shared lock, so it holds still for a writer.
+            std::atomic<unsigned> copies_pending{0};
+        };
+
+        void cleanupLoop(std::chrono::milliseconds tick);
+        void rehashIdleShards();
+        bool setExpiryAt(std::string_view key, Clock::time_point when, const OnWrite& on_write = nullptr);
+        void setEntryExpiry(Shard& shard, FlatMap<Entry>::Slot& slot, Expiry expiry);
+        void untrackExpiry(Shard& shard, Entry& entry);
+        Clock::time_point get_time_() const { return time_provider_(); }
+
+        size_t shardIndex(std::string_view key) const;
+        Shard& shardFor(std::string_view key) { return shards_[shardIndex(key)]; }
+        // (shard, position) for every key, ordered by shard and then by
+        // position.
+        std::vector<std::pair<size_t, size_t>> groupByShard(const std::vector<std::string_view>& keys) const;
+        // Takes the unique lock of each shard named in order, lowest index
+        // first.
+        std::vector<std::unique_lock<std::shared_mutex>> lockShards(
+            const std::vector<std::pair<size_t, size_t>>& order);
+        // Looks key up for a read-modify-write, inserting it if missing.
+        // exists says whether it holds a live value; an expired one is
+        // cleared for reuse. before gets the entry's bytes, for account.
+        FlatMap<Entry>::Slot* claim(Shard& shard, std::string_view key, Clock::time_point now, bool& exists,
+                                    size_t& before);
+        // Looks key up for a change to an existing entry. An expired entry
+        // is reclaimed and reads as missing. Caller holds the unique lock.
+        FlatMap<Entry>::Slot* findLive(Shard& shard, std::string_view key, Clock::time_point now);
+        // Replaces an entry's value, as an integer when it is one in
+        // canonical form. Caller holds the lock and accounts for it.
+        void storeValue(Shard& shard, Entry& entry, std::string_view value);
+        void storeInteger(Shard& shard, Entry& entry, int64_t value);
+        static int64_t integerOf(const Entry& entry);
+        static Collection* collectionOf(const Entry& entry);
+        // Frees whatever the entry's value holds. Caller holds the lock and
+        // accounts for it.
+        void releaseValue(Shard& shard, Entry& entry);
+        // The collection a write goes to, created if the key is missing.
+        // slot and before are as for claim.
+        Collection* claimCollection(Shard& shard, std::string_view key, ValueType type, Clock::time_point now,
+                                    FlatMap<Entry>::Slot*& slot, size_t& before);
+        // The live collection a read looks at, or nullptr.
+        const Collection* findCollection(Shard& shard, std::string_view key, ValueType type,
+                                         Clock::time_point now);
+        // Calls on_write for a list write; slot is null if it removed the
+        // key. Caller holds the unique lock.
+        void listWritten(Shard& shard, const FlatMap<Entry>::Slot* slot, const OnListWrite& on_write);
+        // The value as a client sees it.
+        static std::string valueText(const Entry& entry);
+        SetResult write(Shard& shard, std::string_view key, std::string_view value, Expiry expiry,
+                        const SetOptions& options, Clock::time_point now);
+        bool isExpired(const Entry& entry, Clock::time_point now) const;
+        void eraseEntry(Shard& shard, FlatMap<Entry>::Slot* slot);
+        bool defragShard(Shard& shard, const std::chrono::steady_clock::time_point& deadline,
+                         size_t& moved);
+        size_t entryBytes(const Shard& shard, const FlatMap<Entry>::Slot& slot) const;
+        void account(Shard& shard, size_t before, size_t after);
+        void updatePeak(size_t used);
+        void initAccess(Entry& entry, Clock::time_point now) const;
+        void touch(Entry& entry, Clock::time_point now) const;
+        uint8_t lfuCounter(uint32_t stamp, Clock::time_point now) const;
+        uint64_t evictionScore(const Shard& shard, const FlatMap<Entry>::Slot& slot,
+                               TimerWheel::Handle timer, Clock::time_point now) const;
+        void refillEvictionPool();
+        void addCandidate(uint64_t score, size_t shard, const std::string& key);
+        bool evictOne(const std::function<void(const std::string& key)>& on_evict);
+        bool evictKey(size_t shard_index, const std::string& key,
+                      const std::function<void(const std::string& key)>& on_evict);
+        uint64_t nextRandom();
+
+        std::unique_ptr<Shard[]> shards_;
+        size_t shard_mask_;
+        TimeProvider time_provider_;
+        std::thread cleanup_thread_;
+        std::atomic<bool> running_;
+        ActiveExpireConfig expire_config_;
+        size_t expire_cursor_ = 0;
+        std::atomic<uint64_t> expired_keys_{0};
+        std::atomic<bool> loading_{false};
+        std::atomic<size_t> peak_bytes_{0};
+
+        ActiveDefragConfig defrag_config_;
+        size_t defrag_shard_ = 0;
+        std::atomic<bool> defrag_running_{false};
+        std::atomic<uint64_t> defrag_hits_{0};
+        std::atomic<uint64_t> defrag_misses_{0};
+
+        EvictionConfig eviction_config_;
+        // Serializes evictions; guards the pool and the random state.
+        std::mutex eviction_mutex_;
+        // Sorted by score, best candidate last.
+        std::vector<PoolEntry> eviction_pool_;
+        uint64_t random_state_ = 0x9e3779b97f4a7c15ULL;
+        std::atomic<uint64_t> evicted_keys_{0};
+};
+
+}
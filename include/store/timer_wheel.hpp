@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace store {
+
+// Hashed hierarchical timing wheel over millisecond ticks. Level L has 64
+// slots, each covering 64^L ticks; a timer lives on the lowest level whose
+// span reaches its deadline and drops a level each time the wheel below it
+// wraps into its slot. Scheduling and cancelling are O(1), and advancing
+// jumps straight between occupied slots.
+//
+// Timers that come due are moved onto a due list rather than fired, so the
+// owner can drain them in batches of its choosing. A due timer stays
+// scheduled until it is cancelled.
+class TimerWheel {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle NONE = UINT32_MAX;
+
+    TimerWheel();
+
+    // now seeds the wheel's clock when it holds no timers; otherwise the
+    // wheel keeps counting from its last advance.
+    Handle schedule(std::string_view key, uint64_t deadline, uint64_t now);
+    void reschedule(Handle handle, uint64_t deadline);
+    void cancel(Handle handle);
+
+    // Moves every timer with a deadline at or before now onto the due list.
+    void advance(uint64_t now);
+
+    // Any due timer, or NONE.
+    Handle nextDue() const { return heads_[DUE_LIST]; }
+
+    // Picks a scheduled timer for random sampling from a random number: the
+    // first one at or after a position derived from it. NONE if empty.
+    Handle sample(uint64_t random) const;
+
+    const std::string& key(Handle handle) const { return nodes_[handle].key; }
+    uint64_t deadline(Handle handle) const { return nodes_[handle].deadline; }
+    uint64_t now() const { return current_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // Bytes held by the node array. Heap memory owned by keys is not
+    // included.
+    size_t tableBytes() const { return nodes_.capacity() * sizeof(Node); }
+
+private:
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr unsigned LEVELS = 6;
+    // Ticks the top level can see; later deadlines are parked in its
+    // furthest slot and placed again when it comes round.
+    static constexpr uint64_t HORIZON = uint64_t{1} << (LEVELS * SLOT_BITS);
+    static constexpr unsigned DUE_LIST = LEVELS * SLOTS;
+    // List of nodes on the free list.
+    static constexpr uint16_t FREE_LIST = UINT16_MAX;
+
+    struct Node {
+        std::string key;
+        uint64_t deadline = 0;
+        Handle prev = NONE;
+        // Next node in the same list, or the next free node.
+        Handle next = NONE;
+        uint16_t list = 0;
+    };
+
+    void place(Handle handle);
+    void link(Handle handle, unsigned list);
+    void unlink(Handle handle);
+    void cascade(unsigned level);
+    void expireSlot(unsigned slot);
+    uint64_t nextEvent() const;
+
+    std::vector<Node> nodes_;
+    Handle free_ = NONE;
+    // Heads of every slot's list followed by the due list.
+    std::array<Handle, DUE_LIST + 1> heads_;
+    // Bit s of occupied_[L] is set while slot s of level L is non-empty.
+    std::array<uint64_t, LEVELS> occupied_{};
+    uint64_t current_ = 0;
+    size_t size_ = 0;
+};
+
+}
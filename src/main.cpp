@@ -1,13 +1,94 @@
-#include "server/server.hpp"
-#include <iostream>
-
-int main() {
-    try {
-        server::Server server("127.0.0.1", 6379);
-        server.start();
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << std::endl;
-        return 1;
-    }
-    return 0;
+#include "server/logger.hpp"
+#include "server/server.hpp"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <optional>
+#include <string>
+
+namespace {
+
+// Redis-style sizes: plain bytes or with a k, kb, m, mb, g or gb suffix.
+std::optional<size_t> parseMemory(const std::string& text) {
+    size_t digits = 0;
+    while (digits < text.size() && std::isdigit(static_cast<unsigned char>(text[digits]))) {
+        ++digits;
+    }
+    if (digits == 0) return std::nullopt;
+    std::string unit = text.substr(digits);
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::tolower);
+    size_t scale = 1;
+    if (unit == "k") scale = 1000;
+    else if (unit == "kb") scale = 1024;
+    else if (unit == "m") scale = 1000 * 1000;
+    else if (unit == "mb") scale = 1024 * 1024;
+    else if (unit == "g") scale = 1000 * 1000 * 1000;
+    else if (unit == "gb") scale = 1024 * 1024 * 1024;
+    else if (!unit.empty()) return std::nullopt;
+    return std::stoull(text.substr(0, digits)) * scale;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    server::Server::Config config;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::optional<server::AOFManager::FsyncPolicy> policy;
+        std::optional<store::Store::EvictionPolicy> eviction;
+        std::optional<size_t> memory;
+        std::optional<server::LogLevel> level;
+        if (arg == "--threads" && i + 1 < argc) {
+            config.io_threads = std::stoul(argv[++i]);
+        } else if (arg == "--appendfsync" && i + 1 < argc &&
+                   (policy = server::AOFManager::parsePolicy(argv[++i]))) {
+            config.appendfsync = *policy;
+        } else if (arg == "--slowlog-log-slower-than" && i + 1 < argc) {
+            config.slowlog_log_slower_than = std::stoll(argv[++i]);
+        } else if (arg == "--slowlog-max-len" && i + 1 < argc) {
+            config.slowlog_max_len = std::stoul(argv[++i]);
+        } else if (arg == "--latency-monitor-threshold" && i + 1 < argc) {
+            config.latency_monitor_threshold = std::stoull(argv[++i]);
+        } else if (arg == "--maxmemory" && i + 1 < argc && (memory = parseMemory(argv[++i]))) {
+            config.maxmemory = *memory;
+        } else if (arg == "--maxmemory-policy" && i + 1 < argc &&
+                   (eviction = store::Store::parseEvictionPolicy(argv[++i]))) {
+            config.maxmemory_policy = *eviction;
+        } else if (arg == "--maxmemory-samples" && i + 1 < argc) {
+            config.maxmemory_samples = std::stoul(argv[++i]);
+        } else if (arg == "--activedefrag" && i + 1 < argc) {
+            config.activedefrag = std::string(argv[++i]) == "yes";
+        } else if (arg == "--active-defrag-ignore-bytes" && i + 1 < argc && (memory = parseMemory(argv[++i]))) {
+            config.active_defrag_ignore_bytes = *memory;
+        } else if (arg == "--active-defrag-threshold-lower" && i + 1 < argc) {
+            config.active_defrag_threshold_lower = std::stoul(argv[++i]);
+        } else if (arg == "--loglevel" && i + 1 < argc &&
+                   (level = server::Logger::parseLevel(argv[++i]))) {
+            server::Logger::instance().setLevel(*level);
+        } else if (arg == "--logfile" && i + 1 < argc) {
+            if (!server::Logger::instance().setFile(argv[++i])) {
+                std::cerr << "Cannot open log file " << argv[i] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--threads N] [--appendfsync always|everysec|no]"
+                      << " [--slowlog-log-slower-than USEC] [--slowlog-max-len N]"
+                      << " [--latency-monitor-threshold MSEC]"
+                      << " [--maxmemory BYTES] [--maxmemory-policy POLICY] [--maxmemory-samples N]"
+                      << " [--activedefrag yes|no] [--active-defrag-ignore-bytes BYTES]"
+                      << " [--active-defrag-threshold-lower PERCENT]"
+                      << " [--loglevel debug|verbose|notice|warning] [--logfile PATH]" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        server::Server server(config);
+        server.start();
+    } catch (const std::exception& e) {
+        SERVER_LOG(Warning, "Error: ", e.what());
+        return 1;
+    }
+    return 0;
 }
\ No newline at end of file
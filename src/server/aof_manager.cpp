@@ -1,186 +1,949 @@
-#include "server/aof_manager.hpp"
-#include "server/resp.hpp"
-#include "server/metrics.hpp"
-#include <iostream>
-
-namespace server {
-    AOFManager::AOFManager(const std::string& aof_file_path) : aof_file_path_(aof_file_path) {
-        aof_file_.open(aof_file_path_, std::ios::out | std::ios::app | std::ios::binary);
-        if (!aof_file_.is_open()) {
-            std::cerr << "Failed to open AOF file: " << aof_file_path_ << std::endl;
-            throw std::runtime_error("Failed to open AOF file");
-        }
-    }
-
-    AOFManager::~AOFManager() {
-        if (aof_file_.is_open()) {
-            aof_file_.close();
-        }
-    }
-
-    bool AOFManager::logSet(const std::string& key, const std::string& value) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        try {
-            if (!aof_file_.is_open()) {
-                std::cerr << "AOF file is not open" << std::endl;
-                return false;
-            }
-
-            std::string command = "*3\r\n$3\r\nSET\r\n$" + 
-                std::to_string(key.length()) + "\r\n" + key + "\r\n$" +
-                std::to_string(value.length()) + "\r\n" + value + "\r\n";
-            
-            aof_file_ << command;
-            if (!aof_file_.good()) {
-                std::cerr << "Error writing to AOF file" << std::endl;
-                return false;
-            }
-            
-            aof_file_.flush();
-            if (!aof_file_.good()) {
-                std::cerr << "Error flushing AOF file" << std::endl;
-                return false;
-            }
-            
-            Metrics::getInstance().incrementAOFWrites();
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error in logSet: " << e.what() << std::endl;
-            return false;
-        }
-    }
-
-    bool AOFManager::logDel(const std::string& key) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        try {
-            if (!aof_file_.is_open()) {
-                std::cerr << "AOF file is not open" << std::endl;
-                return false;
-            }
-
-            std::string command = "*2\r\n$3\r\nDEL\r\n$" + 
-                std::to_string(key.length()) + "\r\n" + key + "\r\n";
-            
-            aof_file_ << command;
-            if (!aof_file_.good()) {
-                std::cerr << "Error writing to AOF file" << std::endl;
-                return false;
-            }
-            
-            aof_file_.flush();
-            if (!aof_file_.good()) {
-                std::cerr << "Error flushing AOF file" << std::endl;
-                return false;
-            }
-            
-            Metrics::getInstance().incrementAOFWrites();
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error in logDel: " << e.what() << std::endl;
-            return false;
-        }
-    }
-
-    bool AOFManager::logPersist(const std::string& key) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        try {
-            if (!aof_file_.is_open()) {
-                std::cerr << "AOF file is not open" << std::endl;
-                return false;
-            }
-
-            std::string command = "*2\r\n$7\r\nPERSIST\r\n$" + 
-                std::to_string(key.length()) + "\r\n" + key + "\r\n";
-            
-            aof_file_ << command;
-            if (!aof_file_.good()) {
-                std::cerr << "Error writing to AOF file" << std::endl;
-                return false;
-            }
-            
-            aof_file_.flush();
-            if (!aof_file_.good()) {
-                std::cerr << "Error flushing AOF file" << std::endl;
-                return false;
-            }
-            
-            Metrics::getInstance().incrementAOFWrites();
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error in logPersist: " << e.what() << std::endl;
-            return false;
-        }
-    }
-
-    bool AOFManager::replay(std::function<void(const std::string&, const std::string&)> onSet,
-                            std::function<void(const std::string&)> onDel,
-                            std::function<void(const std::string&)> onPersist) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!aof_file_.is_open()) {
-            return false;
-        }
-        aof_file_.close();
-        std::ifstream in_file(aof_file_path_, std::ios::binary);
-        if (!in_file.is_open()) {
-            return false;
-        }
-
-        std::string buffer;
-        char chunk[1024];
-        while (in_file.read(chunk, sizeof(chunk))) {
-            buffer.append(chunk, in_file.gcount());
-        }
-        buffer.append(chunk, in_file.gcount());
-
-        size_t pos = 0;
-        while (pos < buffer.size()) {
-            auto value = resp::Parser::parse(buffer, pos);
-            if (!value) break;
-
-            if (value->holds_alternative<resp::Array>()) {
-                const auto& array = value->get<resp::Array>();
-                if (array.empty()) continue;
-
-                if (array[0].holds_alternative<resp::BulkString>()) {
-                    const auto& cmd = array[0].get<resp::BulkString>();
-                    if (!cmd) continue;
-
-                    if (*cmd == "SET" && array.size() >= 3) {
-                        const auto& key = array[1].get<resp::BulkString>();
-                        const auto& value = array[2].get<resp::BulkString>();
-                        if (key && value) {
-                            onSet(*key, *value);
-                        }
-                    }
-                    else if (*cmd == "DEL" && array.size() >= 2) {
-                        const auto& key = array[1].get<resp::BulkString>();
-                        if (key) {
-                            onDel(*key);
-                        }
-                    }
-                    else if (*cmd == "PERSIST" && array.size() >= 2) {
-                        const auto& key = array[1].get<resp::BulkString>();
-                        if (key) {
-                            onPersist(*key);
-                        }
-                    }
-                }
-            }
-        }
-
-        in_file.close();
-        aof_file_.open(aof_file_path_, std::ios::out | std::ios::app | std::ios::binary);
-        return true;
-    }
-
-    bool AOFManager::writeCommand(const std::string& command) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!aof_file_.is_open()) {
-            return false;
-        }
-        
-        aof_file_ << command;
-        aof_file_.flush();
-        return true;
-    }
-}
\ No newline at end of file
+#include "server/aof_manager.hpp"
+#include "server/resp.hpp"
+#include "server/metrics.hpp"
+#include "server/checksum.hpp"
+#include "server/latency_monitor.hpp"
+#include "server/logger.hpp"
+#include "server/snapshot_manager.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <vector>
+#include <future>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace server {
+namespace {
+
+bool parseInteger(std::string_view text, int64_t& value) {
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return ec == std::errc() && end == text.data() + text.size();
+}
+
+// Elements per command when a collection is written out as commands, as
+// Redis' AOF_REWRITE_ITEMS_PER_CMD.
+constexpr size_t REWRITE_ITEMS_PER_COMMAND = 64;
+
+// Passes fn the commands that rebuild a collection from its payload, with
+// arguments viewing key and payload. False if the payload is malformed.
+template<typename F>
+bool forEachCollectionCommand(std::string_view key, store::ValueType type, std::string_view payload, F&& fn) {
+    const auto pack = store::ListPack::fromData(payload);
+    if (!pack) return false;
+    // Views into the copy, moved over to the same bytes of payload.
+    auto element = [&](size_t offset) {
+        const std::string_view copy = pack->at(offset);
+        return payload.substr(static_cast<size_t>(copy.data() - pack->data().data()), copy.size());
+    };
+    const char* name = type == store::ValueType::Hash ? "HSET"
+                     : type == store::ValueType::List ? "RPUSH"
+                     : type == store::ValueType::Set ? "SADD" : "ZADD";
+    const size_t width = type == store::ValueType::Hash || type == store::ValueType::ZSet ? 2 : 1;
+    std::vector<std::string_view> args;
+    size_t offset = pack->begin();
+    while (offset != pack->end()) {
+        args.assign({name, key});
+        for (size_t items = 0; items < REWRITE_ITEMS_PER_COMMAND && offset != pack->end(); ++items) {
+            if (width == 1) {
+                args.push_back(element(offset));
+                offset = pack->next(offset);
+                continue;
+            }
+            const size_t second = pack->next(offset);
+            if (second == pack->end()) return false;
+            // Payloads hold a member before its score; ZADD wants it after.
+            if (type == store::ValueType::ZSet) {
+                args.push_back(element(second));
+                args.push_back(element(offset));
+            } else {
+                args.push_back(element(offset));
+                args.push_back(element(second));
+            }
+            offset = pack->next(second);
+        }
+        fn(args);
+    }
+    return true;
+}
+
+// Applies replayed commands, partitioned by key hash across worker threads
+// so each key's commands still run in log order. Commands hold views into
+// the mapped file, which stay valid until the next drain.
+class ReplayApplier {
+public:
+    struct Command {
+        enum class Kind { Set, Del, Persist, ExpireAt, Other };
+        Kind kind;
+        std::string_view key;
+        std::string_view value;
+        int64_t expire_at = 0;
+        // The whole command, for Other.
+        std::vector<std::string_view> args{};
+    };
+
+    ReplayApplier(size_t threads, AOFManager::SetHandler on_set, AOFManager::KeyHandler on_del,
+                  AOFManager::KeyHandler on_persist, AOFManager::ExpireAtHandler on_expire_at,
+                  AOFManager::CommandHandler on_command)
+        : on_set_(std::move(on_set)), on_del_(std::move(on_del)), on_persist_(std::move(on_persist))
+        , on_expire_at_(std::move(on_expire_at)), on_command_(std::move(on_command))
+        , workers_(threads > 1 ? threads : 0) {
+        for (auto& worker : workers_) {
+            worker.thread = std::thread(&ReplayApplier::work, this, std::ref(worker));
+        }
+    }
+
+    ~ReplayApplier() {
+        for (auto& worker : workers_) {
+            {
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.stopping = true;
+            }
+            worker.ready.notify_one();
+            worker.thread.join();
+        }
+    }
+
+    void add(const std::vector<std::string_view>& args) {
+        int64_t expire_at;
+        if (args[0] == "SET" && args.size() >= 3) {
+            add({Command::Kind::Set, args[1], args[2]});
+            if (args.size() == 5 && args[3] == "PXAT" && parseInteger(args[4], expire_at)) {
+                add({Command::Kind::ExpireAt, args[1], {}, expire_at});
+            }
+        } else if (args[0] == "PEXPIREAT" && args.size() >= 3 && parseInteger(args[2], expire_at)) {
+            add({Command::Kind::ExpireAt, args[1], {}, expire_at});
+        } else if (args[0] == "MSET" && args.size() % 2 == 1) {
+            for (size_t i = 1; i < args.size(); i += 2) {
+                add({Command::Kind::Set, args[i], args[i + 1]});
+            }
+        } else if (args[0] == "DEL") {
+            for (size_t i = 1; i < args.size(); ++i) {
+                add({Command::Kind::Del, args[i], {}});
+            }
+        } else if (args[0] == "PERSIST" && args.size() >= 2) {
+            add({Command::Kind::Persist, args[1], {}});
+        } else if (on_command_ && args.size() >= 2) {
+            add({Command::Kind::Other, args[1], {}, 0, args});
+        }
+    }
+
+    void add(const Command& command) {
+        if (workers_.empty()) {
+            apply(command);
+            return;
+        }
+        Worker& worker = workers_[std::hash<std::string_view>{}(command.key) % workers_.size()];
+        worker.filling.push_back(command);
+        if (worker.filling.size() >= BATCH_SIZE) {
+            hand_off(worker);
+        }
+    }
+
+    // Returns once every command added so far has been applied.
+    void drain() {
+        for (auto& worker : workers_) {
+            if (!worker.filling.empty()) {
+                hand_off(worker);
+            }
+        }
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        idle_.wait(lock, [this]() { return outstanding_ == 0; });
+    }
+
+private:
+    static constexpr size_t BATCH_SIZE = 4096;
+
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::vector<std::vector<Command>> batches;
+        std::vector<Command> filling;
+        bool stopping = false;
+    };
+
+    void apply(const Command& command) {
+        switch (command.kind) {
+        case Command::Kind::Set: on_set_(command.key, command.value); break;
+        case Command::Kind::Del: on_del_(command.key); break;
+        case Command::Kind::Persist: on_persist_(command.key); break;
+        case Command::Kind::ExpireAt: on_expire_at_(command.key, command.expire_at); break;
+        case Command::Kind::Other: on_command_(command.args); break;
+        }
+    }
+
+    void hand_off(Worker& worker) {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            ++outstanding_;
+        }
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.batches.push_back(std::move(worker.filling));
+        }
+        worker.filling.clear();
+        worker.filling.reserve(BATCH_SIZE);
+        worker.ready.notify_one();
+    }
+
+    void work(Worker& worker) {
+        std::vector<std::vector<Command>> batches;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                worker.ready.wait(lock, [&worker]() { return worker.stopping || !worker.batches.empty(); });
+                if (worker.batches.empty()) return;
+                batches.swap(worker.batches);
+            }
+            for (const auto& batch : batches) {
+                for (const auto& command : batch) {
+                    apply(command);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex_);
+                outstanding_ -= batches.size();
+            }
+            idle_.notify_all();
+            batches.clear();
+        }
+    }
+
+    AOFManager::SetHandler on_set_;
+    AOFManager::KeyHandler on_del_;
+    AOFManager::KeyHandler on_persist_;
+    AOFManager::ExpireAtHandler on_expire_at_;
+    AOFManager::CommandHandler on_command_;
+    std::vector<Worker> workers_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    size_t outstanding_ = 0;
+};
+
+}
+
+    AOFManager::AOFManager(const std::string& aof_file_path, FsyncPolicy policy)
+        : aof_file_path_(aof_file_path), policy_(policy) {
+        // Opened for reading too so position() can checksum what was written.
+        int fd = ::open(aof_file_path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            SERVER_LOG(Warning, "Failed to open AOF file: ", aof_file_path_);
+            throw std::runtime_error("Failed to open AOF file");
+        }
+        struct stat st;
+        if (::fstat(fd, &st) == 0) {
+            file_size_ = static_cast<uint64_t>(st.st_size);
+            rewrite_base_size_ = static_cast<uint64_t>(st.st_size);
+        }
+        fd_ = fd;
+        last_fsync_ = std::chrono::steady_clock::now();
+        writer_ = std::thread(&AOFManager::writerLoop, this);
+    }
+
+    AOFManager::~AOFManager() {
+        // A running rewrite needs the writer to finish, so let it complete
+        // before stopping the writer.
+        closing_ = true;
+        {
+            std::lock_guard<std::mutex> lock(rewrite_mutex_);
+            if (rewrite_thread_.joinable()) {
+                rewrite_thread_.join();
+            }
+        }
+        stopping_ = true;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            wake_.notify_one();
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        ::close(fd_);
+    }
+
+    template <typename Args>
+    static std::string encodeArgs(const Args& args) {
+        // Sized up front so a large value is copied exactly once.
+        size_t size = 16;
+        for (auto arg : args) {
+            size += arg.size() + 16;
+        }
+        std::string command;
+        command.reserve(size);
+        command += '*';
+        command += std::to_string(args.size());
+        command += "\r\n";
+        for (auto arg : args) {
+            command += '$';
+            command += std::to_string(arg.size());
+            command += "\r\n";
+            command.append(arg.data(), arg.size());
+            command += "\r\n";
+        }
+        return command;
+    }
+
+    std::string AOFManager::encodeCommand(std::initializer_list<std::string_view> args) {
+        return encodeArgs(args);
+    }
+
+    std::string AOFManager::encodeCommand(const std::vector<std::string_view>& args) {
+        return encodeArgs(args);
+    }
+
+    bool AOFManager::logSet(std::string_view key, std::string_view value, std::optional<int64_t> expire_at) {
+        try {
+            if (expire_at) {
+                return writeCommand(encodeCommand({"SET", key, value, "PXAT", std::to_string(*expire_at)}));
+            }
+            return writeCommand(encodeCommand({"SET", key, value}));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logSet: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logDel(const std::string& key) {
+        try {
+            return writeCommand(encodeCommand({"DEL", key}));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logDel: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logDel(const std::vector<std::string_view>& keys) {
+        try {
+            std::vector<std::string_view> args;
+            args.reserve(keys.size() + 1);
+            args.push_back("DEL");
+            args.insert(args.end(), keys.begin(), keys.end());
+            return writeCommand(encodeCommand(args));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logDel: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logMSet(const std::vector<std::pair<std::string_view, std::string_view>>& pairs) {
+        try {
+            std::vector<std::string_view> args;
+            args.reserve(pairs.size() * 2 + 1);
+            args.push_back("MSET");
+            for (const auto& [key, value] : pairs) {
+                args.push_back(key);
+                args.push_back(value);
+            }
+            return writeCommand(encodeCommand(args));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logMSet: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logCommand(const std::vector<std::string_view>& args) {
+        try {
+            return writeCommand(encodeCommand(args));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logCommand: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logValue(std::string_view key, store::ValueType type, std::string_view payload,
+                              std::optional<int64_t> expire_at) {
+        try {
+            std::string commands = encodeCommand({"DEL", key});
+            if (!forEachCollectionCommand(key, type, payload,
+                                          [&commands](const auto& args) { commands += encodeCommand(args); })) {
+                SERVER_LOG(Warning, "Error in logValue: malformed ", store::valueTypeName(type), " ", key);
+                return false;
+            }
+            if (expire_at && !payload.empty()) {
+                commands += encodeCommand({"PEXPIREAT", key, std::to_string(*expire_at)});
+            }
+            return writeCommand(std::move(commands));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logValue: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logPersist(const std::string& key) {
+        try {
+            return writeCommand(encodeCommand({"PERSIST", key}));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logPersist: ", e.what());
+            return false;
+        }
+    }
+
+    bool AOFManager::logExpireAt(const std::string& key, int64_t expire_at) {
+        try {
+            return writeCommand(encodeCommand({"PEXPIREAT", key, std::to_string(expire_at)}));
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in logExpireAt: ", e.what());
+            return false;
+        }
+    }
+
+    // Parses the mapped file in place and feeds commands to the applier,
+    // which may run them on several threads. Every REPLAY_WINDOW bytes the
+    // appliers are drained so the pages behind them can be dropped, which
+    // keeps the file's share of RSS bounded however large it is.
+    bool AOFManager::replay(SetHandler onSet, KeyHandler onDel, KeyHandler onPersist,
+                            ExpireAtHandler onExpireAt, size_t threads, uint64_t from,
+                            CommandHandler onCommand) {
+        if (!isEnabled()) {
+            return false;
+        }
+        int fd = ::open(aof_file_path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        if (from > size) {
+            SERVER_LOG(Warning, "AOF is shorter than the replay offset ", from);
+            ::close(fd);
+            return false;
+        }
+        if (size == from) {
+            ::close(fd);
+            return true;
+        }
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            SERVER_LOG(Warning, "Failed to map AOF file: ", std::strerror(errno));
+            return false;
+        }
+        ::madvise(map, size, MADV_SEQUENTIAL);
+
+        const char* base = static_cast<const char*>(map);
+        const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        ReplayApplier applier(threads, std::move(onSet), std::move(onDel), std::move(onPersist),
+                              std::move(onExpireAt), std::move(onCommand));
+        size_t released = from / page * page;
+        auto release = [&](size_t parsed) {
+            if (parsed - released >= REPLAY_WINDOW) {
+                applier.drain();
+                const size_t drop = parsed / page * page;
+                ::madvise(const_cast<char*>(base) + released, drop - released, MADV_DONTNEED);
+                released = drop;
+            }
+        };
+
+        // Offsets past the start are always in the RESP tail: positions are
+        // only ever taken at the end of the file.
+        size_t start = from;
+        if (start == 0 && SnapshotManager::detect(std::string_view(base, size))) {
+            using Kind = ReplayApplier::Command::Kind;
+            auto preamble = SnapshotManager::read(std::string_view(base, size),
+                [&applier](std::string_view key, store::ValueType type, std::string_view value,
+                           std::optional<int64_t> expire_at) {
+                    if (type == store::ValueType::String) {
+                        applier.add({Kind::Set, key, value});
+                    } else if (!forEachCollectionCommand(key, type, value, [&applier](const auto& args) {
+                                   applier.add(args);
+                               })) {
+                        SERVER_LOG(Warning, "Skipping malformed ", store::valueTypeName(type), " ", key);
+                        return;
+                    }
+                    if (expire_at) {
+                        applier.add({Kind::ExpireAt, key, {}, *expire_at});
+                    }
+                }, nullptr, release);
+            if (!preamble) {
+                SERVER_LOG(Warning, "Corrupt snapshot preamble in AOF");
+                applier.drain();
+                ::munmap(map, size);
+                return false;
+            }
+            start = *preamble;
+        }
+
+        const std::string_view data(base + start, size - start);
+        resp::RequestParser parser;
+        bool ok = true;
+        while (true) {
+            auto status = parser.parse(data);
+            if (status == resp::RequestParser::Status::Incomplete) {
+                if (parser.consumed() < data.size()) {
+                    SERVER_LOG(Warning, "AOF ends with a truncated command; ignoring the last ",
+                               data.size() - parser.consumed(), " bytes");
+                }
+                break;
+            }
+            if (status == resp::RequestParser::Status::Error) {
+                SERVER_LOG(Warning, "Corrupt AOF at offset ", start + parser.consumed(), ": ",
+                           parser.error());
+                ok = false;
+                break;
+            }
+            applier.add(parser.args());
+            release(start + parser.consumed());
+        }
+        applier.drain();
+        ::munmap(map, size);
+        return ok;
+    }
+
+    AOFManager::Position AOFManager::position() {
+        // Runs on the writer thread, which is the only one that writes or
+        // swaps the file, after the batch holding earlier records is out.
+        std::promise<Position> result;
+        sync([this, &result]() {
+            Position position;
+            position.offset = file_size_.load(std::memory_order_relaxed);
+            position.fence = fenceAt(fd_.load(std::memory_order_relaxed), position.offset).value_or(0);
+            result.set_value(position);
+        });
+        return result.get_future().get();
+    }
+
+    bool AOFManager::contains(const Position& position) const {
+        int fd = ::open(aof_file_path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        const bool ok = ::fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= position.offset &&
+                        fenceAt(fd, position.offset) == position.fence;
+        ::close(fd);
+        return ok;
+    }
+
+    // Checksum of the FENCE_SIZE bytes (or fewer, at the start of the file)
+    // before offset.
+    std::optional<uint32_t> AOFManager::fenceAt(int fd, uint64_t offset) {
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        std::string bytes(std::min<uint64_t>(offset, FENCE_SIZE), '\0');
+        size_t read = 0;
+        while (read < bytes.size()) {
+            ssize_t n = ::pread(fd, bytes.data() + read, bytes.size() - read,
+                                static_cast<off_t>(offset - bytes.size() + read));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return std::nullopt;
+            read += static_cast<size_t>(n);
+        }
+        return crc32c(bytes);
+    }
+
+    bool AOFManager::writeCommand(std::string command) {
+        if (!isEnabled()) {
+            SERVER_LOG(Warning, "AOF file is not open");
+            return false;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        auto* record = new Record;
+        record->data = std::move(command);
+        push(record);
+        appended_.fetch_add(1, std::memory_order_relaxed);
+        Metrics::getInstance().recordStage(Metrics::Stage::AOFAppend, std::chrono::steady_clock::now() - start);
+        return true;
+    }
+
+    void AOFManager::sync(std::function<void()> on_durable) {
+        if (!isEnabled()) {
+            on_durable();
+            return;
+        }
+        auto* record = new Record;
+        record->kind = Record::Kind::Sync;
+        record->on_durable = std::move(on_durable);
+        push(record);
+    }
+
+    void AOFManager::push(Record* record) {
+        Record* head = pending_.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!pending_.compare_exchange_weak(head, record));
+        // Pairs with the writer publishing writer_idle_ before it rechecks
+        // pending_, so either it sees this record or we see it parked.
+        if (writer_idle_.load()) {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            wake_.notify_one();
+        }
+    }
+
+    void AOFManager::writerLoop() {
+        while (true) {
+            Record* batch = pending_.exchange(nullptr, std::memory_order_acquire);
+            if (batch) {
+                commit(batch);
+                continue;
+            }
+            if (batch_records_ > 0) {
+                // A failed write is retried after each wait, and before
+                // that whenever new records arrive.
+                flushBatch();
+                releaseHeld();
+            }
+            if (dirty_ && policy_ == FsyncPolicy::EverySec &&
+                std::chrono::steady_clock::now() - last_fsync_ >= EVERYSEC_INTERVAL) {
+                fsync();
+            }
+            if (stopping_) break;
+
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            writer_idle_ = true;
+            wake_.wait_for(lock, EVERYSEC_INTERVAL, [this]() {
+                return pending_.load() != nullptr || stopping_;
+            });
+            writer_idle_ = false;
+        }
+        if (batch_records_ > 0) {
+            // Held callbacks are dropped with their records, never run.
+            SERVER_LOG(Warning, "Closing the AOF with ", batch_records_, " records that could not be written");
+        }
+        if (dirty_ && policy_ != FsyncPolicy::No) {
+            fsync();
+        }
+    }
+
+    // Commits a batch taken from the queue with as few writes as the
+    // rewrite markers in it allow (normally one), then releases any
+    // callbacks waiting on it.
+    void AOFManager::commit(Record* batch) {
+        Record* ordered = nullptr;
+        while (batch) {
+            Record* next = batch->next;
+            batch->next = ordered;
+            ordered = batch;
+            batch = next;
+        }
+
+        for (Record* record = ordered; record; record = record->next) {
+            switch (record->kind) {
+            case Record::Kind::Data:
+                if (record->data.size() >= LARGE_RECORD_SIZE) {
+                    // Write what is batched so far and take the record's
+                    // buffer rather than copying it, unless a failed write
+                    // is still waiting in the batch.
+                    if (rewrite_buffering_) {
+                        rewrite_buffer_ += record->data;
+                    }
+                    writeBatch();
+                    if (batch_buffer_.empty()) {
+                        batch_buffer_.swap(record->data);
+                    } else {
+                        batch_buffer_ += record->data;
+                    }
+                    ++batch_records_;
+                    break;
+                }
+                batch_buffer_ += record->data;
+                ++batch_records_;
+                if (rewrite_buffering_) {
+                    rewrite_buffer_ += record->data;
+                }
+                break;
+            case Record::Kind::Sync:
+                break;
+            case Record::Kind::RewriteStart:
+                rewrite_buffering_ = true;
+                rewrite_buffer_.clear();
+                break;
+            case Record::Kind::RewriteFinish:
+                // Everything before the marker belongs in the old file.
+                flushBatch();
+                last_rewrite_ok_ = finishRewrite(record->data);
+                if (last_rewrite_ok_ && batch_records_ > 0) {
+                    // What the old file could not take is in the new one:
+                    // the snapshot holds the records logged before the
+                    // rewrite started, and the rewrite buffer the rest.
+                    SERVER_LOG(Notice, "AOF rewrite recovered ", batch_records_, " unwritten records");
+                    batch_buffer_.clear();
+                    batch_records_ = 0;
+                    write_failing_ = false;
+                }
+                break;
+            }
+        }
+        flushBatch();
+
+        // Sync callbacks are acknowledgements, so they wait for every
+        // record before them; the rewrite's only waits for the swap.
+        while (ordered) {
+            Record* next = ordered->next;
+            if (ordered->kind == Record::Kind::Sync) {
+                held_.push_back(std::move(ordered->on_durable));
+            } else if (ordered->on_durable) {
+                ordered->on_durable();
+            }
+            delete ordered;
+            ordered = next;
+        }
+        releaseHeld();
+        maybeStartAutoRewrite();
+    }
+
+    void AOFManager::releaseHeld() {
+        if (batch_records_ > 0) return;
+        for (auto& on_durable : held_) {
+            on_durable();
+        }
+        held_.clear();
+    }
+
+    void AOFManager::flushBatch() {
+        if (batch_records_ == 0) return;
+        if (!writeBatch()) return;
+        if (policy_ == FsyncPolicy::Always ||
+            (policy_ == FsyncPolicy::EverySec &&
+             std::chrono::steady_clock::now() - last_fsync_ >= EVERYSEC_INTERVAL)) {
+            fsync();
+        }
+    }
+
+    // On failure the batch is kept for the next attempt. A torn tail is cut
+    // off the file so the retry appends whole records; if it cannot be,
+    // only the bytes the file is missing are retried.
+    bool AOFManager::writeBatch() {
+        if (batch_records_ == 0) return true;
+        const int fd = fd_.load(std::memory_order_relaxed);
+        const auto start = std::chrono::steady_clock::now();
+        size_t done = 0;
+        const bool written = writeAll(fd, batch_buffer_, done);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        Metrics::getInstance().recordStage(Metrics::Stage::AOFWrite, elapsed);
+        LatencyMonitor::getInstance().record("aof-write", elapsed);
+        if (!written) {
+            const auto size = static_cast<off_t>(file_size_.load(std::memory_order_relaxed));
+            if (done > 0 && ::ftruncate(fd, size) != 0) {
+                batch_buffer_.erase(0, done);
+                file_size_.fetch_add(done, std::memory_order_relaxed);
+                dirty_ = true;
+            }
+            write_failing_ = true;
+            return false;
+        }
+        if (write_failing_) {
+            SERVER_LOG(Notice, "AOF write error is solved, ", batch_records_, " pending records written");
+            write_failing_ = false;
+        }
+        Metrics::getInstance().incrementAOFWrites(batch_records_);
+        file_size_.fetch_add(batch_buffer_.size(), std::memory_order_relaxed);
+        dirty_ = true;
+        batch_buffer_.clear();
+        batch_records_ = 0;
+        return true;
+    }
+
+    // Appends the records buffered during the rewrite to the snapshot file
+    // and renames it over the log. The snapshot's descriptor becomes the
+    // live one, so nothing is lost between the rename and the next write.
+    bool AOFManager::finishRewrite(const std::string& temp_path) {
+        // Writers' records queue up behind the swap.
+        LatencyMonitor::Timer timer("aof-rewrite-swap");
+        rewrite_buffering_ = false;
+        std::string buffered;
+        buffered.swap(rewrite_buffer_);
+        // Whatever the outcome, wait for the file to grow again before the
+        // next automatic attempt.
+        rewrite_base_size_ = file_size_.load(std::memory_order_relaxed);
+        if (temp_path.empty()) {
+            return false;
+        }
+
+        int fd = ::open(temp_path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        struct stat st;
+        const bool ok = fd >= 0 && writeAll(fd, buffered) && ::fdatasync(fd) == 0 &&
+                        ::fstat(fd, &st) == 0 && ::rename(temp_path.c_str(), aof_file_path_.c_str()) == 0;
+        if (!ok) {
+            SERVER_LOG(Warning, "Error installing rewritten AOF: ", std::strerror(errno));
+            Metrics::getInstance().incrementAOFErrors();
+            if (fd >= 0) ::close(fd);
+            ::unlink(temp_path.c_str());
+            return false;
+        }
+
+        ::close(fd_.exchange(fd));
+        dirty_ = false;
+        file_size_ = static_cast<uint64_t>(st.st_size);
+        rewrite_base_size_ = static_cast<uint64_t>(st.st_size);
+        SERVER_LOG(Notice, "AOF rewrite complete: ", st.st_size, " bytes");
+        return true;
+    }
+
+    void AOFManager::setSnapshotSource(SnapshotSource source) {
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        snapshot_source_ = std::move(source);
+    }
+
+    void AOFManager::setAutoRewrite(unsigned percentage, uint64_t min_size) {
+        auto_rewrite_min_size_ = min_size;
+        auto_rewrite_percentage_ = percentage;
+    }
+
+    void AOFManager::maybeStartAutoRewrite() {
+        const unsigned percentage = auto_rewrite_percentage_.load(std::memory_order_relaxed);
+        if (percentage == 0 || rewriting_) return;
+        const uint64_t size = file_size_.load(std::memory_order_relaxed);
+        if (size < auto_rewrite_min_size_.load(std::memory_order_relaxed) ||
+            size < rewrite_base_size_ + rewrite_base_size_ * percentage / 100) {
+            return;
+        }
+        // Never wait here: the destructor holds the lock while it joins a
+        // rewrite that is waiting on this thread.
+        std::unique_lock<std::mutex> lock(rewrite_mutex_, std::try_to_lock);
+        if (lock.owns_lock() && startRewriteLocked()) {
+            SERVER_LOG(Notice, "Starting automatic AOF rewrite at ", size, " bytes");
+        }
+    }
+
+    bool AOFManager::rewrite() {
+        SnapshotSource source;
+        {
+            std::lock_guard<std::mutex> lock(rewrite_mutex_);
+            if (closing_ || !snapshot_source_) return false;
+            source = snapshot_source_;
+        }
+        if (rewriting_.exchange(true)) return false;
+        const bool ok = runRewrite(source);
+        rewriting_ = false;
+        return ok;
+    }
+
+    bool AOFManager::rewriteInBackground() {
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        return startRewriteLocked();
+    }
+
+    // Caller holds rewrite_mutex_.
+    bool AOFManager::startRewriteLocked() {
+        if (closing_ || !snapshot_source_ || rewriting_.exchange(true)) return false;
+        if (rewrite_thread_.joinable()) {
+            // Already done: it clears rewriting_ as its last step.
+            rewrite_thread_.join();
+        }
+        rewrite_thread_ = std::thread([this, source = snapshot_source_]() {
+            runRewrite(source);
+            rewriting_ = false;
+        });
+        return true;
+    }
+
+    // Writes the snapshot to a temporary file, then hands it to the writer
+    // to append the records buffered meanwhile and swap it in. Buffering
+    // starts when the source starts reading keys, or at the first key if
+    // it never says.
+    bool AOFManager::runRewrite(const SnapshotSource& source) {
+        bool started = false;
+        const auto start = [&]() {
+            if (started) return;
+            started = true;
+            auto* marker = new Record;
+            marker->kind = Record::Kind::RewriteStart;
+            push(marker);
+        };
+
+        const std::string temp_path = aof_file_path_ + ".rewrite";
+        int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0;
+        if (ok && rewrite_preamble_) {
+            ok = SnapshotManager::write(fd, source, [&start]() {
+                start();
+                return Position{};
+            });
+        } else if (ok) {
+            std::string chunk;
+            try {
+                source([&](const std::string& key, store::ValueType type, const std::string& value,
+                           std::optional<int64_t> expire_at) {
+                    start();
+                    if (!ok) return;
+                    if (type == store::ValueType::String) {
+                        chunk += expire_at
+                            ? encodeCommand({"SET", key, value, "PXAT", std::to_string(*expire_at)})
+                            : encodeCommand({"SET", key, value});
+                    } else {
+                        forEachCollectionCommand(key, type, value,
+                                                 [&chunk](const auto& args) { chunk += encodeCommand(args); });
+                        if (expire_at) {
+                            chunk += encodeCommand({"PEXPIREAT", key, std::to_string(*expire_at)});
+                        }
+                    }
+                    if (chunk.size() >= REWRITE_CHUNK_SIZE) {
+                        ok = writeAll(fd, chunk);
+                        chunk.clear();
+                    }
+                }, start);
+            } catch (const std::exception& e) {
+                SERVER_LOG(Warning, "Error in AOF rewrite: ", e.what());
+                ok = false;
+            }
+            ok = ok && writeAll(fd, chunk);
+        }
+        start();
+        if (fd >= 0) {
+            ok = ok && ::fdatasync(fd) == 0;
+            ::close(fd);
+        }
+        if (!ok) {
+            SERVER_LOG(Warning, "AOF rewrite failed: ", std::strerror(errno));
+            Metrics::getInstance().incrementAOFErrors();
+            ::unlink(temp_path.c_str());
+        }
+
+        std::promise<void> done;
+        auto* finish = new Record;
+        finish->kind = Record::Kind::RewriteFinish;
+        finish->data = ok ? temp_path : std::string();
+        finish->on_durable = [&done]() { done.set_value(); };
+        push(finish);
+        done.get_future().wait();
+        return ok && last_rewrite_ok_;
+    }
+
+    bool AOFManager::writeAll(int fd, const std::string& data) {
+        size_t written;
+        return writeAll(fd, data, written);
+    }
+
+    bool AOFManager::writeAll(int fd, const std::string& data, size_t& written) {
+        written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                SERVER_LOG(Warning, "Error writing to AOF file: ", std::strerror(errno));
+                Metrics::getInstance().incrementAOFErrors();
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void AOFManager::fsync() {
+        const auto start = std::chrono::steady_clock::now();
+        if (::fdatasync(fd_.load(std::memory_order_relaxed)) != 0) {
+            SERVER_LOG(Warning, "Error syncing AOF file: ", std::strerror(errno));
+            Metrics::getInstance().incrementAOFErrors();
+        }
+        dirty_ = false;
+        last_fsync_ = std::chrono::steady_clock::now();
+        Metrics::getInstance().recordStage(Metrics::Stage::AOFFsync, last_fsync_ - start);
+        LatencyMonitor::getInstance().record("aof-fsync", last_fsync_ - start);
+    }
+
+    std::optional<AOFManager::FsyncPolicy> AOFManager::parsePolicy(const std::string& name) {
+        if (name == "always") return FsyncPolicy::Always;
+        if (name == "everysec") return FsyncPolicy::EverySec;
+        if (name == "no") return FsyncPolicy::No;
+        return std::nullopt;
+    }
+}
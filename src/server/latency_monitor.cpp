@@ -0,0 +1,73 @@
+#include "server/latency_monitor.hpp"
+#include <algorithm>
+
+namespace server {
+
+void LatencyMonitor::record(const char* event, std::chrono::nanoseconds duration) {
+    const int64_t threshold = threshold_ms_.load(std::memory_order_relaxed);
+    if (threshold <= 0) return;
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    if (ms < threshold) return;
+
+    const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const auto latency = static_cast<uint64_t>(ms);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = events_.find(std::string_view(event));
+    if (it == events_.end()) {
+        it = events_.emplace(event, Event{}).first;
+    }
+    Event& stats = it->second;
+    stats.max_ms = std::max(stats.max_ms, latency);
+    if (stats.size > 0) {
+        Sample& last = stats.samples[(stats.next + HISTORY_LENGTH - 1) % HISTORY_LENGTH];
+        if (last.time == now) {
+            last.latency_ms = std::max(last.latency_ms, latency);
+            return;
+        }
+    }
+    stats.samples[stats.next] = Sample{now, latency};
+    stats.next = (stats.next + 1) % HISTORY_LENGTH;
+    stats.size = std::min(stats.size + 1, HISTORY_LENGTH);
+}
+
+std::vector<LatencyMonitor::EventStats> LatencyMonitor::latest() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<EventStats> result;
+    result.reserve(events_.size());
+    for (const auto& [name, stats] : events_) {
+        const Sample& last = stats.samples[(stats.next + HISTORY_LENGTH - 1) % HISTORY_LENGTH];
+        result.push_back(EventStats{name, last, stats.max_ms});
+    }
+    return result;
+}
+
+std::vector<LatencyMonitor::Sample> LatencyMonitor::history(const std::string& event) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Sample> result;
+    auto it = events_.find(event);
+    if (it == events_.end()) return result;
+    const Event& stats = it->second;
+    result.reserve(stats.size);
+    for (size_t i = 0; i < stats.size; ++i) {
+        result.push_back(stats.samples[(stats.next + HISTORY_LENGTH - stats.size + i) % HISTORY_LENGTH]);
+    }
+    return result;
+}
+
+size_t LatencyMonitor::reset(const std::vector<std::string>& events) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (events.empty()) {
+        const size_t count = events_.size();
+        events_.clear();
+        return count;
+    }
+    size_t count = 0;
+    for (const auto& event : events) {
+        count += events_.erase(event);
+    }
+    return count;
+}
+
+}
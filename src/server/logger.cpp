@@ -0,0 +1,159 @@
+#include "server/logger.hpp"
+#include <ctime>
+#include <unistd.h>
+
+namespace server {
+namespace {
+
+// Redis marks each line with its level.
+char levelMark(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return '.';
+        case LogLevel::Verbose: return '-';
+        case LogLevel::Notice: return '*';
+        case LogLevel::Warning: return '#';
+    }
+    return '?';
+}
+
+// "pid:M 17 Oct 2026 09:30:00.123 * text\n", as Redis writes it.
+void appendLine(std::string& buffer, int64_t time, LogLevel level, std::string_view text) {
+    const std::time_t seconds = static_cast<std::time_t>(time / 1'000'000);
+    std::tm local;
+    ::localtime_r(&seconds, &local);
+    char stamp[64];
+    const size_t length = std::strftime(stamp, sizeof(stamp), "%d %b %Y %H:%M:%S", &local);
+    char prefix[96];
+    const int written = std::snprintf(prefix, sizeof(prefix), "%d:M %.*s.%03d %c ",
+                                      static_cast<int>(::getpid()), static_cast<int>(length), stamp,
+                                      static_cast<int>(time / 1000 % 1000), levelMark(level));
+    buffer.append(prefix, static_cast<size_t>(std::max(written, 0)));
+    buffer.append(text.data(), text.size());
+    buffer += '\n';
+}
+
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : slots_(new Slot[RING_SIZE])
+{
+    for (size_t i = 0; i < RING_SIZE; ++i) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    thread_ = std::thread([this]() { run(); });
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    if (out_ != stdout) {
+        std::fclose(out_);
+    }
+}
+
+std::optional<LogLevel> Logger::parseLevel(std::string_view name) {
+    if (name == "debug") return LogLevel::Debug;
+    if (name == "verbose") return LogLevel::Verbose;
+    if (name == "notice") return LogLevel::Notice;
+    if (name == "warning") return LogLevel::Warning;
+    return std::nullopt;
+}
+
+bool Logger::setFile(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "a");
+    if (file == nullptr) return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (out_ != stdout) {
+        std::fclose(out_);
+    }
+    out_ = file;
+    return true;
+}
+
+// The enqueue half of Vyukov's bounded queue: many threads race for
+// positions with a CAS, and a slot's sequence says whether the reader is
+// done with it.
+Logger::Slot* Logger::claim(uint64_t& position) {
+    position = write_position_.load(std::memory_order_relaxed);
+    for (;;) {
+        Slot& slot = slots_[position & RING_MASK];
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        const int64_t lag = static_cast<int64_t>(sequence - position);
+        if (lag == 0) {
+            if (write_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return &slot;
+            }
+        } else if (lag < 0) {
+            // The reader has yet to take the line written a lap ago.
+            return nullptr;
+        } else {
+            position = write_position_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::flush() {
+    const uint64_t target = write_position_.load(std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++flush_requests_;
+    wake_.notify_one();
+    flushed_.wait(lock, [&]() { return read_position_.load(std::memory_order_relaxed) >= target; });
+}
+
+void Logger::run() {
+    std::string buffer;
+    uint64_t flushes_seen = 0;
+    for (;;) {
+        const size_t lines = drain(buffer);
+        std::unique_lock<std::mutex> lock(mutex_);
+        flushed_.notify_all();
+        if (lines > 0) continue;
+        if (stopping_) return;
+        // Nothing wakes the writer for an ordinary line, so logging never
+        // makes a system call; it picks lines up within IDLE_WAIT.
+        wake_.wait_for(lock, IDLE_WAIT, [&]() { return stopping_ || flush_requests_ != flushes_seen; });
+        flushes_seen = flush_requests_;
+    }
+}
+
+size_t Logger::drain(std::string& buffer) {
+    buffer.clear();
+    uint64_t position = read_position_.load(std::memory_order_relaxed);
+    size_t lines = 0;
+    const uint64_t drops = dropped_.load(std::memory_order_relaxed);
+    if (drops != reported_drops_) {
+        appendLine(buffer, std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count(),
+                   LogLevel::Warning,
+                   std::to_string(drops - reported_drops_) + " log lines dropped: the log ring was full");
+        reported_drops_ = drops;
+    }
+    // At most a ring's worth, so busy producers cannot keep the writer
+    // from getting to the output.
+    while (lines < RING_SIZE) {
+        Slot& slot = slots_[position & RING_MASK];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) break;
+        appendLine(buffer, slot.time, slot.level, std::string_view(slot.text, slot.length));
+        slot.sequence.store(position + RING_SIZE, std::memory_order_release);
+        ++position;
+        ++lines;
+    }
+    if (!buffer.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::fwrite(buffer.data(), 1, buffer.size(), out_);
+        std::fflush(out_);
+    }
+    read_position_.store(position, std::memory_order_release);
+    return lines;
+}
+
+}
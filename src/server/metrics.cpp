@@ -1,148 +1,263 @@
-#include "server/metrics.hpp"
-#include <sstream>
-#include <iostream>
-
-namespace server {
-void Metrics::incrementCommand(const std::string& command) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (command == "SET") {
-        set_commands++;
-    } else if (command == "GET") {
-        get_commands++;
-    } else if (command == "DEL") {
-        del_commands++;
-    } else if (command == "PERSIST") {
-        persist_commands++;
-    } else if (command == "EXPIRE") {
-        expire_commands++;
-    } else if (command == "TTL") {
-        ttl_commands++;
-    }
-}
-
-uint64_t Metrics::getCommandCount(const std::string& command) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (command == "SET") {
-        return set_commands;
-    } else if (command == "GET") {
-        return get_commands;
-    } else if (command == "DEL") {
-        return del_commands;
-    } else if (command == "PERSIST") {
-        return persist_commands;
-    } else if (command == "EXPIRE") {
-        return expire_commands;
-    } else if (command == "TTL") {
-        return ttl_commands;
-    }
-    return 0;
-}
-
-void Metrics::updateMemoryUsage(int64_t bytes) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::cout << "\n=== Metrics::updateMemoryUsage called ===" << std::endl;
-    std::cout << "Current total memory: " << total_memory_bytes << " bytes" << std::endl;
-    std::cout << "Requested change: " << bytes << " bytes" << std::endl;
-    std::cout.flush();
-
-    if (bytes < 0) {
-        if (static_cast<uint64_t>(-bytes) > total_memory_bytes) {
-            std::cout << "Memory underflow detected, resetting to 0" << std::endl;
-            std::cout.flush();
-            total_memory_bytes = 0;
-        } else {
-            total_memory_bytes -= static_cast<uint64_t>(-bytes);
-            std::cout << "Removed memory usage: " << -bytes << " bytes" << std::endl;
-            std::cout << "New total: " << total_memory_bytes << " bytes" << std::endl;
-            std::cout.flush();
-        }
-    } else {
-        total_memory_bytes += static_cast<uint64_t>(bytes);
-        std::cout << "Added memory usage: " << bytes << " bytes" << std::endl;
-        std::cout << "New total: " << total_memory_bytes << " bytes" << std::endl;
-        std::cout.flush();
-    }
-    std::cout << "=== Metrics::updateMemoryUsage completed ===\n" << std::endl;
-    std::cout.flush();
-}
-
-size_t Metrics::getMemoryUsage() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::cout << "Metrics::getMemoryUsage called, returning " << total_memory_bytes << " bytes" << std::endl;
-    std::cout.flush();
-    return total_memory_bytes;
-}
-
-void Metrics::incrementConnections() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    total_connections++;
-    active_connections++;
-}
-
-void Metrics::decrementConnections() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_connections > 0) {
-        active_connections--;
-    }
-}
-
-uint64_t Metrics::getActiveConnections() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return active_connections;
-}
-
-void Metrics::incrementAOFWrites() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    aof_writes++;
-}
-
-void Metrics::incrementAOFErrors() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    aof_errors++;
-}
-
-uint64_t Metrics::getAOFErrors() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return aof_errors;
-}
-
-uint64_t Metrics::getAOFWrites() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return aof_writes;
-}
-
-std::string Metrics::getPrometheusMetrics() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::stringstream ss;
-    ss << "# HELP redis_commands_total Total number of commands processed\n";
-    ss << "# TYPE redis_commands_total counter\n";
-    ss << "redis_commands_total{command=\"set\"} " << set_commands << "\n";
-    ss << "redis_commands_total{command=\"get\"} " << get_commands << "\n";
-    ss << "redis_commands_total{command=\"del\"} " << del_commands << "\n";
-    ss << "redis_commands_total{command=\"persist\"} " << persist_commands << "\n";
-    ss << "redis_commands_total{command=\"expire\"} " << expire_commands << "\n";
-    ss << "redis_commands_total{command=\"ttl\"} " << ttl_commands << "\n\n";
-    
-    ss << "# HELP redis_memory_bytes Total memory used in bytes\n";
-    ss << "# TYPE redis_memory_bytes gauge\n";
-    ss << "redis_memory_bytes " << total_memory_bytes << "\n\n";
-    
-    ss << "# HELP redis_connections_active Current number of active connections\n";
-    ss << "# TYPE redis_connections_active gauge\n";
-    ss << "redis_connections_active " << active_connections << "\n\n";
-    
-    ss << "# HELP redis_connections_total Total number of connections since server start\n";
-    ss << "# TYPE redis_connections_total counter\n";
-    ss << "redis_connections_total " << total_connections << "\n\n";
-    
-    ss << "# HELP redis_aof_writes_total Total number of AOF writes\n";
-    ss << "# TYPE redis_aof_writes_total counter\n";
-    ss << "redis_aof_writes_total " << aof_writes << "\n\n";
-    
-    ss << "# HELP redis_aof_errors_total Total number of AOF errors\n";
-    ss << "# TYPE redis_aof_errors_total counter\n";
-    ss << "redis_aof_errors_total " << aof_errors << "\n";
-    
-    return ss.str();
-}
-}
+#include "server/metrics.hpp"
+#include <sstream>
+
+namespace server {
+namespace {
+
+uint64_t nanoseconds(std::chrono::nanoseconds duration) {
+    return duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+}
+
+// Writes one labelled series of a Prometheus histogram. Bucket bounds are
+// the histogram's powers of two, where its buckets line up exactly, from
+// about 1us to about 17s.
+void writeHistogram(std::ostream& out, const char* name, const char* label, const char* value,
+                    const LatencyHistogram::Counts& counts) {
+    const std::string labels = std::string(label) + "=\"" + value + "\"";
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    for (unsigned bits = 10; bits <= 34; ++bits) {
+        for (; bucket < LatencyHistogram::BUCKETS &&
+               LatencyHistogram::upperBound(bucket) < (uint64_t{1} << bits); ++bucket) {
+            cumulative += counts.buckets[bucket];
+        }
+        out << name << "_bucket{" << labels << ",le=\""
+            << static_cast<double>(uint64_t{1} << bits) / 1e9 << "\"} " << cumulative << "\n";
+    }
+    out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << counts.count << "\n";
+    out << name << "_sum{" << labels << "} " << static_cast<double>(counts.sum) / 1e9 << "\n";
+    out << name << "_count{" << labels << "} " << counts.count << "\n";
+}
+
+}
+
+Metrics::CommandId Metrics::commandId(std::string_view command) {
+    if (command == "SET" || command == "MSET" || command == "MSETNX") return CommandId::Set;
+    if (command == "GET" || command == "MGET") return CommandId::Get;
+    if (command == "DEL" || command == "UNLINK") return CommandId::Del;
+    if (command == "PERSIST") return CommandId::Persist;
+    if (command == "EXPIRE" || command == "PEXPIRE" || command == "EXPIREAT" || command == "PEXPIREAT") {
+        return CommandId::Expire;
+    }
+    if (command == "TTL" || command == "PTTL") return CommandId::Ttl;
+    if (command == "INCR" || command == "DECR" || command == "INCRBY" || command == "DECRBY" ||
+        command == "INCRBYFLOAT") {
+        return CommandId::Incr;
+    }
+    return CommandId::Other;
+}
+
+const char* Metrics::commandLabel(CommandId id) {
+    switch (id) {
+    case CommandId::Set: return "set";
+    case CommandId::Get: return "get";
+    case CommandId::Del: return "del";
+    case CommandId::Persist: return "persist";
+    case CommandId::Expire: return "expire";
+    case CommandId::Ttl: return "ttl";
+    case CommandId::Incr: return "incr";
+    default: return "other";
+    }
+}
+
+const char* Metrics::stageLabel(Stage stage) {
+    switch (stage) {
+    case Stage::Parse: return "parse";
+    case Stage::AOFAppend: return "aof_append";
+    case Stage::AOFWrite: return "aof_write";
+    case Stage::AOFFsync: return "aof_fsync";
+    case Stage::SocketWrite: return "socket_write";
+    default: return "unknown";
+    }
+}
+
+Metrics::Slot& Metrics::slot() {
+    thread_local const size_t index = next_slot_.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+    return slots_[index];
+}
+
+template<typename Field>
+uint64_t Metrics::sum(Field field) const {
+    uint64_t total = 0;
+    for (const auto& slot : slots_) {
+        total += (slot.*field).load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Metrics::incrementCommand(CommandId id) {
+    slot().commands[static_cast<size_t>(id)].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::getCommandCount(CommandId id) const {
+    uint64_t total = 0;
+    for (const auto& slot : slots_) {
+        total += slot.commands[static_cast<size_t>(id)].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Metrics::recordLatency(CommandId id, std::chrono::nanoseconds latency) {
+    slot().latency[static_cast<size_t>(id)].record(nanoseconds(latency));
+}
+
+LatencyHistogram::Counts Metrics::getLatency(CommandId id) const {
+    LatencyHistogram::Counts counts;
+    for (const auto& slot : slots_) {
+        slot.latency[static_cast<size_t>(id)].addTo(counts);
+    }
+    return counts;
+}
+
+void Metrics::recordStage(Stage stage, std::chrono::nanoseconds duration) {
+    slot().stages[static_cast<size_t>(stage)].record(nanoseconds(duration));
+}
+
+LatencyHistogram::Counts Metrics::getStageLatency(Stage stage) const {
+    LatencyHistogram::Counts counts;
+    for (const auto& slot : slots_) {
+        slot.stages[static_cast<size_t>(stage)].addTo(counts);
+    }
+    return counts;
+}
+
+void Metrics::setMemoryStatsSource(MemoryStatsSource source) {
+    std::lock_guard<std::mutex> lock(memory_source_mutex_);
+    memory_source_ = std::move(source);
+}
+
+// Slots hold signed deltas, so a slot may go negative when memory is freed
+// on another thread than allocated it; only the total is meaningful.
+void Metrics::updateMemoryUsage(int64_t bytes) {
+    slot().memory_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+size_t Metrics::getMemoryUsage() const {
+    {
+        std::lock_guard<std::mutex> lock(memory_source_mutex_);
+        if (memory_source_) {
+            return memory_source_().used;
+        }
+    }
+    int64_t total = 0;
+    for (const auto& slot : slots_) {
+        total += slot.memory_bytes.load(std::memory_order_relaxed);
+    }
+    return total > 0 ? static_cast<size_t>(total) : 0;
+}
+
+void Metrics::incrementConnections() {
+    slot().connections_opened.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::decrementConnections() {
+    slot().connections_closed.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::getActiveConnections() const {
+    const uint64_t closed = sum(&Slot::connections_closed);
+    const uint64_t opened = sum(&Slot::connections_opened);
+    return opened > closed ? opened - closed : 0;
+}
+
+void Metrics::incrementAOFWrites(uint64_t count) {
+    slot().aof_writes.fetch_add(count, std::memory_order_relaxed);
+}
+
+void Metrics::incrementAOFErrors() {
+    slot().aof_errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::getAOFErrors() const {
+    return sum(&Slot::aof_errors);
+}
+
+uint64_t Metrics::getAOFWrites() const {
+    return sum(&Slot::aof_writes);
+}
+
+std::string Metrics::getPrometheusMetrics() const {
+    std::stringstream ss;
+    ss << "# HELP redis_commands_total Total number of commands processed\n";
+    ss << "# TYPE redis_commands_total counter\n";
+    for (size_t i = 0; i < COMMAND_IDS; ++i) {
+        const auto id = static_cast<CommandId>(i);
+        if (id == CommandId::Other) continue;
+        ss << "redis_commands_total{command=\"" << commandLabel(id) << "\"} " << getCommandCount(id) << "\n";
+    }
+    ss << "\n";
+
+    ss << "# HELP redis_command_duration_seconds Time spent executing commands\n";
+    ss << "# TYPE redis_command_duration_seconds histogram\n";
+    for (size_t i = 0; i < COMMAND_IDS; ++i) {
+        const auto id = static_cast<CommandId>(i);
+        writeHistogram(ss, "redis_command_duration_seconds", "command", commandLabel(id), getLatency(id));
+    }
+    ss << "\n";
+
+    ss << "# HELP redis_stage_duration_seconds Time spent in each stage of serving requests\n";
+    ss << "# TYPE redis_stage_duration_seconds histogram\n";
+    for (size_t i = 0; i < STAGES; ++i) {
+        const auto stage = static_cast<Stage>(i);
+        writeHistogram(ss, "redis_stage_duration_seconds", "stage", stageLabel(stage), getStageLatency(stage));
+    }
+    ss << "\n";
+
+    std::unique_lock<std::mutex> memory_lock(memory_source_mutex_);
+    if (memory_source_) {
+        const MemoryStats memory = memory_source_();
+        memory_lock.unlock();
+        ss << "# HELP redis_memory_bytes Total memory used in bytes\n";
+        ss << "# TYPE redis_memory_bytes gauge\n";
+        ss << "redis_memory_bytes " << memory.used << "\n\n";
+
+        ss << "# HELP redis_memory_peak_bytes Highest memory used in bytes\n";
+        ss << "# TYPE redis_memory_peak_bytes gauge\n";
+        ss << "redis_memory_peak_bytes " << memory.peak << "\n\n";
+
+        ss << "# HELP redis_memory_rss_bytes Resident set size of the process in bytes\n";
+        ss << "# TYPE redis_memory_rss_bytes gauge\n";
+        ss << "redis_memory_rss_bytes " << memory.rss << "\n\n";
+
+        ss << "# HELP redis_memory_fragmentation_ratio Resident set size over memory used\n";
+        ss << "# TYPE redis_memory_fragmentation_ratio gauge\n";
+        ss << "redis_memory_fragmentation_ratio "
+           << (memory.used ? static_cast<double>(memory.rss) / static_cast<double>(memory.used) : 0.0)
+           << "\n\n";
+
+        ss << "# HELP redis_memory_shard_bytes Memory used by each shard of the keyspace in bytes\n";
+        ss << "# TYPE redis_memory_shard_bytes gauge\n";
+        for (size_t i = 0; i < memory.shards.size(); ++i) {
+            ss << "redis_memory_shard_bytes{shard=\"" << i << "\"} " << memory.shards[i] << "\n";
+        }
+        ss << "\n";
+
+        ss << "# HELP redis_evicted_keys_total Keys evicted to stay within maxmemory\n";
+        ss << "# TYPE redis_evicted_keys_total counter\n";
+        ss << "redis_evicted_keys_total " << memory.evicted_keys << "\n\n";
+    } else {
+        memory_lock.unlock();
+        ss << "# HELP redis_memory_bytes Total memory used in bytes\n";
+        ss << "# TYPE redis_memory_bytes gauge\n";
+        ss << "redis_memory_bytes " << getMemoryUsage() << "\n\n";
+    }
+
+    ss << "# HELP redis_connections_active Current number of active connections\n";
+    ss << "# TYPE redis_connections_active gauge\n";
+    ss << "redis_connections_active " << getActiveConnections() << "\n\n";
+
+    ss << "# HELP redis_connections_total Total number of connections since server start\n";
+    ss << "# TYPE redis_connections_total counter\n";
+    ss << "redis_connections_total " << sum(&Slot::connections_opened) << "\n\n";
+
+    ss << "# HELP redis_aof_writes_total Total number of AOF writes\n";
+    ss << "# TYPE redis_aof_writes_total counter\n";
+    ss << "redis_aof_writes_total " << getAOFWrites() << "\n\n";
+
+    ss << "# HELP redis_aof_errors_total Total number of AOF errors\n";
+    ss << "# TYPE redis_aof_errors_total counter\n";
+    ss << "redis_aof_errors_total " << getAOFErrors() << "\n";
+
+    return ss.str();
+}
+}
@@ -1,167 +1,294 @@
-#include "server/resp.hpp"
-#include <stdexcept>
-#include <iostream>
-
-namespace server {
-namespace resp {
-    static std::optional<Value> parse(const std::string& input, size_t& pos);
-
-    std::optional<Value> Parser::parse(const std::string& input) {
-        size_t pos = 0;
-        return Parser::parse(input, pos);
-    }
-
-    std::optional<Value> Parser::parse(const std::string& input, size_t& pos) {
-        if (pos >= input.size()) return std::nullopt;
-        static const size_t MAX_PARSE_DEPTH = 100;
-        static thread_local size_t parse_depth = 0;
-        
-        if (++parse_depth > MAX_PARSE_DEPTH) {
-            parse_depth = 0;
-            return std::nullopt;
-        }
-        
-        char type = input[pos];
-        std::optional<Value> result;
-        
-        try {
-            if (type == '+') {
-                result = Parser::parseSimpleString(input, pos);
-            } else if (type == '-') {
-                result = Parser::parseError(input, pos);
-            } else if (type == ':') {
-                result = Parser::parseInteger(input, pos);
-            } else if (type == '$') {
-                result = Parser::parseBulkString(input, pos);
-            } else if (type == '*') {
-                result = Parser::parseArray(input, pos);
-            }
-        } catch (const std::exception& e) {
-            parse_depth = 0;
-            return std::nullopt;
-        }
-        
-        parse_depth = 0;
-        return result;
-    }
-
-    std::optional<Value> Parser::parseSimpleString(const std::string& input, size_t& pos) {
-        size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) return std::nullopt;
-        std::string result = input.substr(pos + 1, end - pos - 1);
-        pos = end + 2;
-        std::cout << "[RESP] SimpleString: '" << result << "'\n";
-        return Value(SimpleString(result));
-    }
-
-    std::optional<Value> Parser::parseError(const std::string& input, size_t& pos) {
-        size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) return std::nullopt;
-        std::string result = input.substr(pos + 1, end - pos - 1);
-        pos = end + 2;
-        std::cout << "[RESP] Error: '" << result << "'\n";
-        return Value(Error(result));
-    }
-
-    std::optional<Value> Parser::parseInteger(const std::string& input, size_t& pos) {
-        size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) return std::nullopt;
-        std::string numStr = input.substr(pos + 1, end - pos - 1);
-        pos = end + 2;
-        std::cout << "[RESP] Integer: '" << numStr << "'\n";
-        return Value(Integer(std::stoll(numStr)));
-    }
-
-    std::optional<Value> Parser::parseBulkString(const std::string& input, size_t& pos) {
-        size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) {
-            std::cout << "[RESP] BulkString: waiting for length delimiter\n";
-            return std::nullopt;
-        }
-        
-        std::string length_str = input.substr(pos + 1, end - pos - 1);
-        std::cout << "[RESP] BulkString: length_str='" << length_str << "'\n";
-        int length = std::stoi(length_str);
-        pos = end + 2;
-        
-        if (length == -1) {
-            std::cout << "[RESP] BulkString: null\n";
-            return Value(BulkString(std::nullopt));
-        }
-        
-        if (pos + length + 2 > input.size()) {
-            std::cout << "[RESP] BulkString: waiting for data (need " << length << " bytes)\n";
-            return std::nullopt;
-        }
-        
-        std::string result = input.substr(pos, length);
-        pos += length;
-        
-        if (pos + 2 > input.size() || input.substr(pos, 2) != "\r\n") {
-            std::cout << "[RESP] BulkString: waiting for final delimiter\n";
-            return std::nullopt;
-        }
-        pos += 2;
-        
-        std::cout << "[RESP] BulkString: '" << result << "'\n";
-        return Value(BulkString(result));
-    }
-
-    std::optional<Value> Parser::parseArray(const std::string& input, size_t& pos) {
-        size_t end = input.find("\r\n", pos);
-        if (end == std::string::npos) {
-            std::cout << "[RESP] Array: waiting for length delimiter\n";
-            return std::nullopt;
-        }
-        
-        std::string length_str = input.substr(pos + 1, end - pos - 1);
-        std::cout << "[RESP] Array: length_str='" << length_str << "'\n";
-        int count = std::stoi(length_str);
-        pos = end + 2;
-        std::cout << "[RESP] Array: count=" << count << " pos=" << pos << "\n";
-        
-        Array result;
-        for (int i = 0; i < count; i++) {   
-            if (pos >= input.size()) {
-                std::cout << "[RESP] Array: waiting for element " << i << " type\n";
-                return std::nullopt;
-            }
-                    
-            auto element = parse(input, pos);
-            if (!element) {
-                std::cout << "[RESP] Array: failed to parse element " << i << "\n";
-                return std::nullopt;
-            }
-            result.push_back(*element);
-        }
-        
-        return Value(result);
-    }
-
-    std::string Parser::serialize(const Value& value) {
-        try {
-            if (value.holds_alternative<SimpleString>()) {
-                return "+" + value.get<SimpleString>().value + "\r\n";
-            } else if (value.holds_alternative<Error>()) {
-                return "-" + value.get<Error>().value + "\r\n";
-            } else if (value.holds_alternative<Integer>()) {
-                return ":" + std::to_string(value.get<Integer>()) + "\r\n";
-            } else if (value.holds_alternative<BulkString>()) {
-                const auto& bulk = value.get<BulkString>();
-                if (!bulk) return "$-1\r\n";
-                return "$" + std::to_string(bulk->length()) + "\r\n" + *bulk + "\r\n";
-            } else if (value.holds_alternative<Array>()) {
-                const auto& array = value.get<Array>();
-                std::string result = "*" + std::to_string(array.size()) + "\r\n";
-                for (const auto& element : array) {
-                    result += serialize(element);
-                }
-                return result;
-            }
-            return "";
-        } catch (const std::exception& e) {
-            return "-ERR Internal error\r\n";
-        }
-    }
-}
-}
\ No newline at end of file
+#include "server/resp.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+namespace server {
+namespace resp {
+    static std::optional<Value> parse(const std::string& input, size_t& pos);
+
+    std::optional<Value> Parser::parse(const std::string& input) {
+        size_t pos = 0;
+        return Parser::parse(input, pos);
+    }
+
+    std::optional<Value> Parser::parse(const std::string& input, size_t& pos) {
+        if (pos >= input.size()) return std::nullopt;
+        static const size_t MAX_PARSE_DEPTH = 100;
+        static thread_local size_t parse_depth = 0;
+        
+        if (++parse_depth > MAX_PARSE_DEPTH) {
+            parse_depth = 0;
+            return std::nullopt;
+        }
+        
+        char type = input[pos];
+        std::optional<Value> result;
+        
+        try {
+            if (type == '+') {
+                result = Parser::parseSimpleString(input, pos);
+            } else if (type == '-') {
+                result = Parser::parseError(input, pos);
+            } else if (type == ':') {
+                result = Parser::parseInteger(input, pos);
+            } else if (type == '$') {
+                result = Parser::parseBulkString(input, pos);
+            } else if (type == '*') {
+                result = Parser::parseArray(input, pos);
+            }
+        } catch (const std::exception& e) {
+            parse_depth = 0;
+            return std::nullopt;
+        }
+        
+        parse_depth = 0;
+        return result;
+    }
+
+    std::optional<Value> Parser::parseSimpleString(const std::string& input, size_t& pos) {
+        size_t end = input.find("\r\n", pos);
+        if (end == std::string::npos) return std::nullopt;
+        std::string result = input.substr(pos + 1, end - pos - 1);
+        pos = end + 2;
+        return Value(SimpleString(result));
+    }
+
+    std::optional<Value> Parser::parseError(const std::string& input, size_t& pos) {
+        size_t end = input.find("\r\n", pos);
+        if (end == std::string::npos) return std::nullopt;
+        std::string result = input.substr(pos + 1, end - pos - 1);
+        pos = end + 2;
+        return Value(Error(result));
+    }
+
+    std::optional<Value> Parser::parseInteger(const std::string& input, size_t& pos) {
+        size_t end = input.find("\r\n", pos);
+        if (end == std::string::npos) return std::nullopt;
+        std::string numStr = input.substr(pos + 1, end - pos - 1);
+        pos = end + 2;
+        return Value(Integer(std::stoll(numStr)));
+    }
+
+    std::optional<Value> Parser::parseBulkString(const std::string& input, size_t& pos) {
+        size_t end = input.find("\r\n", pos);
+        if (end == std::string::npos) {
+            return std::nullopt;
+        }
+        
+        std::string length_str = input.substr(pos + 1, end - pos - 1);
+        int length = std::stoi(length_str);
+        pos = end + 2;
+        
+        if (length == -1) {
+            return Value(BulkString(std::nullopt));
+        }
+        
+        if (pos + length + 2 > input.size()) {
+            return std::nullopt;
+        }
+        
+        std::string result = input.substr(pos, length);
+        pos += length;
+        
+        if (pos + 2 > input.size() || input.substr(pos, 2) != "\r\n") {
+            return std::nullopt;
+        }
+        pos += 2;
+        
+        return Value(BulkString(result));
+    }
+
+    std::optional<Value> Parser::parseArray(const std::string& input, size_t& pos) {
+        size_t end = input.find("\r\n", pos);
+        if (end == std::string::npos) {
+            return std::nullopt;
+        }
+        
+        std::string length_str = input.substr(pos + 1, end - pos - 1);
+        int count = std::stoi(length_str);
+        pos = end + 2;
+        
+        Array result;
+        for (int i = 0; i < count; i++) {   
+            if (pos >= input.size()) {
+                return std::nullopt;
+            }
+                    
+            auto element = parse(input, pos);
+            if (!element) {
+                return std::nullopt;
+            }
+            result.push_back(*element);
+        }
+        
+        return Value(result);
+    }
+
+    std::string Parser::serialize(const Value& value) {
+        try {
+            if (value.holds_alternative<SimpleString>()) {
+                return "+" + value.get<SimpleString>().value + "\r\n";
+            } else if (value.holds_alternative<Error>()) {
+                return "-" + value.get<Error>().value + "\r\n";
+            } else if (value.holds_alternative<Integer>()) {
+                return ":" + std::to_string(value.get<Integer>()) + "\r\n";
+            } else if (value.holds_alternative<BulkString>()) {
+                const auto& bulk = value.get<BulkString>();
+                if (!bulk) return "$-1\r\n";
+                return "$" + std::to_string(bulk->length()) + "\r\n" + *bulk + "\r\n";
+            } else if (value.holds_alternative<Array>()) {
+                const auto& array = value.get<Array>();
+                std::string result = "*" + std::to_string(array.size()) + "\r\n";
+                for (const auto& element : array) {
+                    result += serialize(element);
+                }
+                return result;
+            }
+            return "";
+        } catch (const std::exception& e) {
+            return "-ERR Internal error\r\n";
+        }
+    }
+
+    void Parser::serialize(Value&& value, std::vector<std::string>& out) {
+        std::string pending;
+        serializeInto(std::move(value), pending, out);
+        if (!pending.empty()) {
+            out.push_back(std::move(pending));
+        }
+    }
+
+    // pending collects the encoding since the last entry pushed to out.
+    void Parser::serializeInto(Value&& value, std::string& pending, std::vector<std::string>& out) {
+        if (value.holds_alternative<BulkString>()) {
+            auto& bulk = value.get<BulkString>();
+            if (bulk && bulk->size() >= MOVE_THRESHOLD) {
+                pending += '$';
+                pending += std::to_string(bulk->size());
+                pending += "\r\n";
+                out.push_back(std::move(pending));
+                out.push_back(std::move(*bulk));
+                pending = "\r\n";
+                return;
+            }
+            if (bulk) {
+                pending += '$';
+                pending += std::to_string(bulk->size());
+                pending += "\r\n";
+                pending += *bulk;
+                pending += "\r\n";
+                return;
+            }
+        } else if (value.holds_alternative<Array>()) {
+            auto& array = value.get<Array>();
+            pending += "*" + std::to_string(array.size()) + "\r\n";
+            for (auto& element : array) {
+                serializeInto(std::move(element), pending, out);
+            }
+            return;
+        }
+        pending += serialize(value);
+    }
+
+    RequestParser::Status RequestParser::parse(std::string_view buffer) {
+        args_.clear();
+        if (!error_.empty()) return Status::Error;
+        while (true) {
+            switch (state_) {
+            case State::ArrayHeader: {
+                int64_t count = 0;
+                Status status = readLength(buffer, '*', count);
+                if (status != Status::Complete) return status;
+                if (count < 0 || count > MAX_ARGS) return fail("invalid multibulk length");
+                remaining_ = count;
+                offsets_.clear();
+                offsets_.reserve(static_cast<size_t>(std::min<int64_t>(count, 1024)));
+                state_ = State::BulkHeader;
+                break;
+            }
+            case State::BulkHeader: {
+                if (remaining_ == 0) {
+                    for (const auto& [offset, length] : offsets_) {
+                        args_.emplace_back(buffer.data() + offset, length);
+                    }
+                    frame_start_ = pos_;
+                    state_ = State::ArrayHeader;
+                    return Status::Complete;
+                }
+                Status status = readLength(buffer, '$', bulk_length_);
+                if (status != Status::Complete) return status;
+                if (bulk_length_ < 0 || bulk_length_ > MAX_BULK_LENGTH) return fail("invalid bulk length");
+                state_ = State::BulkData;
+                break;
+            }
+            case State::BulkData: {
+                const size_t length = static_cast<size_t>(bulk_length_);
+                if (buffer.size() - pos_ < length + 2) return Status::Incomplete;
+                if (buffer[pos_ + length] != '\r' || buffer[pos_ + length + 1] != '\n') {
+                    return fail("expected CRLF after bulk string");
+                }
+                offsets_.emplace_back(pos_, length);
+                pos_ += length + 2;
+                scan_ = pos_;
+                --remaining_;
+                state_ = State::BulkHeader;
+                break;
+            }
+            }
+        }
+    }
+
+    // Reads a "<type><integer>\r\n" header at pos_. The search for CR
+    // resumes at scan_, so a header split across reads is only scanned once.
+    RequestParser::Status RequestParser::readLength(std::string_view buffer, char type, int64_t& length) {
+        static const size_t MAX_HEADER_LENGTH = 32;
+        if (pos_ >= buffer.size()) return Status::Incomplete;
+        if (buffer[pos_] != type) {
+            return fail(type == '*' ? "expected '*'" : "expected '$'");
+        }
+
+        size_t from = std::max(scan_, pos_ + 1);
+        const void* found = std::memchr(buffer.data() + from, '\r', buffer.size() - from);
+        if (!found) {
+            scan_ = buffer.size();
+            if (scan_ - pos_ > MAX_HEADER_LENGTH) return fail("header too long");
+            return Status::Incomplete;
+        }
+        size_t cr = static_cast<const char*>(found) - buffer.data();
+        scan_ = cr;
+        if (cr + 1 >= buffer.size()) return Status::Incomplete;
+        if (buffer[cr + 1] != '\n') return fail("expected CRLF after header");
+
+        const char* first = buffer.data() + pos_ + 1;
+        const char* last = buffer.data() + cr;
+        auto [ptr, ec] = std::from_chars(first, last, length);
+        if (ec != std::errc() || ptr != last || first == last) return fail("invalid length");
+
+        pos_ = cr + 2;
+        scan_ = pos_;
+        return Status::Complete;
+    }
+
+    RequestParser::Status RequestParser::fail(const char* message) {
+        error_ = message;
+        return Status::Error;
+    }
+
+    size_t RequestParser::pendingBytes(size_t buffered) const {
+        if (state_ != State::BulkData) return 0;
+        const size_t needed = pos_ + static_cast<size_t>(bulk_length_) + 2;
+        return needed > buffered ? std::min(needed - buffered, MAX_READ_AHEAD) : 0;
+    }
+
+    void RequestParser::discard(size_t n) {
+        frame_start_ -= n;
+        pos_ -= n;
+        scan_ -= n;
+        for (auto& offset : offsets_) {
+            offset.first -= n;
+        }
+    }
+}
+}
@@ -1,450 +1,919 @@
-#include "server/server.hpp"
-#include "server/aof_manager.hpp"
-#include "server/metrics.hpp"
-#include <iostream>
-
-namespace server {
-Server::Server(const std::string& host, unsigned short port)
-    : host_(host)
-    , port_(port)
-    , running_(false)
-    , io_context_()
-    , acceptor_(io_context_) 
-    , aof_manager_("redis.aof")
-{
-    boost::asio::ip::tcp::endpoint endpoint(
-        boost::asio::ip::address::from_string(host_),
-        port_
-    );
-    acceptor_.open(endpoint.protocol());
-    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-    acceptor_.bind(endpoint);
-    acceptor_.listen();
-}
-
-Server::~Server() {
-    stop();
-}
-
-void Server::start() {
-    if (running_) return;
-    running_ = true;
-    std::cout << "Starting AOF replay..." << std::endl;
-    aof_manager_.replay(
-        [this](const std::string& key, const std::string& value) {
-            std::cout << "Replaying SET command for key='" << key << "', value='" << value << "'" << std::endl;
-            store_.add(key, value);
-        },
-        [this](const std::string& key) {
-            std::cout << "Replaying DEL command for key='" << key << "'" << std::endl;
-            store_.remove(key);
-        },
-        [this](const std::string& key) {
-            std::cout << "Replaying PERSIST command for key='" << key << "'" << std::endl;
-            store_.persist(key);
-        }
-    );
-    std::cout << "AOF replay completed" << std::endl;
-    store_.startCleanupThread(std::chrono::seconds(60));
-    std::cout << "Server starting on " << host_ << ":" << port_ << std::endl;
-    accept_connections();
-    io_context_.run();
-}
-
-void Server::stop() {
-    if (!running_) return;
-    running_ = false;
-    store_.stopCleanupThread();
-    io_context_.stop();
-    for (auto& thread : threads_) {
-        if (thread.joinable()) {
-            thread.join();
-        }
-    }
-    threads_.clear();
-    std::cout << "Server stopped" << std::endl;
-}
-
-void Server::accept_connections() {
-    if (!running_) return;
-    acceptor_.async_accept(
-        [this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
-            if (!error) {
-                Metrics::getInstance().incrementConnections();
-                threads_.emplace_back(
-                    [this, socket = std::move(socket)]() mutable {
-                        handle_client(std::move(socket));
-                    }
-                );
-            }
-            accept_connections();
-        }
-    );
-}
-
-void Server::handle_client(boost::asio::ip::tcp::socket&& socket) {
-    try {
-        std::cout << "New client connected" << std::endl;
-        std::string complete_message;
-        
-        while (running_) {
-            boost::asio::streambuf buffer;
-            boost::system::error_code error;
-            socket.set_option(boost::asio::ip::tcp::socket::linger(true, 0));
-            
-            size_t bytes_read = socket.read_some(boost::asio::buffer(buffer.prepare(1024)), error);
-            if (error) {
-                if (error == boost::asio::error::eof) {
-                    std::cout << "Client disconnected normally" << std::endl;
-                    Metrics::getInstance().decrementConnections();
-                } else {
-                    std::cerr << "Error reading from socket: " << error.message() << std::endl;
-                    Metrics::getInstance().incrementAOFErrors();
-                }
-                break;
-            }
-            
-            if (bytes_read == 0) {
-                std::cout << "No data received, client might have disconnected" << std::endl;
-                Metrics::getInstance().decrementConnections();
-                break;
-            }
-            
-            buffer.commit(bytes_read);
-            std::string chunk = boost::asio::buffer_cast<const char*>(buffer.data());
-            complete_message += chunk;
-            buffer.consume(buffer.size());
-            
-            if (complete_message.size() > 1024 * 1024) {
-                std::cerr << "Message too large, disconnecting client" << std::endl;
-                Metrics::getInstance().decrementConnections();
-                break;
-            }
-            
-            size_t pos = 0;
-            auto value = resp::Parser::parse(complete_message, pos);
-            if (!value) {
-                if (complete_message.size() >= 2 && 
-                    complete_message.substr(complete_message.size() - 2) == "\r\n") {
-                    std::cout << "Failed to parse complete message" << std::endl;
-                    complete_message.clear();
-                }
-                continue;
-            }
-            
-            auto response = handleCommand(*value);
-            std::string serialized = resp::Parser::serialize(response);
-            
-            boost::asio::write(socket, boost::asio::buffer(serialized), error);
-            if (error) {
-                std::cerr << "Error writing response: " << error.message() << std::endl;
-                Metrics::getInstance().incrementAOFErrors();
-                break;
-            }
-            
-            complete_message.clear();
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error handling client: " << e.what() << std::endl;
-        Metrics::getInstance().incrementAOFErrors();
-    }
-    
-    socket.close();
-    
-    std::cout << "Client disconnected" << std::endl;
-}
-
-resp::Value Server::handleCommand(const resp::Value& command) {
-    try {
-        if (command.holds_alternative<resp::Array>()) {
-            const auto& array = command.get<resp::Array>();
-            if (array.empty()) {
-                return resp::Error{"ERR empty command"};
-            }
-            
-            std::string cmd;
-            if (array[0].holds_alternative<resp::BulkString>()) {
-                const auto& bulk = array[0].get<resp::BulkString>();
-                if (!bulk) {
-                    return resp::Error{"ERR invalid command"};
-                }
-                cmd = *bulk;
-            } else {
-                return resp::Error{"ERR invalid command"};
-            }
-            
-            std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-            
-            if (cmd == "SET") {
-                if (array.size() < 3) {
-                    return resp::Error{"ERR wrong number of arguments for SET command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-                
-                std::string value;
-                if (array[2].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[2].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid value"};
-                    }
-                    value = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid value"};
-                }
-                
-                try {
-                    std::cout << "\n=== Processing SET command ===" << std::endl;
-                    std::cout << "Key: '" << key << "'" << std::endl;
-                    std::cout << "Value: '" << value << "'" << std::endl;
-                    std::cout.flush();
-
-                    std::cout << "Calling store_.add..." << std::endl;
-                    std::cout.flush();
-                    bool add_result = store_.add(key, value);
-                    std::cout << "store_.add returned: " << (add_result ? "true" : "false") << std::endl;
-                    std::cout.flush();
-
-                    if (add_result) {
-                        std::cout << "Calling aof_manager_.logSet..." << std::endl;
-                        std::cout.flush();
-                        aof_manager_.logSet(key, value);
-                        std::cout << "Calling Metrics::incrementCommand..." << std::endl;
-                        std::cout.flush();
-                        Metrics::getInstance().incrementCommand("SET");
-                        std::cout << "=== SET command completed successfully ===\n" << std::endl;
-                        std::cout.flush();
-                        return resp::SimpleString{"OK"};
-                    } else {
-                        std::cout << "=== SET command failed: key already exists ===\n" << std::endl;
-                        std::cout.flush();
-                        return resp::Error{"ERR key already exists"};
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in SET command: " << e.what() << std::endl;
-                    std::cerr.flush();
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else if (cmd == "GET") {
-                if (array.size() != 2) {
-                    return resp::Error{"ERR wrong number of arguments for GET command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-                
-                auto value = store_.get(key);
-                if (value) {
-                    Metrics::getInstance().incrementCommand("GET");
-                    return resp::BulkString{*value};
-                } else {
-                    return resp::BulkString{std::nullopt};
-                }
-            }
-            else if (cmd == "DEL") {
-                if (array.size() != 2) {
-                    return resp::Error{"ERR wrong number of arguments for DEL command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-                
-                try {
-                    std::cout << "Attempting to delete key: " << key << std::endl;
-                    if (store_.remove(key)) {
-                        std::cout << "Successfully deleted key" << std::endl;
-                        try {
-                            if (aof_manager_.logDel(key)) {
-                                std::cout << "Successfully logged DEL to AOF" << std::endl;
-                            } else {
-                                std::cerr << "Failed to log DEL to AOF" << std::endl;
-                            }
-                        } catch (const std::exception& e) {
-                            std::cerr << "Error logging DEL to AOF: " << e.what() << std::endl;
-                        }
-                        Metrics::getInstance().incrementCommand("DEL");
-                        return resp::Integer{1};
-                    } else {
-                        std::cout << "Failed to delete key" << std::endl;
-                        return resp::Integer{0};
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in DEL command: " << e.what() << std::endl;
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else if (cmd == "PERSIST") {
-                if (array.size() != 2) {
-                    return resp::Error{"ERR wrong number of arguments for PERSIST command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-                
-                try {
-                    std::cout << "Attempting to persist key: " << key << std::endl;
-                    if (store_.persist(key)) {
-                        std::cout << "Successfully persisted key" << std::endl;
-                        try {
-                            if (aof_manager_.logPersist(key)) {
-                                std::cout << "Successfully logged PERSIST to AOF" << std::endl;
-                            } else {
-                                std::cerr << "Failed to log PERSIST to AOF" << std::endl;
-                            }
-                        } catch (const std::exception& e) {
-                            std::cerr << "Error logging PERSIST to AOF: " << e.what() << std::endl;
-                        }
-                        Metrics::getInstance().incrementCommand("PERSIST");
-                        return resp::Integer{1};
-                    } else {
-                        std::cout << "Failed to persist key" << std::endl;
-                        return resp::Integer{0};
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in PERSIST command: " << e.what() << std::endl;
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else if (cmd == "EXPIRE") {
-                if (array.size() != 3) {
-                    return resp::Error{"ERR wrong number of arguments for EXPIRE command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-
-                int64_t seconds;
-                if (array[2].holds_alternative<resp::Integer>()) {
-                    seconds = array[2].get<resp::Integer>();
-                } else if (array[2].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[2].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid seconds"};
-                    }
-                    try {
-                        seconds = std::stoll(*bulk);
-                    } catch (...) {
-                        return resp::Error{"ERR invalid seconds"};
-                    }
-                } else {
-                    return resp::Error{"ERR invalid seconds"};
-                }
-
-                if (seconds <= 0) {
-                    return resp::Error{"ERR invalid seconds"};
-                }
-                
-                try {
-                    std::cout << "Attempting to set expiry for key: " << key << " to " << seconds << " seconds" << std::endl;
-                    if (store_.setExpiry(key, std::chrono::seconds(seconds))) {
-                        std::cout << "Successfully set expiry" << std::endl;
-                        Metrics::getInstance().incrementCommand("EXPIRE");
-                        return resp::Integer{1};
-                    } else {
-                        std::cout << "Failed to set expiry" << std::endl;
-                        return resp::Integer{0};
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in EXPIRE command: " << e.what() << std::endl;
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else if (cmd == "TTL") {
-                if (array.size() != 2) {
-                    return resp::Error{"ERR wrong number of arguments for TTL command"};
-                }
-                
-                std::string key;
-                if (array[1].holds_alternative<resp::BulkString>()) {
-                    const auto& bulk = array[1].get<resp::BulkString>();
-                    if (!bulk) {
-                        return resp::Error{"ERR invalid key"};
-                    }
-                    key = *bulk;
-                } else {
-                    return resp::Error{"ERR invalid key"};
-                }
-                
-                try {
-                    std::cout << "Getting TTL for key: " << key << std::endl;
-                    auto ttl = store_.getTTL(key);
-                    if (ttl) {
-                        std::cout << "TTL: " << ttl->count() << " seconds" << std::endl;
-                        Metrics::getInstance().incrementCommand("TTL");
-                        return resp::Integer{static_cast<int64_t>(ttl->count())};
-                    } else {
-                        std::cout << "No TTL set for key" << std::endl;
-                        return resp::Integer{-1};
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in TTL command: " << e.what() << std::endl;
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else if (cmd == "METRICS") {
-                if (array.size() != 1) {
-                    return resp::Error{"ERR wrong number of arguments for METRICS command"};
-                }
-                
-                try {
-                    std::string metrics = Metrics::getInstance().getPrometheusMetrics();
-                    return resp::BulkString{metrics};
-                } catch (const std::exception& e) {
-                    std::cerr << "Error getting metrics: " << e.what() << std::endl;
-                    return resp::Error{"ERR internal error"};
-                }
-            }
-            else {
-                return resp::Error{"ERR unknown command"};
-            }
-        }
-        return resp::Error{"ERR invalid command"};
-    } catch (const std::exception& e) {
-        std::cerr << "Error handling command: " << e.what() << std::endl;
-        return resp::Error{"ERR internal error"};
-    }
-}
-
-}
\ No newline at end of file
+#include "server/server.hpp"
+#include "server/aof_manager.hpp"
+#include "server/latency_monitor.hpp"
+#include "server/logger.hpp"
+#include "server/metrics.hpp"
+#include "server/session.hpp"
+#include "store/memory.hpp"
+#include "store/numbers.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <chrono>
+#include <iterator>
+#include <limits>
+#include <optional>
+
+namespace server {
+namespace {
+
+std::optional<int64_t> parseInteger(std::string_view text) {
+    int64_t value;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+const char* const COLLECTION_WRITES[] = {"HSET", "LPUSH", "RPUSH", "LPOP", "RPOP", "SADD", "ZADD"};
+const char* const COLLECTION_READS[] = {"TYPE", "HGET", "HGETALL", "LRANGE", "SISMEMBER", "ZRANGE"};
+
+bool isCollectionWrite(const std::string& cmd) {
+    return std::find(std::begin(COLLECTION_WRITES), std::end(COLLECTION_WRITES), cmd) != std::end(COLLECTION_WRITES);
+}
+
+bool isCollectionCommand(const std::string& cmd) {
+    return isCollectionWrite(cmd) ||
+           std::find(std::begin(COLLECTION_READS), std::end(COLLECTION_READS), cmd) != std::end(COLLECTION_READS);
+}
+
+std::string upper(std::string_view text) {
+    std::string result(text);
+    std::transform(result.begin(), result.end(), result.begin(), ::toupper);
+    return result;
+}
+
+// Longest TTL EX, PX, EXPIRE and PEXPIRE take, about 158 years. Both
+// clocks count nanoseconds in 64 bits, which runs out 292 years from their
+// epochs, so a deadline this far from now still fits either of them.
+constexpr int64_t MAX_TTL_SECONDS = 5'000'000'000;
+
+int64_t unixMillis(std::chrono::system_clock::time_point when) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(when.time_since_epoch()).count();
+}
+
+// Records the time from clock until it goes out of scope as the command's
+// latency, advancing clock to the end.
+class LatencyTimer {
+public:
+    LatencyTimer(Metrics::CommandId id, const std::vector<std::string_view>& args, SlowLog& slowlog,
+                 std::chrono::steady_clock::time_point& clock)
+        : id_(id), args_(args), slowlog_(slowlog), clock_(clock), start_(clock) {}
+    ~LatencyTimer() {
+        clock_ = std::chrono::steady_clock::now();
+        const auto elapsed = clock_ - start_;
+        Metrics::getInstance().recordLatency(id_, elapsed);
+        slowlog_.record(args_, elapsed);
+        LatencyMonitor::getInstance().record("command", elapsed);
+    }
+
+private:
+    Metrics::CommandId id_;
+    const std::vector<std::string_view>& args_;
+    SlowLog& slowlog_;
+    std::chrono::steady_clock::time_point& clock_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Byte counts as INFO shows them, e.g. 1.50M.
+std::string humanBytes(size_t bytes) {
+    static const char* const units[] = {"B", "K", "M", "G", "T"};
+    double amount = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (amount >= 1024 && unit + 1 < std::size(units)) {
+        amount /= 1024;
+        ++unit;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f%s" : "%.2f%s", amount, units[unit]);
+    return text;
+}
+
+double ratio(size_t numerator, size_t denominator) {
+    return denominator ? static_cast<double>(numerator) / static_cast<double>(denominator) : 0.0;
+}
+
+std::chrono::system_clock::time_point wallClock(int64_t unix_millis) {
+    return std::chrono::system_clock::time_point(std::chrono::milliseconds(unix_millis));
+}
+
+}
+
+Server::Server(const std::string& host, unsigned short port, size_t io_threads)
+    : Server(Config{host, port, io_threads})
+{
+}
+
+Server::Server(const Config& config)
+    : aof_manager_(config.aof_path, config.appendfsync)
+    , snapshot_manager_(config.snapshot_path, &aof_manager_)
+    , slowlog_(std::chrono::microseconds(config.slowlog_log_slower_than), config.slowlog_max_len)
+    , host_(config.host)
+    , port_(config.port)
+    , io_threads_(config.io_threads ? config.io_threads : std::max(1u, std::thread::hardware_concurrency()))
+    , running_(false)
+    , io_context_()
+    , acceptor_(io_context_)
+{
+    boost::asio::ip::tcp::endpoint endpoint(
+        boost::asio::ip::address::from_string(host_),
+        port_
+    );
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+
+    aof_manager_.setSnapshotSource(
+        [this](const AOFManager::Emit& emit, const std::function<void()>& start) { snapshot(emit, start); });
+    aof_manager_.setAutoRewrite(config.auto_aof_rewrite_percentage, config.auto_aof_rewrite_min_size);
+    aof_manager_.setRewritePreamble(config.aof_use_snapshot_preamble);
+    snapshot_manager_.setSource(
+        [this](const SnapshotManager::Emit& emit, const std::function<void()>& start) { snapshot(emit, start); });
+    store::Store::EvictionConfig eviction;
+    eviction.maxmemory = config.maxmemory;
+    eviction.policy = config.maxmemory_policy;
+    eviction.samples = config.maxmemory_samples;
+    store_.setEvictionConfig(eviction);
+    store::Store::ActiveDefragConfig defrag;
+    defrag.enabled = config.activedefrag;
+    defrag.ignore_bytes = config.active_defrag_ignore_bytes;
+    defrag.threshold_lower = config.active_defrag_threshold_lower;
+    store_.setActiveDefragConfig(defrag);
+    LatencyMonitor::getInstance().setThreshold(std::chrono::milliseconds(config.latency_monitor_threshold));
+    Metrics::getInstance().setMemoryStatsSource([this]() {
+        const auto stats = store_.memoryStats();
+        Metrics::MemoryStats memory;
+        memory.used = stats.used();
+        memory.peak = stats.peak;
+        memory.rss = store::processMemory().rss;
+        memory.shards.assign(stats.shards.begin(), stats.shards.end());
+        memory.evicted_keys = store_.evictedCount();
+        return memory;
+    });
+}
+
+Server::~Server() {
+    Metrics::getInstance().setMemoryStatsSource(nullptr);
+    stop();
+}
+
+void Server::start() {
+    if (running_) return;
+    running_ = true;
+    load();
+    store_.startCleanupThread();
+    SERVER_LOG(Notice, "Server starting on ", host_, ":", port_, " with ", io_threads_, " I/O threads");
+    accept_connections();
+    for (size_t i = 1; i < io_threads_; ++i) {
+        threads_.emplace_back([this]() { io_context_.run(); });
+    }
+    io_context_.run();
+}
+
+// Feeds AOF rewrites and snapshots, with TTLs as wall clock times.
+void Server::snapshot(const AOFManager::Emit& emit, const std::function<void()>& start) {
+    store_.snapshot([this, &emit](const std::string& key, store::ValueType type, const std::string& value,
+                                  store::Store::Expiry expiry) {
+        emit(key, type, value, expiry ? std::optional<int64_t>(unixMillis(store_.wallClockAt(*expiry)))
+                                : std::nullopt);
+    }, start);
+}
+
+// Loads the snapshot if it was taken against the current AOF, then replays
+// the log from the position the snapshot recorded. A snapshot that fails
+// part way through still leaves a state the log once passed through, so
+// replaying the whole log over it gives the right result.
+//
+// TTLs that have already passed are applied like any other, since a later
+// PERSIST in the log may still cancel them; the store is in loading mode
+// until the log is done, and the keys that remain expired are reclaimed
+// after that.
+void Server::load() {
+    store_.setLoading(true);
+    uint64_t replay_from = 0;
+    if (auto position = snapshot_manager_.logPosition()) {
+        if (!aof_manager_.contains(*position)) {
+            SERVER_LOG(Warning, "Snapshot does not match the AOF; ignoring it");
+        } else {
+            SERVER_LOG(Notice, "Loading snapshot...");
+            const bool loaded = snapshot_manager_.load(
+                [this](std::string_view key, store::ValueType type, std::string_view value,
+                       std::optional<int64_t> expire_at) {
+                    if (!store_.restore(key, type, value, expire_at
+                            ? store::Store::Expiry(store_.deadlineAt(wallClock(*expire_at))) : std::nullopt)) {
+                        SERVER_LOG(Warning, "Skipping malformed ", store::valueTypeName(type), " ", key);
+                    }
+                });
+            if (loaded) {
+                replay_from = position->offset;
+            }
+        }
+    }
+
+    SERVER_LOG(Notice, "Starting AOF replay...");
+    aof_manager_.replay(
+        [this](std::string_view key, std::string_view value) { store_.upsert(key, value); },
+        [this](std::string_view key) { store_.remove(key); },
+        [this](std::string_view key) { store_.persist(key); },
+        [this](std::string_view key, int64_t expire_at) { store_.expireAt(key, wallClock(expire_at)); },
+        io_threads_,
+        replay_from,
+        [this](const std::vector<std::string_view>& args) {
+            try {
+                handleCollectionCommand(upper(args[0]), args, false);
+            } catch (const store::WrongType&) {
+                SERVER_LOG(Warning, "Skipping ", args[0], " on ", args[1], " in the AOF: wrong type");
+            }
+        }
+    );
+    store_.setLoading(false);
+    // Keys whose TTL ran out while the server was down.
+    while (store_.activeExpireCycle() > 0) {
+    }
+    SERVER_LOG(Notice, "AOF replay completed");
+}
+
+void Server::stop() {
+    if (!running_) return;
+    running_ = false;
+    store_.stopCleanupThread();
+    io_context_.stop();
+    for (auto& thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+    SERVER_LOG(Notice, "Server stopped");
+}
+
+void Server::accept_connections() {
+    if (!running_) return;
+    acceptor_.async_accept(
+        [this](const boost::system::error_code& error, boost::asio::ip::tcp::socket socket) {
+            if (!error) {
+                Metrics::getInstance().incrementConnections();
+                std::make_shared<Session>(std::move(socket), *this)->start();
+            }
+            accept_connections();
+        }
+    );
+}
+
+resp::Value Server::handleCommand(const std::vector<std::string_view>& args,
+                                  std::chrono::steady_clock::time_point& clock) {
+    try {
+        if (args.empty()) {
+            return resp::Error{"ERR empty command"};
+        }
+        
+        std::string cmd(args[0]);
+        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+        const Metrics::CommandId id = Metrics::commandId(cmd);
+        LatencyTimer timer(id, args, slowlog_, clock);
+
+        if (cmd == "SET") {
+            if (args.size() < 3) {
+                return resp::Error{"ERR wrong number of arguments for SET command"};
+            }
+            
+            // Views into the session's read buffer, which outlives the
+            // command: the value is copied once, into the store.
+            const std::string_view key = args[1];
+            const std::string_view value = args[2];
+
+            store::Store::Expiry expiry;
+            store::Store::SetOptions options;
+            for (size_t i = 3; i < args.size(); ++i) {
+                const std::string option = upper(args[i]);
+                if (option == "NX" || option == "XX") {
+                    if (options.condition != store::Store::SetCondition::Always) {
+                        return resp::Error{"ERR syntax error"};
+                    }
+                    options.condition = option == "NX" ? store::Store::SetCondition::IfAbsent
+                                                       : store::Store::SetCondition::IfPresent;
+                    continue;
+                }
+                if (option == "GET") {
+                    options.get = true;
+                    continue;
+                }
+                if (option == "KEEPTTL") {
+                    if (expiry) {
+                        return resp::Error{"ERR syntax error"};
+                    }
+                    options.keep_ttl = true;
+                    continue;
+                }
+                if ((option != "EX" && option != "PX") || expiry || options.keep_ttl || i + 1 == args.size()) {
+                    return resp::Error{"ERR syntax error"};
+                }
+                auto amount = parseInteger(args[++i]);
+                if (!amount) {
+                    return resp::Error{"ERR value is not an integer or out of range"};
+                }
+                const int64_t limit = option == "EX" ? MAX_TTL_SECONDS : MAX_TTL_SECONDS * 1000;
+                if (*amount <= 0 || *amount > limit) {
+                    return resp::Error{"ERR invalid expire time in 'set' command"};
+                }
+                expiry = option == "EX" ? store_.deadlineIn(std::chrono::seconds(*amount))
+                                        : store_.deadlineIn(std::chrono::milliseconds(*amount));
+            }
+            
+            if (!store_.evictIfNeeded([this](const std::string& evicted) { aof_manager_.logDel(evicted); })) {
+                return resp::Error{"OOM command not allowed when used memory > 'maxmemory'."};
+            }
+
+            // Logged with the TTL the key ended up with, so KEEPTTL replays
+            // too.
+            auto result = store_.set(key, value, expiry, options,
+                [&](const store::Store::SetResult& written) {
+                    aof_manager_.logSet(key, value, written.expiry
+                        ? std::optional<int64_t>(unixMillis(store_.wallClockAt(*written.expiry))) : std::nullopt);
+                });
+            if (result.written) {
+                Metrics::getInstance().incrementCommand(id);
+            }
+            if (options.get) {
+                return resp::BulkString{std::move(result.previous)};
+            }
+            if (!result.written) {
+                return resp::BulkString{std::nullopt};
+            }
+            return resp::SimpleString{"OK"};
+        }
+        else if (cmd == "GET") {
+            if (args.size() != 2) {
+                return resp::Error{"ERR wrong number of arguments for GET command"};
+            }
+            
+            // The copy get makes is moved through to the reply, and large
+            // ones are written from where they are (see Parser::serialize).
+            auto value = store_.get(args[1]);
+            if (value) {
+                Metrics::getInstance().incrementCommand(id);
+            }
+            return resp::BulkString{std::move(value)};
+        }
+        else if (cmd == "MGET") {
+            if (args.size() < 2) {
+                return resp::Error{"ERR wrong number of arguments for MGET command"};
+            }
+
+            auto values = store_.getMany(std::vector<std::string_view>(args.begin() + 1, args.end()));
+            resp::Array reply;
+            reply.reserve(values.size());
+            for (auto& value : values) {
+                reply.emplace_back(resp::BulkString{std::move(value)});
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return reply;
+        }
+        else if (cmd == "MSET" || cmd == "MSETNX") {
+            if (args.size() < 3 || args.size() % 2 == 0) {
+                return resp::Error{"ERR wrong number of arguments for " + cmd + " command"};
+            }
+
+            std::vector<store::Store::KeyValue> pairs;
+            pairs.reserve(args.size() / 2);
+            for (size_t i = 1; i < args.size(); i += 2) {
+                pairs.emplace_back(args[i], args[i + 1]);
+            }
+
+            if (!store_.evictIfNeeded([this](const std::string& evicted) { aof_manager_.logDel(evicted); })) {
+                return resp::Error{"OOM command not allowed when used memory > 'maxmemory'."};
+            }
+
+            const auto log = [&]() { aof_manager_.logMSet(pairs); };
+            if (cmd == "MSETNX") {
+                if (!store_.setManyIfAbsent(pairs, log)) {
+                    return resp::Integer{0};
+                }
+            } else {
+                store_.setMany(pairs, log);
+            }
+            Metrics::getInstance().incrementCommand(id);
+            if (cmd == "MSETNX") {
+                return resp::Integer{1};
+            }
+            return resp::SimpleString{"OK"};
+        }
+        else if (cmd == "DEL" || cmd == "UNLINK") {
+            if (args.size() < 2) {
+                return resp::Error{"ERR wrong number of arguments for " + cmd + " command"};
+            }
+
+            // Values are freed in place either way; UNLINK is accepted for
+            // clients that use it.
+            // A DEL across shards is logged as one per shard, each under
+            // that shard's lock.
+            const std::vector<std::string_view> keys(args.begin() + 1, args.end());
+            const size_t removed = keys.size() == 1
+                ? store_.remove(keys[0], [&]() { aof_manager_.logDel(keys); })
+                : store_.removeMany(keys, [this](const std::vector<std::string_view>& shard_keys) {
+                      aof_manager_.logDel(shard_keys);
+                  });
+            if (removed == 0) {
+                return resp::Integer{0};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{static_cast<int64_t>(removed)};
+        }
+        else if (cmd == "EXISTS") {
+            if (args.size() < 2) {
+                return resp::Error{"ERR wrong number of arguments for EXISTS command"};
+            }
+
+            return resp::Integer{static_cast<int64_t>(
+                store_.existsMany(std::vector<std::string_view>(args.begin() + 1, args.end())))};
+        }
+        else if (cmd == "INCR" || cmd == "DECR" || cmd == "INCRBY" || cmd == "DECRBY") {
+            const bool by = cmd == "INCRBY" || cmd == "DECRBY";
+            if (args.size() != (by ? 3 : 2)) {
+                return resp::Error{"ERR wrong number of arguments for " + cmd + " command"};
+            }
+
+            std::optional<int64_t> delta = 1;
+            if (by) {
+                delta = parseInteger(args[2]);
+                if (!delta) {
+                    return resp::Error{"ERR value is not an integer or out of range"};
+                }
+            }
+            if (cmd[0] == 'D') {
+                if (*delta == std::numeric_limits<int64_t>::min()) {
+                    return resp::Error{"ERR decrement would overflow"};
+                }
+                delta = -*delta;
+            }
+
+            if (!store_.evictIfNeeded([this](const std::string& evicted) { aof_manager_.logDel(evicted); })) {
+                return resp::Error{"OOM command not allowed when used memory > 'maxmemory'."};
+            }
+            // Logged as the value it produced, so replay needs no arithmetic
+            // and the record can be applied more than once.
+            const auto result = store_.incrementBy(args[1], *delta,
+                [&](const store::Store::IncrementResult& written) {
+                    char text[store::INTEGER_TEXT_SIZE];
+                    aof_manager_.logSet(args[1], store::integerText(written.integer, text), written.expiry
+                        ? std::optional<int64_t>(unixMillis(store_.wallClockAt(*written.expiry))) : std::nullopt);
+                });
+            if (result.status == store::Store::IncrementResult::Status::NotNumber) {
+                return resp::Error{"ERR value is not an integer or out of range"};
+            }
+            if (result.status == store::Store::IncrementResult::Status::OutOfRange) {
+                return resp::Error{"ERR increment or decrement would overflow"};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{result.integer};
+        }
+        else if (cmd == "INCRBYFLOAT") {
+            if (args.size() != 3) {
+                return resp::Error{"ERR wrong number of arguments for INCRBYFLOAT command"};
+            }
+
+            const auto delta = store::parseLongDouble(args[2]);
+            if (!delta) {
+                return resp::Error{"ERR value is not a valid float"};
+            }
+            if (!store_.evictIfNeeded([this](const std::string& evicted) { aof_manager_.logDel(evicted); })) {
+                return resp::Error{"OOM command not allowed when used memory > 'maxmemory'."};
+            }
+            auto result = store_.incrementByFloat(args[1], *delta,
+                [&](const store::Store::IncrementResult& written) {
+                    aof_manager_.logSet(args[1], written.text, written.expiry
+                        ? std::optional<int64_t>(unixMillis(store_.wallClockAt(*written.expiry))) : std::nullopt);
+                });
+            if (result.status == store::Store::IncrementResult::Status::NotNumber) {
+                return resp::Error{"ERR value is not a valid float"};
+            }
+            if (result.status == store::Store::IncrementResult::Status::OutOfRange) {
+                return resp::Error{"ERR increment would produce NaN or Infinity"};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::BulkString{std::move(result.text)};
+        }
+        else if (isCollectionCommand(cmd)) {
+            if (isCollectionWrite(cmd) &&
+                !store_.evictIfNeeded([this](const std::string& evicted) { aof_manager_.logDel(evicted); })) {
+                return resp::Error{"OOM command not allowed when used memory > 'maxmemory'."};
+            }
+            auto reply = handleCollectionCommand(cmd, args, true);
+            if (!reply.holds_alternative<resp::Error>()) {
+                Metrics::getInstance().incrementCommand(id);
+            }
+            return reply;
+        }
+        else if (cmd == "PERSIST") {
+            if (args.size() != 2) {
+                return resp::Error{"ERR wrong number of arguments for PERSIST command"};
+            }
+            
+            if (!store_.persist(args[1], [&]() { aof_manager_.logPersist(std::string(args[1])); })) {
+                return resp::Integer{0};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{1};
+        }
+        else if (cmd == "EXPIRE") {
+            if (args.size() != 3) {
+                return resp::Error{"ERR wrong number of arguments for EXPIRE command"};
+            }
+            
+            auto seconds = parseInteger(args[2]);
+            if (!seconds || *seconds <= 0) {
+                return resp::Error{"ERR invalid seconds"};
+            }
+            if (*seconds > MAX_TTL_SECONDS) {
+                return resp::Error{"ERR invalid expire time in 'expire' command"};
+            }
+            const auto when = std::chrono::system_clock::now() + std::chrono::seconds(*seconds);
+            if (!store_.expireAt(args[1], when,
+                                 [&]() { aof_manager_.logExpireAt(std::string(args[1]), unixMillis(when)); })) {
+                return resp::Integer{0};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{1};
+        }
+        else if (cmd == "PEXPIRE") {
+            if (args.size() != 3) {
+                return resp::Error{"ERR wrong number of arguments for PEXPIRE command"};
+            }
+            auto milliseconds = parseInteger(args[2]);
+            if (!milliseconds || *milliseconds <= 0) {
+                return resp::Error{"ERR invalid milliseconds"};
+            }
+            if (*milliseconds > MAX_TTL_SECONDS * 1000) {
+                return resp::Error{"ERR invalid expire time in 'pexpire' command"};
+            }
+            const auto when = std::chrono::system_clock::now() + std::chrono::milliseconds(*milliseconds);
+            if (!store_.expireAt(args[1], when,
+                                 [&]() { aof_manager_.logExpireAt(std::string(args[1]), unixMillis(when)); })) {
+                return resp::Integer{0};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{1};
+        }
+        else if (cmd == "EXPIREAT" || cmd == "PEXPIREAT") {
+            if (args.size() != 3) {
+                return resp::Error{"ERR wrong number of arguments for " + cmd + " command"};
+            }
+            auto timestamp = parseInteger(args[2]);
+            // Bounded so the conversion to clock ticks cannot overflow.
+            const int64_t limit = cmd == "EXPIREAT" ? 9'000'000'000 : 9'000'000'000'000;
+            if (!timestamp || *timestamp > limit || *timestamp < -limit) {
+                return resp::Error{"ERR invalid timestamp"};
+            }
+            // A timestamp in the past expires the key straight away.
+            const std::chrono::system_clock::time_point when{cmd == "EXPIREAT"
+                ? std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(*timestamp))
+                : std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::milliseconds(*timestamp))};
+            if (!store_.expireAt(args[1], when,
+                                 [&]() { aof_manager_.logExpireAt(std::string(args[1]), unixMillis(when)); })) {
+                return resp::Integer{0};
+            }
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{1};
+        }
+        else if (cmd == "PTTL") {
+            if (args.size() != 2) {
+                return resp::Error{"ERR wrong number of arguments for PTTL command"};
+            }
+            // -2 for a missing key and -1 for one without a TTL, as in Redis.
+            bool exists;
+            auto ttl = store_.getPTTL(args[1], exists);
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{ttl ? static_cast<int64_t>(ttl->count()) : exists ? -1 : -2};
+        }
+        else if (cmd == "TTL") {
+            if (args.size() != 2) {
+                return resp::Error{"ERR wrong number of arguments for TTL command"};
+            }
+            
+            bool exists;
+            auto ttl = store_.getTTL(args[1], exists);
+            Metrics::getInstance().incrementCommand(id);
+            return resp::Integer{ttl ? static_cast<int64_t>(ttl->count()) : exists ? -1 : -2};
+        }
+        else if (cmd == "BGREWRITEAOF") {
+            if (args.size() != 1) {
+                return resp::Error{"ERR wrong number of arguments for BGREWRITEAOF command"};
+            }
+            if (!aof_manager_.rewriteInBackground()) {
+                return resp::Error{"ERR Background append only file rewriting already in progress"};
+            }
+            return resp::SimpleString{"Background append only file rewriting started"};
+        }
+        else if (cmd == "SAVE") {
+            if (args.size() != 1) {
+                return resp::Error{"ERR wrong number of arguments for SAVE command"};
+            }
+            if (snapshot_manager_.saving()) {
+                return resp::Error{"ERR Background save already in progress"};
+            }
+            if (!snapshot_manager_.save()) {
+                return resp::Error{"ERR snapshot save failed"};
+            }
+            return resp::SimpleString{"OK"};
+        }
+        else if (cmd == "BGSAVE") {
+            if (args.size() != 1) {
+                return resp::Error{"ERR wrong number of arguments for BGSAVE command"};
+            }
+            if (!snapshot_manager_.saveInBackground()) {
+                return resp::Error{"ERR Background save already in progress"};
+            }
+            return resp::SimpleString{"Background saving started"};
+        }
+        else if (cmd == "INFO") {
+            if (args.size() > 2) {
+                return resp::Error{"ERR wrong number of arguments for INFO command"};
+            }
+            return resp::BulkString{info(args.size() == 2 ? upper(args[1]) : "DEFAULT")};
+        }
+        else if (cmd == "SLOWLOG") {
+            return handleSlowLog(args);
+        }
+        else if (cmd == "LATENCY") {
+            return handleLatency(args);
+        }
+        else if (cmd == "METRICS") {
+            if (args.size() != 1) {
+                return resp::Error{"ERR wrong number of arguments for METRICS command"};
+            }
+            
+            try {
+                std::string metrics = Metrics::getInstance().getPrometheusMetrics();
+                return resp::BulkString{metrics};
+            } catch (const std::exception& e) {
+                SERVER_LOG(Warning, "Error getting metrics: ", e.what());
+                return resp::Error{"ERR internal error"};
+            }
+        }
+        else {
+            return resp::Error{"ERR unknown command"};
+        }
+    } catch (const store::WrongType& e) {
+        return resp::Error{e.what()};
+    } catch (const std::exception& e) {
+        SERVER_LOG(Warning, "Error handling command: ", e.what());
+        return resp::Error{"ERR internal error"};
+    }
+}
+
+resp::Value Server::handleCollectionCommand(const std::string& cmd, const std::vector<std::string_view>& args,
+                                            bool log) {
+    const auto arity = [&]() { return resp::Error{"ERR wrong number of arguments for " + cmd + " command"}; };
+    if (args.size() < 2) {
+        return arity();
+    }
+    const std::string_view key = args[1];
+
+    // Logged under the canonical name, as replay matches it. Reads build no
+    // callbacks.
+    log = log && isCollectionWrite(cmd);
+    const auto log_command = [&]() {
+        std::vector<std::string_view> logged(args);
+        logged[0] = cmd;
+        aof_manager_.logCommand(logged);
+    };
+    const store::Store::OnWrite on_write = log ? store::Store::OnWrite(log_command) : nullptr;
+    // A list a snapshot may already hold is logged whole instead.
+    const store::Store::OnListWrite on_list_write = !log ? nullptr
+        : store::Store::OnListWrite([&](const store::Store::ListWrite& write) {
+              if (!write.whole) {
+                  log_command();
+                  return;
+              }
+              aof_manager_.logValue(key, store::ValueType::List, write.payload, write.expiry
+                  ? std::optional<int64_t>(unixMillis(store_.wallClockAt(*write.expiry))) : std::nullopt);
+          });
+
+    if (cmd == "TYPE") {
+        if (args.size() != 2) return arity();
+        const auto type = store_.type(key);
+        return resp::SimpleString{type ? store::valueTypeName(*type) : "none"};
+    }
+    if (cmd == "HSET") {
+        if (args.size() < 4 || args.size() % 2 != 0) return arity();
+        std::vector<store::Store::KeyValue> pairs;
+        pairs.reserve(args.size() / 2 - 1);
+        for (size_t i = 2; i < args.size(); i += 2) {
+            pairs.emplace_back(args[i], args[i + 1]);
+        }
+        return resp::Integer{static_cast<int64_t>(store_.hashSet(key, pairs, on_write))};
+    }
+    if (cmd == "HGET") {
+        if (args.size() != 3) return arity();
+        return resp::BulkString{store_.hashGet(key, args[2])};
+    }
+    if (cmd == "HGETALL") {
+        if (args.size() != 2) return arity();
+        resp::Array reply;
+        for (auto& [field, value] : store_.hashGetAll(key)) {
+            reply.emplace_back(resp::BulkString{std::move(field)});
+            reply.emplace_back(resp::BulkString{std::move(value)});
+        }
+        return reply;
+    }
+    if (cmd == "LPUSH" || cmd == "RPUSH") {
+        if (args.size() < 3) return arity();
+        return resp::Integer{static_cast<int64_t>(store_.listPush(
+            key, std::vector<std::string_view>(args.begin() + 2, args.end()), cmd == "LPUSH",
+            on_list_write))};
+    }
+    if (cmd == "LPOP" || cmd == "RPOP") {
+        if (args.size() > 3) return arity();
+        std::optional<int64_t> count = 1;
+        if (args.size() == 3) {
+            count = parseInteger(args[2]);
+            if (!count || *count < 0) {
+                return resp::Error{"ERR value is out of range, must be positive"};
+            }
+        }
+        auto values = store_.listPop(key, static_cast<size_t>(*count), cmd == "LPOP", on_list_write);
+        // A missing key is nil either way; RESP2 has no separate nil array
+        // here.
+        if (!values) {
+            return resp::BulkString{std::nullopt};
+        }
+        if (args.size() == 2) {
+            return resp::BulkString{std::move(values->front())};
+        }
+        resp::Array reply;
+        reply.reserve(values->size());
+        for (auto& value : *values) {
+            reply.emplace_back(resp::BulkString{std::move(value)});
+        }
+        return reply;
+    }
+    if (cmd == "LRANGE" || cmd == "ZRANGE") {
+        const bool with_scores = args.size() == 5 && upper(args[4]) == "WITHSCORES" && cmd == "ZRANGE";
+        if (args.size() != 4 && !with_scores) {
+            return args.size() == 5 ? resp::Error{"ERR syntax error"} : arity();
+        }
+        const auto start = parseInteger(args[2]);
+        const auto stop = parseInteger(args[3]);
+        if (!start || !stop) {
+            return resp::Error{"ERR value is not an integer or out of range"};
+        }
+        resp::Array reply;
+        if (cmd == "LRANGE") {
+            for (auto& value : store_.listRange(key, *start, *stop)) {
+                reply.emplace_back(resp::BulkString{std::move(value)});
+            }
+            return reply;
+        }
+        for (auto& [member, score] : store_.zsetRange(key, *start, *stop)) {
+            reply.emplace_back(resp::BulkString{std::move(member)});
+            if (with_scores) {
+                reply.emplace_back(resp::BulkString{store::scoreText(score)});
+            }
+        }
+        return reply;
+    }
+    if (cmd == "SADD") {
+        if (args.size() < 3) return arity();
+        return resp::Integer{static_cast<int64_t>(
+            store_.setAdd(key, std::vector<std::string_view>(args.begin() + 2, args.end()), on_write))};
+    }
+    if (cmd == "SISMEMBER") {
+        if (args.size() != 3) return arity();
+        return resp::Integer{store_.setIsMember(key, args[2]) ? 1 : 0};
+    }
+    if (cmd == "ZADD") {
+        if (args.size() < 4 || args.size() % 2 != 0) return arity();
+        std::vector<std::pair<double, std::string_view>> items;
+        items.reserve(args.size() / 2 - 1);
+        for (size_t i = 2; i < args.size(); i += 2) {
+            const auto score = store::parseScore(args[i]);
+            if (!score) {
+                return resp::Error{"ERR value is not a valid float"};
+            }
+            items.emplace_back(*score, args[i + 1]);
+        }
+        return resp::Integer{static_cast<int64_t>(store_.zsetAdd(key, items, on_write))};
+    }
+    return resp::Error{"ERR unknown command"};
+}
+
+// INFO's sections in Redis' format. Memory figures are allocator-sized
+// bytes held by the keyspace; RSS also counts everything else in the
+// process, so the fragmentation ratio runs high while the keyspace is small.
+std::string Server::info(const std::string& section) {
+    const bool all = section == "DEFAULT" || section == "ALL" || section == "EVERYTHING";
+    std::ostringstream out;
+    if (all || section == "MEMORY") {
+        const auto stats = store_.memoryStats();
+        const auto process = store::processMemory();
+        out << "# Memory\r\n"
+            << "used_memory:" << stats.used() << "\r\n"
+            << "used_memory_human:" << humanBytes(stats.used()) << "\r\n"
+            << "used_memory_rss:" << process.rss << "\r\n"
+            << "used_memory_rss_human:" << humanBytes(process.rss) << "\r\n"
+            << "used_memory_peak:" << stats.peak << "\r\n"
+            << "used_memory_peak_human:" << humanBytes(stats.peak) << "\r\n"
+            << "used_memory_dataset:" << stats.dataset << "\r\n"
+            << "used_memory_overhead:" << stats.overhead << "\r\n"
+            << "allocator_allocated:" << process.allocator_allocated << "\r\n"
+            << "allocator_active:" << process.allocator_active << "\r\n"
+            << "allocator_frag_ratio:" << ratio(process.allocator_active, process.allocator_allocated) << "\r\n"
+            << "mem_fragmentation_ratio:" << ratio(process.rss, stats.used()) << "\r\n"
+            << "slab_active:" << stats.slab_active << "\r\n"
+            << "slab_frag_bytes:" << stats.slab_free << "\r\n"
+            << "slab_frag_ratio:" << ratio(stats.slab_active, stats.slab_active - stats.slab_free) << "\r\n"
+            << "active_defrag_running:" << (store_.activeDefragRunning() ? 1 : 0) << "\r\n"
+            << "maxmemory:" << store_.evictionConfig().maxmemory << "\r\n"
+            << "maxmemory_human:" << humanBytes(store_.evictionConfig().maxmemory) << "\r\n"
+            << "maxmemory_policy:" << store::Store::evictionPolicyName(store_.evictionConfig().policy) << "\r\n"
+            << "mem_allocator:libc\r\n";
+        for (size_t i = 0; i < stats.shards.size(); ++i) {
+            out << "shard" << i << ":used_memory=" << stats.shards[i] << "\r\n";
+        }
+    }
+    if (all || section == "STATS") {
+        if (out.tellp() > 0) out << "\r\n";
+        out << "# Stats\r\n"
+            << "expired_keys:" << store_.expiredCount() << "\r\n"
+            << "evicted_keys:" << store_.evictedCount() << "\r\n"
+            << "active_defrag_hits:" << store_.defragHits() << "\r\n"
+            << "active_defrag_misses:" << store_.defragMisses() << "\r\n";
+    }
+    return out.str();
+}
+
+// SLOWLOG GET [count] | LEN | RESET. Entries are [id, unix time,
+// microseconds, arguments], newest first.
+resp::Value Server::handleSlowLog(const std::vector<std::string_view>& args) {
+    const std::string sub = args.size() > 1 ? upper(args[1]) : "";
+    if (sub == "GET" && args.size() <= 3) {
+        size_t count = 10;
+        if (args.size() == 3) {
+            auto requested = parseInteger(args[2]);
+            if (!requested || *requested < -1) {
+                return resp::Error{"ERR count should be greater than or equal to -1"};
+            }
+            count = *requested == -1 ? SIZE_MAX : static_cast<size_t>(*requested);
+        }
+        resp::Array reply;
+        for (auto& entry : slowlog_.get(count)) {
+            resp::Array command;
+            for (auto& arg : entry.args) {
+                command.emplace_back(resp::BulkString{std::move(arg)});
+            }
+            resp::Array item;
+            item.emplace_back(resp::Integer{static_cast<int64_t>(entry.id)});
+            item.emplace_back(resp::Integer{entry.time});
+            item.emplace_back(resp::Integer{entry.duration.count()});
+            item.emplace_back(std::move(command));
+            reply.emplace_back(std::move(item));
+        }
+        return reply;
+    }
+    if (sub == "LEN" && args.size() == 2) {
+        return resp::Integer{static_cast<int64_t>(slowlog_.size())};
+    }
+    if (sub == "RESET" && args.size() == 2) {
+        slowlog_.reset();
+        return resp::SimpleString{"OK"};
+    }
+    return resp::Error{"ERR unknown subcommand or wrong number of arguments for SLOWLOG"};
+}
+
+// LATENCY LATEST | HISTORY event | RESET [event ...], as in Redis.
+// Latencies are in milliseconds and times in Unix seconds.
+resp::Value Server::handleLatency(const std::vector<std::string_view>& args) {
+    auto& monitor = LatencyMonitor::getInstance();
+    const std::string sub = args.size() > 1 ? upper(args[1]) : "";
+    if (sub == "LATEST" && args.size() == 2) {
+        resp::Array reply;
+        for (auto& event : monitor.latest()) {
+            resp::Array item;
+            item.emplace_back(resp::BulkString{std::move(event.name)});
+            item.emplace_back(resp::Integer{event.latest.time});
+            item.emplace_back(resp::Integer{static_cast<int64_t>(event.latest.latency_ms)});
+            item.emplace_back(resp::Integer{static_cast<int64_t>(event.max_ms)});
+            reply.emplace_back(std::move(item));
+        }
+        return reply;
+    }
+    if (sub == "HISTORY" && args.size() == 3) {
+        resp::Array reply;
+        for (const auto& sample : monitor.history(std::string(args[2]))) {
+            resp::Array item;
+            item.emplace_back(resp::Integer{sample.time});
+            item.emplace_back(resp::Integer{static_cast<int64_t>(sample.latency_ms)});
+            reply.emplace_back(std::move(item));
+        }
+        return reply;
+    }
+    if (sub == "RESET") {
+        return resp::Integer{static_cast<int64_t>(
+            monitor.reset(std::vector<std::string>(args.begin() + 2, args.end())))};
+    }
+    return resp::Error{"ERR unknown subcommand or wrong number of arguments for LATENCY"};
+}
+
+}
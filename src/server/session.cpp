@@ -0,0 +1,154 @@
+#include "server/session.hpp"
+#include "server/server.hpp"
+#include "server/logger.hpp"
+#include "server/metrics.hpp"
+#include <chrono>
+#include <cstring>
+
+namespace server {
+Session::Session(boost::asio::ip::tcp::socket socket, Server& server)
+    : socket_(std::move(socket))
+    , server_(server)
+    , read_buffer_(READ_CHUNK_SIZE)
+{
+}
+
+Session::~Session() {
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    Metrics::getInstance().decrementConnections();
+    SERVER_LOG(Verbose, "Client disconnected");
+}
+
+void Session::start() {
+    SERVER_LOG(Verbose, "New client connected");
+    boost::system::error_code ignored;
+    socket_.set_option(boost::asio::ip::tcp::socket::linger(true, 0), ignored);
+    socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+    do_read();
+}
+
+void Session::do_read() {
+    if (!server_.running_) return;
+    // Read a large bulk string in steps of up to MAX_READ_AHEAD. Capacity
+    // doubles, so its bytes are copied O(1) times on average, but only ever
+    // in proportion to what the client actually sent.
+    const size_t wanted = std::max(READ_CHUNK_SIZE, parser_.pendingBytes(filled_));
+    if (read_buffer_.size() - filled_ < wanted) {
+        const size_t size = filled_ + wanted;
+        if (size > read_buffer_.capacity()) {
+            read_buffer_.reserve(std::max(size, read_buffer_.capacity() * 2));
+        }
+        read_buffer_.resize(size);
+    }
+    socket_.async_read_some(
+        boost::asio::buffer(read_buffer_.data() + filled_, read_buffer_.size() - filled_),
+        [self = shared_from_this()](const boost::system::error_code& error, size_t bytes_read) {
+            self->on_read(error, bytes_read);
+        }
+    );
+}
+
+void Session::on_read(const boost::system::error_code& error, size_t bytes_read) {
+    if (error) {
+        if (error == boost::asio::error::eof) {
+            SERVER_LOG(Verbose, "Client disconnected normally");
+        } else if (error != boost::asio::error::operation_aborted) {
+            SERVER_LOG(Verbose, "Error reading from socket: ", error.message());
+            Metrics::getInstance().incrementAOFErrors();
+        }
+        return;
+    }
+
+    filled_ += bytes_read;
+
+    AOFManager& aof = server_.aof_manager_;
+    const uint64_t appended = aof.appended();
+    try {
+        process_commands();
+    } catch (const std::exception& e) {
+        SERVER_LOG(Warning, "Error handling client: ", e.what());
+        Metrics::getInstance().incrementAOFErrors();
+        return;
+    }
+
+    if (responses_.empty()) {
+        do_read();
+    } else if (aof.policy() == AOFManager::FsyncPolicy::Always && aof.appended() != appended) {
+        // Hold the replies until the batch's writes are on disk. The count
+        // may include other sessions' records, which only costs a wait for
+        // a batch that is being synced anyway.
+        aof.sync([self = shared_from_this()]() {
+            boost::asio::post(self->socket_.get_executor(), [self]() { self->do_write(); });
+        });
+    } else {
+        do_write();
+    }
+}
+
+// Executes every complete command in the read buffer and queues its reply,
+// then moves any partial trailing command to the front of the buffer.
+void Session::process_commands() {
+    std::string_view input(read_buffer_.data(), filled_);
+    auto& metrics = Metrics::getInstance();
+    // One clock read per parse and per command: each command starts timing
+    // where its parse ended and the next parse starts where it finished, so
+    // parse times also cover queueing the previous reply.
+    auto clock = std::chrono::steady_clock::now();
+    while (true) {
+        auto status = parser_.parse(input);
+        const auto parsed = std::chrono::steady_clock::now();
+        metrics.recordStage(Metrics::Stage::Parse, parsed - clock);
+        clock = parsed;
+        if (status == resp::RequestParser::Status::Incomplete) break;
+        if (status == resp::RequestParser::Status::Error) {
+            SERVER_LOG(Verbose, "Protocol error: ", parser_.error());
+            responses_.push_back("-ERR Protocol error: " + parser_.error() + "\r\n");
+            close_after_write_ = true;
+            return;
+        }
+        if (parser_.args().empty()) continue;
+        resp::Parser::serialize(server_.handleCommand(parser_.args(), clock), responses_);
+    }
+
+    const size_t consumed = parser_.consumed();
+    if (consumed > 0) {
+        std::memmove(read_buffer_.data(), read_buffer_.data() + consumed, filled_ - consumed);
+        filled_ -= consumed;
+        parser_.discard(consumed);
+    }
+    if (filled_ == 0 && read_buffer_.size() > MAX_IDLE_BUFFER_SIZE) {
+        std::vector<char>(READ_CHUNK_SIZE).swap(read_buffer_);
+    }
+}
+
+void Session::do_write() {
+    write_started_ = std::chrono::steady_clock::now();
+    write_buffers_.clear();
+    for (const auto& response : responses_) {
+        write_buffers_.push_back(boost::asio::buffer(response));
+    }
+    boost::asio::async_write(
+        socket_,
+        write_buffers_,
+        [self = shared_from_this()](const boost::system::error_code& error, size_t) {
+            self->on_write(error);
+        }
+    );
+}
+
+void Session::on_write(const boost::system::error_code& error) {
+    if (error) {
+        if (error != boost::asio::error::operation_aborted) {
+            SERVER_LOG(Verbose, "Error writing response: ", error.message());
+            Metrics::getInstance().incrementAOFErrors();
+        }
+        return;
+    }
+    Metrics::getInstance().recordStage(Metrics::Stage::SocketWrite,
+                                       std::chrono::steady_clock::now() - write_started_);
+    responses_.clear();
+    if (close_after_write_) return;
+    do_read();
+}
+}
@@ -0,0 +1,69 @@
+#include "server/slowlog.hpp"
+#include <algorithm>
+
+namespace server {
+
+SlowLog::SlowLog(std::chrono::microseconds threshold, size_t max_length)
+    : threshold_us_(threshold.count())
+    , max_length_(max_length)
+{
+}
+
+void SlowLog::setMaxLength(size_t max_length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_length_ = max_length;
+    if (entries_.size() > max_length_) {
+        entries_.resize(max_length_);
+    }
+}
+
+void SlowLog::record(const std::vector<std::string_view>& args, std::chrono::nanoseconds duration) {
+    if (!isSlow(duration)) return;
+
+    Entry entry;
+    entry.time = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    entry.duration = std::chrono::duration_cast<std::chrono::microseconds>(duration);
+    // Long commands are cut short the way Redis does it, saying how much
+    // was left out.
+    const size_t kept = args.size() > MAX_ARGS ? MAX_ARGS - 1 : args.size();
+    entry.args.reserve(kept + 1);
+    for (size_t i = 0; i < kept; ++i) {
+        const std::string_view arg = args[i];
+        if (arg.size() > MAX_ARG_LENGTH) {
+            entry.args.push_back(std::string(arg.substr(0, MAX_ARG_LENGTH)) + "... (" +
+                                 std::to_string(arg.size() - MAX_ARG_LENGTH) + " more bytes)");
+        } else {
+            entry.args.emplace_back(arg);
+        }
+    }
+    if (kept < args.size()) {
+        entry.args.push_back("... (" + std::to_string(args.size() - kept) + " more arguments)");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_length_ == 0) return;
+    entry.id = next_id_++;
+    entries_.push_front(std::move(entry));
+    if (entries_.size() > max_length_) {
+        entries_.pop_back();
+    }
+}
+
+std::vector<SlowLog::Entry> SlowLog::get(size_t count) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    count = std::min(count, entries_.size());
+    return std::vector<Entry>(entries_.begin(), entries_.begin() + count);
+}
+
+size_t SlowLog::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void SlowLog::reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+}
+
+}
@@ -0,0 +1,354 @@
+#include "server/snapshot_manager.hpp"
+#include "server/checksum.hpp"
+#include "server/logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace server {
+namespace {
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void putFixed32(std::string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>(value >> (8 * i));
+    }
+}
+
+// Reads from the front of a buffer; every get fails once the buffer runs
+// out, so callers can check once after a sequence of reads.
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data_(data) {}
+
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos_ >= data_.size()) return false;
+            const auto byte = static_cast<uint8_t>(data_[pos_++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool getFixed32(uint32_t& value) {
+        if (data_.size() - pos_ < 4) return false;
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[pos_++])) << (8 * i);
+        }
+        return true;
+    }
+
+    bool getBytes(uint64_t size, std::string_view& bytes) {
+        if (data_.size() - pos_ < size) return false;
+        bytes = data_.substr(pos_, static_cast<size_t>(size));
+        pos_ += static_cast<size_t>(size);
+        return true;
+    }
+
+    bool getString(std::string_view& bytes) {
+        uint64_t size;
+        return getVarint(size) && getBytes(size, bytes);
+    }
+
+    size_t position() const { return pos_; }
+    bool done() const { return pos_ == data_.size(); }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+};
+
+bool writeAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+}
+
+    SnapshotManager::SnapshotManager(const std::string& path, AOFManager* aof)
+        : path_(path), aof_(aof) {
+    }
+
+    SnapshotManager::~SnapshotManager() {
+        closing_ = true;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (save_thread_.joinable()) {
+            save_thread_.join();
+        }
+    }
+
+    void SnapshotManager::setSource(Source source) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        source_ = std::move(source);
+    }
+
+    bool SnapshotManager::save() {
+        Source source;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closing_ || !source_) return false;
+            source = source_;
+        }
+        if (saving_.exchange(true)) return false;
+        const bool ok = runSave(source);
+        saving_ = false;
+        return ok;
+    }
+
+    bool SnapshotManager::saveInBackground() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closing_ || !source_ || saving_.exchange(true)) return false;
+        if (save_thread_.joinable()) {
+            // Already done: it clears saving_ as its last step.
+            save_thread_.join();
+        }
+        save_thread_ = std::thread([this, source = source_]() {
+            runSave(source);
+            saving_ = false;
+        });
+        return true;
+    }
+
+    // The log position is taken before the keyspace is read, so every
+    // change after it is either in the snapshot or replayed over it, and
+    // the source logs the ones the snapshot may already hold in a form
+    // that leaves the same result when replayed over it.
+    bool SnapshotManager::runSave(const Source& source) {
+        const std::string temp_path = path_ + ".tmp";
+        int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write(fd, source, [this]() {
+            return aof_ ? aof_->position() : AOFManager::Position{};
+        }) && ::fdatasync(fd) == 0;
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        ok = ok && ::rename(temp_path.c_str(), path_.c_str()) == 0;
+        if (!ok) {
+            SERVER_LOG(Warning, "Snapshot save failed: ", std::strerror(errno));
+            ::unlink(temp_path.c_str());
+            return false;
+        }
+        SERVER_LOG(Notice, "Snapshot saved to ", path_);
+        return true;
+    }
+
+    // The header is written once start has given the position, before the
+    // first key, or at the end if the source never calls it.
+    bool SnapshotManager::write(int fd, const Source& source,
+                                const std::function<AOFManager::Position()>& start) {
+        std::string out;
+        bool started = false;
+        const auto header = [&]() {
+            if (started) return;
+            started = true;
+            const AOFManager::Position position = start ? start() : AOFManager::Position{};
+            out.assign(MAGIC, sizeof(MAGIC) - 1);
+            out += static_cast<char>(VERSION);
+            putVarint(out, position.offset);
+            putFixed32(out, position.fence);
+            putFixed32(out, crc32c(out));
+        };
+
+        std::string block;
+        uint64_t block_count = 0;
+        uint64_t total = 0;
+        bool ok = true;
+        auto closeBlock = [&]() {
+            putVarint(out, block.size());
+            putVarint(out, block_count);
+            out += block;
+            putFixed32(out, crc32c(block));
+            block.clear();
+            block_count = 0;
+            if (out.size() >= WRITE_CHUNK_SIZE) {
+                ok = writeAll(fd, out);
+                out.clear();
+            }
+        };
+
+        try {
+            source([&](const std::string& key, store::ValueType type, const std::string& value,
+                       std::optional<int64_t> expire_at) {
+                header();
+                if (!ok) return;
+                const auto entry_type = static_cast<uint8_t>(static_cast<uint8_t>(type) << 1);
+                if (expire_at) {
+                    block += static_cast<char>(entry_type | EXPIRING);
+                    // Anything before the epoch has long passed.
+                    putVarint(block, static_cast<uint64_t>(std::max<int64_t>(*expire_at, 0)));
+                } else {
+                    block += static_cast<char>(entry_type);
+                }
+                putVarint(block, key.size());
+                block += key;
+                putVarint(block, value.size());
+                block += value;
+                ++block_count;
+                ++total;
+                if (block.size() >= BLOCK_SIZE) {
+                    closeBlock();
+                }
+            }, header);
+        } catch (const std::exception& e) {
+            SERVER_LOG(Warning, "Error in snapshot save: ", e.what());
+            return false;
+        }
+        header();
+        if (block_count > 0) {
+            closeBlock();
+        }
+        putVarint(out, 0);
+        putVarint(out, total);
+        return ok && writeAll(fd, out);
+    }
+
+    bool SnapshotManager::detect(std::string_view data) {
+        return data.substr(0, sizeof(MAGIC) - 1) == MAGIC;
+    }
+
+    std::optional<size_t> SnapshotManager::read(std::string_view data, const LoadHandler& handler,
+                                                AOFManager::Position* position, const Progress& progress) {
+        Reader reader(data);
+        std::string_view magic;
+        std::string_view version;
+        AOFManager::Position header;
+        uint32_t crc;
+        if (!reader.getBytes(sizeof(MAGIC) - 1, magic) || magic != MAGIC ||
+            !reader.getBytes(1, version) || static_cast<uint8_t>(version[0]) < FIRST_VERSION ||
+            static_cast<uint8_t>(version[0]) > VERSION ||
+            !reader.getVarint(header.offset) || !reader.getFixed32(header.fence)) {
+            return std::nullopt;
+        }
+        const size_t header_size = reader.position();
+        if (!reader.getFixed32(crc) || crc != crc32c(data.substr(0, header_size))) {
+            return std::nullopt;
+        }
+        if (position) {
+            *position = header;
+        }
+        if (!handler) {
+            return reader.position();
+        }
+
+        uint64_t total = 0;
+        while (true) {
+            uint64_t size;
+            uint64_t count;
+            if (!reader.getVarint(size)) return std::nullopt;
+            if (size == 0) {
+                if (!reader.getVarint(count) || count != total) return std::nullopt;
+                return reader.position();
+            }
+            std::string_view block;
+            if (!reader.getVarint(count) || !reader.getBytes(size, block) ||
+                !reader.getFixed32(crc) || crc != crc32c(block)) {
+                return std::nullopt;
+            }
+
+            Reader entries(block);
+            for (uint64_t i = 0; i < count; ++i) {
+                std::string_view type;
+                uint64_t expire_at = 0;
+                std::string_view key;
+                std::string_view value;
+                if (!entries.getBytes(1, type)) return std::nullopt;
+                const auto entry_type = static_cast<uint8_t>(type[0]);
+                const bool expiring = entry_type & EXPIRING;
+                if ((entry_type >> 1) > static_cast<uint8_t>(store::ValueType::ZSet) ||
+                    (expiring && !entries.getVarint(expire_at)) ||
+                    !entries.getString(key) || !entries.getString(value)) {
+                    return std::nullopt;
+                }
+                handler(key, static_cast<store::ValueType>(entry_type >> 1), value,
+                        expiring ? std::optional<int64_t>(static_cast<int64_t>(expire_at)) : std::nullopt);
+            }
+            if (!entries.done()) return std::nullopt;
+            total += count;
+            if (progress) {
+                progress(reader.position());
+            }
+        }
+    }
+
+    // Maps the file read-only and passes it to visit as a string_view.
+    template<typename Visit>
+    bool SnapshotManager::mapFile(const Visit& visit) const {
+        int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        const size_t size = static_cast<size_t>(st.st_size);
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            SERVER_LOG(Warning, "Failed to map snapshot: ", std::strerror(errno));
+            return false;
+        }
+        ::madvise(map, size, MADV_SEQUENTIAL);
+        const bool ok = visit(std::string_view(static_cast<const char*>(map), size));
+        ::munmap(map, size);
+        return ok;
+    }
+
+    std::optional<AOFManager::Position> SnapshotManager::logPosition() const {
+        AOFManager::Position position;
+        if (!mapFile([&position](std::string_view data) {
+                return read(data, nullptr, &position).has_value();
+            })) {
+            return std::nullopt;
+        }
+        return position;
+    }
+
+    // Pages behind the parser are dropped every LOAD_WINDOW bytes, so the
+    // file's share of RSS stays bounded however large it is.
+    bool SnapshotManager::load(const LoadHandler& handler) const {
+        return mapFile([&](std::string_view data) {
+            const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            size_t released = 0;
+            auto size = read(data, handler, nullptr, [&](size_t parsed) {
+                if (parsed - released >= LOAD_WINDOW) {
+                    const size_t drop = parsed / page * page;
+                    ::madvise(const_cast<char*>(data.data()) + released, drop - released, MADV_DONTNEED);
+                    released = drop;
+                }
+            });
+            if (!size) {
+                SERVER_LOG(Warning, "Corrupt snapshot: ", path_);
+                return false;
+            }
+            if (*size != data.size()) {
+                SERVER_LOG(Warning, "Ignoring ", data.size() - *size, " bytes after the snapshot in ",
+                           path_);
+            }
+            return true;
+        });
+    }
+}
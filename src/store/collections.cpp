@@ -0,0 +1,679 @@
+#include "store/collections.hpp"
+#include "store/memory.hpp"
+#include "store/numbers.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace store {
+namespace {
+
+size_t varintSize(size_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+// Seven bits a byte, low bits first, the top bit set on all but the last.
+void writeVarint(char* out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *out = static_cast<char>(value);
+}
+
+// The same bytes in reverse, so they are read from the end of an entry
+// towards its start. out points at the last byte.
+void writeBackVarint(char* out, size_t value) {
+    while (value >= 0x80) {
+        *out-- = static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    *out = static_cast<char>(value);
+}
+
+// Reads a varint from data within limit bytes. Returns the bytes used, or
+// 0 if it runs past limit.
+size_t readVarint(const char* data, size_t limit, size_t& value) {
+    value = 0;
+    for (size_t i = 0; i < limit && i < 10; ++i) {
+        const auto byte = static_cast<unsigned char>(data[i]);
+        value |= static_cast<size_t>(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+size_t entrySize(size_t length) {
+    const size_t front = varintSize(length) + length;
+    return front + varintSize(front);
+}
+
+std::string_view scoreBytes(const double& score) {
+    return {reinterpret_cast<const char*>(&score), sizeof(score)};
+}
+
+double scoreOf(std::string_view bytes) {
+    double score;
+    std::memcpy(&score, bytes.data(), sizeof(score));
+    return score;
+}
+
+bool fitsListPack(std::string_view value) {
+    return value.size() <= LISTPACK_MAX_VALUE;
+}
+
+}
+
+const char* valueTypeName(ValueType type) {
+    switch (type) {
+        case ValueType::String: return "string";
+        case ValueType::Hash: return "hash";
+        case ValueType::List: return "list";
+        case ValueType::Set: return "set";
+        case ValueType::ZSet: return "zset";
+    }
+    return "none";
+}
+
+std::string_view ListPack::at(size_t offset) const {
+    size_t length;
+    const size_t header = readVarint(buffer_.data() + offset, buffer_.size() - offset, length);
+    return {buffer_.data() + offset + header, length};
+}
+
+size_t ListPack::next(size_t offset) const {
+    size_t length;
+    const size_t header = readVarint(buffer_.data() + offset, buffer_.size() - offset, length);
+    return offset + header + length + varintSize(header + length);
+}
+
+size_t ListPack::prev(size_t offset) const {
+    size_t back = 0;
+    size_t used = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        const auto byte = static_cast<unsigned char>(buffer_[offset - ++used]);
+        back |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return offset - used - back;
+}
+
+size_t ListPack::find(std::string_view value, size_t stride, size_t first) const {
+    // One header decode per entry, and the bytes are compared only when the
+    // lengths match.
+    const char* data = buffer_.data();
+    const size_t size = buffer_.size();
+    size_t skip = 0;
+    for (size_t offset = first; offset != size;) {
+        size_t length;
+        const size_t header = readVarint(data + offset, size - offset, length);
+        if (skip == 0 && length == value.size() &&
+            (length == 0 || std::memcmp(data + offset + header, value.data(), length) == 0)) {
+            return offset;
+        }
+        skip = skip == 0 ? stride - 1 : skip - 1;
+        offset += header + length + varintSize(header + length);
+    }
+    return end();
+}
+
+void ListPack::insert(size_t offset, std::string_view value) {
+    const size_t size = entrySize(value.size());
+    const size_t header = varintSize(value.size());
+    buffer_.insert(offset, size, '\0');
+    char* out = &buffer_[offset];
+    writeVarint(out, value.size());
+    std::memcpy(out + header, value.data(), value.size());
+    writeBackVarint(out + size - 1, header + value.size());
+    ++count_;
+}
+
+void ListPack::erase(size_t offset, size_t count) {
+    size_t last = offset;
+    for (size_t i = 0; i < count; ++i) {
+        last = next(last);
+    }
+    buffer_.erase(offset, last - offset);
+    count_ -= count;
+}
+
+void ListPack::replace(size_t offset, std::string_view value) {
+    if (at(offset).size() == value.size()) {
+        std::memcpy(&buffer_[offset + varintSize(value.size())], value.data(), value.size());
+        return;
+    }
+    erase(offset);
+    insert(offset, value);
+}
+
+void ListPack::clear() {
+    std::string().swap(buffer_);
+    count_ = 0;
+}
+
+size_t ListPack::bytes() const {
+    return heapBytes(buffer_);
+}
+
+std::optional<ListPack> ListPack::fromData(std::string_view data) {
+    ListPack pack;
+    pack.buffer_.assign(data);
+    for (size_t offset = 0; offset < data.size(); ++pack.count_) {
+        size_t length;
+        const size_t header = readVarint(data.data() + offset, data.size() - offset, length);
+        if (header == 0 || length > data.size() - offset - header) return std::nullopt;
+        const size_t front = header + length;
+        size_t back;
+        const size_t back_size = varintSize(front);
+        if (back_size > data.size() - offset - front) return std::nullopt;
+        // The backwards varint, read forwards, is the forward one reversed.
+        std::string forward(data.substr(offset + front, back_size));
+        std::reverse(forward.begin(), forward.end());
+        if (readVarint(forward.data(), back_size, back) != back_size || back != front) return std::nullopt;
+        offset += front + back_size;
+    }
+    return pack;
+}
+
+HashValue::HashValue() = default;
+HashValue::~HashValue() = default;
+HashValue::HashValue(HashValue&&) noexcept = default;
+HashValue& HashValue::operator=(HashValue&&) noexcept = default;
+
+bool HashValue::set(std::string_view field, std::string_view value) {
+    if (!table_) {
+        const size_t offset = pack_.find(field, 2);
+        if (offset != pack_.end() && fitsListPack(value)) {
+            pack_.replace(pack_.next(offset), value);
+            return false;
+        }
+        if (offset == pack_.end() && fitsListPack(field) && fitsListPack(value) &&
+            pack_.size() / 2 < LISTPACK_MAX_ENTRIES) {
+            pack_.pushBack(field);
+            pack_.pushBack(value);
+            return true;
+        }
+        convert();
+    }
+    auto [slot, inserted] = table_->tryEmplace(field);
+    if (inserted) {
+        element_bytes_ += heapBytes(slot->key);
+    } else {
+        element_bytes_ -= heapBytes(slot->value);
+    }
+    slot->value.assign(value);
+    element_bytes_ += heapBytes(slot->value);
+    return inserted;
+}
+
+std::optional<std::string_view> HashValue::get(std::string_view field) const {
+    if (!table_) {
+        const size_t offset = pack_.find(field, 2);
+        if (offset == pack_.end()) return std::nullopt;
+        return pack_.at(pack_.next(offset));
+    }
+    const auto* slot = table_->find(field);
+    if (!slot) return std::nullopt;
+    return std::string_view(slot->value);
+}
+
+size_t HashValue::size() const {
+    return table_ ? table_->size() : pack_.size() / 2;
+}
+
+size_t HashValue::bytes() const {
+    if (!table_) return pack_.bytes();
+    return heapBytes(table_.get()) + table_->tableBytes() + table_->retiredBytes() + element_bytes_;
+}
+
+void HashValue::convert() {
+    auto table = std::make_unique<FlatMap<std::string>>();
+    table->reserve(size() + 1);
+    table_ = std::move(table);
+    ListPack pack = std::move(pack_);
+    pack_.clear();
+    for (size_t offset = pack.begin(); offset != pack.end(); offset = pack.next(pack.next(offset))) {
+        set(pack.at(offset), pack.at(pack.next(offset)));
+    }
+}
+
+ListValue::ListValue() = default;
+ListValue::~ListValue() = default;
+ListValue::ListValue(ListValue&&) noexcept = default;
+ListValue& ListValue::operator=(ListValue&&) noexcept = default;
+
+void ListValue::push(std::string_view value, bool front) {
+    if (!deque_ && (!fitsListPack(value) || pack_.size() >= LISTPACK_MAX_ENTRIES)) {
+        convert();
+    }
+    if (!deque_) {
+        pack_.insert(front ? pack_.begin() : pack_.end(), value);
+        return;
+    }
+    if (front) {
+        deque_->emplace_front(value);
+        element_bytes_ += heapBytes(deque_->front());
+    } else {
+        deque_->emplace_back(value);
+        element_bytes_ += heapBytes(deque_->back());
+    }
+}
+
+std::string ListValue::pop(bool front) {
+    if (!deque_) {
+        const size_t offset = front ? pack_.begin() : pack_.prev(pack_.end());
+        std::string value(pack_.at(offset));
+        pack_.erase(offset);
+        return value;
+    }
+    std::string& end = front ? deque_->front() : deque_->back();
+    element_bytes_ -= heapBytes(end);
+    std::string value = std::move(end);
+    if (front) {
+        deque_->pop_front();
+    } else {
+        deque_->pop_back();
+    }
+    return value;
+}
+
+std::vector<std::string> ListValue::range(size_t start, size_t stop) const {
+    std::vector<std::string> values;
+    values.reserve(stop - start + 1);
+    if (deque_) {
+        for (size_t i = start; i <= stop; ++i) {
+            values.push_back((*deque_)[i]);
+        }
+        return values;
+    }
+    size_t offset = pack_.begin();
+    for (size_t i = 0; i < start; ++i) {
+        offset = pack_.next(offset);
+    }
+    for (size_t i = start; i <= stop; ++i, offset = pack_.next(offset)) {
+        values.emplace_back(pack_.at(offset));
+    }
+    return values;
+}
+
+size_t ListValue::size() const {
+    return deque_ ? deque_->size() : pack_.size();
+}
+
+size_t ListValue::bytes() const {
+    if (!deque_) return pack_.bytes();
+    // The deque's blocks are not visible; count a string's worth each.
+    return heapBytes(deque_.get()) + deque_->size() * sizeof(std::string) + element_bytes_;
+}
+
+void ListValue::convert() {
+    deque_ = std::make_unique<std::deque<std::string>>();
+    for (size_t offset = pack_.begin(); offset != pack_.end(); offset = pack_.next(offset)) {
+        deque_->emplace_back(pack_.at(offset));
+        element_bytes_ += heapBytes(deque_->back());
+    }
+    pack_.clear();
+}
+
+SetValue::SetValue() = default;
+SetValue::~SetValue() = default;
+SetValue::SetValue(SetValue&&) noexcept = default;
+SetValue& SetValue::operator=(SetValue&&) noexcept = default;
+
+bool SetValue::add(std::string_view member) {
+    if (!table_) {
+        if (pack_.find(member) != pack_.end()) return false;
+        if (fitsListPack(member) && pack_.size() < LISTPACK_MAX_ENTRIES) {
+            pack_.pushBack(member);
+            return true;
+        }
+        convert();
+    }
+    auto [slot, inserted] = table_->tryEmplace(member);
+    if (inserted) element_bytes_ += heapBytes(slot->key);
+    return inserted;
+}
+
+bool SetValue::contains(std::string_view member) const {
+    if (!table_) return pack_.find(member) != pack_.end();
+    return table_->find(member) != nullptr;
+}
+
+size_t SetValue::size() const {
+    return table_ ? table_->size() : pack_.size();
+}
+
+size_t SetValue::bytes() const {
+    if (!table_) return pack_.bytes();
+    return heapBytes(table_.get()) + table_->tableBytes() + table_->retiredBytes() + element_bytes_;
+}
+
+void SetValue::convert() {
+    table_ = std::make_unique<FlatMap<Member>>();
+    table_->reserve(pack_.size() + 1);
+    for (size_t offset = pack_.begin(); offset != pack_.end(); offset = pack_.next(offset)) {
+        element_bytes_ += heapBytes(table_->tryEmplace(pack_.at(offset)).first->key);
+    }
+    pack_.clear();
+}
+
+SkipList::SkipList() : head_(createNode(MAX_LEVEL, 0, {})) {
+    bytes_ = heapBytes(static_cast<const void*>(head_));
+}
+
+SkipList::~SkipList() {
+    Node* node = head_;
+    while (node) {
+        Node* next = node->links()[0].forward;
+        node->~Node();
+        ::operator delete(node);
+        node = next;
+    }
+}
+
+SkipList::Node* SkipList::createNode(int level, double score, std::string_view member) {
+    void* memory = ::operator new(sizeof(Node) + static_cast<size_t>(level) * sizeof(Link));
+    Node* node = new (memory) Node{std::string(member), score, nullptr, level};
+    for (int i = 0; i < level; ++i) {
+        new (&node->links()[i]) Link();
+    }
+    return node;
+}
+
+void SkipList::destroyNode(Node* node) {
+    bytes_ -= heapBytes(static_cast<const void*>(node)) + heapBytes(node->member);
+    node->~Node();
+    ::operator delete(node);
+}
+
+// Each level up is a quarter as likely, as in Redis.
+int SkipList::randomLevel() {
+    int level = 1;
+    while (level < MAX_LEVEL) {
+        random_state_ ^= random_state_ << 13;
+        random_state_ ^= random_state_ >> 7;
+        random_state_ ^= random_state_ << 17;
+        if ((random_state_ & 3) != 0) break;
+        ++level;
+    }
+    return level;
+}
+
+namespace {
+
+bool before(const SkipList::Node* node, double score, std::string_view member) {
+    return node->score < score || (node->score == score && std::string_view(node->member) < member);
+}
+
+}
+
+void SkipList::insert(double score, std::string_view member) {
+    Node* update[MAX_LEVEL];
+    size_t rank[MAX_LEVEL];
+    Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        rank[i] = i == level_ - 1 ? 0 : rank[i + 1];
+        while (node->links()[i].forward && before(node->links()[i].forward, score, member)) {
+            rank[i] += node->links()[i].span;
+            node = node->links()[i].forward;
+        }
+        update[i] = node;
+    }
+    const int level = randomLevel();
+    if (level > level_) {
+        for (int i = level_; i < level; ++i) {
+            rank[i] = 0;
+            update[i] = head_;
+            head_->links()[i].span = size_;
+        }
+        level_ = level;
+    }
+
+    Node* created = createNode(level, score, member);
+    bytes_ += heapBytes(static_cast<const void*>(created)) + heapBytes(created->member);
+    for (int i = 0; i < level; ++i) {
+        Link& link = update[i]->links()[i];
+        created->links()[i].forward = link.forward;
+        created->links()[i].span = link.span - (rank[0] - rank[i]);
+        link.forward = created;
+        link.span = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < level_; ++i) {
+        ++update[i]->links()[i].span;
+    }
+    created->backward = update[0] == head_ ? nullptr : update[0];
+    if (Node* next = created->links()[0].forward) {
+        next->backward = created;
+    } else {
+        tail_ = created;
+    }
+    ++size_;
+}
+
+bool SkipList::erase(double score, std::string_view member) {
+    Node* update[MAX_LEVEL];
+    Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        while (node->links()[i].forward && before(node->links()[i].forward, score, member)) {
+            node = node->links()[i].forward;
+        }
+        update[i] = node;
+    }
+    node = node->links()[0].forward;
+    if (!node || node->score != score || node->member != member) return false;
+
+    for (int i = 0; i < level_; ++i) {
+        Link& link = update[i]->links()[i];
+        if (link.forward == node) {
+            link.span += node->links()[i].span - 1;
+            link.forward = node->links()[i].forward;
+        } else {
+            --link.span;
+        }
+    }
+    if (Node* next = node->links()[0].forward) {
+        next->backward = node->backward;
+    } else {
+        tail_ = node->backward;
+    }
+    while (level_ > 1 && !head_->links()[level_ - 1].forward) {
+        --level_;
+    }
+    --size_;
+    destroyNode(node);
+    return true;
+}
+
+const SkipList::Node* SkipList::at(size_t rank) const {
+    const size_t target = rank + 1;
+    size_t traversed = 0;
+    const Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        while (node->links()[i].forward && traversed + node->links()[i].span <= target) {
+            traversed += node->links()[i].span;
+            node = node->links()[i].forward;
+        }
+        if (traversed == target) return node;
+    }
+    return nullptr;
+}
+
+ZSetValue::ZSetValue() = default;
+ZSetValue::~ZSetValue() = default;
+ZSetValue::ZSetValue(ZSetValue&&) noexcept = default;
+ZSetValue& ZSetValue::operator=(ZSetValue&&) noexcept = default;
+
+bool ZSetValue::add(double score, std::string_view member) {
+    if (!large_) {
+        const size_t offset = pack_.find(member, 2);
+        if (offset != pack_.end()) {
+            if (scoreOf(pack_.at(pack_.next(offset))) != score) {
+                pack_.erase(offset, 2);
+                packInsert(score, member);
+            }
+            return false;
+        }
+        if (fitsListPack(member) && pack_.size() / 2 < LISTPACK_MAX_ENTRIES) {
+            packInsert(score, member);
+            return true;
+        }
+        convert();
+    }
+    auto [slot, inserted] = large_->scores.tryEmplace(member, score);
+    if (inserted) {
+        large_->key_bytes += heapBytes(slot->key);
+        large_->list.insert(score, member);
+    } else if (slot->value != score) {
+        large_->list.erase(slot->value, member);
+        large_->list.insert(score, member);
+        slot->value = score;
+    }
+    return inserted;
+}
+
+void ZSetValue::packInsert(double score, std::string_view member) {
+    size_t offset = pack_.begin();
+    while (offset != pack_.end()) {
+        const size_t score_offset = pack_.next(offset);
+        const double current = scoreOf(pack_.at(score_offset));
+        if (current > score || (current == score && pack_.at(offset) > member)) break;
+        offset = pack_.next(score_offset);
+    }
+    pack_.insert(offset, member);
+    pack_.insert(pack_.next(offset), scoreBytes(score));
+}
+
+std::optional<double> ZSetValue::score(std::string_view member) const {
+    if (!large_) {
+        const size_t offset = pack_.find(member, 2);
+        if (offset == pack_.end()) return std::nullopt;
+        return scoreOf(pack_.at(pack_.next(offset)));
+    }
+    const auto* slot = large_->scores.find(member);
+    if (!slot) return std::nullopt;
+    return slot->value;
+}
+
+std::vector<ZSetValue::ScoredMember> ZSetValue::range(size_t start, size_t stop) const {
+    std::vector<ScoredMember> members;
+    members.reserve(stop - start + 1);
+    if (large_) {
+        const SkipList::Node* node = large_->list.at(start);
+        for (size_t i = start; i <= stop; ++i, node = node->next()) {
+            members.emplace_back(node->member, node->score);
+        }
+        return members;
+    }
+    size_t offset = pack_.begin();
+    for (size_t i = 0; i < start; ++i) {
+        offset = pack_.next(pack_.next(offset));
+    }
+    for (size_t i = start; i <= stop; ++i) {
+        const size_t score_offset = pack_.next(offset);
+        members.emplace_back(std::string(pack_.at(offset)), scoreOf(pack_.at(score_offset)));
+        offset = pack_.next(score_offset);
+    }
+    return members;
+}
+
+size_t ZSetValue::size() const {
+    return large_ ? large_->list.size() : pack_.size() / 2;
+}
+
+size_t ZSetValue::bytes() const {
+    if (!large_) return pack_.bytes();
+    return heapBytes(large_.get()) + large_->list.bytes() + large_->scores.tableBytes() +
+           large_->scores.retiredBytes() + large_->key_bytes;
+}
+
+void ZSetValue::convert() {
+    auto large = std::make_unique<Large>();
+    large->scores.reserve(size() + 1);
+    for (size_t offset = pack_.begin(); offset != pack_.end(); offset = pack_.next(pack_.next(offset))) {
+        const std::string_view member = pack_.at(offset);
+        const double score = scoreOf(pack_.at(pack_.next(offset)));
+        large->key_bytes += heapBytes(large->scores.tryEmplace(member, score).first->key);
+        large->list.insert(score, member);
+    }
+    large_ = std::move(large);
+    pack_.clear();
+}
+
+size_t collectionBytes(const Collection& collection) {
+    return std::visit([](const auto& value) { return value.bytes(); }, collection);
+}
+
+std::string collectionPayload(const Collection& collection) {
+    ListPack pack;
+    if (const auto* hash = std::get_if<HashValue>(&collection)) {
+        hash->forEach([&](std::string_view field, std::string_view value) {
+            pack.pushBack(field);
+            pack.pushBack(value);
+        });
+    } else if (const auto* list = std::get_if<ListValue>(&collection)) {
+        if (list->size() == 0) return pack.data();
+        for (const auto& value : list->range(0, list->size() - 1)) {
+            pack.pushBack(value);
+        }
+    } else if (const auto* set = std::get_if<SetValue>(&collection)) {
+        set->forEach([&](std::string_view member) { pack.pushBack(member); });
+    } else {
+        const auto& zset = std::get<ZSetValue>(collection);
+        if (zset.size() == 0) return pack.data();
+        for (const auto& [member, score] : zset.range(0, zset.size() - 1)) {
+            pack.pushBack(member);
+            pack.pushBack(scoreText(score));
+        }
+    }
+    return pack.data();
+}
+
+std::optional<Collection> collectionFromPayload(ValueType type, std::string_view payload) {
+    auto pack = ListPack::fromData(payload);
+    if (!pack || pack->empty()) return std::nullopt;
+    const bool pairs = type == ValueType::Hash || type == ValueType::ZSet;
+    if (pairs && pack->size() % 2 != 0) return std::nullopt;
+
+    switch (type) {
+        case ValueType::Hash: {
+            HashValue hash;
+            for (size_t offset = pack->begin(); offset != pack->end(); offset = pack->next(pack->next(offset))) {
+                hash.set(pack->at(offset), pack->at(pack->next(offset)));
+            }
+            return Collection(std::move(hash));
+        }
+        case ValueType::List: {
+            ListValue list;
+            for (size_t offset = pack->begin(); offset != pack->end(); offset = pack->next(offset)) {
+                list.push(pack->at(offset), false);
+            }
+            return Collection(std::move(list));
+        }
+        case ValueType::Set: {
+            SetValue set;
+            for (size_t offset = pack->begin(); offset != pack->end(); offset = pack->next(offset)) {
+                set.add(pack->at(offset));
+            }
+            return Collection(std::move(set));
+        }
+        case ValueType::ZSet: {
+            ZSetValue zset;
+            for (size_t offset = pack->begin(); offset != pack->end(); offset = pack->next(pack->next(offset))) {
+                const auto score = parseScore(pack->at(pack->next(offset)));
+                if (!score) return std::nullopt;
+                zset.add(*score, pack->at(offset));
+            }
+            return Collection(std::move(zset));
+        }
+        case ValueType::String:
+            break;
+    }
+    return std::nullopt;
+}
+
+}
@@ -0,0 +1,267 @@
+#include "store/store.hpp"
+#include <algorithm>
+
+namespace store {
+
+    namespace {
+        bool isLRU(Store::EvictionPolicy policy) {
+            return policy == Store::EvictionPolicy::AllKeysLRU || policy == Store::EvictionPolicy::VolatileLRU;
+        }
+
+        bool isLFU(Store::EvictionPolicy policy) {
+            return policy == Store::EvictionPolicy::AllKeysLFU || policy == Store::EvictionPolicy::VolatileLFU;
+        }
+
+        bool isVolatile(Store::EvictionPolicy policy) {
+            return policy == Store::EvictionPolicy::VolatileLRU || policy == Store::EvictionPolicy::VolatileLFU ||
+                   policy == Store::EvictionPolicy::VolatileRandom || policy == Store::EvictionPolicy::VolatileTTL;
+        }
+
+        // The LRU clock: milliseconds, wrapping every 49 days. Idle times
+        // are taken modulo the wrap, so a key idle for longer looks recent.
+        uint32_t lruClock(Store::Clock::time_point now) {
+            return static_cast<uint32_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count());
+        }
+
+        // The LFU decay clock: minutes, wrapping every 45 days.
+        uint16_t lfuMinutes(Store::Clock::time_point now) {
+            return static_cast<uint16_t>(
+                std::chrono::duration_cast<std::chrono::minutes>(now.time_since_epoch()).count());
+        }
+
+        // xorshift64*, one per thread, for the LFU counters' coin flips.
+        uint64_t threadRandom() {
+            thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) | 1;
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545f4914f6cdd1dULL;
+        }
+
+        // Morris counter step: the higher the counter, the less likely a
+        // hit is to move it, so 8 bits count up to about a million hits
+        // with the default log factor.
+        uint8_t lfuIncrement(uint8_t counter, unsigned log_factor, uint8_t init) {
+            if (counter == UINT8_MAX) return counter;
+            const double base = counter > init ? counter - init : 0;
+            const double p = 1.0 / (base * log_factor + 1);
+            const double r = static_cast<double>(threadRandom() >> 11) / static_cast<double>(uint64_t{1} << 53);
+            return r < p ? counter + 1 : counter;
+        }
+    }
+
+    std::optional<Store::EvictionPolicy> Store::parseEvictionPolicy(const std::string& name) {
+        for (auto policy : {EvictionPolicy::NoEviction, EvictionPolicy::AllKeysLRU, EvictionPolicy::VolatileLRU,
+                            EvictionPolicy::AllKeysLFU, EvictionPolicy::VolatileLFU, EvictionPolicy::AllKeysRandom,
+                            EvictionPolicy::VolatileRandom, EvictionPolicy::VolatileTTL}) {
+            if (name == evictionPolicyName(policy)) return policy;
+        }
+        return std::nullopt;
+    }
+
+    const char* Store::evictionPolicyName(EvictionPolicy policy) {
+        switch (policy) {
+        case EvictionPolicy::NoEviction: return "noeviction";
+        case EvictionPolicy::AllKeysLRU: return "allkeys-lru";
+        case EvictionPolicy::VolatileLRU: return "volatile-lru";
+        case EvictionPolicy::AllKeysLFU: return "allkeys-lfu";
+        case EvictionPolicy::VolatileLFU: return "volatile-lfu";
+        case EvictionPolicy::AllKeysRandom: return "allkeys-random";
+        case EvictionPolicy::VolatileRandom: return "volatile-random";
+        case EvictionPolicy::VolatileTTL: return "volatile-ttl";
+        }
+        return "noeviction";
+    }
+
+    // Stamps a new entry. Other policies never read the stamp, so they
+    // skip it.
+    void Store::initAccess(Entry& entry, Clock::time_point now) const {
+        const EvictionPolicy policy = eviction_config_.policy;
+        if (isLRU(policy)) {
+            entry.access.store(lruClock(now));
+        } else if (isLFU(policy)) {
+            entry.access.store(static_cast<uint32_t>(lfuMinutes(now)) << 8 | LFU_INIT_VAL);
+        }
+    }
+
+    // Records a read. Called under the shared lock, so it only stores when
+    // the stamp changes: at most once a millisecond for LRU, and rarely
+    // for LFU once a key is hot.
+    void Store::touch(Entry& entry, Clock::time_point now) const {
+        const EvictionPolicy policy = eviction_config_.policy;
+        uint32_t stamp;
+        if (isLRU(policy)) {
+            stamp = lruClock(now);
+        } else if (isLFU(policy)) {
+            const uint8_t counter = lfuIncrement(lfuCounter(entry.access.load(), now),
+                                                 eviction_config_.lfu_log_factor, LFU_INIT_VAL);
+            stamp = static_cast<uint32_t>(lfuMinutes(now)) << 8 | counter;
+        } else {
+            return;
+        }
+        if (entry.access.load() != stamp) {
+            entry.access.store(stamp);
+        }
+    }
+
+    // The counter less one for every decay period since it was last decayed.
+    uint8_t Store::lfuCounter(uint32_t stamp, Clock::time_point now) const {
+        const uint8_t counter = static_cast<uint8_t>(stamp & 0xff);
+        const auto period = eviction_config_.lfu_decay_time.count();
+        if (period <= 0) return counter;
+        const uint16_t elapsed = static_cast<uint16_t>(lfuMinutes(now) - static_cast<uint16_t>(stamp >> 8));
+        const auto periods = elapsed / period;
+        return periods < counter ? static_cast<uint8_t>(counter - periods) : 0;
+    }
+
+    uint64_t Store::evictionScore(const Shard& shard, const FlatMap<Entry>::Slot& slot,
+                                  TimerWheel::Handle timer, Clock::time_point now) const {
+        const EvictionPolicy policy = eviction_config_.policy;
+        if (isLRU(policy)) {
+            return static_cast<uint32_t>(lruClock(now) - slot.value.access.load());
+        }
+        if (isLFU(policy)) {
+            return UINT8_MAX - lfuCounter(slot.value.access.load(), now);
+        }
+        if (policy == EvictionPolicy::VolatileTTL) {
+            return UINT64_MAX - shard.timers.deadline(timer);
+        }
+        return 0;
+    }
+
+    // Samples keys into the pool, each from a random shard that has
+    // something the policy may evict, so candidates span the keyspace.
+    // The pool keeps the best of them across calls, as in Redis.
+    void Store::refillEvictionPool() {
+        const bool volatile_only = isVolatile(eviction_config_.policy);
+        for (size_t i = 0; i < std::max<size_t>(1, eviction_config_.samples); ++i) {
+            const size_t start = static_cast<size_t>(nextRandom());
+            for (size_t attempt = 0; attempt <= shard_mask_; ++attempt) {
+                const size_t index = (start + attempt) & shard_mask_;
+                Shard& shard = shards_[index];
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                TimerWheel::Handle timer = TimerWheel::NONE;
+                FlatMap<Entry>::Slot* slot = nullptr;
+                if (volatile_only) {
+                    timer = shard.timers.sample(nextRandom());
+                    slot = timer != TimerWheel::NONE ? shard.map.find(shard.timers.key(timer)) : nullptr;
+                } else if ((slot = shard.map.sample(nextRandom()))) {
+                    timer = slot->value.timer;
+                }
+                if (!slot) continue;
+                addCandidate(evictionScore(shard, *slot, timer, get_time_()), index, slot->key);
+                break;
+            }
+        }
+    }
+
+    // Keeps the pool sorted and at most EVICTION_POOL_SIZE long, dropping
+    // the worst candidate to make room.
+    void Store::addCandidate(uint64_t score, size_t shard, const std::string& key) {
+        auto existing = std::find_if(eviction_pool_.begin(), eviction_pool_.end(),
+            [&](const PoolEntry& entry) { return entry.shard == shard && entry.key == key; });
+        if (existing != eviction_pool_.end()) {
+            eviction_pool_.erase(existing);
+        } else if (eviction_pool_.size() == EVICTION_POOL_SIZE) {
+            if (score <= eviction_pool_.front().score) return;
+            eviction_pool_.erase(eviction_pool_.begin());
+        }
+        auto position = std::upper_bound(eviction_pool_.begin(), eviction_pool_.end(), score,
+            [](uint64_t value, const PoolEntry& entry) { return value < entry.score; });
+        eviction_pool_.insert(position, PoolEntry{score, shard, key});
+    }
+
+    // Caller holds eviction_mutex_.
+    bool Store::evictOne(const std::function<void(const std::string& key)>& on_evict) {
+        const EvictionPolicy policy = eviction_config_.policy;
+        if (policy == EvictionPolicy::AllKeysRandom || policy == EvictionPolicy::VolatileRandom) {
+            const bool volatile_only = policy == EvictionPolicy::VolatileRandom;
+            const size_t start = static_cast<size_t>(nextRandom());
+            for (size_t attempt = 0; attempt <= shard_mask_; ++attempt) {
+                const size_t index = (start + attempt) & shard_mask_;
+                std::string key;
+                {
+                    Shard& shard = shards_[index];
+                    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                    if (volatile_only) {
+                        const TimerWheel::Handle timer = shard.timers.sample(nextRandom());
+                        if (timer == TimerWheel::NONE) continue;
+                        key = shard.timers.key(timer);
+                    } else {
+                        const auto* slot = shard.map.sample(nextRandom());
+                        if (!slot) continue;
+                        key = slot->key;
+                    }
+                }
+                if (evictKey(index, key, on_evict)) return true;
+            }
+            return false;
+        }
+
+        refillEvictionPool();
+        while (!eviction_pool_.empty()) {
+            PoolEntry candidate = std::move(eviction_pool_.back());
+            eviction_pool_.pop_back();
+            // Gone or changed since it was sampled: try the next best.
+            if (evictKey(candidate.shard, candidate.key, on_evict)) return true;
+        }
+        return false;
+    }
+
+    // on_evict runs under the shard's lock, so a write to the same key
+    // cannot be logged between the eviction and its record.
+    bool Store::evictKey(size_t shard_index, const std::string& key,
+                         const std::function<void(const std::string& key)>& on_evict) {
+        Shard& shard = shards_[shard_index];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = shard.map.find(key);
+        if (!slot) return false;
+        if (isVolatile(eviction_config_.policy) && slot->value.timer == TimerWheel::NONE) return false;
+        eraseEntry(shard, slot);
+        evicted_keys_.fetch_add(1, std::memory_order_relaxed);
+        if (on_evict) {
+            on_evict(key);
+        }
+        return true;
+    }
+
+    bool Store::evictIfNeeded(const std::function<void(const std::string& key)>& on_evict) {
+        const size_t limit = eviction_config_.maxmemory;
+        if (limit == 0 || usedMemory() <= limit) return true;
+        if (eviction_config_.policy == EvictionPolicy::NoEviction) return false;
+
+        std::lock_guard<std::mutex> lock(eviction_mutex_);
+        while (usedMemory() > limit) {
+            if (!evictOne(on_evict)) return false;
+        }
+        return true;
+    }
+
+    // Caller holds eviction_mutex_.
+    uint64_t Store::nextRandom() {
+        random_state_ ^= random_state_ >> 12;
+        random_state_ ^= random_state_ << 25;
+        random_state_ ^= random_state_ >> 27;
+        return random_state_ * 0x2545f4914f6cdd1dULL;
+    }
+
+    std::optional<uint8_t> Store::accessFrequency(std::string_view key) {
+        if (!isLFU(eviction_config_.policy)) return std::nullopt;
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* slot = shard.map.find(key);
+        if (!slot) return std::nullopt;
+        return lfuCounter(slot->value.access.load(), get_time_());
+    }
+
+    std::optional<std::chrono::milliseconds> Store::idleTime(std::string_view key) {
+        if (!isLRU(eviction_config_.policy)) return std::nullopt;
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* slot = shard.map.find(key);
+        if (!slot) return std::nullopt;
+        return std::chrono::milliseconds(static_cast<uint32_t>(lruClock(get_time_()) - slot->value.access.load()));
+    }
+
+}
@@ -0,0 +1,52 @@
+#include "store/memory.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace store {
+
+size_t heapBytes(const std::string& value) {
+    const char* data = value.data();
+    const char* self = reinterpret_cast<const char*>(&value);
+    if (data >= self && data < self + sizeof(value)) {
+        return 0;
+    }
+#if defined(__GLIBC__)
+    return heapBytes(static_cast<const void*>(data));
+#else
+    return value.capacity() + 1;
+#endif
+}
+
+size_t heapBytes(const void* block) {
+#if defined(__GLIBC__)
+    // glibc keeps a size word in front of every chunk it hands out.
+    return malloc_usable_size(const_cast<void*>(block)) + sizeof(size_t);
+#else
+    (void)block;
+    return 0;
+#endif
+}
+
+ProcessMemory processMemory() {
+    ProcessMemory memory;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        unsigned long size = 0;
+        unsigned long resident = 0;
+        if (std::fscanf(statm, "%lu %lu", &size, &resident) == 2) {
+            memory.rss = resident * static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        }
+        std::fclose(statm);
+    }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 info = mallinfo2();
+    memory.allocator_allocated = info.uordblks + info.hblkhd;
+    memory.allocator_active = info.arena + info.hblkhd;
+#endif
+    return memory;
+}
+
+}
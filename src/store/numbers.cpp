@@ -0,0 +1,116 @@
+#include "store/numbers.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace store {
+namespace {
+
+// Every number below SHARED_INTEGERS, zero-padded to four digits; the
+// leading zeros are skipped when a number is read out. Built at compile
+// time, so it is ready before any static initialiser could need it.
+constexpr size_t SHARED_WIDTH = 4;
+static_assert(SHARED_INTEGERS <= 10000, "shared integers are at most four digits");
+
+struct SharedIntegers {
+    char text[SHARED_INTEGERS * SHARED_WIDTH] = {};
+
+    constexpr SharedIntegers() {
+        for (int64_t value = 0; value < SHARED_INTEGERS; ++value) {
+            int64_t rest = value;
+            for (size_t digit = SHARED_WIDTH; digit-- > 0;) {
+                text[value * SHARED_WIDTH + digit] = static_cast<char>('0' + rest % 10);
+                rest /= 10;
+            }
+        }
+    }
+};
+
+constexpr SharedIntegers shared;
+
+size_t digits(int64_t value) {
+    size_t count = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++count;
+    }
+    return count;
+}
+
+}
+
+std::optional<int64_t> parseInteger(std::string_view text) {
+    if (text.empty() || text.size() > INTEGER_TEXT_SIZE) return std::nullopt;
+    const bool negative = text[0] == '-';
+    const std::string_view digits = text.substr(negative ? 1 : 0);
+    // "0" but not "-0" or "007".
+    if (digits.empty() || (digits[0] == '0' && (digits.size() > 1 || negative))) return std::nullopt;
+    int64_t value;
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || end != text.data() + text.size()) return std::nullopt;
+    return value;
+}
+
+std::string_view integerText(int64_t value, char (&buffer)[INTEGER_TEXT_SIZE]) {
+    if (value >= 0 && value < SHARED_INTEGERS) {
+        const size_t length = digits(value);
+        return {shared.text + value * SHARED_WIDTH + SHARED_WIDTH - length, length};
+    }
+    const auto result = std::to_chars(buffer, buffer + INTEGER_TEXT_SIZE, value);
+    return {buffer, static_cast<size_t>(result.ptr - buffer)};
+}
+
+std::optional<long double> parseLongDouble(std::string_view text) {
+    // Redis' bound on the text of a long double.
+    constexpr size_t MAX_TEXT = 5 * 1024;
+    if (text.empty() || text.size() > MAX_TEXT || std::isspace(static_cast<unsigned char>(text[0]))) {
+        return std::nullopt;
+    }
+    // strtold wants a terminated string.
+    const std::string terminated(text);
+    char* end = nullptr;
+    const long double value = std::strtold(terminated.c_str(), &end);
+    if (end != terminated.c_str() + terminated.size() || !std::isfinite(value)) return std::nullopt;
+    return value;
+}
+
+std::string longDoubleText(long double value) {
+    // Fixed notation spells out every digit of the largest long doubles.
+    char buffer[5 * 1024];
+    const int written = std::snprintf(buffer, sizeof(buffer), "%.17Lf", value);
+    std::string text(buffer, static_cast<size_t>(std::max(written, 0)));
+    if (text.find('.') != std::string::npos) {
+        text.erase(text.find_last_not_of('0') + 1);
+        if (text.back() == '.') text.pop_back();
+    }
+    if (text == "-0") text = "0";
+    return text;
+}
+
+std::optional<double> parseScore(std::string_view text) {
+    if (text.empty() || text.size() > 5 * 1024 || std::isspace(static_cast<unsigned char>(text[0]))) {
+        return std::nullopt;
+    }
+    const std::string terminated(text);
+    char* end = nullptr;
+    const double value = std::strtod(terminated.c_str(), &end);
+    if (end != terminated.c_str() + terminated.size() || std::isnan(value)) return std::nullopt;
+    return value;
+}
+
+std::string scoreText(double value) {
+    if (std::isinf(value)) return value > 0 ? "inf" : "-inf";
+    // 17 significant digits always read back exactly; fewer usually do.
+    char buffer[32];
+    int written = 0;
+    for (int precision = 15; precision <= 17; ++precision) {
+        written = std::snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+        if (std::strtod(buffer, nullptr) == value) break;
+    }
+    return std::string(buffer, static_cast<size_t>(std::max(written, 0)));
+}
+
+}
@@ -0,0 +1,273 @@
+#include "store/slab_allocator.hpp"
+#include "store/memory.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace store {
+
+namespace {
+
+constexpr std::array<uint32_t, SlabAllocator::CLASS_COUNT> CLASS_SIZES = [] {
+    std::array<uint32_t, SlabAllocator::CLASS_COUNT> sizes{};
+    size_t count = 0;
+    for (uint32_t size = 16; size <= 32; size += 8) {
+        sizes[count++] = size;
+    }
+    for (uint32_t base = 32; base < SlabAllocator::MAX_CLASS_SIZE; base *= 2) {
+        for (uint32_t step = 1; step <= 4; ++step) {
+            sizes[count++] = base + step * base / 4;
+        }
+    }
+    return sizes;
+}();
+
+static_assert(CLASS_SIZES.back() == SlabAllocator::MAX_CLASS_SIZE, "classes must reach MAX_CLASS_SIZE");
+
+// Size class of every multiple of 8 bytes up to MAX_CLASS_SIZE.
+constexpr std::array<uint8_t, SlabAllocator::MAX_CLASS_SIZE / 8 + 1> CLASS_INDEX = [] {
+    std::array<uint8_t, SlabAllocator::MAX_CLASS_SIZE / 8 + 1> index{};
+    size_t size_class = 0;
+    for (size_t i = 1; i < index.size(); ++i) {
+        while (CLASS_SIZES[size_class] < i * 8) {
+            ++size_class;
+        }
+        index[i] = static_cast<uint8_t>(size_class);
+    }
+    return index;
+}();
+
+}
+
+SlabAllocator::~SlabAllocator() {
+    for (const Slab& slab : slabs_) {
+        std::free(slab.base);
+    }
+}
+
+size_t SlabAllocator::classIndex(size_t size) {
+    return CLASS_INDEX[(size + 7) / 8];
+}
+
+size_t SlabAllocator::classSize(size_t size) {
+    if (size <= INLINE_SIZE || size > MAX_CLASS_SIZE) return 0;
+    return CLASS_SIZES[classIndex(size)];
+}
+
+SlabAllocator::Block SlabAllocator::allocate(std::string_view bytes) {
+    Block block;
+    block.size = static_cast<uint32_t>(bytes.size());
+    if (bytes.size() <= INLINE_SIZE) {
+        block.slab = INLINE;
+        std::memcpy(&block.data, bytes.data(), bytes.size());
+        return block;
+    }
+    if (bytes.size() > MAX_CLASS_SIZE) {
+        block.data = static_cast<char*>(std::malloc(bytes.size()));
+        if (!block.data) throw std::bad_alloc();
+    } else {
+        block.data = allocateSlot(classIndex(bytes.size()), block.slab);
+    }
+    std::memcpy(block.data, bytes.data(), bytes.size());
+    return block;
+}
+
+SlabAllocator::Block SlabAllocator::tagged(const void* bytes, uint8_t tag) {
+    Block block;
+    block.size = INLINE_SIZE;
+    block.slab = INLINE - tag;
+    std::memcpy(&block.data, bytes, INLINE_SIZE);
+    return block;
+}
+
+void SlabAllocator::deallocate(Block& block) {
+    if (block.slab == NO_SLAB) {
+        std::free(block.data);
+    } else if (!block.isInline()) {
+        freeSlot(block.slab, block.data);
+    }
+    block = Block();
+}
+
+void SlabAllocator::assign(Block& block, std::string_view bytes) {
+    if (block.slab < INLINE - MAX_TAG && bytes.size() > INLINE_SIZE && bytes.size() <= MAX_CLASS_SIZE &&
+        classIndex(bytes.size()) == slabs_[block.slab].size_class) {
+        std::memmove(block.data, bytes.data(), bytes.size());
+        block.size = static_cast<uint32_t>(bytes.size());
+        return;
+    }
+    // Allocated first in case bytes points into block.
+    Block replacement = allocate(bytes);
+    deallocate(block);
+    block = replacement;
+}
+
+bool SlabAllocator::defrag(Block& block) {
+    if (block.slab >= INLINE - MAX_TAG) return false;
+    const uint32_t from = block.slab;
+    const size_t size_class = slabs_[from].size_class;
+    SizeClass& cls = classes_[size_class];
+    if (cls.current != NO_SLAB && slabs_[cls.current].live * cls.slabs < cls.live) {
+        // Allocating from a sparse slab would keep it alive; let refill pick
+        // a fuller one and let this one drain like the rest.
+        const uint32_t sparse = cls.current;
+        cls.current = NO_SLAB;
+        if (slabs_[sparse].live == 0) {
+            releaseSlab(sparse);
+        } else {
+            linkPartial(sparse);
+        }
+    }
+    const size_t live = slabs_[from].live;
+    if (from == cls.current || live == slabs_[from].capacity) return false;
+    // Worth moving when the slab it lands in is at least as full, so blocks
+    // never go back and forth, or when this slab is emptier than average
+    // and refill will pick something fuller.
+    const bool target_has_room = cls.current != NO_SLAB &&
+        slabs_[cls.current].live < slabs_[cls.current].capacity;
+    if (target_has_room ? live > slabs_[cls.current].live : live * cls.slabs >= cls.live) {
+        return false;
+    }
+    Block moved;
+    moved.size = block.size;
+    moved.data = allocateSlot(size_class, moved.slab);
+    if (moved.slab == from) {
+        // Every fuller slab was full, so refill picked this one.
+        freeSlot(moved.slab, moved.data);
+        return false;
+    }
+    std::memcpy(moved.data, block.data, block.size);
+    freeSlot(from, block.data);
+    block = moved;
+    return true;
+}
+
+size_t SlabAllocator::bytes(const Block& block) const {
+    if (block.isInline()) return 0;
+    if (block.slab != NO_SLAB) return CLASS_SIZES[slabs_[block.slab].size_class];
+    return block.data ? heapBytes(static_cast<const void*>(block.data)) : 0;
+}
+
+char* SlabAllocator::allocateSlot(size_t size_class, uint32_t& slab_index) {
+    SizeClass& cls = classes_[size_class];
+    uint32_t index = cls.current;
+    if (index == NO_SLAB || slabs_[index].live == slabs_[index].capacity) {
+        index = refill(size_class);
+    }
+    Slab& slab = slabs_[index];
+    char* slot;
+    if (slab.free) {
+        slot = slab.free;
+        std::memcpy(&slab.free, slot, sizeof(slab.free));
+    } else {
+        slot = slab.base + static_cast<size_t>(slab.untouched++) * CLASS_SIZES[size_class];
+    }
+    ++slab.live;
+    ++cls.live;
+    addAllocated(0, CLASS_SIZES[size_class]);
+    slab_index = index;
+    return slot;
+}
+
+void SlabAllocator::freeSlot(uint32_t index, char* slot) {
+    Slab& slab = slabs_[index];
+    SizeClass& cls = classes_[slab.size_class];
+    std::memcpy(slot, &slab.free, sizeof(slab.free));
+    slab.free = slot;
+    const bool was_full = slab.live == slab.capacity;
+    --slab.live;
+    --cls.live;
+    addAllocated(CLASS_SIZES[slab.size_class], 0);
+    if (index == cls.current) return;
+    if (slab.live == 0) {
+        if (!was_full) unlinkPartial(index);
+        releaseSlab(index);
+    } else if (was_full) {
+        linkPartial(index);
+    }
+}
+
+// Called once the current slab is full. Takes the fullest of the first
+// REFILL_CANDIDATES partly used slabs, so the emptier ones get the chance to
+// drain, or a new slab when none has room.
+uint32_t SlabAllocator::refill(size_t size_class) {
+    SizeClass& cls = classes_[size_class];
+    uint32_t best = NO_SLAB;
+    size_t seen = 0;
+    for (uint32_t index = cls.partial; index != NO_SLAB && seen < REFILL_CANDIDATES;
+         index = slabs_[index].next, ++seen) {
+        if (best == NO_SLAB || slabs_[index].live > slabs_[best].live) {
+            best = index;
+        }
+    }
+    if (best != NO_SLAB) {
+        unlinkPartial(best);
+    } else {
+        best = newSlab(size_class);
+    }
+    cls.current = best;
+    return best;
+}
+
+uint32_t SlabAllocator::newSlab(size_t size_class) {
+    char* base = static_cast<char*>(std::malloc(SLAB_SIZE));
+    if (!base) throw std::bad_alloc();
+    uint32_t index;
+    if (free_slabs_ != NO_SLAB) {
+        index = free_slabs_;
+        free_slabs_ = slabs_[index].next;
+    } else {
+        index = static_cast<uint32_t>(slabs_.size());
+        slabs_.emplace_back();
+    }
+    Slab& slab = slabs_[index];
+    slab = Slab();
+    slab.base = base;
+    slab.capacity = static_cast<uint32_t>(SLAB_SIZE / CLASS_SIZES[size_class]);
+    slab.size_class = static_cast<uint8_t>(size_class);
+    ++classes_[size_class].slabs;
+    active_.store(active_.load(std::memory_order_relaxed) + SLAB_SIZE, std::memory_order_relaxed);
+    return index;
+}
+
+void SlabAllocator::releaseSlab(uint32_t index) {
+    Slab& slab = slabs_[index];
+    std::free(slab.base);
+    --classes_[slab.size_class].slabs;
+    active_.store(active_.load(std::memory_order_relaxed) - SLAB_SIZE, std::memory_order_relaxed);
+    slab = Slab();
+    slab.next = free_slabs_;
+    free_slabs_ = index;
+}
+
+void SlabAllocator::linkPartial(uint32_t index) {
+    Slab& slab = slabs_[index];
+    SizeClass& cls = classes_[slab.size_class];
+    slab.prev = NO_SLAB;
+    slab.next = cls.partial;
+    if (cls.partial != NO_SLAB) {
+        slabs_[cls.partial].prev = index;
+    }
+    cls.partial = index;
+}
+
+void SlabAllocator::unlinkPartial(uint32_t index) {
+    Slab& slab = slabs_[index];
+    if (slab.prev != NO_SLAB) {
+        slabs_[slab.prev].next = slab.next;
+    } else {
+        classes_[slab.size_class].partial = slab.next;
+    }
+    if (slab.next != NO_SLAB) {
+        slabs_[slab.next].prev = slab.prev;
+    }
+    slab.prev = NO_SLAB;
+    slab.next = NO_SLAB;
+}
+
+// Written under the owner's lock, so a plain load and store is enough.
+void SlabAllocator::addAllocated(size_t before, size_t after) {
+    allocated_.store(allocated_.load(std::memory_order_relaxed) - before + after, std::memory_order_relaxed);
+}
+
+}
@@ -1,215 +1,915 @@
-#include "store/store.hpp"
-#include "server/metrics.hpp"
-#include <thread>
-#include <chrono>
-#include <iostream>
-
-namespace store {
-
-    size_t Store::calculateMemoryUsage(const std::string& key, const std::string& value) {
-        std::cout << "\n=== Store::calculateMemoryUsage called ===" << std::endl;
-        std::cout << "Key: '" << key << "'" << std::endl;
-        std::cout << "Value: '" << value << "'" << std::endl;
-        std::cout.flush();
-        size_t key_size = key.size();
-        size_t value_size = value.size();
-        size_t expiry_size = sizeof(std::optional<std::chrono::system_clock::time_point>);
-        size_t pair_size = sizeof(std::pair<std::string, std::pair<std::string, std::optional<std::chrono::system_clock::time_point>>>);
-        size_t string_overhead = 2 * sizeof(std::string::size_type);
-        
-        size_t usage = key_size + value_size + expiry_size + pair_size + string_overhead;
-        
-        std::cout << "Memory calculation details:" << std::endl;
-        std::cout << "  Key size: " << key_size << " bytes" << std::endl;
-        std::cout << "  Value size: " << value_size << " bytes" << std::endl;
-        std::cout << "  Expiry size: " << expiry_size << " bytes" << std::endl;
-        std::cout << "  Pair size: " << pair_size << " bytes" << std::endl;
-        std::cout << "  String overhead: " << string_overhead << " bytes" << std::endl;
-        std::cout << "  Total usage: " << usage << " bytes" << std::endl;
-        std::cout << "=== Store::calculateMemoryUsage completed ===\n" << std::endl;
-        std::cout.flush();
-        
-        return usage;
-    }
-
-    void Store::startCleanupThread(std::chrono::seconds interval) {
-        if (running_) return;
-        running_ = true;
-        cleanup_thread_ = std::thread(&Store::cleanupLoop, this, interval);
-    }
-
-    void Store::stopCleanupThread() {
-        if (!running_) return;
-        running_ = false;
-        if (cleanup_thread_.joinable()) {
-            cleanup_thread_.join();
-        }
-    }
-
-    void Store::cleanupLoop(std::chrono::seconds interval) {
-        while (running_) {
-            std::this_thread::sleep_for(interval);
-            if (!running_) break;
-            cleanupExpired();
-        }
-    }
-
-    bool Store::add(const std::string& key, const std::string& value) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        std::cout << "\n=== Store::add called ===" << std::endl;
-        std::cout << "Key: '" << key << "'" << std::endl;
-        std::cout << "Value: '" << value << "'" << std::endl;
-        std::cout.flush();
-
-        if (store.find(key) != store.end()) {
-            std::cout << "Key already exists, returning false" << std::endl;
-            std::cout.flush();
-            return false;
-        }
-
-        std::cout << "Calculating memory usage..." << std::endl;
-        std::cout.flush();
-        size_t memory_usage = calculateMemoryUsage(key, value);
-        
-        std::cout << "Calling Metrics::updateMemoryUsage with " << memory_usage << " bytes..." << std::endl;
-        std::cout.flush();
-        server::Metrics::getInstance().updateMemoryUsage(memory_usage);
-        
-        std::cout << "Storing key-value pair..." << std::endl;
-        std::cout.flush();
-        store[key] = {value, std::nullopt};
-        
-        std::cout << "Key-value pair added successfully" << std::endl;
-        std::cout << "=== Store::add completed ===\n" << std::endl;
-        std::cout.flush();
-        return true;
-    }
-
-    bool Store::remove(const std::string& key) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        std::cout << "Store::remove called for key='" << key << "'" << std::endl;
-        if (store.find(key) == store.end()) {
-            std::cout << "Key not found, returning false" << std::endl;
-            return false;
-        }
-        size_t memory_usage = calculateMemoryUsage(key, store[key].value);
-        std::cout << "Removing memory usage: " << memory_usage << " bytes" << std::endl;
-        server::Metrics::getInstance().updateMemoryUsage(-memory_usage);
-        store.erase(key);
-        std::cout << "Key removed successfully" << std::endl;
-        return true;
-    }
-
-    bool Store::update(const std::string& key, const std::string& value) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        std::cout << "Store::update called for key='" << key << "', value='" << value << "'" << std::endl;
-        if (store.find(key) == store.end()) {
-            std::cout << "Key not found, returning false" << std::endl;
-            return false;
-        }
-        if (isExpired(key)) {
-            std::cout << "Key is expired, removing it" << std::endl;
-            remove(key);
-            return false;
-        }
-        size_t old_memory_usage = calculateMemoryUsage(key, store[key].value);
-        std::cout << "Removing old memory usage: " << old_memory_usage << " bytes" << std::endl;
-        server::Metrics::getInstance().updateMemoryUsage(-old_memory_usage);
-        size_t new_memory_usage = calculateMemoryUsage(key, value);
-        std::cout << "Adding new memory usage: " << new_memory_usage << " bytes" << std::endl;
-        server::Metrics::getInstance().updateMemoryUsage(new_memory_usage);
-        store[key] = {value, std::nullopt};
-        std::cout << "Key-value pair updated successfully" << std::endl;
-        return true;
-    }
-
-    std::optional<std::string> Store::get(const std::string& key) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (store.find(key) == store.end()) {
-            return std::nullopt;
-        }
-        if (isExpired(key)) {
-            remove(key);
-            return std::nullopt;
-        }
-        return store[key].value;
-    }
-
-    std::vector<std::string> Store::getAll() {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        std::vector<std::string> result;
-        for (const auto& [key, _] : store) {
-            if (isExpired(key)) {
-                remove(key);
-                continue;
-            }
-            result.push_back(key);
-        }
-        return result;
-    }
-
-    std::optional<std::chrono::seconds> Store::getTTL(const std::string& key) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (store.find(key) == store.end()) {
-            return std::nullopt;
-        }
-        if (store[key].expiry) {
-            return std::chrono::duration_cast<std::chrono::seconds>(store[key].expiry.value() - get_time_());
-        }
-        return std::nullopt;
-    }
-
-    bool Store::persist(const std::string& key) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (store.find(key) == store.end()) {
-            return false;
-        }
-        if (store[key].expiry) {
-            size_t old_memory_usage = calculateMemoryUsage(key, store[key].value);
-            std::cout << "Removing expiry memory usage: " << old_memory_usage << " bytes" << std::endl;
-            server::Metrics::getInstance().updateMemoryUsage(-old_memory_usage);
-            size_t new_memory_usage = calculateMemoryUsage(key, store[key].value);
-            std::cout << "Adding new memory usage: " << new_memory_usage << " bytes" << std::endl;
-            server::Metrics::getInstance().updateMemoryUsage(new_memory_usage);
-        }
-        store[key].expiry = std::nullopt;
-        return true;
-    }
-
-    bool Store::isExpired(const std::string& key) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (store.find(key) == store.end()) {
-            return false;
-        }
-        return store[key].expiry && store[key].expiry.value() < get_time_();
-    }
-
-    void Store::cleanupExpired() {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        for (auto it = store.begin(); it != store.end();) {
-            if (isExpired(it->first)) {
-                size_t memory_usage = calculateMemoryUsage(it->first, it->second.value);
-                std::cout << "Removing expired key memory usage: " << memory_usage << " bytes" << std::endl;
-                server::Metrics::getInstance().updateMemoryUsage(-memory_usage);
-                it = store.erase(it);
-            } else {
-                ++it;
-            }
-        }
-    }
-
-    bool Store::setExpiry(const std::string& key, std::chrono::seconds ttl) {
-        std::lock_guard<std::recursive_mutex> lock(mutex);
-        if (store.find(key) == store.end()) {
-            return false;
-        }
-        if (store[key].expiry) {
-            size_t old_memory_usage = calculateMemoryUsage(key, store[key].value);
-            server::Metrics::getInstance().updateMemoryUsage(-old_memory_usage);
-        }
-        size_t new_memory_usage = calculateMemoryUsage(key, store[key].value);
-        server::Metrics::getInstance().updateMemoryUsage(new_memory_usage);
-        store[key].expiry = get_time_() + ttl;
-        return true;
-    }
+#include "store/store.hpp"
+#include "store/memory.hpp"
+#include "store/numbers.hpp"
+#include "server/latency_monitor.hpp"
+#include <thread>
+#include <chrono>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+
+namespace store {
+
+    Store::Store(TimeProvider time_provider, size_t shard_count)
+        : time_provider_(time_provider), running_(false) {
+        size_t count = 1;
+        while (count < shard_count) {
+            count <<= 1;
+        }
+        shards_ = std::make_unique<Shard[]>(count);
+        shard_mask_ = count - 1;
+    }
+
+    Store::~Store() {
+        stopCleanupThread();
+        // Slabs go with their allocator; values too big for one came from
+        // malloc and must be freed one by one, like collections.
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            Shard& shard = shards_[i];
+            shard.map.forEach([&](FlatMap<Entry>::Slot& slot) { releaseValue(shard, slot.value); });
+        }
+    }
+
+    size_t Store::shardIndex(std::string_view key) const {
+        // Mix the hash so shard selection doesn't correlate with the bucket
+        // index the shard's own map derives from the same hash.
+        uint64_t hash = std::hash<std::string_view>{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash & shard_mask_;
+    }
+
+    std::vector<std::pair<size_t, size_t>> Store::groupByShard(const std::vector<std::string_view>& keys) const {
+        // A counting sort: there are few shards, and it keeps each shard's
+        // keys in the order given.
+        std::vector<size_t> shards(keys.size());
+        std::vector<size_t> starts(shard_mask_ + 2, 0);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            shards[i] = shardIndex(keys[i]);
+            ++starts[shards[i] + 1];
+        }
+        for (size_t shard = 1; shard < starts.size(); ++shard) {
+            starts[shard] += starts[shard - 1];
+        }
+        std::vector<std::pair<size_t, size_t>> order(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            order[starts[shards[i]]++] = {shards[i], i};
+        }
+        return order;
+    }
+
+    std::vector<std::unique_lock<std::shared_mutex>> Store::lockShards(
+            const std::vector<std::pair<size_t, size_t>>& order) {
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i == 0 || order[i].first != order[i - 1].first) {
+                locks.emplace_back(shards_[order[i].first].mutex);
+            }
+        }
+        return locks;
+    }
+
+    bool Store::isExpired(const Entry& entry, Clock::time_point now) const {
+        return entry.expiry && entry.expiry.value() < now && !loading_.load(std::memory_order_relaxed);
+    }
+
+    namespace {
+        // Whole milliseconds elapsed at now.
+        uint64_t tickAt(Store::Clock::time_point now) {
+            auto ms = std::chrono::floor<std::chrono::milliseconds>(now.time_since_epoch()).count();
+            return ms > 0 ? static_cast<uint64_t>(ms) : 0;
+        }
+
+        // First tick at which a key with this deadline is expired, so a timer
+        // never fires before isExpired agrees.
+        uint64_t tickAfter(Store::Clock::time_point deadline) {
+            return tickAt(deadline) + 1;
+        }
+    }
+
+    // Caller holds the shard's unique lock.
+    void Store::eraseEntry(Shard& shard, FlatMap<Entry>::Slot* slot) {
+        const size_t bytes = entryBytes(shard, *slot);
+        untrackExpiry(shard, slot->value);
+        releaseValue(shard, slot->value);
+        shard.map.erase(slot);
+        account(shard, bytes, 0);
+    }
+
+    // Heap bytes owned by one entry.
+    size_t Store::entryBytes(const Shard& shard, const FlatMap<Entry>::Slot& slot) const {
+        size_t bytes = heapBytes(slot.key) + shard.values.bytes(slot.value.value);
+        if (slot.value.value.tag() == COLLECTION_TAG) {
+            const Collection* collection = collectionOf(slot.value);
+            bytes += heapBytes(static_cast<const void*>(collection)) + collectionBytes(*collection);
+        }
+        if (slot.value.timer != TimerWheel::NONE) {
+            bytes += heapBytes(shard.timers.key(slot.value.timer));
+        }
+        return bytes;
+    }
+
+    // Replaces before bytes of entry data with after, and refreshes the size
+    // of the shard's arrays, which any insert or erase may have changed.
+    // Caller holds the shard's unique lock, so nothing else writes the
+    // counters.
+    void Store::account(Shard& shard, size_t before, size_t after) {
+        shard.data_bytes.store(shard.data_bytes.load(std::memory_order_relaxed) - before + after,
+                               std::memory_order_relaxed);
+        shard.table_bytes.store(shard.map.tableBytes() + shard.map.retiredBytes() + shard.timers.tableBytes(),
+                                std::memory_order_relaxed);
+    }
+
+    void Store::updatePeak(size_t used) {
+        size_t peak = peak_bytes_.load(std::memory_order_relaxed);
+        while (used > peak && !peak_bytes_.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+        }
+    }
+
+    Store::MemoryStats Store::memoryStats() {
+        MemoryStats stats;
+        stats.shards.reserve(shard_mask_ + 1);
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            const size_t data = shards_[i].data_bytes.load(std::memory_order_relaxed);
+            const size_t tables = sizeof(Shard) + shards_[i].table_bytes.load(std::memory_order_relaxed);
+            stats.dataset += data;
+            stats.overhead += tables;
+            stats.shards.push_back(data + tables);
+            stats.slab_active += shards_[i].values.activeBytes();
+            stats.slab_free += shards_[i].values.activeBytes() - shards_[i].values.allocatedBytes();
+        }
+        updatePeak(stats.used());
+        stats.peak = peak_bytes_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    size_t Store::usedMemory() const {
+        size_t used = (shard_mask_ + 1) * sizeof(Shard);
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            used += shards_[i].data_bytes.load(std::memory_order_relaxed) +
+                    shards_[i].table_bytes.load(std::memory_order_relaxed);
+        }
+        return used;
+    }
+
+    // Sets or clears an entry's TTL and keeps its timer in step. Caller holds
+    // the shard's unique lock.
+    void Store::setEntryExpiry(Shard& shard, FlatMap<Entry>::Slot& slot, Expiry expiry) {
+        slot.value.expiry = expiry;
+        if (!expiry) {
+            untrackExpiry(shard, slot.value);
+        } else if (slot.value.timer == TimerWheel::NONE) {
+            slot.value.timer = shard.timers.schedule(slot.key, tickAfter(*expiry), tickAt(get_time_()));
+        } else {
+            shard.timers.reschedule(slot.value.timer, tickAfter(*expiry));
+        }
+    }
+
+    // Caller holds the shard's unique lock.
+    void Store::untrackExpiry(Shard& shard, Entry& entry) {
+        if (entry.timer == TimerWheel::NONE) return;
+        shard.timers.cancel(entry.timer);
+        entry.timer = TimerWheel::NONE;
+    }
+
+    void Store::startCleanupThread(std::chrono::milliseconds tick) {
+        if (running_) return;
+        running_ = true;
+        cleanup_thread_ = std::thread(&Store::cleanupLoop, this, tick);
+    }
+
+    void Store::stopCleanupThread() {
+        if (!running_) return;
+        running_ = false;
+        if (cleanup_thread_.joinable()) {
+            cleanup_thread_.join();
+        }
+    }
+
+    void Store::cleanupLoop(std::chrono::milliseconds tick) {
+        while (running_) {
+            std::this_thread::sleep_for(tick);
+            if (!running_) break;
+            {
+                server::LatencyMonitor::Timer timer("expire-cycle");
+                activeExpireCycle();
+            }
+            {
+                server::LatencyMonitor::Timer timer("rehash-cycle");
+                rehashIdleShards();
+            }
+            if (defrag_config_.enabled) {
+                server::LatencyMonitor::Timer timer("active-defrag-cycle");
+                activeDefragCycle();
+            }
+            updatePeak(usedMemory());
+        }
+    }
+
+    // Visits shards round-robin, resuming on the shard where the previous
+    // cycle ran out of time. A shard's lock is dropped after every
+    // keys_per_loop keys, so it is never blocked for more than one batch.
+    size_t Store::activeExpireCycle() {
+        const auto deadline = std::chrono::steady_clock::now() + expire_config_.time_budget;
+        const size_t keys_per_loop = std::max<size_t>(1, expire_config_.keys_per_loop);
+        size_t reclaimed = 0;
+
+        for (size_t visited = 0; visited <= shard_mask_; ++visited) {
+            Shard& shard = shards_[expire_cursor_ & shard_mask_];
+            bool drained = false;
+            while (!drained) {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                shard.timers.advance(tickAt(get_time_()));
+                size_t expired = 0;
+                TimerWheel::Handle due;
+                while (expired < keys_per_loop && (due = shard.timers.nextDue()) != TimerWheel::NONE) {
+                    eraseEntry(shard, shard.map.find(shard.timers.key(due)));
+                    ++expired;
+                }
+                drained = shard.timers.nextDue() == TimerWheel::NONE;
+                lock.unlock();
+
+                reclaimed += expired;
+                if (std::chrono::steady_clock::now() >= deadline) break;
+            }
+            if (!drained) break;
+            ++expire_cursor_;
+        }
+
+        expired_keys_.fetch_add(reclaimed, std::memory_order_relaxed);
+        return reclaimed;
+    }
+
+    // Visits shards round-robin like activeExpireCycle, skipping those whose
+    // slabs are not fragmented enough to be worth the copying.
+    size_t Store::activeDefragCycle() {
+        const auto deadline = std::chrono::steady_clock::now() + defrag_config_.time_budget;
+        size_t moved = 0;
+        bool unfinished = false;
+        for (size_t visited = 0; visited <= shard_mask_; ++visited) {
+            Shard& shard = shards_[defrag_shard_ & shard_mask_];
+            const size_t active = shard.values.activeBytes();
+            const size_t free = active - shard.values.allocatedBytes();
+            if (free > defrag_config_.ignore_bytes && free * 100 > active * defrag_config_.threshold_lower) {
+                defrag_running_.store(true, std::memory_order_relaxed);
+                if (!defragShard(shard, deadline, moved)) {
+                    unfinished = true;
+                    break;
+                }
+            }
+            ++defrag_shard_;
+            if (std::chrono::steady_clock::now() >= deadline) break;
+        }
+        defrag_running_.store(unfinished, std::memory_order_relaxed);
+        return moved;
+    }
+
+    // Scans the shard's map from where the last cycle left it, a batch of
+    // keys_per_loop slots per lock. Returns false if time ran out first.
+    bool Store::defragShard(Shard& shard, const std::chrono::steady_clock::time_point& deadline,
+                            size_t& moved) {
+        const size_t keys_per_loop = std::max<size_t>(1, defrag_config_.keys_per_loop);
+        while (true) {
+            size_t hits = 0;
+            size_t misses = 0;
+            {
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                shard.defrag_cursor = shard.map.scan(shard.defrag_cursor, keys_per_loop,
+                                                     [&](FlatMap<Entry>::Slot& slot) {
+                    if (shard.values.defrag(slot.value.value)) {
+                        ++hits;
+                    } else {
+                        ++misses;
+                    }
+                });
+            }
+            moved += hits;
+            defrag_hits_.fetch_add(hits, std::memory_order_relaxed);
+            defrag_misses_.fetch_add(misses, std::memory_order_relaxed);
+            if (shard.defrag_cursor == 0) return true;
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+        }
+    }
+
+    // Moves a pending rehash along on shards nobody is using right now, so
+    // migrations finish even when writes stop.
+    void Store::rehashIdleShards() {
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            Shard& shard = shards_[i];
+            FlatMap<Entry>::Retired retired;
+            std::unique_lock<std::shared_mutex> lock(shard.mutex, std::try_to_lock);
+            if (!lock.owns_lock()) continue;
+            shard.map.rehashStep(BACKGROUND_REHASH_SLOTS);
+            // Freed after the lock is released.
+            retired = shard.map.takeRetired();
+            account(shard, 0, 0);
+        }
+    }
+
+    bool Store::add(std::string_view key, std::string_view value, Expiry expiry) {
+        return setIfAbsent(key, value, expiry);
+    }
+
+    Store::SetResult Store::set(std::string_view key, std::string_view value, Expiry expiry,
+                                const SetOptions& options, const std::function<void(const SetResult&)>& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto result = write(shard, key, value, expiry, options, get_time_());
+        if (result.written && on_write) {
+            on_write(result);
+        }
+        return result;
+    }
+
+    bool Store::upsert(std::string_view key, std::string_view value, Expiry expiry) {
+        return set(key, value, expiry, {}).created;
+    }
+
+    bool Store::setIfAbsent(std::string_view key, std::string_view value, Expiry expiry) {
+        return set(key, value, expiry, {SetCondition::IfAbsent}).written;
+    }
+
+    bool Store::setIfPresent(std::string_view key, std::string_view value, Expiry expiry) {
+        return set(key, value, expiry, {SetCondition::IfPresent}).written;
+    }
+
+    // Caller holds the shard's unique lock. The key is looked up once:
+    // tryEmplace finds it or inserts it in the same probe, and IfPresent,
+    // which must not insert, uses find instead. An expired entry counts as
+    // missing and is reused in place.
+    Store::SetResult Store::write(Shard& shard, std::string_view key, std::string_view value, Expiry expiry,
+                                  const SetOptions& options, Clock::time_point now) {
+        SetResult result;
+        FlatMap<Entry>::Slot* slot;
+        bool exists;
+        if (options.condition == SetCondition::IfPresent) {
+            slot = shard.map.find(key);
+            exists = slot != nullptr;
+        } else {
+            bool inserted;
+            std::tie(slot, inserted) = shard.map.tryEmplace(key);
+            exists = !inserted;
+        }
+
+        size_t before = 0;
+        if (exists) {
+            before = entryBytes(shard, *slot);
+            if (isExpired(slot->value, now)) {
+                expired_keys_.fetch_add(1, std::memory_order_relaxed);
+                if (options.condition == SetCondition::IfPresent) {
+                    eraseEntry(shard, slot);
+                    return result;
+                }
+                setEntryExpiry(shard, *slot, std::nullopt);
+                exists = false;
+            } else if (options.get) {
+                if (slot->value.value.tag() == COLLECTION_TAG) {
+                    account(shard, 0, 0);
+                    throw WrongType();
+                }
+                result.previous = valueText(slot->value);
+            }
+        }
+        if (!slot) {
+            return result;
+        }
+        if (exists && options.condition == SetCondition::IfAbsent) {
+            // tryEmplace may still have moved a rehash along.
+            account(shard, 0, 0);
+            result.expiry = slot->value.expiry;
+            return result;
+        }
+
+        storeValue(shard, slot->value, value);
+        if (!options.keep_ttl && (expiry || slot->value.expiry)) {
+            setEntryExpiry(shard, *slot, expiry);
+        }
+        if (exists) {
+            touch(slot->value, now);
+        } else {
+            initAccess(slot->value, now);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        result.written = true;
+        result.created = !exists;
+        result.expiry = slot->value.expiry;
+        return result;
+    }
+
+    Store::IncrementResult Store::incrementBy(std::string_view key, int64_t delta,
+                                                const std::function<void(const IncrementResult&)>& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const auto now = get_time_();
+        bool exists;
+        size_t before;
+        auto* slot = claim(shard, key, now, exists, before);
+
+        if (exists && slot->value.value.tag() == COLLECTION_TAG) {
+            account(shard, 0, 0);
+            throw WrongType();
+        }
+        IncrementResult result;
+        const bool integer = slot->value.value.tag() == INTEGER_TAG;
+        const int64_t current = exists && integer ? integerOf(slot->value) : 0;
+        if (exists && !integer) {
+            result.status = IncrementResult::Status::NotNumber;
+        } else if (__builtin_add_overflow(current, delta, &result.integer)) {
+            result.status = IncrementResult::Status::OutOfRange;
+        }
+        if (result.status != IncrementResult::Status::Ok) {
+            account(shard, 0, 0);
+            return result;
+        }
+        storeInteger(shard, slot->value, result.integer);
+        if (exists) {
+            touch(slot->value, now);
+        } else {
+            initAccess(slot->value, now);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        result.expiry = slot->value.expiry;
+        if (on_write) {
+            on_write(result);
+        }
+        return result;
+    }
+
+    Store::IncrementResult Store::incrementByFloat(std::string_view key, long double delta,
+                                                     const std::function<void(const IncrementResult&)>& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const auto now = get_time_();
+        bool exists;
+        size_t before;
+        auto* slot = claim(shard, key, now, exists, before);
+
+        if (exists && slot->value.value.tag() == COLLECTION_TAG) {
+            account(shard, 0, 0);
+            throw WrongType();
+        }
+        IncrementResult result;
+        std::optional<long double> current = 0;
+        if (exists) {
+            current = slot->value.value.tag() == INTEGER_TAG ? static_cast<long double>(integerOf(slot->value))
+                                                             : parseLongDouble(slot->value.value.view());
+        }
+        if (!current) {
+            result.status = IncrementResult::Status::NotNumber;
+        } else if (!std::isfinite(*current + delta)) {
+            result.status = IncrementResult::Status::OutOfRange;
+        }
+        if (result.status != IncrementResult::Status::Ok) {
+            if (!exists) {
+                // A key that had just expired stays cleared.
+                eraseEntry(shard, slot);
+            }
+            account(shard, 0, 0);
+            return result;
+        }
+        result.text = longDoubleText(*current + delta);
+        storeValue(shard, slot->value, result.text);
+        if (exists) {
+            touch(slot->value, now);
+        } else {
+            initAccess(slot->value, now);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        result.expiry = slot->value.expiry;
+        if (on_write) {
+            on_write(result);
+        }
+        return result;
+    }
+
+    FlatMap<Store::Entry>::Slot* Store::claim(Shard& shard, std::string_view key, Clock::time_point now,
+                                              bool& exists, size_t& before) {
+        auto [slot, inserted] = shard.map.tryEmplace(key);
+        exists = !inserted;
+        before = 0;
+        if (exists) {
+            before = entryBytes(shard, *slot);
+            if (isExpired(slot->value, now)) {
+                expired_keys_.fetch_add(1, std::memory_order_relaxed);
+                setEntryExpiry(shard, *slot, std::nullopt);
+                exists = false;
+            }
+        }
+        return slot;
+    }
+
+    void Store::storeValue(Shard& shard, Entry& entry, std::string_view value) {
+        if (auto number = parseInteger(value)) {
+            storeInteger(shard, entry, *number);
+            return;
+        }
+        if (entry.value.tag() == COLLECTION_TAG) {
+            releaseValue(shard, entry);
+        }
+        shard.values.assign(entry.value, value);
+    }
+
+    // An int64 fits the allocator's inline bytes, so it never takes a slot,
+    // and the tag keeps the entry as small as any other.
+    void Store::storeInteger(Shard& shard, Entry& entry, int64_t value) {
+        static_assert(sizeof(value) <= SlabAllocator::INLINE_SIZE, "integers are stored inline");
+        if (entry.value.tag() == INTEGER_TAG) {
+            std::memcpy(&entry.value.data, &value, sizeof(value));
+            return;
+        }
+        releaseValue(shard, entry);
+        entry.value = SlabAllocator::tagged(&value, INTEGER_TAG);
+    }
+
+    int64_t Store::integerOf(const Entry& entry) {
+        int64_t value;
+        std::memcpy(&value, entry.value.view().data(), sizeof(value));
+        return value;
+    }
+
+    Collection* Store::collectionOf(const Entry& entry) {
+        Collection* collection;
+        std::memcpy(&collection, entry.value.view().data(), sizeof(collection));
+        return collection;
+    }
+
+    void Store::releaseValue(Shard& shard, Entry& entry) {
+        if (entry.value.tag() == COLLECTION_TAG) {
+            delete collectionOf(entry);
+            entry.value = SlabAllocator::Block();
+            return;
+        }
+        shard.values.deallocate(entry.value);
+    }
+
+    std::string Store::valueText(const Entry& entry) {
+        if (entry.value.tag() != INTEGER_TAG) {
+            return std::string(entry.value.view());
+        }
+        char buffer[INTEGER_TEXT_SIZE];
+        return std::string(integerText(integerOf(entry), buffer));
+    }
+
+    FlatMap<Store::Entry>::Slot* Store::findLive(Shard& shard, std::string_view key, Clock::time_point now) {
+        auto* slot = shard.map.find(key);
+        if (slot && isExpired(slot->value, now)) {
+            eraseEntry(shard, slot);
+            expired_keys_.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return slot;
+    }
+
+    bool Store::remove(std::string_view key, const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = findLive(shard, key, get_time_());
+        if (!slot) {
+            return false;
+        }
+        eraseEntry(shard, slot);
+        if (on_write) {
+            on_write();
+        }
+        return true;
+    }
+
+    bool Store::update(std::string_view key, std::string_view value) {
+        return setIfPresent(key, value);
+    }
+
+    std::optional<std::string> Store::get(std::string_view key) {
+        Shard& shard = shardFor(key);
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto* slot = shard.map.find(key);
+            if (!slot) {
+                return std::nullopt;
+            }
+            const auto now = get_time_();
+            if (!isExpired(slot->value, now)) {
+                if (slot->value.value.tag() == COLLECTION_TAG) throw WrongType();
+                touch(slot->value, now);
+                return valueText(slot->value);
+            }
+        }
+
+        // Expired: retake the lock exclusively to reclaim the entry. Another
+        // thread may have replaced or removed it in between.
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = shard.map.find(key);
+        if (!slot) {
+            return std::nullopt;
+        }
+        if (isExpired(slot->value, get_time_())) {
+            eraseEntry(shard, slot);
+            expired_keys_.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        if (slot->value.value.tag() == COLLECTION_TAG) throw WrongType();
+        return valueText(slot->value);
+    }
+
+    std::vector<std::optional<std::string>> Store::getMany(const std::vector<std::string_view>& keys) {
+        std::vector<std::optional<std::string>> values(keys.size());
+        const auto order = groupByShard(keys);
+        for (size_t i = 0; i < order.size();) {
+            Shard& shard = shards_[order[i].first];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            const auto now = get_time_();
+            // Expired entries read as missing and are left to the expire
+            // cycle, which keeps this to the shared lock. As in Redis,
+            // collections read as missing too.
+            for (const size_t index = order[i].first; i < order.size() && order[i].first == index; ++i) {
+                auto* slot = shard.map.find(keys[order[i].second]);
+                if (slot && !isExpired(slot->value, now) && slot->value.value.tag() != COLLECTION_TAG) {
+                    touch(slot->value, now);
+                    values[order[i].second] = valueText(slot->value);
+                }
+            }
+        }
+        return values;
+    }
+
+    size_t Store::removeMany(const std::vector<std::string_view>& keys,
+                             const std::function<void(const std::vector<std::string_view>& removed)>& on_remove) {
+        size_t removed = 0;
+        std::vector<std::string_view> shard_removed;
+        const auto order = groupByShard(keys);
+        for (size_t i = 0; i < order.size();) {
+            Shard& shard = shards_[order[i].first];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            const auto now = get_time_();
+            shard_removed.clear();
+            for (const size_t index = order[i].first; i < order.size() && order[i].first == index; ++i) {
+                const std::string_view key = keys[order[i].second];
+                auto* slot = shard.map.find(key);
+                if (!slot) continue;
+                if (isExpired(slot->value, now)) {
+                    expired_keys_.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    shard_removed.push_back(key);
+                }
+                eraseEntry(shard, slot);
+            }
+            removed += shard_removed.size();
+            if (!shard_removed.empty() && on_remove) {
+                on_remove(shard_removed);
+            }
+        }
+        return removed;
+    }
+
+    size_t Store::existsMany(const std::vector<std::string_view>& keys) {
+        size_t found = 0;
+        const auto order = groupByShard(keys);
+        for (size_t i = 0; i < order.size();) {
+            Shard& shard = shards_[order[i].first];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            const auto now = get_time_();
+            for (const size_t index = order[i].first; i < order.size() && order[i].first == index; ++i) {
+                auto* slot = shard.map.find(keys[order[i].second]);
+                if (slot && !isExpired(slot->value, now)) {
+                    ++found;
+                }
+            }
+        }
+        return found;
+    }
+
+    void Store::setMany(const std::vector<KeyValue>& pairs, const OnWrite& on_write) {
+        std::vector<std::string_view> keys;
+        keys.reserve(pairs.size());
+        for (const auto& pair : pairs) {
+            keys.push_back(pair.first);
+        }
+        const auto order = groupByShard(keys);
+        const auto locks = lockShards(order);
+        const auto now = get_time_();
+        for (const auto& [index, position] : order) {
+            write(shards_[index], pairs[position].first, pairs[position].second, std::nullopt, {}, now);
+        }
+        if (on_write) {
+            on_write();
+        }
+    }
+
+    bool Store::setManyIfAbsent(const std::vector<KeyValue>& pairs, const OnWrite& on_write) {
+        std::vector<std::string_view> keys;
+        keys.reserve(pairs.size());
+        for (const auto& pair : pairs) {
+            keys.push_back(pair.first);
+        }
+        const auto order = groupByShard(keys);
+        const auto locks = lockShards(order);
+        const auto now = get_time_();
+        for (const auto& [index, position] : order) {
+            auto* slot = shards_[index].map.find(keys[position]);
+            if (slot && !isExpired(slot->value, now)) {
+                return false;
+            }
+        }
+        for (const auto& [index, position] : order) {
+            write(shards_[index], pairs[position].first, pairs[position].second, std::nullopt, {}, now);
+        }
+        if (on_write) {
+            on_write();
+        }
+        return true;
+    }
+
+    std::vector<std::string> Store::getAll() {
+        std::vector<std::string> result;
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            Shard& shard = shards_[i];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            const auto now = get_time_();
+            shard.map.forEach([&](const FlatMap<Entry>::Slot& slot) {
+                if (!isExpired(slot.value, now)) {
+                    result.push_back(slot.key);
+                }
+            });
+        }
+        return result;
+    }
+
+    // Taking each shard's lock to mark it waits out the writers inside it,
+    // which log before they let go, so everything logged before on_start
+    // is in the copies.
+    void Store::snapshot(const SnapshotVisitor& visit, const std::function<void()>& on_start) {
+        struct Copy {
+            std::string key;
+            ValueType type;
+            Value value;
+            Expiry expiry;
+        };
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+            shards_[i].copies_pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        size_t copied = 0;
+        try {
+            if (on_start) {
+                on_start();
+            }
+            std::vector<Copy> copies;
+            while (copied <= shard_mask_) {
+                Shard& shard = shards_[copied];
+                copies.clear();
+                {
+                    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                    const auto now = get_time_();
+                    copies.reserve(shard.map.size());
+                    shard.map.forEach([&](const FlatMap<Entry>::Slot& slot) {
+                        if (isExpired(slot.value, now)) return;
+                        if (slot.value.value.tag() == COLLECTION_TAG) {
+                            const Collection& collection = *collectionOf(slot.value);
+                            copies.push_back({slot.key, collectionType(collection), collectionPayload(collection),
+                                              slot.value.expiry});
+                        } else {
+                            copies.push_back({slot.key, ValueType::String, valueText(slot.value),
+                                              slot.value.expiry});
+                        }
+                    });
+                    shard.copies_pending.fetch_sub(1, std::memory_order_relaxed);
+                    ++copied;
+                }
+                for (const auto& copy : copies) {
+                    visit(copy.key, copy.type, copy.value, copy.expiry);
+                }
+            }
+        } catch (...) {
+            for (; copied <= shard_mask_; ++copied) {
+                std::shared_lock<std::shared_mutex> lock(shards_[copied].mutex);
+                shards_[copied].copies_pending.fetch_sub(1, std::memory_order_relaxed);
+            }
+            throw;
+        }
+    }
+
+    std::optional<std::chrono::seconds> Store::getTTL(std::string_view key) {
+        bool exists;
+        return getTTL(key, exists);
+    }
+
+    std::optional<std::chrono::seconds> Store::getTTL(std::string_view key, bool& exists) {
+        auto ttl = getPTTL(key, exists);
+        if (!ttl) {
+            return std::nullopt;
+        }
+        // Rounded to the nearest second, as Redis does, so a TTL just set
+        // reads back as given.
+        return std::chrono::seconds((ttl->count() + 500) / 1000);
+    }
+
+    std::optional<std::chrono::milliseconds> Store::getPTTL(std::string_view key) {
+        bool exists;
+        return getPTTL(key, exists);
+    }
+
+    std::optional<std::chrono::milliseconds> Store::getPTTL(std::string_view key, bool& exists) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = shard.map.find(key);
+        const auto now = get_time_();
+        // Expired entries read as missing and are left to the expire cycle.
+        exists = slot && !isExpired(slot->value, now);
+        if (!exists || !slot->value.expiry) {
+            return std::nullopt;
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(slot->value.expiry.value() - now);
+    }
+
+    bool Store::persist(std::string_view key, const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = findLive(shard, key, get_time_());
+        if (!slot) {
+            return false;
+        }
+        const size_t before = entryBytes(shard, *slot);
+        setEntryExpiry(shard, *slot, std::nullopt);
+        account(shard, before, entryBytes(shard, *slot));
+        if (on_write) {
+            on_write();
+        }
+        return true;
+    }
+
+    // Sweeps one shard at a time so a cleanup pass never blocks the whole
+    // keyspace.
+    void Store::cleanupExpired() {
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            Shard& shard = shards_[i];
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            const auto now = get_time_();
+            size_t freed = 0;
+            size_t erased = shard.map.eraseIf([&](FlatMap<Entry>::Slot& slot) {
+                if (!isExpired(slot.value, now)) {
+                    return false;
+                }
+                freed += entryBytes(shard, slot);
+                untrackExpiry(shard, slot.value);
+                releaseValue(shard, slot.value);
+                return true;
+            });
+            account(shard, freed, 0);
+            expired_keys_.fetch_add(erased, std::memory_order_relaxed);
+        }
+    }
+
+    bool Store::setExpiry(std::string_view key, std::chrono::seconds ttl) {
+        return setExpiryAt(key, get_time_() + ttl);
+    }
+
+    bool Store::expireAt(std::string_view key, std::chrono::system_clock::time_point when,
+                         const OnWrite& on_write) {
+        return setExpiryAt(key, deadlineAt(when), on_write);
+    }
+
+    Store::Clock::time_point Store::deadlineAt(std::chrono::system_clock::time_point when) const {
+        const auto remaining = when - std::chrono::system_clock::now();
+        return get_time_() + std::chrono::duration_cast<Clock::duration>(remaining);
+    }
+
+    std::chrono::system_clock::time_point Store::wallClockAt(Clock::time_point deadline) const {
+        const auto remaining = deadline - get_time_();
+        return std::chrono::system_clock::now() +
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(remaining);
+    }
+
+    bool Store::setExpiryAt(std::string_view key, Clock::time_point when, const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = findLive(shard, key, get_time_());
+        if (!slot) {
+            return false;
+        }
+        const size_t before = entryBytes(shard, *slot);
+        setEntryExpiry(shard, *slot, when);
+        account(shard, before, entryBytes(shard, *slot));
+        if (on_write) {
+            on_write();
+        }
+        return true;
+    }
+
+    size_t Store::size() {
+        size_t total = 0;
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+            total += shards_[i].map.size();
+        }
+        return total;
+    }
+
+    size_t Store::volatileCount() {
+        size_t total = 0;
+        for (size_t i = 0; i <= shard_mask_; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards_[i].mutex);
+            total += shards_[i].timers.size();
+        }
+        return total;
+    }
 }
\ No newline at end of file
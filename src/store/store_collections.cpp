@@ -0,0 +1,278 @@
+#include "store/store.hpp"
+#include <algorithm>
+
+namespace store {
+
+    namespace {
+        Collection emptyCollection(ValueType type) {
+            switch (type) {
+                case ValueType::Hash: return Collection(std::in_place_type<HashValue>);
+                case ValueType::List: return Collection(std::in_place_type<ListValue>);
+                case ValueType::Set: return Collection(std::in_place_type<SetValue>);
+                default: return Collection(std::in_place_type<ZSetValue>);
+            }
+        }
+
+        // Turns LRANGE's indexes into positions within size. Returns false
+        // if the range is empty.
+        bool clipRange(int64_t& start, int64_t& stop, size_t size) {
+            const auto length = static_cast<int64_t>(size);
+            if (start < 0) start = std::max<int64_t>(start + length, 0);
+            if (stop < 0) stop += length;
+            stop = std::min(stop, length - 1);
+            return start <= stop && start < length;
+        }
+    }
+
+    // Caller holds the shard's unique lock. A key of another type is left
+    // as it was, apart from the rehash step tryEmplace may have taken.
+    Collection* Store::claimCollection(Shard& shard, std::string_view key, ValueType type, Clock::time_point now,
+                                       FlatMap<Entry>::Slot*& slot, size_t& before) {
+        bool exists;
+        slot = claim(shard, key, now, exists, before);
+        if (exists) {
+            if (slot->value.value.tag() != COLLECTION_TAG || collectionType(*collectionOf(slot->value)) != type) {
+                account(shard, 0, 0);
+                throw WrongType();
+            }
+            touch(slot->value, now);
+            return collectionOf(slot->value);
+        }
+        releaseValue(shard, slot->value);
+        auto* collection = new Collection(emptyCollection(type));
+        slot->value.value = SlabAllocator::tagged(&collection, COLLECTION_TAG);
+        initAccess(slot->value, now);
+        return collection;
+    }
+
+    // Caller holds the shard's lock; shared will do. Expired keys read as
+    // missing and are left to the expire cycle.
+    const Collection* Store::findCollection(Shard& shard, std::string_view key, ValueType type,
+                                            Clock::time_point now) {
+        auto* slot = shard.map.find(key);
+        if (!slot || isExpired(slot->value, now)) {
+            return nullptr;
+        }
+        if (slot->value.value.tag() != COLLECTION_TAG || collectionType(*collectionOf(slot->value)) != type) {
+            throw WrongType();
+        }
+        touch(slot->value, now);
+        return collectionOf(slot->value);
+    }
+
+    void Store::listWritten(Shard& shard, const FlatMap<Entry>::Slot* slot, const OnListWrite& on_write) {
+        if (!on_write) {
+            return;
+        }
+        ListWrite write;
+        if (shard.copies_pending.load(std::memory_order_relaxed) > 0) {
+            write.whole = true;
+            if (slot) {
+                write.payload = collectionPayload(*collectionOf(slot->value));
+                write.expiry = slot->value.expiry;
+            }
+        }
+        on_write(write);
+    }
+
+    std::optional<ValueType> Store::type(std::string_view key) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto* slot = shard.map.find(key);
+        if (!slot || isExpired(slot->value, get_time_())) {
+            return std::nullopt;
+        }
+        if (slot->value.value.tag() != COLLECTION_TAG) {
+            return ValueType::String;
+        }
+        return collectionType(*collectionOf(slot->value));
+    }
+
+    size_t Store::hashSet(std::string_view key, const std::vector<KeyValue>& pairs, const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        FlatMap<Entry>::Slot* slot;
+        size_t before;
+        auto& hash = std::get<HashValue>(*claimCollection(shard, key, ValueType::Hash, get_time_(), slot, before));
+        size_t added = 0;
+        for (const auto& [field, value] : pairs) {
+            added += hash.set(field, value);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        if (on_write) {
+            on_write();
+        }
+        return added;
+    }
+
+    std::optional<std::string> Store::hashGet(std::string_view key, std::string_view field) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* collection = findCollection(shard, key, ValueType::Hash, get_time_());
+        if (!collection) {
+            return std::nullopt;
+        }
+        const auto value = std::get<HashValue>(*collection).get(field);
+        if (!value) {
+            return std::nullopt;
+        }
+        return std::string(*value);
+    }
+
+    std::vector<std::pair<std::string, std::string>> Store::hashGetAll(std::string_view key) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        std::vector<std::pair<std::string, std::string>> pairs;
+        if (const auto* collection = findCollection(shard, key, ValueType::Hash, get_time_())) {
+            const auto& hash = std::get<HashValue>(*collection);
+            pairs.reserve(hash.size());
+            hash.forEach([&](std::string_view field, std::string_view value) { pairs.emplace_back(field, value); });
+        }
+        return pairs;
+    }
+
+    size_t Store::listPush(std::string_view key, const std::vector<std::string_view>& values, bool front,
+                           const OnListWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        FlatMap<Entry>::Slot* slot;
+        size_t before;
+        auto& list = std::get<ListValue>(*claimCollection(shard, key, ValueType::List, get_time_(), slot, before));
+        for (const auto& value : values) {
+            list.push(value, front);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        listWritten(shard, slot, on_write);
+        return list.size();
+    }
+
+    std::optional<std::vector<std::string>> Store::listPop(std::string_view key, size_t count, bool front,
+                                                           const OnListWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const auto now = get_time_();
+        auto* slot = findLive(shard, key, now);
+        if (!slot) {
+            return std::nullopt;
+        }
+        if (slot->value.value.tag() != COLLECTION_TAG ||
+            collectionType(*collectionOf(slot->value)) != ValueType::List) {
+            throw WrongType();
+        }
+        const size_t before = entryBytes(shard, *slot);
+        auto& list = std::get<ListValue>(*collectionOf(slot->value));
+        std::vector<std::string> values;
+        values.reserve(std::min(count, list.size()));
+        while (values.size() < count && list.size() > 0) {
+            values.push_back(list.pop(front));
+        }
+        touch(slot->value, now);
+        account(shard, before, entryBytes(shard, *slot));
+        if (list.size() == 0) {
+            eraseEntry(shard, slot);
+            slot = nullptr;
+        }
+        if (!values.empty()) {
+            listWritten(shard, slot, on_write);
+        }
+        return values;
+    }
+
+    std::vector<std::string> Store::listRange(std::string_view key, int64_t start, int64_t stop) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* collection = findCollection(shard, key, ValueType::List, get_time_());
+        if (!collection) {
+            return {};
+        }
+        const auto& list = std::get<ListValue>(*collection);
+        if (!clipRange(start, stop, list.size())) {
+            return {};
+        }
+        return list.range(static_cast<size_t>(start), static_cast<size_t>(stop));
+    }
+
+    size_t Store::setAdd(std::string_view key, const std::vector<std::string_view>& members,
+                         const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        FlatMap<Entry>::Slot* slot;
+        size_t before;
+        auto& set = std::get<SetValue>(*claimCollection(shard, key, ValueType::Set, get_time_(), slot, before));
+        size_t added = 0;
+        for (const auto& member : members) {
+            added += set.add(member);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        if (added > 0 && on_write) {
+            on_write();
+        }
+        return added;
+    }
+
+    bool Store::setIsMember(std::string_view key, std::string_view member) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* collection = findCollection(shard, key, ValueType::Set, get_time_());
+        return collection && std::get<SetValue>(*collection).contains(member);
+    }
+
+    size_t Store::zsetAdd(std::string_view key, const std::vector<std::pair<double, std::string_view>>& items,
+                          const OnWrite& on_write) {
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        FlatMap<Entry>::Slot* slot;
+        size_t before;
+        auto& zset = std::get<ZSetValue>(*claimCollection(shard, key, ValueType::ZSet, get_time_(), slot, before));
+        size_t added = 0;
+        for (const auto& [score, member] : items) {
+            added += zset.add(score, member);
+        }
+        account(shard, before, entryBytes(shard, *slot));
+        if (on_write) {
+            on_write();
+        }
+        return added;
+    }
+
+    std::vector<Store::ScoredMember> Store::zsetRange(std::string_view key, int64_t start, int64_t stop) {
+        Shard& shard = shardFor(key);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        const auto* collection = findCollection(shard, key, ValueType::ZSet, get_time_());
+        if (!collection) {
+            return {};
+        }
+        const auto& zset = std::get<ZSetValue>(*collection);
+        if (!clipRange(start, stop, zset.size())) {
+            return {};
+        }
+        return zset.range(static_cast<size_t>(start), static_cast<size_t>(stop));
+    }
+
+    bool Store::restore(std::string_view key, ValueType type, std::string_view value, Expiry expiry) {
+        if (type == ValueType::String) {
+            upsert(key, value, expiry);
+            return true;
+        }
+        auto collection = collectionFromPayload(type, value);
+        if (!collection) {
+            return false;
+        }
+        auto* owned = new Collection(std::move(*collection));
+        Shard& shard = shardFor(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        const auto now = get_time_();
+        bool exists;
+        size_t before;
+        auto* slot = claim(shard, key, now, exists, before);
+        releaseValue(shard, slot->value);
+        slot->value.value = SlabAllocator::tagged(&owned, COLLECTION_TAG);
+        if (expiry || slot->value.expiry) {
+            setEntryExpiry(shard, *slot, expiry);
+        }
+        initAccess(slot->value, now);
+        account(shard, before, entryBytes(shard, *slot));
+        return true;
+    }
+
+}
@@ -0,0 +1,169 @@
+#include "store/timer_wheel.hpp"
+#include <algorithm>
+
+namespace store {
+
+TimerWheel::TimerWheel() {
+    heads_.fill(NONE);
+}
+
+TimerWheel::Handle TimerWheel::schedule(std::string_view key, uint64_t deadline, uint64_t now) {
+    if (size_ == 0) {
+        current_ = std::max(current_, now);
+    }
+    Handle handle;
+    if (free_ != NONE) {
+        handle = free_;
+        free_ = nodes_[handle].next;
+    } else {
+        handle = static_cast<Handle>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    Node& node = nodes_[handle];
+    node.key.assign(key.data(), key.size());
+    node.deadline = deadline;
+    ++size_;
+    place(handle);
+    return handle;
+}
+
+void TimerWheel::reschedule(Handle handle, uint64_t deadline) {
+    unlink(handle);
+    nodes_[handle].deadline = deadline;
+    place(handle);
+}
+
+void TimerWheel::cancel(Handle handle) {
+    unlink(handle);
+    Node& node = nodes_[handle];
+    std::string().swap(node.key);
+    node.list = FREE_LIST;
+    node.next = free_;
+    free_ = handle;
+    --size_;
+}
+
+TimerWheel::Handle TimerWheel::sample(uint64_t random) const {
+    if (size_ == 0) return NONE;
+    const size_t start = static_cast<size_t>(random % nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        const size_t index = (start + i) % nodes_.size();
+        if (nodes_[index].list != FREE_LIST) return static_cast<Handle>(index);
+    }
+    return NONE;
+}
+
+void TimerWheel::advance(uint64_t now) {
+    while (current_ < now) {
+        const uint64_t next = nextEvent();
+        if (next > now) {
+            current_ = now;
+            return;
+        }
+        current_ = next;
+        if ((current_ & SLOT_MASK) == 0) {
+            // Level 0 wrapped: pull the next slot of each level above down first.
+            cascade(1);
+        }
+        expireSlot(static_cast<unsigned>(current_ & SLOT_MASK));
+    }
+}
+
+// The first tick after current_ at which an occupied slot is cascaded or
+// expired, so advancing over idle stretches costs nothing per tick.
+uint64_t TimerWheel::nextEvent() const {
+    uint64_t next = UINT64_MAX;
+    for (unsigned level = 0; level < LEVELS; ++level) {
+        const uint64_t bits = occupied_[level];
+        if (bits == 0) continue;
+        const unsigned shift = level * SLOT_BITS;
+        const unsigned index = static_cast<unsigned>((current_ >> shift) & SLOT_MASK);
+        uint64_t rotation = current_ >> (shift + SLOT_BITS) << (shift + SLOT_BITS);
+        uint64_t ahead = index == SLOT_MASK ? 0 : bits >> (index + 1) << (index + 1);
+        if (ahead == 0) {
+            // Only slots at or behind this level's hand: next rotation.
+            rotation += uint64_t{1} << (shift + SLOT_BITS);
+            ahead = bits;
+        }
+        const uint64_t slot = static_cast<uint64_t>(__builtin_ctzll(ahead));
+        next = std::min(next, rotation | (slot << shift));
+    }
+    return next;
+}
+
+void TimerWheel::place(Handle handle) {
+    Node& node = nodes_[handle];
+    if (node.deadline <= current_) {
+        link(handle, DUE_LIST);
+        return;
+    }
+    const uint64_t delta = std::min(node.deadline - current_, HORIZON - 1);
+    const uint64_t when = current_ + delta;
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t{1} << ((level + 1) * SLOT_BITS))) {
+        ++level;
+    }
+    link(handle, level * SLOTS + static_cast<unsigned>((when >> (level * SLOT_BITS)) & SLOT_MASK));
+}
+
+void TimerWheel::link(Handle handle, unsigned list) {
+    Node& node = nodes_[handle];
+    node.list = static_cast<uint16_t>(list);
+    node.prev = NONE;
+    node.next = heads_[list];
+    if (node.next != NONE) {
+        nodes_[node.next].prev = handle;
+    }
+    heads_[list] = handle;
+    if (list != DUE_LIST) {
+        occupied_[list / SLOTS] |= uint64_t{1} << (list % SLOTS);
+    }
+}
+
+void TimerWheel::unlink(Handle handle) {
+    Node& node = nodes_[handle];
+    if (node.prev != NONE) {
+        nodes_[node.prev].next = node.next;
+    } else {
+        heads_[node.list] = node.next;
+        if (node.next == NONE && node.list != DUE_LIST) {
+            occupied_[node.list / SLOTS] &= ~(uint64_t{1} << (node.list % SLOTS));
+        }
+    }
+    if (node.next != NONE) {
+        nodes_[node.next].prev = node.prev;
+    }
+}
+
+// Called when every level below has just wrapped: re-places the timers in
+// this level's current slot, which now fall within reach of the levels below.
+void TimerWheel::cascade(unsigned level) {
+    if (level >= LEVELS) return;
+    const unsigned slot = static_cast<unsigned>((current_ >> (level * SLOT_BITS)) & SLOT_MASK);
+    if (slot == 0) {
+        cascade(level + 1);
+    }
+    const unsigned list = level * SLOTS + slot;
+    Handle handle = heads_[list];
+    heads_[list] = NONE;
+    occupied_[level] &= ~(uint64_t{1} << slot);
+    while (handle != NONE) {
+        const Handle next = nodes_[handle].next;
+        place(handle);
+        handle = next;
+    }
+}
+
+void TimerWheel::expireSlot(unsigned slot) {
+    Handle handle = heads_[slot];
+    heads_[slot] = NONE;
+    occupied_[0] &= ~(uint64_t{1} << slot);
+    while (handle != NONE) {
+        const Handle next = nodes_[handle].next;
+        // Due unless it was parked beyond the horizon.
+        place(handle);
+        handle = next;
+    }
+}
+
+}
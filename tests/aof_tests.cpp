@@ -0,0 +1,650 @@
+#include <gtest/gtest.h>
+#include "server/aof_manager.hpp"
+#include "server_fixture.hpp"
+#include "server/snapshot_manager.hpp"
+#include "store/numbers.hpp"
+#include "store/store.hpp"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <cstdio>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace server;
+
+class AOFManagerTest : public ::testing::Test {
+protected:
+    std::string path = "aof_test_" + std::to_string(::getpid()) + ".aof";
+
+    void SetUp() override { std::remove(path.c_str()); }
+    void TearDown() override { std::remove(path.c_str()); }
+
+    std::vector<std::string> replayAll() {
+        AOFManager aof(path);
+        std::vector<std::string> log;
+        aof.replay(
+            [&](std::string_view key, std::string_view value) {
+                log.push_back("SET " + std::string(key) + " " + std::string(value));
+            },
+            [&](std::string_view key) { log.push_back("DEL " + std::string(key)); },
+            [&](std::string_view key) { log.push_back("PERSIST " + std::string(key)); },
+            [&](std::string_view key, int64_t expire_at) {
+                log.push_back("PEXPIREAT " + std::string(key) + " " + std::to_string(expire_at));
+            });
+        return log;
+    }
+
+    // Mutates the store and logs the change under the shard's lock, as the
+    // server does.
+    void set(store::Store& store, AOFManager& aof, const std::string& key, const std::string& value) {
+        store.set(key, value, std::nullopt, {store::Store::SetCondition::IfAbsent},
+                  [&](const store::Store::SetResult&) { aof.logSet(key, value); });
+    }
+
+    void del(store::Store& store, AOFManager& aof, const std::string& key) {
+        store.remove(key, [&]() { aof.logDel(key); });
+    }
+
+    static int64_t unixMillis(std::chrono::system_clock::time_point when) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(when.time_since_epoch()).count();
+    }
+
+    static void watch(AOFManager& aof, store::Store& store) {
+        aof.setSnapshotSource([&store](const AOFManager::Emit& emit, const std::function<void()>& start) {
+            store.snapshot([&](const std::string& key, store::ValueType type, const std::string& value,
+                               store::Store::Expiry expiry) {
+                emit(key, type, value, expiry ? std::optional<int64_t>(unixMillis(store.wallClockAt(*expiry)))
+                                        : std::nullopt);
+            }, start);
+        });
+    }
+
+    void expectReplaysTo(store::Store& expected, size_t threads = 1) {
+        store::Store replayed;
+        replayed.setLoading(true);
+        AOFManager aof(path);
+        EXPECT_TRUE(aof.replay(
+            [&](std::string_view key, std::string_view value) { replayed.upsert(key, value); },
+            [&](std::string_view key) { replayed.remove(key); },
+            [&](std::string_view key) { replayed.persist(key); },
+            [&](std::string_view key, int64_t expire_at) {
+                replayed.expireAt(key, std::chrono::system_clock::time_point(std::chrono::milliseconds(expire_at)));
+            },
+            threads));
+        // Keys that expired while the server was down are reclaimed, as the
+        // server does after replay.
+        replayed.setLoading(false);
+        while (replayed.activeExpireCycle() > 0) {
+        }
+        auto keys = expected.getAll();
+        EXPECT_EQ(replayed.size(), keys.size());
+        for (const auto& key : keys) {
+            EXPECT_EQ(replayed.get(key), expected.get(key)) << key;
+            EXPECT_EQ(replayed.getPTTL(key).has_value(), expected.getPTTL(key).has_value()) << key;
+        }
+    }
+
+    size_t fileSize() {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        return static_cast<size_t>(in.tellg());
+    }
+};
+
+TEST_F(AOFManagerTest, ReplaysInLogOrder) {
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::No);
+        EXPECT_TRUE(aof.logSet("key1", "value1"));
+        EXPECT_TRUE(aof.logPersist("key1"));
+        EXPECT_TRUE(aof.logDel("key1"));
+        EXPECT_TRUE(aof.logSet("key2", "value2"));
+        EXPECT_EQ(aof.appended(), 4);
+    }
+    EXPECT_EQ(replayAll(), (std::vector<std::string>{
+        "SET key1 value1", "PERSIST key1", "DEL key1", "SET key2 value2"}));
+}
+
+TEST_F(AOFManagerTest, LogsExpiryAsAbsoluteTime) {
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::No);
+        EXPECT_TRUE(aof.logSet("key1", "value1", 1700000000123));
+        EXPECT_TRUE(aof.logExpireAt("key2", 1700000000456));
+    }
+    EXPECT_EQ(replayAll(), (std::vector<std::string>{
+        "SET key1 value1",
+        "PEXPIREAT key1 1700000000123",
+        "PEXPIREAT key2 1700000000456",
+    }));
+}
+
+TEST_F(AOFManagerTest, ReplaysBatchesKeyByKey) {
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::No);
+        EXPECT_TRUE(aof.logMSet({{"key1", "value1"}, {"key2", "value2"}}));
+        EXPECT_TRUE(aof.logDel(std::vector<std::string_view>{"key1", "key3"}));
+        EXPECT_EQ(aof.appended(), 2);
+    }
+    EXPECT_EQ(replayAll(), (std::vector<std::string>{
+        "SET key1 value1", "SET key2 value2", "DEL key1", "DEL key3"}));
+}
+
+// The keyspace after a restart holds exactly the keys that were live at
+// shutdown, with their TTLs, whichever command set them.
+TEST_F(AOFManagerTest, ExpiryChangesSurviveRestart) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        for (int i = 0; i < 300; ++i) {
+            const std::string key = "key" + std::to_string(i);
+            std::optional<std::chrono::system_clock::time_point> when;
+            if (i % 3 == 0) {
+                when = std::chrono::system_clock::now() + std::chrono::milliseconds(20);
+            } else if (i % 3 == 1) {
+                when = std::chrono::system_clock::now() + std::chrono::hours(1);
+            }
+            // SET with a TTL, then EXPIRE on a key set without one.
+            if (i % 2 == 0 && when) {
+                store.add(key, "value", store.deadlineAt(*when));
+                aof.logSet(key, "value", unixMillis(*when));
+            } else {
+                set(store, aof, key, "value");
+                if (when && store.expireAt(key, *when)) {
+                    aof.logExpireAt(key, unixMillis(*when));
+                }
+            }
+        }
+        if (store.persist("key3")) {
+            aof.logPersist("key3");
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    EXPECT_EQ(store.getAll().size(), 201);
+    expectReplaysTo(store);
+    expectReplaysTo(store, 4);
+}
+
+TEST_F(AOFManagerTest, IgnoresTruncatedTail) {
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::No);
+        aof.logSet("key1", "value1");
+    }
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out << "*3\r\n$3\r\nSET\r\n$4\r\nke";
+    }
+    EXPECT_EQ(replayAll(), (std::vector<std::string>{"SET key1 value1"}));
+}
+
+TEST_F(AOFManagerTest, ParallelReplayKeepsPerKeyOrder) {
+    store::Store store;
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::No);
+        for (int round = 0; round < 5; ++round) {
+            for (int i = 0; i < 2000; ++i) {
+                const std::string key = "key" + std::to_string(i);
+                del(store, aof, key);
+                set(store, aof, key, "value" + std::to_string(round));
+            }
+        }
+        for (int i = 0; i < 2000; i += 2) {
+            del(store, aof, "key" + std::to_string(i));
+        }
+    }
+    expectReplaysTo(store, 4);
+}
+
+TEST_F(AOFManagerTest, SyncWaitsForEarlierRecords) {
+    std::vector<std::string> expected;
+    {
+        AOFManager aof(path, AOFManager::FsyncPolicy::Always);
+        for (int i = 0; i < 100; ++i) {
+            aof.logSet("key" + std::to_string(i), "value");
+            expected.push_back("SET key" + std::to_string(i) + " value");
+        }
+        std::promise<void> durable;
+        aof.sync([&durable]() { durable.set_value(); });
+        durable.get_future().wait();
+        EXPECT_EQ(replayAll(), expected);
+    }
+}
+
+// Past the file size limit writes fail with EFBIG. Nothing is acknowledged
+// until its records are written, and each lands in the file once.
+TEST_F(AOFManagerTest, FailedWritesAreHeldAndRetried) {
+    std::signal(SIGXFSZ, SIG_IGN);
+    rlimit original;
+    ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &original), 0);
+    AOFManager aof(path, AOFManager::FsyncPolicy::Always);
+    std::promise<void> first;
+    aof.logSet("key0", "value");
+    aof.sync([&first]() { first.set_value(); });
+    first.get_future().wait();
+    const auto before = fileSize();
+
+    rlimit limited = original;
+    limited.rlim_cur = before + 10;
+    ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &limited), 0);
+    aof.logSet("key1", std::string(100, 'v'));
+    std::promise<void> durable;
+    aof.sync([&durable]() { durable.set_value(); });
+    auto acknowledged = durable.get_future();
+    EXPECT_EQ(acknowledged.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+    // The part that fit was cut off again.
+    EXPECT_EQ(fileSize(), before);
+
+    ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &original), 0);
+    aof.logSet("key2", "value");
+    EXPECT_EQ(acknowledged.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+    std::promise<void> last;
+    aof.sync([&last]() { last.set_value(); });
+    last.get_future().wait();
+    EXPECT_EQ(replayAll(), (std::vector<std::string>{
+        "SET key0 value", "SET key1 " + std::string(100, 'v'), "SET key2 value"}));
+}
+
+TEST_F(AOFManagerTest, ConcurrentProducers) {
+    {
+        AOFManager aof(path);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&aof, t]() {
+                for (int i = 0; i < 500; ++i) {
+                    aof.logSet("key" + std::to_string(t) + ":" + std::to_string(i), "value");
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    auto log = replayAll();
+    ASSERT_EQ(log.size(), 2000);
+    // Each producer's records stay in the order it logged them.
+    std::vector<int> next(4, 0);
+    for (const auto& entry : log) {
+        const int t = entry[7] - '0';
+        EXPECT_EQ(entry, "SET key" + std::to_string(t) + ":" + std::to_string(next[t]++) + " value");
+    }
+}
+
+// Threads racing on the same keys log them in the order the store applied
+// them, so the last record for each key holds its final value.
+TEST_F(AOFManagerTest, WritesToOneKeyAreLoggedInOrder) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < 2000; ++i) {
+                    const std::string key = "key" + std::to_string(i % 8);
+                    const std::string value = std::to_string(t) + ":" + std::to_string(i);
+                    if (i % 5 == 4) {
+                        del(store, aof, key);
+                        continue;
+                    }
+                    store.set(key, value, std::nullopt, {},
+                              [&](const store::Store::SetResult&) { aof.logSet(key, value); });
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    expectReplaysTo(store);
+}
+
+TEST_F(AOFManagerTest, RewriteReplaysToIdenticalDataset) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        watch(aof, store);
+        for (int round = 0; round < 20; ++round) {
+            for (int i = 0; i < 200; ++i) {
+                const std::string key = "key" + std::to_string(i);
+                set(store, aof, key, "value" + std::to_string(round));
+                if (round < 19 || i % 3 == 0) {
+                    del(store, aof, key);
+                }
+            }
+        }
+        std::promise<void> written;
+        aof.sync([&written]() { written.set_value(); });
+        written.get_future().wait();
+        const size_t before = aof.fileSize();
+
+        ASSERT_TRUE(aof.rewrite());
+        EXPECT_LT(aof.fileSize() * 20, before);
+        EXPECT_EQ(aof.fileSize(), fileSize());
+
+        // Writes after the swap land in the new file.
+        set(store, aof, "after", "rewrite");
+    }
+    EXPECT_EQ(store.getAll().size(), 134);
+    expectReplaysTo(store);
+}
+
+TEST_F(AOFManagerTest, RewriteStartsWithSnapshotPreamble) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        watch(aof, store);
+        for (int i = 0; i < 1000; ++i) {
+            const std::string key = "key" + std::to_string(i);
+            store.add(key, "value", i % 4 == 0 ? store::Store::Expiry(store.deadlineIn(std::chrono::hours(1)))
+                                               : std::nullopt);
+        }
+        ASSERT_TRUE(aof.rewrite());
+        set(store, aof, "tail", "value");
+        del(store, aof, "key1");
+    }
+    std::ifstream in(path, std::ios::binary);
+    const std::string data(std::istreambuf_iterator<char>(in), {});
+    EXPECT_TRUE(SnapshotManager::detect(data));
+
+    auto log = replayAll();
+    ASSERT_EQ(log.size(), 1000 + 250 + 2);
+    EXPECT_EQ(std::count_if(log.begin(), log.end(), [](const std::string& line) {
+        return line.rfind("PEXPIREAT ", 0) == 0;
+    }), 250);
+    // The RESP tail follows the preamble.
+    EXPECT_EQ(log[log.size() - 2], "SET tail value");
+    EXPECT_EQ(log.back(), "DEL key1");
+    expectReplaysTo(store);
+    expectReplaysTo(store, 4);
+}
+
+TEST_F(AOFManagerTest, RewriteWithoutPreambleWritesCommands) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        aof.setRewritePreamble(false);
+        watch(aof, store);
+        for (int i = 0; i < 100; ++i) {
+            set(store, aof, "key" + std::to_string(i), "value");
+        }
+        ASSERT_TRUE(aof.rewrite());
+        set(store, aof, "tail", "value");
+    }
+    std::ifstream in(path, std::ios::binary);
+    EXPECT_EQ(in.get(), '*');
+    EXPECT_EQ(replayAll().size(), 101);
+    expectReplaysTo(store);
+}
+
+TEST_F(AOFManagerTest, RewriteKeepsConcurrentWrites) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        watch(aof, store);
+        for (int i = 0; i < 5000; ++i) {
+            set(store, aof, "base" + std::to_string(i), "value");
+        }
+
+        std::atomic<bool> done{false};
+        std::thread writer([&]() {
+            for (int i = 0; !done || i < 1000; ++i) {
+                set(store, aof, "live" + std::to_string(i), "value");
+                del(store, aof, "base" + std::to_string(i % 5000));
+            }
+        });
+        EXPECT_TRUE(aof.rewrite());
+        done = true;
+        writer.join();
+    }
+    expectReplaysTo(store);
+}
+
+TEST_F(AOFManagerTest, OnlyOneRewriteAtATime) {
+    AOFManager aof(path);
+    EXPECT_FALSE(aof.rewriteInBackground());
+
+    std::promise<void> release;
+    std::shared_future<void> gate = release.get_future().share();
+    aof.setSnapshotSource([gate](const AOFManager::Emit& emit, const std::function<void()>&) {
+        gate.wait();
+        emit("key", store::ValueType::String, "value", std::nullopt);
+    });
+    EXPECT_TRUE(aof.rewriteInBackground());
+    EXPECT_TRUE(aof.rewriting());
+    EXPECT_FALSE(aof.rewriteInBackground());
+    EXPECT_FALSE(aof.rewrite());
+
+    release.set_value();
+    while (aof.rewriting()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(aof.rewriteInBackground());
+}
+
+TEST_F(AOFManagerTest, RewritesAutomaticallyOnGrowth) {
+    store::Store store;
+    {
+        AOFManager aof(path);
+        watch(aof, store);
+        aof.setAutoRewrite(100, 16 * 1024);
+        for (int i = 0; i < 2000; ++i) {
+            set(store, aof, "key", "value");
+            del(store, aof, "key");
+            // What is logged during a rewrite is carried into the new file
+            // and becomes the base for the next one, so a loop that outruns
+            // the rewrite could leave the file above the threshold for good.
+            while (aof.rewriting()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        set(store, aof, "survivor", "value");
+
+        // Churn never leaves more than a key or two live, so a completed
+        // rewrite keeps the file far below what was logged.
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while ((aof.rewriting() || aof.fileSize() > 16 * 1024) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        EXPECT_LT(aof.fileSize(), 16 * 1024);
+    }
+    expectReplaysTo(store);
+}
+
+namespace {
+
+// Each key's type and elements, hashes and sets sorted since their order
+// depends on the table.
+std::map<std::string, std::pair<store::ValueType, std::vector<std::string>>> contents(store::Store& store) {
+    std::map<std::string, std::pair<store::ValueType, std::vector<std::string>>> result;
+    store.snapshot([&](const std::string& key, store::ValueType type, const std::string& value, store::Store::Expiry) {
+        if (type == store::ValueType::String) {
+            result[key] = {type, {value}};
+            return;
+        }
+        auto pack = store::ListPack::fromData(value);
+        std::vector<std::string> elements;
+        for (size_t offset = pack->begin(); offset != pack->end(); offset = pack->next(offset)) {
+            elements.emplace_back(pack->at(offset));
+        }
+        if (type == store::ValueType::Hash) {
+            std::vector<std::string> pairs;
+            for (size_t i = 0; i < elements.size(); i += 2) {
+                pairs.push_back(elements[i] + "=" + elements[i + 1]);
+            }
+            elements = pairs;
+        }
+        if (type == store::ValueType::Hash || type == store::ValueType::Set) {
+            std::sort(elements.begin(), elements.end());
+        }
+        result[key] = {type, elements};
+    });
+    return result;
+}
+
+// The collection commands a rewrite writes, applied as the server would.
+void applyCommand(store::Store& store, const std::vector<std::string_view>& args) {
+    const std::string_view key = args[1];
+    if (args[0] == "HSET") {
+        std::vector<store::Store::KeyValue> pairs;
+        for (size_t i = 2; i + 1 < args.size(); i += 2) pairs.emplace_back(args[i], args[i + 1]);
+        store.hashSet(key, pairs);
+    } else if (args[0] == "LPUSH" || args[0] == "RPUSH") {
+        store.listPush(key, {args.begin() + 2, args.end()}, args[0] == "LPUSH");
+    } else if (args[0] == "LPOP" || args[0] == "RPOP") {
+        store.listPop(key, 1, args[0] == "LPOP");
+    } else if (args[0] == "SADD") {
+        store.setAdd(key, {args.begin() + 2, args.end()});
+    } else if (args[0] == "ZADD") {
+        std::vector<std::pair<double, std::string_view>> items;
+        for (size_t i = 2; i + 1 < args.size(); i += 2) {
+            items.emplace_back(*store::parseScore(args[i]), args[i + 1]);
+        }
+        store.zsetAdd(key, items);
+    }
+}
+
+}
+
+// Large collections take several commands each, and a preamble turns them
+// back into the same commands on replay.
+TEST_F(AOFManagerTest, RewritesCollections) {
+    store::Store store;
+    store.upsert("string", "value");
+    for (int i = 0; i < 200; ++i) {
+        const std::string item = "item" + std::to_string(i);
+        store.hashSet("hash", {{item, "value" + std::to_string(i)}});
+        store.listPush("list", {item}, i % 2 == 0);
+        store.setAdd("set", {item});
+        store.zsetAdd("zset", {{i * 0.5 - 20, item}});
+    }
+    store.hashSet("small", {{"field", "value"}});
+    store.expire("zset", std::chrono::hours(1));
+
+    for (const bool preamble : {false, true}) {
+        {
+            AOFManager aof(path);
+            aof.setRewritePreamble(preamble);
+            watch(aof, store);
+            ASSERT_TRUE(aof.rewrite());
+        }
+        for (const size_t threads : {1, 4}) {
+            store::Store replayed;
+            AOFManager aof(path);
+            size_t commands = 0;
+            std::mutex mutex;
+            EXPECT_TRUE(aof.replay(
+                [&](std::string_view key, std::string_view value) { replayed.upsert(key, value); },
+                [&](std::string_view key) { replayed.remove(key); },
+                [&](std::string_view key) { replayed.persist(key); },
+                [&](std::string_view key, int64_t expire_at) {
+                    replayed.expireAt(key, std::chrono::system_clock::time_point(std::chrono::milliseconds(expire_at)));
+                },
+                threads, 0,
+                [&](const std::vector<std::string_view>& args) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ++commands;
+                    }
+                    applyCommand(replayed, args);
+                }));
+            // 200 elements in chunks of 64 for each of four keys, and one
+            // more for the small hash; the expiry is applied on its own.
+            EXPECT_EQ(commands, 4 * 4 + 1) << preamble;
+            EXPECT_EQ(contents(replayed), contents(store)) << preamble;
+            EXPECT_TRUE(replayed.getPTTL("zset").has_value());
+            EXPECT_FALSE(replayed.getPTTL("hash").has_value());
+        }
+    }
+}
+
+// Pushes and pops that the rewrite's snapshot already holds must not be
+// applied again from the records buffered while it ran.
+TEST_F(AOFManagerTest, RewriteDuringListWrites) {
+    for (const bool preamble : {false, true}) {
+        store::Store store;
+        for (int i = 0; i < 20000; ++i) {
+            store.upsert("base" + std::to_string(i), "value");
+        }
+        {
+            AOFManager aof(path);
+            aof.setRewritePreamble(preamble);
+            watch(aof, store);
+            std::atomic<bool> done{false};
+            std::thread writer([&]() {
+                for (int i = 0; !done || i < 2000; ++i) {
+                    const std::string key = "list" + std::to_string(i % 32);
+                    const std::string value = std::to_string(i);
+                    const bool front = i % 2 == 0;
+                    // Logged as the server logs them.
+                    const auto log = [&](const std::vector<std::string_view>& args) {
+                        return [&aof, &key, args](const store::Store::ListWrite& write) {
+                            if (write.whole) {
+                                aof.logValue(key, store::ValueType::List, write.payload);
+                            } else {
+                                aof.logCommand(args);
+                            }
+                        };
+                    };
+                    if (i % 5 == 4) {
+                        store.listPop(key, 1, front, log({front ? "LPOP" : "RPOP", key}));
+                    } else {
+                        store.listPush(key, {value}, front, log({front ? "LPUSH" : "RPUSH", key, value}));
+                    }
+                }
+            });
+            for (int i = 0; i < 3; ++i) {
+                EXPECT_TRUE(aof.rewrite());
+            }
+            done = true;
+            writer.join();
+        }
+
+        store::Store replayed;
+        AOFManager aof(path);
+        EXPECT_TRUE(aof.replay(
+            [&](std::string_view key, std::string_view value) { replayed.upsert(key, value); },
+            [&](std::string_view key) { replayed.remove(key); },
+            [&](std::string_view key) { replayed.persist(key); },
+            [&](std::string_view, int64_t) {},
+            1, 0,
+            [&](const std::vector<std::string_view>& args) { applyCommand(replayed, args); }));
+        EXPECT_EQ(contents(replayed), contents(store)) << preamble;
+    }
+}
+
+// A TTL too large for the clocks used to be logged as a PXAT in the past,
+// which dropped the key on restart. It is now refused before anything is
+// written.
+TEST_F(ServerTest, HugeTTLsAreNotLogged) {
+    ASSERT_EQ(call({"SET", "kept", "v"}), "+OK\r\n");
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "10000000000"}).substr(0, 4), "-ERR");
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "9223372036854775807"}).substr(0, 4), "-ERR");
+    EXPECT_EQ(call({"EXPIRE", "kept", "9223372036854775807"}).substr(0, 4), "-ERR");
+    EXPECT_EQ(call({"PEXPIRE", "kept", "9223372036854775807"}).substr(0, 4), "-ERR");
+    ASSERT_EQ(call({"SET", "last", "v"}), "+OK\r\n");
+    stop();
+
+    std::vector<std::string> log;
+    AOFManager aof(aof_path);
+    EXPECT_TRUE(aof.replay(
+        [&](std::string_view key, std::string_view value) {
+            log.push_back("SET " + std::string(key) + " " + std::string(value));
+        },
+        [&](std::string_view key) { log.push_back("DEL " + std::string(key)); },
+        [&](std::string_view key) { log.push_back("PERSIST " + std::string(key)); },
+        [&](std::string_view key, int64_t expire_at) {
+            log.push_back("PEXPIREAT " + std::string(key) + " " + std::to_string(expire_at));
+        }));
+    EXPECT_EQ(log, (std::vector<std::string>{"SET kept v", "SET last v"}));
+}
+
+TEST(AOFManagerPolicyTest, ParsePolicy) {
+    EXPECT_EQ(AOFManager::parsePolicy("always"), AOFManager::FsyncPolicy::Always);
+    EXPECT_EQ(AOFManager::parsePolicy("everysec"), AOFManager::FsyncPolicy::EverySec);
+    EXPECT_EQ(AOFManager::parsePolicy("no"), AOFManager::FsyncPolicy::No);
+    EXPECT_EQ(AOFManager::parsePolicy("sometimes"), std::nullopt);
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include "store/collections.hpp"
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace store;
+
+namespace {
+
+std::vector<std::string> elements(const ListPack& pack) {
+    std::vector<std::string> result;
+    for (size_t offset = pack.begin(); offset != pack.end(); offset = pack.next(offset)) {
+        result.emplace_back(pack.at(offset));
+    }
+    return result;
+}
+
+std::vector<std::string> backwards(const ListPack& pack) {
+    std::vector<std::string> result;
+    for (size_t offset = pack.end(); offset != pack.begin();) {
+        offset = pack.prev(offset);
+        result.emplace_back(pack.at(offset));
+    }
+    return result;
+}
+
+}
+
+TEST(ListPackTest, WalksBothWays) {
+    ListPack pack;
+    // Lengths either side of a one-byte varint.
+    const std::vector<std::string> values{"", "a", std::string(127, 'b'), std::string(128, 'c'),
+                                          std::string(20000, 'd'), "tail"};
+    for (const auto& value : values) {
+        pack.pushBack(value);
+    }
+    EXPECT_EQ(pack.size(), values.size());
+    EXPECT_EQ(elements(pack), values);
+    EXPECT_EQ(backwards(pack), std::vector<std::string>(values.rbegin(), values.rend()));
+}
+
+TEST(ListPackTest, EditsInPlace) {
+    ListPack pack;
+    for (const char* value : {"a", "b", "c", "d"}) {
+        pack.pushBack(value);
+    }
+    pack.insert(pack.begin(), "first");
+    pack.erase(pack.find("b"), 2);
+    pack.replace(pack.find("a"), "A");
+    pack.replace(pack.find("d"), std::string(200, 'x'));
+    EXPECT_EQ(elements(pack), (std::vector<std::string>{"first", "A", std::string(200, 'x')}));
+    EXPECT_EQ(pack.find("missing"), pack.end());
+
+    // Every other entry, as hashes look up fields.
+    ListPack pairs;
+    for (const char* value : {"f1", "f2", "f2", "v2"}) {
+        pairs.pushBack(value);
+    }
+    EXPECT_EQ(pairs.at(pairs.next(pairs.find("f2", 2))), "v2");
+}
+
+TEST(ListPackTest, RejectsMalformedData) {
+    ListPack pack;
+    pack.pushBack("hello");
+    pack.pushBack(std::string(300, 'x'));
+    auto copy = ListPack::fromData(pack.data());
+    ASSERT_TRUE(copy);
+    EXPECT_EQ(elements(*copy), elements(pack));
+
+    EXPECT_FALSE(ListPack::fromData(pack.data().substr(0, pack.data().size() - 1)));
+    std::string corrupt = pack.data();
+    corrupt[6] ^= 0x01;
+    EXPECT_FALSE(ListPack::fromData(corrupt));
+    EXPECT_TRUE(ListPack::fromData(""));
+}
+
+TEST(CollectionsTest, HashConvertsPastTheLimits) {
+    HashValue hash;
+    for (size_t i = 0; i < LISTPACK_MAX_ENTRIES; ++i) {
+        EXPECT_TRUE(hash.set("field" + std::to_string(i), "value"));
+    }
+    EXPECT_FALSE(hash.set("field0", "changed"));
+    EXPECT_TRUE(hash.compact());
+    EXPECT_TRUE(hash.set("one-more", "value"));
+    EXPECT_FALSE(hash.compact());
+    EXPECT_EQ(hash.size(), LISTPACK_MAX_ENTRIES + 1);
+    EXPECT_EQ(hash.get("field0"), "changed");
+    EXPECT_EQ(hash.get("one-more"), "value");
+    EXPECT_FALSE(hash.get("missing"));
+
+    HashValue wide;
+    wide.set("field", "short");
+    wide.set("field", std::string(LISTPACK_MAX_VALUE + 1, 'v'));
+    EXPECT_FALSE(wide.compact());
+    EXPECT_EQ(wide.size(), 1);
+    EXPECT_EQ(wide.get("field")->size(), LISTPACK_MAX_VALUE + 1);
+}
+
+TEST(CollectionsTest, ListPushesAndPopsAtBothEnds) {
+    for (const size_t count : {size_t{10}, LISTPACK_MAX_ENTRIES * 3}) {
+        ListValue list;
+        std::deque<std::string> expected;
+        for (size_t i = 0; i < count; ++i) {
+            const std::string value = std::to_string(i);
+            list.push(value, i % 3 == 0);
+            if (i % 3 == 0) {
+                expected.push_front(value);
+            } else {
+                expected.push_back(value);
+            }
+        }
+        EXPECT_EQ(list.compact(), count <= LISTPACK_MAX_ENTRIES);
+        EXPECT_EQ(list.range(0, list.size() - 1), std::vector<std::string>(expected.begin(), expected.end()));
+        EXPECT_EQ(list.range(2, 4), std::vector<std::string>(expected.begin() + 2, expected.begin() + 5));
+        EXPECT_EQ(list.pop(true), expected.front());
+        EXPECT_EQ(list.pop(false), expected.back());
+        EXPECT_EQ(list.size(), count - 2);
+    }
+}
+
+TEST(CollectionsTest, SetConvertsOnLongMembers) {
+    SetValue set;
+    EXPECT_TRUE(set.add("a"));
+    EXPECT_FALSE(set.add("a"));
+    EXPECT_TRUE(set.compact());
+    EXPECT_TRUE(set.add(std::string(LISTPACK_MAX_VALUE + 1, 'm')));
+    EXPECT_FALSE(set.compact());
+    EXPECT_TRUE(set.contains("a"));
+    EXPECT_FALSE(set.contains("b"));
+    EXPECT_EQ(set.size(), 2);
+}
+
+TEST(CollectionsTest, SkipListFindsMembersByRank) {
+    SkipList list;
+    std::set<std::pair<double, std::string>> expected;
+    std::mt19937 random(7);
+    for (int i = 0; i < 2000; ++i) {
+        const double score = static_cast<double>(random() % 100);
+        const std::string member = "m" + std::to_string(i);
+        list.insert(score, member);
+        expected.emplace(score, member);
+    }
+    for (int i = 0; i < 2000; i += 3) {
+        const auto it = std::next(expected.begin(), static_cast<long>(random() % expected.size()));
+        EXPECT_TRUE(list.erase(it->first, it->second));
+        EXPECT_FALSE(list.erase(it->first, it->second));
+        expected.erase(it);
+    }
+    ASSERT_EQ(list.size(), expected.size());
+    size_t rank = 0;
+    for (const auto& [score, member] : expected) {
+        const auto* node = list.at(rank++);
+        ASSERT_TRUE(node);
+        EXPECT_EQ(node->score, score);
+        EXPECT_EQ(node->member, member);
+    }
+    EXPECT_EQ(list.at(rank), nullptr);
+}
+
+TEST(CollectionsTest, SortedSetOrdersByScoreThenMember) {
+    for (const size_t count : {size_t{20}, LISTPACK_MAX_ENTRIES * 2}) {
+        ZSetValue zset;
+        for (size_t i = 0; i < count; ++i) {
+            EXPECT_TRUE(zset.add(static_cast<double>(i % 5), "m" + std::to_string(i)));
+        }
+        // Moving a member keeps one copy of it.
+        EXPECT_FALSE(zset.add(-1, "m7"));
+        EXPECT_EQ(zset.compact(), count <= LISTPACK_MAX_ENTRIES);
+        ASSERT_EQ(zset.size(), count);
+        EXPECT_EQ(zset.score("m7"), -1);
+
+        const auto members = zset.range(0, count - 1);
+        EXPECT_EQ(members.front(), ZSetValue::ScoredMember("m7", -1));
+        EXPECT_TRUE(std::is_sorted(members.begin(), members.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second || (a.second == b.second && a.first < b.first);
+        }));
+        EXPECT_EQ(zset.range(1, 1).front().first, "m0");
+    }
+}
+
+TEST(CollectionsTest, PayloadsRoundTrip) {
+    Collection zset(std::in_place_type<ZSetValue>);
+    std::get<ZSetValue>(zset).add(1.5, "a");
+    std::get<ZSetValue>(zset).add(-2, "b");
+    auto copy = collectionFromPayload(ValueType::ZSet, collectionPayload(zset));
+    ASSERT_TRUE(copy);
+    EXPECT_EQ(collectionType(*copy), ValueType::ZSet);
+    EXPECT_EQ(std::get<ZSetValue>(*copy).range(0, 1), std::get<ZSetValue>(zset).range(0, 1));
+
+    Collection list(std::in_place_type<ListValue>);
+    for (int i = 0; i < 300; ++i) {
+        std::get<ListValue>(list).push(std::to_string(i), false);
+    }
+    copy = collectionFromPayload(ValueType::List, collectionPayload(list));
+    ASSERT_TRUE(copy);
+    EXPECT_EQ(std::get<ListValue>(*copy).range(0, 299), std::get<ListValue>(list).range(0, 299));
+
+    // An odd number of elements cannot be a hash.
+    ListPack odd;
+    odd.pushBack("field");
+    EXPECT_FALSE(collectionFromPayload(ValueType::Hash, odd.data()));
+    EXPECT_FALSE(collectionFromPayload(ValueType::Set, ""));
+}
@@ -0,0 +1,309 @@
+#include "server_fixture.hpp"
+#include "server/resp.hpp"
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+int64_t integerReply(const std::string& reply) {
+    EXPECT_EQ(reply.substr(0, 1), ":") << reply;
+    return std::stoll(reply.substr(1));
+}
+
+// The AOF's records, one command each, as space-separated arguments.
+std::vector<std::string> records(const std::string& aof) {
+    std::vector<std::string> out;
+    server::resp::RequestParser parser;
+    while (parser.parse(aof) == server::resp::RequestParser::Status::Complete) {
+        std::string record;
+        for (const auto& arg : parser.args()) {
+            record += (record.empty() ? "" : " ") + std::string(arg);
+        }
+        out.push_back(record);
+    }
+    return out;
+}
+
+}
+
+// TTLs large enough to overflow the clocks are rejected rather than
+// wrapping into deadlines that have already passed.
+TEST_F(ServerTest, SetRejectsTTLsBeyondTheLimit) {
+    const std::string error = "-ERR invalid expire time in 'set' command\r\n";
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "5000000001"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "10000000000"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "5000000000001"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "9223372036854775807"}), error);
+    EXPECT_EQ(call({"EXISTS", "key"}), ":0\r\n");
+
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "5000000000"}), "+OK\r\n");
+    EXPECT_GT(integerReply(call({"PTTL", "key"})), 5'000'000'000'000 - 60'000);
+    EXPECT_EQ(call({"SET", "other", "v", "PX", "5000000000000"}), "+OK\r\n");
+    EXPECT_GT(integerReply(call({"PTTL", "other"})), 5'000'000'000'000 - 60'000);
+}
+
+TEST_F(ServerTest, ExpireRejectsTTLsBeyondTheLimit) {
+    ASSERT_EQ(call({"SET", "key", "v"}), "+OK\r\n");
+    EXPECT_EQ(call({"EXPIRE", "key", "9223372036854775807"}),
+              "-ERR invalid expire time in 'expire' command\r\n");
+    EXPECT_EQ(call({"EXPIRE", "key", "5000000001"}), "-ERR invalid expire time in 'expire' command\r\n");
+    EXPECT_EQ(call({"PEXPIRE", "key", "9223372036854775807"}),
+              "-ERR invalid expire time in 'pexpire' command\r\n");
+    EXPECT_EQ(call({"PEXPIRE", "key", "5000000000001"}), "-ERR invalid expire time in 'pexpire' command\r\n");
+    EXPECT_EQ(call({"GET", "key"}), "$1\r\nv\r\n");
+    EXPECT_EQ(call({"TTL", "key"}), ":-1\r\n");
+
+    EXPECT_EQ(call({"EXPIRE", "key", "5000000000"}), ":1\r\n");
+    EXPECT_GT(integerReply(call({"PTTL", "key"})), 5'000'000'000'000 - 60'000);
+    EXPECT_EQ(call({"PEXPIRE", "key", "5000000000000"}), ":1\r\n");
+    EXPECT_GT(integerReply(call({"PTTL", "key"})), 5'000'000'000'000 - 60'000);
+}
+
+TEST_F(ServerTest, SetRejectsConflictingOptions) {
+    const std::string syntax = "-ERR syntax error\r\n";
+    EXPECT_EQ(call({"SET", "key", "v", "NX", "XX"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "XX", "NX"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "NX", "NX"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "KEEPTTL", "EX", "10"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "10", "KEEPTTL"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "10", "KEEPTTL"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "10", "PX", "10"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "EX"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "NX", "PX"}), syntax);
+    EXPECT_EQ(call({"SET", "key", "v", "SOON"}), syntax);
+    EXPECT_EQ(call({"EXISTS", "key"}), ":0\r\n");
+}
+
+TEST_F(ServerTest, SetRejectsNonPositiveTTLs) {
+    const std::string error = "-ERR invalid expire time in 'set' command\r\n";
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "0"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "-1"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "0"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "PX", "-100"}), error);
+    EXPECT_EQ(call({"SET", "key", "v", "EX", "ten"}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(call({"EXISTS", "key"}), ":0\r\n");
+}
+
+TEST_F(ServerTest, SetConditions) {
+    EXPECT_EQ(call({"SET", "key", "1", "XX"}), "$-1\r\n");
+    EXPECT_EQ(call({"EXISTS", "key"}), ":0\r\n");
+    EXPECT_EQ(call({"SET", "key", "1", "NX"}), "+OK\r\n");
+    EXPECT_EQ(call({"SET", "key", "2", "NX"}), "$-1\r\n");
+    EXPECT_EQ(call({"SET", "key", "3", "xx"}), "+OK\r\n");
+    EXPECT_EQ(call({"GET", "key"}), "$1\r\n3\r\n");
+}
+
+TEST_F(ServerTest, SetGetReturnsTheOldValue) {
+    EXPECT_EQ(call({"SET", "key", "1", "GET"}), "$-1\r\n");
+    EXPECT_EQ(call({"GET", "key"}), "$1\r\n1\r\n");
+    EXPECT_EQ(call({"SET", "key", "2", "GET"}), "$1\r\n1\r\n");
+    // NX leaves the key alone but still returns what it holds.
+    EXPECT_EQ(call({"SET", "key", "3", "NX", "GET"}), "$1\r\n2\r\n");
+    EXPECT_EQ(call({"GET", "key"}), "$1\r\n2\r\n");
+    EXPECT_EQ(call({"SET", "missing", "1", "XX", "GET"}), "$-1\r\n");
+    EXPECT_EQ(call({"EXISTS", "missing"}), ":0\r\n");
+}
+
+TEST_F(ServerTest, SetKeepTTL) {
+    ASSERT_EQ(call({"SET", "key", "1", "EX", "100"}), "+OK\r\n");
+    EXPECT_EQ(call({"SET", "key", "2", "KEEPTTL"}), "+OK\r\n");
+    EXPECT_GT(integerReply(call({"PTTL", "key"})), 90'000);
+    EXPECT_EQ(call({"GET", "key"}), "$1\r\n2\r\n");
+    // A plain SET clears the TTL.
+    EXPECT_EQ(call({"SET", "key", "3"}), "+OK\r\n");
+    EXPECT_EQ(call({"PTTL", "key"}), ":-1\r\n");
+    EXPECT_EQ(call({"SET", "fresh", "1", "KEEPTTL"}), "+OK\r\n");
+    EXPECT_EQ(call({"PTTL", "fresh"}), ":-1\r\n");
+}
+
+TEST_F(ServerTest, MultiKeyCommandsCheckTheirArity) {
+    EXPECT_EQ(call({"MSET", "a", "1", "b"}), "-ERR wrong number of arguments for MSET command\r\n");
+    EXPECT_EQ(call({"MSET", "a"}), "-ERR wrong number of arguments for MSET command\r\n");
+    EXPECT_EQ(call({"MSETNX", "a", "1", "b"}), "-ERR wrong number of arguments for MSETNX command\r\n");
+    EXPECT_EQ(call({"MGET"}), "-ERR wrong number of arguments for MGET command\r\n");
+    EXPECT_EQ(call({"DEL"}), "-ERR wrong number of arguments for DEL command\r\n");
+    EXPECT_EQ(call({"UNLINK"}), "-ERR wrong number of arguments for UNLINK command\r\n");
+    EXPECT_EQ(call({"EXISTS"}), "-ERR wrong number of arguments for EXISTS command\r\n");
+    EXPECT_EQ(call({"EXISTS", "a"}), ":0\r\n");
+    EXPECT_EQ(aofContents(), "");
+}
+
+TEST_F(ServerTest, MsetAndMget) {
+    EXPECT_EQ(call({"MSET", "a", "1", "b", "2", "a", "3"}), "+OK\r\n");
+    ASSERT_EQ(call({"HSET", "hash", "field", "v"}), ":1\r\n");
+    // Missing keys and keys that hold collections read as nil.
+    EXPECT_EQ(call({"MGET", "a", "missing", "b", "hash", "a"}),
+              "*5\r\n$1\r\n3\r\n$-1\r\n$1\r\n2\r\n$-1\r\n$1\r\n3\r\n");
+}
+
+TEST_F(ServerTest, MsetnxSetsAllKeysOrNone) {
+    ASSERT_EQ(call({"SET", "b", "old"}), "+OK\r\n");
+    EXPECT_EQ(call({"MSETNX", "a", "1", "b", "2"}), ":0\r\n");
+    EXPECT_EQ(call({"MGET", "a", "b"}), "*2\r\n$-1\r\n$3\r\nold\r\n");
+    EXPECT_EQ(call({"MSETNX", "a", "1", "c", "2"}), ":1\r\n");
+    EXPECT_EQ(call({"MGET", "a", "c"}), "*2\r\n$1\r\n1\r\n$1\r\n2\r\n");
+}
+
+TEST_F(ServerTest, ExistsCountsRepeatedKeys) {
+    ASSERT_EQ(call({"MSET", "a", "1", "b", "2"}), "+OK\r\n");
+    EXPECT_EQ(call({"EXISTS", "a", "a", "missing", "b"}), ":3\r\n");
+    EXPECT_EQ(call({"EXISTS", "missing", "missing"}), ":0\r\n");
+}
+
+TEST_F(ServerTest, DelAndUnlinkCountKeysOnce) {
+    ASSERT_EQ(call({"MSET", "a", "1", "b", "2", "c", "3"}), "+OK\r\n");
+    EXPECT_EQ(call({"DEL", "a", "a", "missing"}), ":1\r\n");
+    EXPECT_EQ(call({"UNLINK", "b", "c", "b"}), ":2\r\n");
+    EXPECT_EQ(call({"DEL", "a", "b", "c"}), ":0\r\n");
+    EXPECT_EQ(call({"EXISTS", "a", "b", "c"}), ":0\r\n");
+}
+
+// MSET and MSETNX are logged as one record for the whole batch, so a
+// restart never sees part of one. DEL is logged as one record per shard,
+// holding only the keys it removed.
+TEST_F(ServerTest, MultiKeyWritesAreLoggedAsBatches) {
+    ASSERT_EQ(call({"MSET", "a", "1", "b", "2", "c", "3"}), "+OK\r\n");
+    ASSERT_EQ(call({"MSETNX", "a", "4", "d", "5"}), ":0\r\n");
+    ASSERT_EQ(call({"MSETNX", "d", "4", "e", "5"}), ":1\r\n");
+    EXPECT_EQ(records(aofContents()), (std::vector<std::string>{"MSET a 1 b 2 c 3", "MSET d 4 e 5"}));
+
+    ASSERT_EQ(call({"DEL", "a", "b", "c", "d", "e", "missing"}), ":5\r\n");
+    ASSERT_EQ(call({"DEL", "missing"}), ":0\r\n");
+    const auto logged = records(aofContents());
+    ASSERT_GT(logged.size(), 2u);
+    std::multiset<std::string> deleted;
+    for (size_t i = 2; i < logged.size(); ++i) {
+        ASSERT_EQ(logged[i].substr(0, 4), "DEL ") << logged[i];
+        for (size_t start = 4, end; start < logged[i].size(); start = end + 1) {
+            end = logged[i].find(' ', start);
+            if (end == std::string::npos) end = logged[i].size();
+            deleted.insert(logged[i].substr(start, end - start));
+        }
+    }
+    EXPECT_EQ(deleted, (std::multiset<std::string>{"a", "b", "c", "d", "e"}));
+}
+
+TEST_F(ServerTest, IncrRejectsOverflow) {
+    const std::string overflow = "-ERR increment or decrement would overflow\r\n";
+    ASSERT_EQ(call({"SET", "n", "9223372036854775806"}), "+OK\r\n");
+    EXPECT_EQ(call({"INCR", "n"}), ":9223372036854775807\r\n");
+    EXPECT_EQ(call({"INCR", "n"}), overflow);
+    EXPECT_EQ(call({"INCRBY", "n", "1"}), overflow);
+    EXPECT_EQ(call({"DECRBY", "n", "-1"}), overflow);
+    EXPECT_EQ(call({"GET", "n"}), "$19\r\n9223372036854775807\r\n");
+
+    ASSERT_EQ(call({"SET", "n", "-9223372036854775807"}), "+OK\r\n");
+    EXPECT_EQ(call({"DECR", "n"}), ":-9223372036854775808\r\n");
+    EXPECT_EQ(call({"DECR", "n"}), overflow);
+    EXPECT_EQ(call({"INCRBY", "n", "-1"}), overflow);
+    EXPECT_EQ(call({"DECRBY", "zero", "-9223372036854775808"}), "-ERR decrement would overflow\r\n");
+    EXPECT_EQ(call({"INCRBY", "zero", "9223372036854775808"}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(call({"EXISTS", "zero"}), ":0\r\n");
+}
+
+// Only the canonical form of an integer counts as one, as in Redis.
+TEST_F(ServerTest, IncrRejectsNonIntegers) {
+    const std::string error = "-ERR value is not an integer or out of range\r\n";
+    for (const std::string value : {"  5", "5 ", "05", "+5", "-0", "5.0", "", "abc", "9223372036854775808"}) {
+        ASSERT_EQ(call({"SET", "n", value}), "+OK\r\n");
+        EXPECT_EQ(call({"INCR", "n"}), error) << "'" << value << "'";
+        EXPECT_EQ(call({"GET", "n"}), "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n");
+    }
+    EXPECT_EQ(call({"INCRBY", "m", " 5"}), error);
+    EXPECT_EQ(call({"INCRBY", "m", "5x"}), error);
+    EXPECT_EQ(call({"EXISTS", "m"}), ":0\r\n");
+
+    ASSERT_EQ(call({"HSET", "hash", "field", "v"}), ":1\r\n");
+    EXPECT_EQ(call({"INCR", "hash"}), "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n");
+}
+
+TEST_F(ServerTest, IncrByFloatRejectsNonFiniteResults) {
+    ASSERT_EQ(call({"SET", "f", "1.5"}), "+OK\r\n");
+    // Increments that are not finite are refused as they are parsed.
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "inf"}), "-ERR value is not a valid float\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "-inf"}), "-ERR value is not a valid float\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "nan"}), "-ERR value is not a valid float\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "1e5000"}), "-ERR value is not a valid float\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "1.0x"}), "-ERR value is not a valid float\r\n");
+    EXPECT_EQ(call({"GET", "f"}), "$3\r\n1.5\r\n");
+
+    ASSERT_EQ(call({"SET", "big", "1e4932"}), "+OK\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "big", "1e4932"}), "-ERR increment would produce NaN or Infinity\r\n");
+    ASSERT_EQ(call({"SET", "text", "one"}), "+OK\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "text", "1"}), "-ERR value is not a valid float\r\n");
+
+    EXPECT_EQ(call({"INCRBYFLOAT", "f", "0.25"}), "$4\r\n1.75\r\n");
+    EXPECT_EQ(call({"INCRBYFLOAT", "new", "5.0e3"}), "$4\r\n5000\r\n");
+}
+
+TEST_F(ServerTest, CollectionCommandsReplyWrongType) {
+    const std::string wrong = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
+    ASSERT_EQ(call({"SET", "string", "v"}), "+OK\r\n");
+    ASSERT_EQ(call({"HSET", "hash", "f", "v"}), ":1\r\n");
+    ASSERT_EQ(call({"RPUSH", "list", "a"}), ":1\r\n");
+    ASSERT_EQ(call({"SADD", "set", "a"}), ":1\r\n");
+    ASSERT_EQ(call({"ZADD", "zset", "1", "a"}), ":1\r\n");
+
+    EXPECT_EQ(call({"HSET", "string", "f", "v"}), wrong);
+    EXPECT_EQ(call({"HGET", "list", "f"}), wrong);
+    EXPECT_EQ(call({"HGETALL", "set"}), wrong);
+    EXPECT_EQ(call({"LPUSH", "hash", "a"}), wrong);
+    EXPECT_EQ(call({"RPOP", "zset"}), wrong);
+    EXPECT_EQ(call({"LRANGE", "string", "0", "-1"}), wrong);
+    EXPECT_EQ(call({"SADD", "list", "a"}), wrong);
+    EXPECT_EQ(call({"SISMEMBER", "hash", "a"}), wrong);
+    EXPECT_EQ(call({"ZADD", "set", "1", "a"}), wrong);
+    EXPECT_EQ(call({"ZRANGE", "list", "0", "-1"}), wrong);
+    EXPECT_EQ(call({"GET", "hash"}), wrong);
+
+    EXPECT_EQ(call({"TYPE", "string"}), "+string\r\n");
+    EXPECT_EQ(call({"TYPE", "hash"}), "+hash\r\n");
+    EXPECT_EQ(call({"TYPE", "list"}), "+list\r\n");
+    EXPECT_EQ(call({"TYPE", "set"}), "+set\r\n");
+    EXPECT_EQ(call({"TYPE", "zset"}), "+zset\r\n");
+    EXPECT_EQ(call({"TYPE", "missing"}), "+none\r\n");
+}
+
+TEST_F(ServerTest, CollectionCommandsCheckTheirArity) {
+    EXPECT_EQ(call({"HSET", "hash", "f"}), "-ERR wrong number of arguments for HSET command\r\n");
+    EXPECT_EQ(call({"HSET", "hash", "f", "v", "g"}), "-ERR wrong number of arguments for HSET command\r\n");
+    EXPECT_EQ(call({"ZADD", "zset", "1"}), "-ERR wrong number of arguments for ZADD command\r\n");
+    EXPECT_EQ(call({"ZADD", "zset", "1", "a", "2"}), "-ERR wrong number of arguments for ZADD command\r\n");
+    EXPECT_EQ(call({"LPUSH", "list"}), "-ERR wrong number of arguments for LPUSH command\r\n");
+    EXPECT_EQ(call({"SADD", "set"}), "-ERR wrong number of arguments for SADD command\r\n");
+    EXPECT_EQ(call({"TYPE"}), "-ERR wrong number of arguments for TYPE command\r\n");
+    EXPECT_EQ(call({"EXISTS", "hash", "zset", "list", "set"}), ":0\r\n");
+    EXPECT_EQ(aofContents(), "");
+}
+
+TEST_F(ServerTest, ZaddRejectsScoresThatAreNotNumbers) {
+    const std::string error = "-ERR value is not a valid float\r\n";
+    EXPECT_EQ(call({"ZADD", "zset", "nan", "a"}), error);
+    EXPECT_EQ(call({"ZADD", "zset", "1", "a", "nan", "b"}), error);
+    EXPECT_EQ(call({"ZADD", "zset", "one", "a"}), error);
+    EXPECT_EQ(call({"ZADD", "zset", "1.5x", "a"}), error);
+    // A bad score anywhere leaves the whole command undone.
+    EXPECT_EQ(call({"EXISTS", "zset"}), ":0\r\n");
+
+    EXPECT_EQ(call({"ZADD", "zset", "inf", "top", "-inf", "bottom", "1.5", "middle"}), ":3\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0", "-1", "WITHSCORES"}),
+              "*6\r\n$6\r\nbottom\r\n$4\r\n-inf\r\n$6\r\nmiddle\r\n$3\r\n1.5\r\n$3\r\ntop\r\n$3\r\ninf\r\n");
+}
+
+TEST_F(ServerTest, ZrangeParsesWithScores) {
+    ASSERT_EQ(call({"ZADD", "zset", "2", "b", "1", "a"}), ":2\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0", "-1"}), "*2\r\n$1\r\na\r\n$1\r\nb\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0", "-1", "withscores"}),
+              "*4\r\n$1\r\na\r\n$1\r\n1\r\n$1\r\nb\r\n$1\r\n2\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "-1", "-1", "WITHSCORES"}), "*2\r\n$1\r\nb\r\n$1\r\n2\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0", "-1", "SCORES"}), "-ERR syntax error\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0", "-1", "WITHSCORES", "x"}),
+              "-ERR wrong number of arguments for ZRANGE command\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "0"}), "-ERR wrong number of arguments for ZRANGE command\r\n");
+    EXPECT_EQ(call({"ZRANGE", "zset", "a", "-1"}), "-ERR value is not an integer or out of range\r\n");
+    EXPECT_EQ(call({"ZRANGE", "missing", "0", "-1", "WITHSCORES"}), "*0\r\n");
+
+    ASSERT_EQ(call({"RPUSH", "list", "a"}), ":1\r\n");
+    EXPECT_EQ(call({"LRANGE", "list", "0", "-1", "WITHSCORES"}), "-ERR syntax error\r\n");
+}
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include "store/flat_map.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace store;
+
+TEST(FlatMapTests, InsertAndFind) {
+    FlatMap<int> map;
+    EXPECT_EQ(map.find("missing"), nullptr);
+
+    auto [slot, inserted] = map.tryEmplace("key1", 1);
+    EXPECT_TRUE(inserted);
+    EXPECT_EQ(slot->key, "key1");
+    EXPECT_EQ(slot->value, 1);
+
+    auto [existing, inserted_again] = map.tryEmplace("key1", 2);
+    EXPECT_FALSE(inserted_again);
+    EXPECT_EQ(existing->value, 1);
+
+    ASSERT_NE(map.find(std::string_view("key1")), nullptr);
+    EXPECT_EQ(map.find("key1")->value, 1);
+    EXPECT_EQ(map.size(), 1);
+}
+
+TEST(FlatMapTests, Erase) {
+    FlatMap<int> map;
+    map.tryEmplace("key1", 1);
+    map.tryEmplace("key2", 2);
+    EXPECT_TRUE(map.erase("key1"));
+    EXPECT_FALSE(map.erase("key1"));
+    EXPECT_EQ(map.find("key1"), nullptr);
+    EXPECT_EQ(map.find("key2")->value, 2);
+    EXPECT_EQ(map.size(), 1);
+}
+
+TEST(FlatMapTests, GrowsAndKeepsEveryKey) {
+    FlatMap<size_t> map;
+    const size_t count = 10000;
+    for (size_t i = 0; i < count; ++i) {
+        EXPECT_TRUE(map.tryEmplace("key:" + std::to_string(i), i).second);
+    }
+    EXPECT_EQ(map.size(), count);
+    EXPECT_GE(map.capacity() * 7 / 8, count);
+    for (size_t i = 0; i < count; ++i) {
+        auto* slot = map.find("key:" + std::to_string(i));
+        ASSERT_NE(slot, nullptr);
+        EXPECT_EQ(slot->value, i);
+    }
+}
+
+TEST(FlatMapTests, ChurnReusesTombstones) {
+    FlatMap<int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.tryEmplace("key:" + std::to_string(i), i);
+    }
+    const size_t capacity = map.capacity();
+    for (int round = 0; round < 100; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_TRUE(map.erase("key:" + std::to_string(i)));
+        }
+        for (int i = 0; i < 100; ++i) {
+            EXPECT_TRUE(map.tryEmplace("key:" + std::to_string(i), i).second);
+        }
+    }
+    EXPECT_EQ(map.size(), 100);
+    EXPECT_EQ(map.capacity(), capacity);
+}
+
+TEST(FlatMapTests, ForEachAndEraseIf) {
+    FlatMap<int> map;
+    for (int i = 0; i < 50; ++i) {
+        map.tryEmplace("key:" + std::to_string(i), i);
+    }
+    size_t erased = map.eraseIf([](FlatMap<int>::Slot& slot) { return slot.value % 2 == 0; });
+    EXPECT_EQ(erased, 25);
+
+    std::vector<int> values;
+    map.forEach([&](const FlatMap<int>::Slot& slot) { values.push_back(slot.value); });
+    EXPECT_EQ(values.size(), 25);
+    EXPECT_TRUE(std::all_of(values.begin(), values.end(), [](int v) { return v % 2 == 1; }));
+}
+
+TEST(FlatMapTests, OwnsNonTrivialValues) {
+    FlatMap<std::string> map;
+    const std::string long_value(1000, 'x');
+    for (int i = 0; i < 100; ++i) {
+        map.tryEmplace("key:" + std::to_string(i), long_value);
+    }
+    FlatMap<std::string> moved(std::move(map));
+    EXPECT_EQ(map.size(), 0);
+    EXPECT_EQ(moved.size(), 100);
+    EXPECT_EQ(moved.find("key:42")->value, long_value);
+    moved.clear();
+    EXPECT_EQ(moved.find("key:42"), nullptr);
+}
+
+TEST(FlatMapTests, IncrementalRehash) {
+    FlatMap<size_t> map;
+    size_t i = 0;
+    while (!map.rehashing()) {
+        map.tryEmplace("key:" + std::to_string(i), i);
+        ++i;
+    }
+    const size_t inserted = i;
+
+    // Both tables are consulted while the migration is in progress.
+    for (size_t j = 0; j < inserted; ++j) {
+        auto* slot = map.find("key:" + std::to_string(j));
+        ASSERT_NE(slot, nullptr);
+        EXPECT_EQ(slot->value, j);
+    }
+    EXPECT_TRUE(map.erase("key:0"));
+    EXPECT_EQ(map.find("key:0"), nullptr);
+
+    while (map.rehashStep(FlatMap<size_t>::MIGRATE_STEP)) {}
+    EXPECT_FALSE(map.rehashing());
+    EXPECT_EQ(map.size(), inserted - 1);
+    for (size_t j = 1; j < inserted; ++j) {
+        ASSERT_NE(map.find("key:" + std::to_string(j)), nullptr);
+    }
+}
+
+TEST(FlatMapTests, InsertsFinishMigration) {
+    FlatMap<size_t> map;
+    for (size_t i = 0; i < 100000; ++i) {
+        map.tryEmplace("key:" + std::to_string(i), i);
+        // At most one migration is ever in flight.
+        EXPECT_LE(map.tableBytes(), map.capacity() * 3 / 2 * (sizeof(FlatMap<size_t>::Slot) + 1));
+    }
+    size_t count = 0;
+    map.forEach([&](const FlatMap<size_t>::Slot&) { ++count; });
+    EXPECT_EQ(count, 100000);
+}
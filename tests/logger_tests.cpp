@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+#include "server/logger.hpp"
+#include <cstdio>
+#include <fstream>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace server;
+
+class LoggerTest : public ::testing::Test {
+protected:
+    std::string path = "logger_test_" + std::to_string(::getpid()) + ".log";
+
+    void SetUp() override { std::remove(path.c_str()); }
+    void TearDown() override { std::remove(path.c_str()); }
+
+    std::vector<std::string> lines() {
+        std::ifstream in(path);
+        std::vector<std::string> result;
+        for (std::string line; std::getline(in, line);) {
+            result.push_back(line);
+        }
+        return result;
+    }
+
+    // The text after the "pid:M date time mark " prefix.
+    static std::string text(const std::string& line) {
+        size_t space = 0;
+        for (int i = 0; i < 6 && space != std::string::npos; ++i) {
+            space = line.find(' ', space + 1);
+        }
+        return space == std::string::npos ? "" : line.substr(space + 1);
+    }
+};
+
+TEST_F(LoggerTest, WritesLinesInRedisFormat) {
+    Logger logger;
+    ASSERT_TRUE(logger.setFile(path));
+    logger.log(LogLevel::Notice, "loaded ", 42, " keys in ", 1.5, std::string(" s"), ' ', true);
+    logger.log(LogLevel::Warning, std::string_view("disk full"));
+    logger.flush();
+
+    auto written = lines();
+    ASSERT_EQ(written.size(), 2);
+    const std::regex format(R"(\d+:M \d\d \w{3} \d{4} \d\d:\d\d:\d\d\.\d{3} \* loaded 42 keys in 1.5 s true)");
+    EXPECT_TRUE(std::regex_match(written[0], format)) << written[0];
+    EXPECT_EQ(written[1].substr(written[1].size() - 11), "# disk full");
+}
+
+TEST_F(LoggerTest, LevelsAndParsing) {
+    Logger logger;
+    EXPECT_EQ(logger.level(), LogLevel::Notice);
+    EXPECT_FALSE(logger.enabled(LogLevel::Verbose));
+    EXPECT_TRUE(logger.enabled(LogLevel::Warning));
+    logger.setLevel(LogLevel::Debug);
+    EXPECT_TRUE(logger.enabled(LogLevel::Debug));
+
+    EXPECT_EQ(Logger::parseLevel("verbose"), LogLevel::Verbose);
+    EXPECT_EQ(Logger::parseLevel("warning"), LogLevel::Warning);
+    EXPECT_FALSE(Logger::parseLevel("loud"));
+}
+
+TEST_F(LoggerTest, CutsLongLinesShort) {
+    Logger logger;
+    ASSERT_TRUE(logger.setFile(path));
+    logger.log(LogLevel::Notice, std::string(Logger::LINE_SIZE - 2, 'x'), 12345, "tail");
+    logger.flush();
+
+    auto written = lines();
+    ASSERT_EQ(written.size(), 1);
+    EXPECT_EQ(text(written[0]), std::string(Logger::LINE_SIZE - 2, 'x') + "12");
+}
+
+TEST_F(LoggerTest, EveryLineIsWrittenOrCountedAsDropped) {
+    constexpr int THREADS = 4;
+    constexpr int LINES = 5000;
+    Logger logger;
+    ASSERT_TRUE(logger.setFile(path));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&logger, t]() {
+            for (int i = 0; i < LINES; ++i) {
+                logger.log(LogLevel::Notice, "line ", t, ' ', i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+
+    std::set<std::string> seen;
+    bool reported_drops = false;
+    for (const auto& line : lines()) {
+        const std::string message = text(line);
+        if (message.find("log lines dropped") != std::string::npos) {
+            reported_drops = true;
+        } else {
+            EXPECT_TRUE(seen.insert(message).second) << message;
+        }
+    }
+    EXPECT_EQ(seen.size() + logger.dropped(), size_t{THREADS * LINES});
+    EXPECT_EQ(reported_drops, logger.dropped() > 0);
+}
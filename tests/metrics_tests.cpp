@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "server/latency_monitor.hpp"
+#include "server/metrics.hpp"
+#include "server/histogram.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace server;
+
+TEST(LatencyHistogramTest, BucketsKeepRelativePrecision) {
+    size_t previous = 0;
+    for (uint64_t value = 0; value < (uint64_t{1} << 40); value = value * 9 / 8 + 1) {
+        const size_t bucket = LatencyHistogram::bucketFor(value);
+        EXPECT_GE(bucket, previous);
+        previous = bucket;
+        if (value >> LatencyHistogram::MAX_BITS) {
+            EXPECT_EQ(bucket, LatencyHistogram::BUCKETS - 1);
+            continue;
+        }
+        const uint64_t upper = LatencyHistogram::upperBound(bucket);
+        EXPECT_GE(upper, value);
+        EXPECT_LE(upper - value, value / LatencyHistogram::SUB_BUCKETS) << value;
+        EXPECT_EQ(LatencyHistogram::bucketFor(upper), bucket);
+        EXPECT_EQ(LatencyHistogram::bucketFor(upper + 1), bucket + 1);
+    }
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 10000; ++value) {
+        histogram.record(value * 1000);
+    }
+    LatencyHistogram::Counts counts;
+    histogram.addTo(counts);
+    EXPECT_EQ(counts.count, 10000);
+    EXPECT_EQ(counts.sum, uint64_t{10000} * 10001 / 2 * 1000);
+    EXPECT_NEAR(static_cast<double>(counts.percentile(0.5)), 5e6, 5e6 / 8);
+    EXPECT_NEAR(static_cast<double>(counts.percentile(0.99)), 9.9e6, 9.9e6 / 8);
+    EXPECT_GE(counts.percentile(1.0), 1e7);
+    EXPECT_EQ(LatencyHistogram::Counts().percentile(0.5), 0);
+}
+
+TEST(MetricsTest, CountsFromManyThreads) {
+    auto& metrics = Metrics::getInstance();
+    const uint64_t commands = metrics.getCommandCount(Metrics::CommandId::Get);
+    const size_t memory = metrics.getMemoryUsage();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&metrics, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                metrics.incrementCommand(Metrics::CommandId::Get);
+                // Half the threads free what the other half allocate.
+                metrics.updateMemoryUsage(t % 2 ? 100 : -100);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(metrics.getCommandCount(Metrics::CommandId::Get) - commands, 80000);
+    EXPECT_EQ(metrics.getCommandCount("GET") - commands, 80000);
+    EXPECT_EQ(metrics.getMemoryUsage(), memory);
+}
+
+TEST(MetricsTest, CommandIdsGroupVariants) {
+    EXPECT_EQ(Metrics::commandId("PEXPIREAT"), Metrics::CommandId::Expire);
+    EXPECT_EQ(Metrics::commandId("PTTL"), Metrics::CommandId::Ttl);
+    EXPECT_EQ(Metrics::commandId("METRICS"), Metrics::CommandId::Other);
+}
+
+TEST(MetricsTest, ExportsLatencyHistograms) {
+    auto& metrics = Metrics::getInstance();
+    const uint64_t before = metrics.getLatency(Metrics::CommandId::Persist).count;
+    metrics.recordLatency(Metrics::CommandId::Persist, std::chrono::microseconds(3));
+    metrics.recordLatency(Metrics::CommandId::Persist, std::chrono::milliseconds(3));
+    const uint64_t after = before + 2;
+
+    const std::string text = metrics.getPrometheusMetrics();
+    EXPECT_NE(text.find("# TYPE redis_command_duration_seconds histogram"), std::string::npos);
+    EXPECT_NE(text.find("redis_command_duration_seconds_bucket{command=\"persist\",le=\"+Inf\"} " +
+                        std::to_string(after) + "\n"), std::string::npos);
+    EXPECT_NE(text.find("redis_command_duration_seconds_count{command=\"persist\"} " +
+                        std::to_string(after) + "\n"), std::string::npos);
+    // 3us is under the 4.096us bound, 3ms is not.
+    EXPECT_NE(text.find("redis_command_duration_seconds_bucket{command=\"persist\",le=\"4.096e-06\"} " +
+                        std::to_string(before + 1) + "\n"), std::string::npos);
+}
+
+TEST(LatencyMonitorTest, KeepsEventsOverThreshold) {
+    auto& monitor = LatencyMonitor::getInstance();
+    monitor.reset();
+    monitor.setThreshold(std::chrono::milliseconds(0));
+    monitor.record("fsync", std::chrono::seconds(1));
+    EXPECT_TRUE(monitor.latest().empty());
+
+    monitor.setThreshold(std::chrono::milliseconds(10));
+    monitor.record("fsync", std::chrono::milliseconds(9));
+    monitor.record("fsync", std::chrono::milliseconds(20));
+    monitor.record("fsync", std::chrono::milliseconds(15));
+    monitor.record("expire", std::chrono::milliseconds(12));
+
+    auto latest = monitor.latest();
+    ASSERT_EQ(latest.size(), 2);
+    EXPECT_EQ(latest[1].name, "fsync");
+    EXPECT_EQ(latest[1].max_ms, 20);
+    EXPECT_GT(latest[1].latest.time, 0);
+
+    // Samples within a second are merged, keeping the worst.
+    auto history = monitor.history("fsync");
+    ASSERT_GE(history.size(), 1);
+    EXPECT_LE(history.size(), 2);
+    EXPECT_EQ(history.back().latency_ms, history.size() == 1 ? 20 : 15);
+    EXPECT_TRUE(monitor.history("unknown").empty());
+
+    EXPECT_EQ(monitor.reset({"fsync", "unknown"}), 1);
+    EXPECT_EQ(monitor.latest().size(), 1);
+    EXPECT_EQ(monitor.reset(), 1);
+    monitor.setThreshold(std::chrono::milliseconds(0));
+}
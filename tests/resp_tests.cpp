@@ -1,111 +1,223 @@
-#include "server/resp.hpp"
-#include <gtest/gtest.h>
-#include <string>
-
-namespace server {
-namespace resp {
-namespace test {
-
-TEST(RespParserTest, ParseSimpleString) {
-    auto result = Parser::parse("+OK\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<SimpleString>());
-    EXPECT_EQ(result->get<SimpleString>().value, "OK");
-
-    result = Parser::parse("+\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<SimpleString>());
-    EXPECT_EQ(result->get<SimpleString>().value, "");
-}
-
-TEST(RespParserTest, ParseError) {
-    auto result = Parser::parse("-Error message\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<Error>());
-    EXPECT_EQ(result->get<Error>().value, "Error message");
-}
-
-TEST(RespParserTest, ParseInteger) {
-    auto result = Parser::parse(":42\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<Integer>());
-    EXPECT_EQ(result->get<Integer>(), 42);
-
-    result = Parser::parse(":-123\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<Integer>());
-    EXPECT_EQ(result->get<Integer>(), -123);
-}
-
-TEST(RespParserTest, ParseBulkString) {
-    auto result = Parser::parse("$6\r\nfoobar\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<BulkString>());
-    EXPECT_EQ(*result->get<BulkString>(), "foobar");
-
-    result = Parser::parse("$-1\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<BulkString>());
-    EXPECT_FALSE(result->get<BulkString>().has_value());
-
-    result = Parser::parse("$0\r\n\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<BulkString>());
-    EXPECT_EQ(*result->get<BulkString>(), "");
-}
-
-TEST(RespParserTest, ParseArray) {
-    auto result = Parser::parse("*2\r\n$3\r\nfoo\r\n$3\r\nbar\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<Array>());
-    const auto& array = result->get<Array>();
-    EXPECT_EQ(array.size(), 2);
-    ASSERT_TRUE(array[0].holds_alternative<BulkString>());
-    ASSERT_TRUE(array[1].holds_alternative<BulkString>());
-    EXPECT_EQ(*array[0].get<BulkString>(), "foo");
-    EXPECT_EQ(*array[1].get<BulkString>(), "bar");
-
-    result = Parser::parse("*0\r\n");
-    ASSERT_TRUE(result.has_value());
-    ASSERT_TRUE(result->holds_alternative<Array>());
-    EXPECT_EQ(result->get<Array>().size(), 0);
-}
-
-TEST(RespParserTest, Serialize) {
-    Value simpleStr = SimpleString("OK");
-    EXPECT_EQ(Parser::serialize(simpleStr), "+OK\r\n");
-
-    Value error = Error("Error message");
-    EXPECT_EQ(Parser::serialize(error), "-Error message\r\n");
-
-    Value integer = Integer(123);
-    EXPECT_EQ(Parser::serialize(integer), ":123\r\n");
-
-    Value bulkStr = BulkString("foobar");
-    EXPECT_EQ(Parser::serialize(bulkStr), "$6\r\nfoobar\r\n");
-
-    Value nullBulk = BulkString(std::nullopt);
-    EXPECT_EQ(Parser::serialize(nullBulk), "$-1\r\n");
-
-    Array array = {
-        SimpleString("foo"),
-        Integer(123),
-        BulkString("bar")
-    };
-    Value arrayValue = array;
-    EXPECT_EQ(Parser::serialize(arrayValue), "*3\r\n+foo\r\n:123\r\n$3\r\nbar\r\n");
-}
-
-TEST(RespParserTest, InvalidInput) {
-    EXPECT_FALSE(Parser::parse("").has_value());
-
-    EXPECT_FALSE(Parser::parse("invalid\r\n").has_value());
-
-    EXPECT_FALSE(Parser::parse("+OK").has_value());
-    EXPECT_FALSE(Parser::parse("$6\r\nfoo").has_value());
-    EXPECT_FALSE(Parser::parse("*2\r\n+foo").has_value());
-}
-
-}
-}
+#include "server/resp.hpp"
+#include <gtest/gtest.h>
+#include <string>
+
+namespace server {
+namespace resp {
+namespace test {
+
+TEST(RespParserTest, ParseSimpleString) {
+    auto result = Parser::parse("+OK\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<SimpleString>());
+    EXPECT_EQ(result->get<SimpleString>().value, "OK");
+
+    result = Parser::parse("+\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<SimpleString>());
+    EXPECT_EQ(result->get<SimpleString>().value, "");
+}
+
+TEST(RespParserTest, ParseError) {
+    auto result = Parser::parse("-Error message\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<Error>());
+    EXPECT_EQ(result->get<Error>().value, "Error message");
+}
+
+TEST(RespParserTest, ParseInteger) {
+    auto result = Parser::parse(":42\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<Integer>());
+    EXPECT_EQ(result->get<Integer>(), 42);
+
+    result = Parser::parse(":-123\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<Integer>());
+    EXPECT_EQ(result->get<Integer>(), -123);
+}
+
+TEST(RespParserTest, ParseBulkString) {
+    auto result = Parser::parse("$6\r\nfoobar\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<BulkString>());
+    EXPECT_EQ(*result->get<BulkString>(), "foobar");
+
+    result = Parser::parse("$-1\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<BulkString>());
+    EXPECT_FALSE(result->get<BulkString>().has_value());
+
+    result = Parser::parse("$0\r\n\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<BulkString>());
+    EXPECT_EQ(*result->get<BulkString>(), "");
+}
+
+TEST(RespParserTest, ParseArray) {
+    auto result = Parser::parse("*2\r\n$3\r\nfoo\r\n$3\r\nbar\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<Array>());
+    const auto& array = result->get<Array>();
+    EXPECT_EQ(array.size(), 2);
+    ASSERT_TRUE(array[0].holds_alternative<BulkString>());
+    ASSERT_TRUE(array[1].holds_alternative<BulkString>());
+    EXPECT_EQ(*array[0].get<BulkString>(), "foo");
+    EXPECT_EQ(*array[1].get<BulkString>(), "bar");
+
+    result = Parser::parse("*0\r\n");
+    ASSERT_TRUE(result.has_value());
+    ASSERT_TRUE(result->holds_alternative<Array>());
+    EXPECT_EQ(result->get<Array>().size(), 0);
+}
+
+TEST(RespParserTest, Serialize) {
+    Value simpleStr = SimpleString("OK");
+    EXPECT_EQ(Parser::serialize(simpleStr), "+OK\r\n");
+
+    Value error = Error("Error message");
+    EXPECT_EQ(Parser::serialize(error), "-Error message\r\n");
+
+    Value integer = Integer(123);
+    EXPECT_EQ(Parser::serialize(integer), ":123\r\n");
+
+    Value bulkStr = BulkString("foobar");
+    EXPECT_EQ(Parser::serialize(bulkStr), "$6\r\nfoobar\r\n");
+
+    Value nullBulk = BulkString(std::nullopt);
+    EXPECT_EQ(Parser::serialize(nullBulk), "$-1\r\n");
+
+    Array array = {
+        SimpleString("foo"),
+        Integer(123),
+        BulkString("bar")
+    };
+    Value arrayValue = array;
+    EXPECT_EQ(Parser::serialize(arrayValue), "*3\r\n+foo\r\n:123\r\n$3\r\nbar\r\n");
+}
+
+TEST(RespParserTest, SerializeMovesLargeBulkStrings) {
+    std::vector<std::string> out;
+    Parser::serialize(BulkString("foobar"), out);
+    ASSERT_EQ(out.size(), 1);
+    EXPECT_EQ(out[0], "$6\r\nfoobar\r\n");
+
+    const std::string large(Parser::MOVE_THRESHOLD, 'x');
+    std::string payload = large;
+    const char* data = payload.data();
+    Array array;
+    array.emplace_back(Integer(1));
+    array.emplace_back(BulkString(std::move(payload)));
+    array.emplace_back(BulkString("bar"));
+    const std::string expected = Parser::serialize(Value(array));
+
+    out.clear();
+    Parser::serialize(Value(std::move(array)), out);
+    ASSERT_EQ(out.size(), 3);
+    EXPECT_EQ(out[0], "*3\r\n:1\r\n$" + std::to_string(large.size()) + "\r\n");
+    EXPECT_EQ(out[1].data(), data);
+    EXPECT_EQ(out[2], "\r\n$3\r\nbar\r\n");
+    std::string joined;
+    for (const auto& piece : out) joined += piece;
+    EXPECT_EQ(joined, expected);
+}
+
+TEST(RespParserTest, InvalidInput) {
+    EXPECT_FALSE(Parser::parse("").has_value());
+
+    EXPECT_FALSE(Parser::parse("invalid\r\n").has_value());
+
+    EXPECT_FALSE(Parser::parse("+OK").has_value());
+    EXPECT_FALSE(Parser::parse("$6\r\nfoo").has_value());
+    EXPECT_FALSE(Parser::parse("*2\r\n+foo").has_value());
+}
+
+TEST(RequestParserTest, ParseCommand) {
+    RequestParser parser;
+    std::string input = "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n";
+    ASSERT_EQ(parser.parse(input), RequestParser::Status::Complete);
+    ASSERT_EQ(parser.args().size(), 2);
+    EXPECT_EQ(parser.args()[0], "GET");
+    EXPECT_EQ(parser.args()[1], "key");
+    EXPECT_EQ(parser.args()[1].data(), input.data() + 17);
+    EXPECT_EQ(parser.consumed(), input.size());
+    EXPECT_EQ(parser.parse(input), RequestParser::Status::Incomplete);
+}
+
+TEST(RequestParserTest, Pipelined) {
+    RequestParser parser;
+    std::string input = "*1\r\n$4\r\nPING\r\n*2\r\n$3\r\nGET\r\n$1\r\nk\r\n*1\r\n$3";
+    ASSERT_EQ(parser.parse(input), RequestParser::Status::Complete);
+    EXPECT_EQ(parser.args()[0], "PING");
+    ASSERT_EQ(parser.parse(input), RequestParser::Status::Complete);
+    EXPECT_EQ(parser.args()[1], "k");
+    EXPECT_EQ(parser.parse(input), RequestParser::Status::Incomplete);
+    EXPECT_EQ(parser.consumed(), 34);
+}
+
+TEST(RequestParserTest, ResumesAcrossReads) {
+    const std::string message = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$10\r\n0123456789\r\n";
+    RequestParser parser;
+    std::string buffer;
+    for (size_t i = 0; i + 1 < message.size(); ++i) {
+        buffer += message[i];
+        ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Incomplete) << "at byte " << i;
+    }
+    buffer += message.back();
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Complete);
+    ASSERT_EQ(parser.args().size(), 3);
+    EXPECT_EQ(parser.args()[2], "0123456789");
+}
+
+TEST(RequestParserTest, DiscardKeepsPartialCommand) {
+    RequestParser parser;
+    std::string buffer = "*1\r\n$4\r\nPING\r\n*2\r\n$3\r\nGET\r\n$3\r\nk";
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Complete);
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Incomplete);
+    EXPECT_EQ(parser.pendingBytes(buffer.size()), 4);
+
+    buffer.erase(0, parser.consumed());
+    parser.discard(14);
+    EXPECT_EQ(parser.consumed(), 0);
+
+    buffer += "ey\r\n";
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Complete);
+    EXPECT_EQ(parser.args()[0], "GET");
+    EXPECT_EQ(parser.args()[1], "key");
+}
+
+TEST(RequestParserTest, LargeBulkIsReadAheadInSteps) {
+    RequestParser parser;
+    std::string buffer = "*1\r\n$536870912\r\n";
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Incomplete);
+    // The declared length alone does not ask for 512MB of room.
+    EXPECT_EQ(parser.pendingBytes(buffer.size()), RequestParser::MAX_READ_AHEAD);
+
+    buffer += std::string(2 * RequestParser::MAX_READ_AHEAD, 'x');
+    ASSERT_EQ(parser.parse(buffer), RequestParser::Status::Incomplete);
+    EXPECT_EQ(parser.pendingBytes(buffer.size()), RequestParser::MAX_READ_AHEAD);
+}
+
+TEST(RequestParserTest, EmptyArrayIsSkipped) {
+    RequestParser parser;
+    ASSERT_EQ(parser.parse("*0\r\n"), RequestParser::Status::Complete);
+    EXPECT_TRUE(parser.args().empty());
+}
+
+TEST(RequestParserTest, InvalidInput) {
+    EXPECT_EQ(RequestParser().parse("PING\r\n"), RequestParser::Status::Error);
+    EXPECT_EQ(RequestParser().parse("*x\r\n"), RequestParser::Status::Error);
+    EXPECT_EQ(RequestParser().parse("*1\r\n+OK\r\n"), RequestParser::Status::Error);
+    EXPECT_EQ(RequestParser().parse("*1\r\n$-1\r\n"), RequestParser::Status::Error);
+    EXPECT_EQ(RequestParser().parse("*1\r\n$2\r\nabcd\r\n"), RequestParser::Status::Error);
+    EXPECT_EQ(RequestParser().parse("*1\r\n$99999999999\r\n"), RequestParser::Status::Error);
+
+    RequestParser parser;
+    ASSERT_EQ(parser.parse("*1\r\n$1x\r\n"), RequestParser::Status::Error);
+    EXPECT_FALSE(parser.error().empty());
+    EXPECT_EQ(parser.parse("*1\r\n$1x\r\n"), RequestParser::Status::Error);
+}
+
+}
+}
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <gtest/gtest.h>
+#include "server/logger.hpp"
+#include "server/server.hpp"
+#include <boost/asio.hpp>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+// Starts an in-process server on a free port for each test, with its own
+// AOF and snapshot files, and talks to it over one connection.
+class ServerTest : public ::testing::Test {
+protected:
+    std::string aof_path = "server_test_" + std::to_string(::getpid()) + ".aof";
+    std::string snapshot_path = "server_test_" + std::to_string(::getpid()) + ".snapshot";
+
+    void SetUp() override {
+        server::Logger::instance().setLevel(server::LogLevel::Warning);
+        removeFiles();
+        start();
+    }
+
+    void TearDown() override {
+        stop();
+        removeFiles();
+    }
+
+    // Fsyncs every write before replying, so the AOF can be read as soon as
+    // a write's reply arrives.
+    virtual server::Server::Config config() {
+        server::Server::Config config;
+        config.port = freePort();
+        config.io_threads = 1;
+        config.aof_path = aof_path;
+        config.appendfsync = server::AOFManager::FsyncPolicy::Always;
+        config.snapshot_path = snapshot_path;
+        return config;
+    }
+
+    void start() {
+        const auto cfg = config();
+        server_ = std::make_unique<server::Server>(cfg);
+        thread_ = std::thread([this]() { server_->start(); });
+        socket_.connect({boost::asio::ip::address::from_string(cfg.host), cfg.port});
+        // The reply means start() has run, so stop() will not race it.
+        ASSERT_EQ(call({"EXISTS", "started"}), ":0\r\n");
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+        pending_.clear();
+        if (server_) server_->stop();
+        if (thread_.joinable()) thread_.join();
+        server_.reset();
+    }
+
+    void send(const std::string& bytes) {
+        boost::asio::write(socket_, boost::asio::buffer(bytes));
+    }
+
+    // Reads one whole reply, nested arrays included, as it came off the wire.
+    std::string reply() {
+        std::string out;
+        readReply(out);
+        return out;
+    }
+
+    std::string call(std::initializer_list<std::string> args) {
+        send(command(args));
+        return reply();
+    }
+
+    // True once the server has closed the connection and every byte it sent
+    // has been read. Closing with unread input resets the connection rather
+    // than ending it.
+    bool closed() {
+        if (!pending_.empty()) return false;
+        char byte;
+        boost::system::error_code error;
+        socket_.read_some(boost::asio::buffer(&byte, 1), error);
+        if (!error) pending_.push_back(byte);
+        return error == boost::asio::error::eof || error == boost::asio::error::connection_reset;
+    }
+
+    std::string aofContents() const {
+        std::string contents;
+        if (FILE* file = std::fopen(aof_path.c_str(), "rb")) {
+            char chunk[4096];
+            size_t n;
+            while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) contents.append(chunk, n);
+            std::fclose(file);
+        }
+        return contents;
+    }
+
+    static std::string command(std::initializer_list<std::string> args) {
+        std::string out = "*" + std::to_string(args.size()) + "\r\n";
+        for (const auto& arg : args) {
+            out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+        }
+        return out;
+    }
+
+private:
+    boost::asio::io_context io_context_;
+    boost::asio::ip::tcp::socket socket_{io_context_};
+    std::unique_ptr<server::Server> server_;
+    std::thread thread_;
+    std::string pending_;
+
+    void removeFiles() {
+        std::remove(aof_path.c_str());
+        std::remove(snapshot_path.c_str());
+    }
+
+    static unsigned short freePort() {
+        boost::asio::io_context io_context;
+        boost::asio::ip::tcp::acceptor acceptor(
+            io_context, {boost::asio::ip::address::from_string("127.0.0.1"), 0});
+        return acceptor.local_endpoint().port();
+    }
+
+    void fill(size_t wanted) {
+        char chunk[4096];
+        while (pending_.size() < wanted) {
+            const size_t n = socket_.read_some(boost::asio::buffer(chunk));
+            pending_.append(chunk, n);
+        }
+    }
+
+    std::string take(size_t n) {
+        fill(n);
+        std::string out = pending_.substr(0, n);
+        pending_.erase(0, n);
+        return out;
+    }
+
+    std::string line() {
+        size_t end;
+        while ((end = pending_.find("\r\n")) == std::string::npos) fill(pending_.size() + 1);
+        return take(end + 2);
+    }
+
+    void readReply(std::string& out) {
+        const std::string header = line();
+        out += header;
+        const char type = header[0];
+        if (type != '$' && type != '*') return;
+        const long length = std::stol(header.substr(1));
+        if (length < 0) return;
+        if (type == '$') {
+            out += take(static_cast<size_t>(length) + 2);
+        } else {
+            for (long i = 0; i < length; ++i) readReply(out);
+        }
+    }
+};
@@ -0,0 +1,83 @@
+#include "server_fixture.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Gives the server time to read what has been sent so far on its own.
+void letServerRead() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+}
+
+TEST_F(ServerTest, RepliesToPipelinedCommandsInOrder) {
+    const int count = 100;
+    std::string batch;
+    for (int i = 0; i < count; ++i) {
+        batch += command({"SET", "key:" + std::to_string(i), std::to_string(i)});
+        batch += command({"GET", "key:" + std::to_string(i)});
+    }
+    send(batch);
+    for (int i = 0; i < count; ++i) {
+        const std::string value = std::to_string(i);
+        ASSERT_EQ(reply(), "+OK\r\n");
+        ASSERT_EQ(reply(), "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n");
+    }
+}
+
+TEST_F(ServerTest, WaitsForTheRestOfASplitCommand) {
+    const std::string set = command({"SET", "split", "value"});
+    for (size_t cut : {size_t(1), set.find("split"), set.size() - 1}) {
+        send(set.substr(0, cut));
+        letServerRead();
+        send(set.substr(cut));
+        EXPECT_EQ(reply(), "+OK\r\n") << "cut at " << cut;
+    }
+    EXPECT_EQ(call({"GET", "split"}), "$5\r\nvalue\r\n");
+}
+
+// The complete commands ahead of a partial one run straight away, and the
+// partial one is kept for the next read.
+TEST_F(ServerTest, KeepsATrailingPartialCommand) {
+    const std::string last = command({"SET", "last", "value"});
+    std::string batch;
+    for (int i = 0; i < 10; ++i) batch += command({"INCR", "counter"});
+    send(batch + last.substr(0, last.size() / 2));
+    for (int i = 1; i <= 10; ++i) ASSERT_EQ(reply(), ":" + std::to_string(i) + "\r\n");
+
+    letServerRead();
+    send(last.substr(last.size() / 2) + command({"GET", "last"}));
+    EXPECT_EQ(reply(), "+OK\r\n");
+    EXPECT_EQ(reply(), "$5\r\nvalue\r\n");
+}
+
+// A value larger than the idle buffer grows it, and the session carries on
+// with a small buffer once the value has been handled.
+TEST_F(ServerTest, HandlesCommandsLargerThanTheReadBuffer) {
+    const std::string big(200 * 1024, 'x');
+    const std::string set = command({"SET", "big", big});
+    send(set.substr(0, 1000));
+    letServerRead();
+    send(set.substr(1000) + command({"SET", "small", "v"}));
+    EXPECT_EQ(reply(), "+OK\r\n");
+    EXPECT_EQ(reply(), "+OK\r\n");
+
+    EXPECT_EQ(call({"GET", "big"}), "$" + std::to_string(big.size()) + "\r\n" + big + "\r\n");
+    EXPECT_EQ(call({"GET", "small"}), "$1\r\nv\r\n");
+}
+
+// Commands ahead of a malformed one still run and get their replies, then
+// the connection is closed.
+TEST_F(ServerTest, ClosesTheConnectionAfterAProtocolError) {
+    send(command({"SET", "before", "v"}) + "PING\r\n" + command({"SET", "after", "v"}));
+    EXPECT_EQ(reply(), "+OK\r\n");
+    EXPECT_EQ(reply(), "-ERR Protocol error: expected '*'\r\n");
+    EXPECT_TRUE(closed());
+
+    stop();
+    start();
+    EXPECT_EQ(call({"EXISTS", "before"}), ":1\r\n");
+    EXPECT_EQ(call({"EXISTS", "after"}), ":0\r\n");
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include "store/slab_allocator.hpp"
+#include <string>
+#include <vector>
+
+using namespace store;
+
+TEST(SlabAllocatorTest, ClassesFitWithLittleWaste) {
+    EXPECT_EQ(SlabAllocator::classSize(0), 0);
+    EXPECT_EQ(SlabAllocator::classSize(SlabAllocator::INLINE_SIZE), 0);
+    EXPECT_EQ(SlabAllocator::classSize(SlabAllocator::INLINE_SIZE + 1), 16);
+    EXPECT_EQ(SlabAllocator::classSize(100), 112);
+    EXPECT_EQ(SlabAllocator::classSize(SlabAllocator::MAX_CLASS_SIZE), SlabAllocator::MAX_CLASS_SIZE);
+    EXPECT_EQ(SlabAllocator::classSize(SlabAllocator::MAX_CLASS_SIZE + 1), 0);
+    for (size_t size = 33; size <= SlabAllocator::MAX_CLASS_SIZE; ++size) {
+        const size_t slot = SlabAllocator::classSize(size);
+        ASSERT_GE(slot, size);
+        ASSERT_LT((slot - size) * 5, slot) << size;
+    }
+}
+
+TEST(SlabAllocatorTest, BlocksKeepTheirBytes) {
+    SlabAllocator allocator;
+    std::vector<SlabAllocator::Block> blocks;
+    std::vector<std::string> expected;
+    for (size_t size : {0, 1, 7, 8, 9, 100, 4096, 4097, 100000}) {
+        expected.push_back(std::string(size, static_cast<char>('a' + size % 26)));
+        blocks.push_back(allocator.allocate(expected.back()));
+    }
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        EXPECT_EQ(blocks[i].view(), expected[i]);
+        const size_t slot = SlabAllocator::classSize(expected[i].size());
+        if (expected[i].size() <= SlabAllocator::INLINE_SIZE) {
+            EXPECT_EQ(allocator.bytes(blocks[i]), 0);
+        } else if (slot != 0) {
+            EXPECT_EQ(allocator.bytes(blocks[i]), slot);
+        } else {
+            EXPECT_GE(allocator.bytes(blocks[i]), expected[i].size());
+        }
+    }
+    // Up to 8 bytes are stored inline.
+    EXPECT_EQ(allocator.allocatedBytes(), 16 + 112 + 4096);
+    for (auto& block : blocks) {
+        allocator.deallocate(block);
+        EXPECT_EQ(block.size, 0);
+    }
+    EXPECT_EQ(allocator.allocatedBytes(), 0);
+}
+
+TEST(SlabAllocatorTest, AssignStaysInPlaceWithinClass) {
+    SlabAllocator allocator;
+    auto block = allocator.allocate(std::string(100, 'a'));
+    const char* data = block.data;
+    allocator.assign(block, std::string(110, 'b'));
+    EXPECT_EQ(block.data, data);
+    EXPECT_EQ(block.view(), std::string(110, 'b'));
+    allocator.assign(block, std::string(200, 'c'));
+    EXPECT_NE(block.data, data);
+    EXPECT_EQ(block.view(), std::string(200, 'c'));
+    allocator.assign(block, "");
+    EXPECT_EQ(block.size, 0);
+    EXPECT_EQ(allocator.allocatedBytes(), 0);
+}
+
+TEST(SlabAllocatorTest, TaggedBlocksStayOutOfTheSlabs) {
+    SlabAllocator allocator;
+    const int64_t number = -42;
+    auto block = SlabAllocator::tagged(&number, 3);
+    EXPECT_EQ(block.tag(), 3);
+    EXPECT_TRUE(block.isInline());
+    EXPECT_EQ(block.view(), std::string_view(reinterpret_cast<const char*>(&number), sizeof(number)));
+    EXPECT_EQ(allocator.bytes(block), 0);
+    EXPECT_EQ(allocator.allocate("short").tag(), 0);
+
+    // Assigning over a tagged block leaves nothing of the tag behind.
+    allocator.assign(block, std::string(100, 'a'));
+    EXPECT_EQ(block.tag(), 0);
+    EXPECT_EQ(block.view(), std::string(100, 'a'));
+    allocator.deallocate(block);
+    EXPECT_EQ(allocator.allocatedBytes(), 0);
+}
+
+TEST(SlabAllocatorTest, EmptySlabsAreFreed) {
+    SlabAllocator allocator;
+    const size_t per_slab = SlabAllocator::SLAB_SIZE / SlabAllocator::classSize(100);
+    std::vector<SlabAllocator::Block> blocks;
+    for (size_t i = 0; i < per_slab * 10; ++i) {
+        blocks.push_back(allocator.allocate(std::string(100, 'x')));
+    }
+    EXPECT_EQ(allocator.activeBytes(), 10 * SlabAllocator::SLAB_SIZE);
+    for (auto& block : blocks) {
+        allocator.deallocate(block);
+    }
+    // The slab allocations were coming from is kept.
+    EXPECT_EQ(allocator.activeBytes(), SlabAllocator::SLAB_SIZE);
+}
+
+TEST(SlabAllocatorTest, DefragPacksSparseSlabs) {
+    SlabAllocator allocator;
+    const size_t per_slab = SlabAllocator::SLAB_SIZE / SlabAllocator::classSize(100);
+    std::vector<SlabAllocator::Block> blocks;
+    for (size_t i = 0; i < per_slab * 20; ++i) {
+        blocks.push_back(allocator.allocate(std::string(100, static_cast<char>('a' + i % 26))));
+    }
+    std::vector<size_t> live;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (i % 4 == 0) {
+            live.push_back(i);
+        } else {
+            allocator.deallocate(blocks[i]);
+        }
+    }
+    EXPECT_EQ(allocator.activeBytes(), 20 * SlabAllocator::SLAB_SIZE);
+
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        for (size_t i : live) {
+            moved |= allocator.defrag(blocks[i]);
+        }
+    }
+    EXPECT_LE(allocator.activeBytes(), 7 * SlabAllocator::SLAB_SIZE);
+    for (size_t i : live) {
+        EXPECT_EQ(blocks[i].view(), std::string(100, static_cast<char>('a' + i % 26)));
+    }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "server/slowlog.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace server;
+using namespace std::chrono_literals;
+
+TEST(SlowLogTest, KeepsNewestSlowCommands) {
+    SlowLog log(1ms, 3);
+    const std::vector<std::string_view> fast{"GET", "fast"};
+    log.record(fast, 999us);
+    EXPECT_EQ(log.size(), 0);
+
+    for (std::string key : {"a", "b", "c", "d"}) {
+        log.record({"GET", key}, 2ms);
+    }
+    ASSERT_EQ(log.size(), 3);
+    auto entries = log.get(10);
+    ASSERT_EQ(entries.size(), 3);
+    EXPECT_EQ(entries[0].id, 3);
+    EXPECT_EQ(entries[0].args, (std::vector<std::string>{"GET", "d"}));
+    EXPECT_EQ(entries[0].duration, 2000us);
+    EXPECT_EQ(entries[2].id, 1);
+    EXPECT_GT(entries[0].time, 0);
+    EXPECT_EQ(log.get(1).size(), 1);
+
+    log.reset();
+    EXPECT_EQ(log.size(), 0);
+    log.record({"GET", "e"}, 2ms);
+    EXPECT_EQ(log.get(1)[0].id, 4);
+}
+
+TEST(SlowLogTest, ThresholdZeroLogsEverythingAndNegativeNothing) {
+    SlowLog log(0us);
+    log.record({"PING"}, 0ns);
+    EXPECT_EQ(log.size(), 1);
+
+    log.setThreshold(-1us);
+    log.record({"PING"}, 10s);
+    EXPECT_EQ(log.size(), 1);
+
+    log.setMaxLength(0);
+    EXPECT_EQ(log.size(), 0);
+}
+
+TEST(SlowLogTest, TruncatesLongCommands) {
+    SlowLog log(0us);
+    const std::string value(SlowLog::MAX_ARG_LENGTH + 10, 'x');
+    std::vector<std::string_view> args{"SET", "key", value};
+    log.record(args, 1ms);
+    auto entry = log.get(1).at(0);
+    EXPECT_EQ(entry.args[2], value.substr(0, SlowLog::MAX_ARG_LENGTH) + "... (10 more bytes)");
+
+    args.assign(40, "x");
+    log.record(args, 1ms);
+    entry = log.get(1).at(0);
+    ASSERT_EQ(entry.args.size(), SlowLog::MAX_ARGS);
+    EXPECT_EQ(entry.args.back(), "... (9 more arguments)");
+}
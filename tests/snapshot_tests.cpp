@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include "server/snapshot_manager.hpp"
+#include "server/checksum.hpp"
+#include <fstream>
+#include <future>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace server;
+
+class SnapshotManagerTest : public ::testing::Test {
+protected:
+    std::string path = "snapshot_test_" + std::to_string(::getpid()) + ".snapshot";
+    std::string aof_path = "snapshot_test_" + std::to_string(::getpid()) + ".aof";
+
+    struct Entry {
+        std::string value;
+        std::optional<int64_t> expire_at;
+        bool operator==(const Entry& other) const {
+            return value == other.value && expire_at == other.expire_at;
+        }
+    };
+    std::map<std::string, Entry> dataset;
+
+    void SetUp() override {
+        std::remove(path.c_str());
+        std::remove(aof_path.c_str());
+    }
+    void TearDown() override {
+        std::remove(path.c_str());
+        std::remove(aof_path.c_str());
+    }
+
+    void serve(SnapshotManager& snapshot) {
+        snapshot.setSource([this](const SnapshotManager::Emit& emit, const std::function<void()>&) {
+            for (const auto& [key, entry] : dataset) {
+                emit(key, store::ValueType::String, entry.value, entry.expire_at);
+            }
+        });
+    }
+
+    bool loadAll(std::map<std::string, Entry>& loaded) {
+        SnapshotManager snapshot(path);
+        return snapshot.load([&](std::string_view key, store::ValueType, std::string_view value,
+                                 std::optional<int64_t> expire_at) {
+            loaded[std::string(key)] = Entry{std::string(value), expire_at};
+        });
+    }
+
+    std::string readFile() {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    }
+
+    void writeFile(const std::string& data) {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+    }
+};
+
+TEST(ChecksumTest, Crc32cCheckValue) {
+    EXPECT_EQ(crc32c("123456789"), 0xE3069283u);
+    EXPECT_EQ(crc32c("56789", crc32c("1234")), 0xE3069283u);
+    EXPECT_EQ(crc32c(""), 0u);
+}
+
+TEST_F(SnapshotManagerTest, RoundTripsKeysAndExpiries) {
+    for (int i = 0; i < 20000; ++i) {
+        dataset["key" + std::to_string(i)] = Entry{std::string(i % 300, 'v'),
+            i % 7 == 0 ? std::optional<int64_t>(1700000000000 + i) : std::nullopt};
+    }
+    dataset[std::string("bin\0ary", 7)] = Entry{std::string("\r\n\0", 3), std::nullopt};
+    dataset[""] = Entry{"", std::nullopt};
+
+    SnapshotManager snapshot(path);
+    serve(snapshot);
+    ASSERT_TRUE(snapshot.save());
+
+    std::map<std::string, Entry> loaded;
+    ASSERT_TRUE(loadAll(loaded));
+    EXPECT_EQ(loaded, dataset);
+}
+
+TEST_F(SnapshotManagerTest, KeepsValueTypes) {
+    const std::vector<store::ValueType> types{store::ValueType::String, store::ValueType::Hash,
+                                              store::ValueType::List, store::ValueType::Set,
+                                              store::ValueType::ZSet};
+    SnapshotManager snapshot(path);
+    snapshot.setSource([&](const SnapshotManager::Emit& emit, const std::function<void()>&) {
+        for (size_t i = 0; i < types.size(); ++i) {
+            emit("key" + std::to_string(i), types[i], "payload",
+                 i % 2 ? std::optional<int64_t>(1700000000000) : std::nullopt);
+        }
+    });
+    ASSERT_TRUE(snapshot.save());
+
+    std::vector<store::ValueType> loaded;
+    ASSERT_TRUE(snapshot.load([&](std::string_view, store::ValueType type, std::string_view value,
+                                  std::optional<int64_t> expire_at) {
+        EXPECT_EQ(value, "payload");
+        EXPECT_EQ(expire_at.has_value(), loaded.size() % 2 == 1);
+        loaded.push_back(type);
+    }));
+    EXPECT_EQ(loaded, types);
+}
+
+TEST_F(SnapshotManagerTest, RejectsCorruptBlock) {
+    for (int i = 0; i < 5000; ++i) {
+        dataset["key" + std::to_string(i)] = Entry{"value" + std::to_string(i), std::nullopt};
+    }
+    SnapshotManager snapshot(path);
+    serve(snapshot);
+    ASSERT_TRUE(snapshot.save());
+
+    std::string data = readFile();
+    data[data.size() / 2] ^= 0x20;
+    writeFile(data);
+    std::map<std::string, Entry> loaded;
+    EXPECT_FALSE(loadAll(loaded));
+    EXPECT_LT(loaded.size(), dataset.size());
+}
+
+TEST_F(SnapshotManagerTest, RejectsTruncatedFile) {
+    dataset["key"] = Entry{"value", std::nullopt};
+    SnapshotManager snapshot(path);
+    serve(snapshot);
+    ASSERT_TRUE(snapshot.save());
+
+    const std::string data = readFile();
+    for (size_t size = 0; size < data.size(); ++size) {
+        writeFile(data.substr(0, size));
+        std::map<std::string, Entry> loaded;
+        EXPECT_FALSE(loadAll(loaded)) << size;
+    }
+}
+
+TEST_F(SnapshotManagerTest, RecordsLogPosition) {
+    AOFManager aof(aof_path);
+    aof.logSet("before", "snapshot");
+    SnapshotManager snapshot(path, &aof);
+    serve(snapshot);
+    ASSERT_TRUE(snapshot.save());
+    aof.logSet("after", "snapshot");
+    aof.logDel("before");
+
+    auto position = snapshot.logPosition();
+    ASSERT_TRUE(position);
+    std::promise<void> written;
+    aof.sync([&written]() { written.set_value(); });
+    written.get_future().wait();
+    EXPECT_TRUE(aof.contains(*position));
+
+    // Only the commands logged after the snapshot are replayed.
+    std::vector<std::string> tail;
+    EXPECT_TRUE(aof.replay(
+        [&](std::string_view key, std::string_view) { tail.push_back("SET " + std::string(key)); },
+        [&](std::string_view key) { tail.push_back("DEL " + std::string(key)); },
+        [&](std::string_view) {},
+        [&](std::string_view, int64_t) {},
+        1, position->offset));
+    EXPECT_EQ(tail, (std::vector<std::string>{"SET after", "DEL before"}));
+}
+
+TEST_F(SnapshotManagerTest, StaleAfterLogRewrite) {
+    AOFManager aof(aof_path);
+    aof.setSnapshotSource([](const AOFManager::Emit& emit, const std::function<void()>&) {
+        emit("key", store::ValueType::String, "value", std::nullopt);
+    });
+    for (int i = 0; i < 100; ++i) {
+        aof.logSet("key", "value");
+        aof.logDel("key");
+    }
+    SnapshotManager snapshot(path, &aof);
+    serve(snapshot);
+    ASSERT_TRUE(snapshot.save());
+    auto position = snapshot.logPosition();
+    ASSERT_TRUE(position);
+    EXPECT_TRUE(aof.contains(*position));
+
+    ASSERT_TRUE(aof.rewrite());
+    for (int i = 0; i < 100; ++i) {
+        aof.logSet("other", "value");
+    }
+    std::promise<void> written;
+    aof.sync([&written]() { written.set_value(); });
+    written.get_future().wait();
+    EXPECT_FALSE(aof.contains(*position));
+}
+
+TEST_F(SnapshotManagerTest, OnlyOneSaveAtATime) {
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::promise<void> entered;
+    SnapshotManager snapshot(path);
+    snapshot.setSource([&](const SnapshotManager::Emit& emit, const std::function<void()>&) {
+        entered.set_value();
+        released.wait();
+        emit("key", store::ValueType::String, "value", std::nullopt);
+    });
+
+    ASSERT_TRUE(snapshot.saveInBackground());
+    entered.get_future().wait();
+    EXPECT_TRUE(snapshot.saving());
+    EXPECT_FALSE(snapshot.saveInBackground());
+    EXPECT_FALSE(snapshot.save());
+    release.set_value();
+}
@@ -1,96 +1,747 @@
-#include <gtest/gtest.h>
-#include "store/store.hpp"
-#include <thread>
-#include <vector>
-#include <iostream>
-#include <chrono>
-#include <algorithm>
-
-using namespace store;
-
-class StoreTests : public ::testing::Test {
-protected:
-    std::chrono::system_clock::time_point current_time = std::chrono::system_clock::now();
-    Store store{[this]() { return current_time; }};
-
-    void advance_time(std::chrono::milliseconds duration) {
-        current_time += duration;
-    }
-
-    void SetUp() override {
-        std::cout << "Starting test: " << ::testing::UnitTest::GetInstance()->current_test_info()->name() << std::endl;
-    }
-
-    void TearDown() override {
-        std::cout << "Finished test: " << ::testing::UnitTest::GetInstance()->current_test_info()->name() << std::endl;
-    }
-};
-
-TEST_F(StoreTests, AddAndGet) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_FALSE(store.add("key1", "value2"));
-    EXPECT_EQ(store.get("key1"), "value1");
-    EXPECT_EQ(store.get("key2"), std::nullopt);
-}
-
-TEST_F(StoreTests, Remove) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.remove("key1"));
-    EXPECT_FALSE(store.remove("key1"));
-    EXPECT_EQ(store.get("key1"), std::nullopt);
-}
-
-TEST_F(StoreTests, Update) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.update("key1", "value2"));
-    EXPECT_FALSE(store.update("key2", "value1"));
-    EXPECT_EQ(store.get("key1"), "value2");
-}
-
-TEST_F(StoreTests, GetAll) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.add("key2", "value2"));
-    auto keys = store.getAll();
-    EXPECT_EQ(keys.size(), 2);
-    EXPECT_TRUE(std::find(keys.begin(), keys.end(), "key1") != keys.end());
-    EXPECT_TRUE(std::find(keys.begin(), keys.end(), "key2") != keys.end());
-}
-
-TEST_F(StoreTests, Expiry) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.add("key2", "value2"));
-    EXPECT_TRUE(store.add("key3", "value3"));
-    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
-    EXPECT_TRUE(store.setExpiry("key2", std::chrono::seconds(2)));
-    advance_time(std::chrono::milliseconds(1500));
-    EXPECT_EQ(store.get("key1"), std::nullopt);
-    EXPECT_EQ(store.get("key2"), "value2");
-    EXPECT_EQ(store.get("key3"), "value3");
-}
-
-TEST_F(StoreTests, Persist) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
-    EXPECT_TRUE(store.persist("key1"));
-    advance_time(std::chrono::milliseconds(1500));
-    EXPECT_EQ(store.get("key1"), "value1");
-}
-
-TEST_F(StoreTests, GetTTL) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(10)));
-    auto ttl = store.getTTL("key1");
-    EXPECT_TRUE(ttl);
-    EXPECT_GE(ttl->count(), 9);
-    EXPECT_LE(ttl->count(), 10);
-}
-
-TEST_F(StoreTests, CleanupThread) {
-    EXPECT_TRUE(store.add("key1", "value1"));
-    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
-    store.startCleanupThread(std::chrono::seconds(1));
-    advance_time(std::chrono::milliseconds(1500));
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    EXPECT_EQ(store.get("key1"), std::nullopt);
-    store.stopCleanupThread();
-}
+#include <gtest/gtest.h>
+#include "store/store.hpp"
+#include "store/memory.hpp"
+#include "store/numbers.hpp"
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+using namespace store;
+
+class StoreTests : public ::testing::Test {
+protected:
+    Store::Clock::time_point current_time = Store::Clock::now();
+    Store store{[this]() { return current_time; }};
+
+    void advance_time(std::chrono::milliseconds duration) {
+        current_time += duration;
+    }
+
+    void SetUp() override {
+        std::cout << "Starting test: " << ::testing::UnitTest::GetInstance()->current_test_info()->name() << std::endl;
+    }
+
+    void TearDown() override {
+        std::cout << "Finished test: " << ::testing::UnitTest::GetInstance()->current_test_info()->name() << std::endl;
+    }
+};
+
+TEST_F(StoreTests, AddAndGet) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_FALSE(store.add("key1", "value2"));
+    EXPECT_EQ(store.get("key1"), "value1");
+    EXPECT_EQ(store.get("key2"), std::nullopt);
+}
+
+TEST_F(StoreTests, Remove) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.remove("key1"));
+    EXPECT_FALSE(store.remove("key1"));
+    EXPECT_EQ(store.get("key1"), std::nullopt);
+}
+
+TEST_F(StoreTests, Update) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.update("key1", "value2"));
+    EXPECT_FALSE(store.update("key2", "value1"));
+    EXPECT_EQ(store.get("key1"), "value2");
+}
+
+TEST_F(StoreTests, GetAll) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.add("key2", "value2"));
+    auto keys = store.getAll();
+    EXPECT_EQ(keys.size(), 2);
+    EXPECT_TRUE(std::find(keys.begin(), keys.end(), "key1") != keys.end());
+    EXPECT_TRUE(std::find(keys.begin(), keys.end(), "key2") != keys.end());
+}
+
+TEST_F(StoreTests, Upsert) {
+    EXPECT_TRUE(store.upsert("key1", "value1", store.deadlineIn(std::chrono::seconds(1))));
+    EXPECT_FALSE(store.upsert("key1", "value2"));
+    EXPECT_EQ(store.get("key1"), "value2");
+    EXPECT_EQ(store.getTTL("key1"), std::nullopt);
+
+    EXPECT_FALSE(store.upsert("key1", "value3", store.deadlineIn(std::chrono::seconds(1))));
+    advance_time(std::chrono::milliseconds(1500));
+    EXPECT_TRUE(store.upsert("key1", "value4"));
+    EXPECT_EQ(store.get("key1"), "value4");
+}
+
+TEST_F(StoreTests, SetConditions) {
+    EXPECT_FALSE(store.setIfPresent("key1", "value1"));
+    EXPECT_EQ(store.size(), 0);
+    EXPECT_TRUE(store.setIfAbsent("key1", "value1"));
+    EXPECT_FALSE(store.setIfAbsent("key1", "value2"));
+    EXPECT_TRUE(store.setIfPresent("key1", "value3", store.deadlineIn(std::chrono::seconds(1))));
+    EXPECT_EQ(store.get("key1"), "value3");
+
+    // An expired key is missing to both.
+    advance_time(std::chrono::milliseconds(1500));
+    EXPECT_FALSE(store.setIfPresent("key1", "value4"));
+    EXPECT_EQ(store.size(), 0);
+    EXPECT_TRUE(store.add("key1", "value4", store.deadlineIn(std::chrono::seconds(1))));
+    advance_time(std::chrono::milliseconds(1500));
+    EXPECT_TRUE(store.setIfAbsent("key1", "value5"));
+    EXPECT_EQ(store.getTTL("key1"), std::nullopt);
+}
+
+TEST_F(StoreTests, SetOptions) {
+    Store::SetOptions options;
+    options.get = true;
+    auto result = store.set("key1", "value1", store.deadlineIn(std::chrono::seconds(10)), options);
+    EXPECT_TRUE(result.written);
+    EXPECT_TRUE(result.created);
+    EXPECT_EQ(result.previous, std::nullopt);
+    ASSERT_TRUE(result.expiry);
+
+    options.keep_ttl = true;
+    result = store.set("key1", "value2", std::nullopt, options);
+    EXPECT_TRUE(result.written);
+    EXPECT_FALSE(result.created);
+    EXPECT_EQ(result.previous, "value1");
+    EXPECT_TRUE(result.expiry);
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(10));
+
+    // NX still hands back the value it left alone.
+    options.condition = Store::SetCondition::IfAbsent;
+    result = store.set("key1", "value3", std::nullopt, options);
+    EXPECT_FALSE(result.written);
+    EXPECT_EQ(result.previous, "value2");
+    EXPECT_EQ(store.get("key1"), "value2");
+
+    // Without KEEPTTL the TTL goes.
+    result = store.set("key1", "value4", std::nullopt, {});
+    EXPECT_FALSE(result.expiry);
+    EXPECT_EQ(store.getTTL("key1"), std::nullopt);
+}
+
+TEST_F(StoreTests, IncrementBy) {
+    using Status = Store::IncrementResult::Status;
+    EXPECT_EQ(store.incrementBy("counter", 1).integer, 1);
+    EXPECT_EQ(store.incrementBy("counter", -11).integer, -10);
+    EXPECT_EQ(store.get("counter"), "-10");
+
+    // Canonical integers written as text count as numbers.
+    EXPECT_TRUE(store.add("written", "9223372036854775806", store.deadlineIn(std::chrono::seconds(10))));
+    auto result = store.incrementBy("written", 1);
+    EXPECT_EQ(result.status, Status::Ok);
+    EXPECT_EQ(result.integer, INT64_MAX);
+    EXPECT_TRUE(result.expiry);
+    EXPECT_EQ(store.getTTL("written"), std::chrono::seconds(10));
+    EXPECT_EQ(store.incrementBy("written", 1).status, Status::OutOfRange);
+    EXPECT_EQ(store.get("written"), "9223372036854775807");
+
+    EXPECT_TRUE(store.add("padded", "007"));
+    EXPECT_EQ(store.incrementBy("padded", 1).status, Status::NotNumber);
+    EXPECT_EQ(store.get("padded"), "007");
+
+    // An expired counter starts again from zero, without its TTL.
+    advance_time(std::chrono::seconds(11));
+    EXPECT_EQ(store.incrementBy("written", 5).integer, 5);
+    EXPECT_EQ(store.getTTL("written"), std::nullopt);
+}
+
+TEST_F(StoreTests, IncrementByFloat) {
+    using Status = Store::IncrementResult::Status;
+    EXPECT_TRUE(store.add("price", "10.50"));
+    EXPECT_EQ(store.incrementByFloat("price", 0.1L).text, "10.6");
+    EXPECT_EQ(store.incrementByFloat("price", -5.6L).text, "5");
+    // A whole result is an integer again.
+    EXPECT_EQ(store.incrementBy("price", 1).integer, 6);
+    EXPECT_EQ(store.incrementByFloat("fresh", 2.5L).text, "2.5");
+
+    EXPECT_TRUE(store.add("name", "abc"));
+    EXPECT_EQ(store.incrementByFloat("name", 1).status, Status::NotNumber);
+    EXPECT_TRUE(store.add("huge", "1e4932"));
+    EXPECT_EQ(store.incrementByFloat("huge", 1e4932L).status, Status::OutOfRange);
+    EXPECT_EQ(store.size(), 4);
+}
+
+TEST(NumbersTests, ParsesOnlyCanonicalIntegers) {
+    EXPECT_EQ(parseInteger("0"), 0);
+    EXPECT_EQ(parseInteger("-42"), -42);
+    EXPECT_EQ(parseInteger("-9223372036854775808"), INT64_MIN);
+    EXPECT_FALSE(parseInteger("9223372036854775808"));
+    EXPECT_FALSE(parseInteger("-0"));
+    EXPECT_FALSE(parseInteger("007"));
+    EXPECT_FALSE(parseInteger("+1"));
+    EXPECT_FALSE(parseInteger(" 1"));
+    EXPECT_FALSE(parseInteger(""));
+}
+
+TEST(NumbersTests, FormatsIntegersAndLongDoubles) {
+    char buffer[INTEGER_TEXT_SIZE];
+    EXPECT_EQ(integerText(0, buffer), "0");
+    EXPECT_EQ(integerText(7, buffer), "7");
+    EXPECT_EQ(integerText(SHARED_INTEGERS - 1, buffer), "9999");
+    EXPECT_EQ(integerText(SHARED_INTEGERS, buffer), "10000");
+    EXPECT_EQ(integerText(-1, buffer), "-1");
+    EXPECT_EQ(integerText(INT64_MIN, buffer), "-9223372036854775808");
+
+    EXPECT_EQ(longDoubleText(3.0L), "3");
+    EXPECT_EQ(longDoubleText(-0.0L), "0");
+    EXPECT_EQ(longDoubleText(0.5L), "0.5");
+    EXPECT_EQ(parseLongDouble("1.5e3"), 1500.0L);
+    EXPECT_FALSE(parseLongDouble("inf"));
+    EXPECT_FALSE(parseLongDouble("1.5 "));
+    EXPECT_FALSE(parseLongDouble(" 1.5"));
+}
+
+TEST(NumbersTests, ParsesAndFormatsScores) {
+    EXPECT_EQ(parseScore("1.5"), 1.5);
+    EXPECT_EQ(parseScore("-inf"), -HUGE_VAL);
+    EXPECT_FALSE(parseScore("nan"));
+    EXPECT_FALSE(parseScore(" 1"));
+    EXPECT_FALSE(parseScore("1x"));
+    EXPECT_FALSE(parseScore(""));
+
+    EXPECT_EQ(scoreText(3), "3");
+    EXPECT_EQ(scoreText(-HUGE_VAL), "-inf");
+    EXPECT_EQ(scoreText(0.1), "0.1");
+    // Text always reads back as the same double.
+    for (double score : {1.0 / 3, 1e300, 5e-324, 0.1 + 0.2}) {
+        EXPECT_EQ(parseScore(scoreText(score)), score);
+    }
+}
+
+TEST_F(StoreTests, BatchReadsAndRemovals) {
+    // Enough keys to land on every shard.
+    std::vector<std::string> names;
+    for (int i = 0; i < 64; ++i) {
+        names.push_back("key" + std::to_string(i));
+        EXPECT_TRUE(store.add(names.back(), "value" + std::to_string(i)));
+    }
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
+    advance_time(std::chrono::milliseconds(1500));
+
+    std::vector<std::string_view> keys(names.begin(), names.end());
+    keys.push_back("missing");
+    keys.push_back("key0");
+    auto values = store.getMany(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    EXPECT_EQ(values[0], "value0");
+    EXPECT_EQ(values[1], std::nullopt);
+    EXPECT_EQ(values[63], "value63");
+    EXPECT_EQ(values[64], std::nullopt);
+    EXPECT_EQ(values[65], "value0");
+
+    // key0 is counted twice.
+    EXPECT_EQ(store.existsMany(keys), 64);
+    EXPECT_EQ(store.removeMany({"key0", "key1", "key2", "key0", "missing"}), 2);
+    EXPECT_EQ(store.existsMany({"key0", "key1", "key2", "key3"}), 1);
+    EXPECT_EQ(store.size(), 61);
+}
+
+TEST_F(StoreTests, BatchWrites) {
+    EXPECT_TRUE(store.add("key1", "old", store.deadlineIn(std::chrono::seconds(1))));
+    store.setMany({{"key1", "value1"}, {"key2", "first"}, {"key2", "value2"}});
+    EXPECT_EQ(store.get("key1"), "value1");
+    EXPECT_EQ(store.getTTL("key1"), std::nullopt);
+    EXPECT_EQ(store.get("key2"), "value2");
+
+    EXPECT_FALSE(store.setManyIfAbsent({{"key3", "value3"}, {"key2", "other"}}));
+    EXPECT_EQ(store.get("key3"), std::nullopt);
+    EXPECT_EQ(store.get("key2"), "value2");
+    EXPECT_TRUE(store.setManyIfAbsent({{"key3", "value3"}, {"key4", "value4"}}));
+    EXPECT_EQ(store.get("key3"), "value3");
+    EXPECT_EQ(store.get("key4"), "value4");
+    EXPECT_EQ(store.size(), 4);
+}
+
+TEST_F(StoreTests, CollectionCommands) {
+    EXPECT_EQ(store.hashSet("user", {{"name", "ada"}, {"lang", "c"}}), 2);
+    EXPECT_EQ(store.hashSet("user", {{"lang", "c++"}}), 0);
+    EXPECT_EQ(store.hashGet("user", "lang"), "c++");
+    EXPECT_EQ(store.hashGet("user", "missing"), std::nullopt);
+    EXPECT_EQ(store.hashGetAll("user").size(), 2);
+
+    EXPECT_EQ(store.listPush("queue", {"b", "c"}, false), 2);
+    EXPECT_EQ(store.listPush("queue", {"a"}, true), 3);
+    EXPECT_EQ(store.listRange("queue", 0, -1), (std::vector<std::string>{"a", "b", "c"}));
+    EXPECT_EQ(store.listRange("queue", -2, 100), (std::vector<std::string>{"b", "c"}));
+    EXPECT_TRUE(store.listRange("queue", 5, 10).empty());
+
+    EXPECT_EQ(store.setAdd("tags", {"x", "y", "x"}), 2);
+    EXPECT_TRUE(store.setIsMember("tags", "x"));
+    EXPECT_FALSE(store.setIsMember("tags", "z"));
+
+    EXPECT_EQ(store.zsetAdd("board", {{2, "b"}, {1, "a"}, {2, "a"}}), 2);
+    EXPECT_EQ(store.zsetRange("board", 0, -1),
+              (std::vector<Store::ScoredMember>{{"a", 2}, {"b", 2}}));
+
+    EXPECT_EQ(store.type("user"), ValueType::Hash);
+    EXPECT_EQ(store.type("queue"), ValueType::List);
+    EXPECT_EQ(store.type("tags"), ValueType::Set);
+    EXPECT_EQ(store.type("board"), ValueType::ZSet);
+    EXPECT_EQ(store.type("missing"), std::nullopt);
+    EXPECT_EQ(store.size(), 4);
+}
+
+TEST_F(StoreTests, WrongTypeLeavesValuesAlone) {
+    EXPECT_TRUE(store.add("text", "hello"));
+    EXPECT_EQ(store.hashSet("user", {{"name", "ada"}}), 1);
+    EXPECT_THROW(store.hashSet("text", {{"f", "v"}}), WrongType);
+    EXPECT_THROW(store.listPush("user", {"a"}, false), WrongType);
+    EXPECT_THROW(store.setIsMember("user", "a"), WrongType);
+    EXPECT_THROW(store.get("user"), WrongType);
+    EXPECT_THROW(store.incrementBy("user", 1), WrongType);
+    EXPECT_EQ(store.get("text"), "hello");
+    EXPECT_EQ(store.hashGet("user", "name"), "ada");
+
+    // SET replaces whatever the key held.
+    store.upsert("user", "plain");
+    EXPECT_EQ(store.type("user"), ValueType::String);
+    EXPECT_EQ(store.get("user"), "plain");
+}
+
+TEST_F(StoreTests, PoppingTheLastElementRemovesTheList) {
+    EXPECT_EQ(store.listPush("queue", {"a", "b", "c"}, false), 3);
+    EXPECT_EQ(store.listPop("queue", 1, true), std::vector<std::string>{"a"});
+    EXPECT_EQ(store.listPop("queue", 5, false), (std::vector<std::string>{"c", "b"}));
+    EXPECT_EQ(store.existsMany({"queue"}), 0);
+    EXPECT_EQ(store.listPop("queue", 1, true), std::nullopt);
+    EXPECT_EQ(store.memoryStats().dataset, 0);
+
+    // An expired list reads as missing.
+    EXPECT_EQ(store.setAdd("tags", {"x"}), 1);
+    EXPECT_TRUE(store.setExpiry("tags", std::chrono::seconds(1)));
+    advance_time(std::chrono::seconds(2));
+    EXPECT_FALSE(store.setIsMember("tags", "x"));
+    EXPECT_EQ(store.setAdd("tags", {"y"}), 1);
+    EXPECT_EQ(store.getTTL("tags"), std::nullopt);
+}
+
+TEST_F(StoreTests, RestoresCollectionsFromPayloads) {
+    EXPECT_EQ(store.zsetAdd("board", {{1.5, "a"}, {-3, "b"}}), 2);
+    std::string payload;
+    ValueType type = ValueType::String;
+    store.snapshot([&](const std::string& key, ValueType value_type, const Store::Value& value, Store::Expiry) {
+        if (key == "board") {
+            type = value_type;
+            payload = std::string(value);
+        }
+    });
+    ASSERT_EQ(type, ValueType::ZSet);
+
+    EXPECT_TRUE(store.restore("copy", type, payload, store.deadlineIn(std::chrono::seconds(5))));
+    EXPECT_EQ(store.zsetRange("copy", 0, -1), store.zsetRange("board", 0, -1));
+    EXPECT_EQ(store.getTTL("copy"), std::chrono::seconds(5));
+    EXPECT_FALSE(store.restore("bad", ValueType::Hash, "not a list pack"));
+    EXPECT_EQ(store.existsMany({"bad"}), 0);
+}
+
+TEST_F(StoreTests, CollectionMemoryIsAccounted) {
+    const size_t empty = store.usedMemory();
+    EXPECT_EQ(store.hashSet("small", {{"f", "v"}}), 1);
+    const size_t small = store.usedMemory();
+    EXPECT_GT(small, empty);
+
+    // Past the list pack limits the hash pays for a table.
+    for (size_t i = 0; i <= LISTPACK_MAX_ENTRIES; ++i) {
+        store.hashSet("large", {{"field" + std::to_string(i), "value"}});
+    }
+    const size_t large = store.usedMemory() - small;
+    EXPECT_GT(large, (LISTPACK_MAX_ENTRIES + 1) * 16);
+    for (size_t i = 0; i < 1000; ++i) {
+        store.zsetAdd("scores", {{static_cast<double>(i), "member" + std::to_string(i)}});
+    }
+    EXPECT_GT(store.memoryStats().dataset, 1000 * sizeof(double));
+
+    EXPECT_EQ(store.removeMany({"small", "large", "scores"}), 3);
+    EXPECT_EQ(store.memoryStats().dataset, 0);
+}
+
+TEST_F(StoreTests, Expiry) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.add("key2", "value2"));
+    EXPECT_TRUE(store.add("key3", "value3"));
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
+    EXPECT_TRUE(store.setExpiry("key2", std::chrono::seconds(2)));
+    advance_time(std::chrono::milliseconds(1500));
+    EXPECT_EQ(store.get("key1"), std::nullopt);
+    EXPECT_EQ(store.get("key2"), "value2");
+    EXPECT_EQ(store.get("key3"), "value3");
+}
+
+TEST_F(StoreTests, Persist) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
+    EXPECT_TRUE(store.persist("key1"));
+    advance_time(std::chrono::milliseconds(1500));
+    EXPECT_EQ(store.get("key1"), "value1");
+}
+
+TEST_F(StoreTests, ExpiredKeysCannotBeRevived) {
+    for (const char* key : {"persisted", "extended", "removed", "timed"}) {
+        EXPECT_TRUE(store.add(key, "value", store.deadlineIn(std::chrono::milliseconds(1))));
+    }
+    advance_time(std::chrono::milliseconds(5));
+    // Not reclaimed yet, but every command sees them as gone.
+    EXPECT_EQ(store.size(), 4);
+    EXPECT_EQ(store.getPTTL("timed"), std::nullopt);
+    EXPECT_FALSE(store.persist("persisted"));
+    EXPECT_FALSE(store.setExpiry("extended", std::chrono::seconds(100)));
+    EXPECT_FALSE(store.remove("removed"));
+    EXPECT_EQ(store.get("persisted"), std::nullopt);
+    EXPECT_EQ(store.get("extended"), std::nullopt);
+    EXPECT_EQ(store.size(), 1);
+    EXPECT_EQ(store.expiredCount(), 3);
+
+    // A deadline in the past expires the key at once.
+    EXPECT_TRUE(store.add("key", "value"));
+    EXPECT_TRUE(store.expireAt("key", std::chrono::system_clock::now() - std::chrono::seconds(1)));
+    EXPECT_FALSE(store.persist("key"));
+    EXPECT_EQ(store.get("key"), std::nullopt);
+
+    // Replaying a log, a PERSIST that came before the deadline still holds.
+    store.setLoading(true);
+    EXPECT_TRUE(store.add("replayed", "value", store.deadlineIn(std::chrono::milliseconds(1))));
+    advance_time(std::chrono::milliseconds(5));
+    EXPECT_TRUE(store.persist("replayed"));
+    store.setLoading(false);
+    EXPECT_EQ(store.get("replayed"), "value");
+}
+
+TEST_F(StoreTests, GetTTL) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(10)));
+    auto ttl = store.getTTL("key1");
+    EXPECT_TRUE(ttl);
+    EXPECT_GE(ttl->count(), 9);
+    EXPECT_LE(ttl->count(), 10);
+}
+
+TEST_F(StoreTests, GetTTLRoundsToTheNearestSecond) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(10)));
+    advance_time(std::chrono::milliseconds(1));
+    EXPECT_EQ(store.getPTTL("key1"), std::chrono::milliseconds(9999));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(10));
+    advance_time(std::chrono::milliseconds(499));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(10));
+    advance_time(std::chrono::milliseconds(1));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(9));
+    advance_time(std::chrono::milliseconds(8999));
+    EXPECT_EQ(store.getPTTL("key1"), std::chrono::milliseconds(500));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(1));
+    advance_time(std::chrono::milliseconds(1));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(0));
+}
+
+TEST_F(StoreTests, TTLTellsMissingKeysFromPersistentOnes) {
+    bool exists = false;
+    EXPECT_TRUE(store.add("persistent", "value"));
+    EXPECT_EQ(store.getPTTL("persistent", exists), std::nullopt);
+    EXPECT_TRUE(exists);
+    EXPECT_EQ(store.getTTL("missing", exists), std::nullopt);
+    EXPECT_FALSE(exists);
+
+    EXPECT_TRUE(store.add("volatile", "value", store.deadlineIn(std::chrono::seconds(1))));
+    EXPECT_EQ(store.getPTTL("volatile", exists), std::chrono::seconds(1));
+    EXPECT_TRUE(exists);
+    advance_time(std::chrono::seconds(2));
+    EXPECT_EQ(store.getPTTL("volatile", exists), std::nullopt);
+    EXPECT_FALSE(exists);
+}
+
+TEST_F(StoreTests, MillisecondTTL) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.expire("key1", std::chrono::milliseconds(250)));
+    EXPECT_EQ(store.getPTTL("key1"), std::chrono::milliseconds(250));
+    EXPECT_EQ(store.getTTL("key1"), std::chrono::seconds(0));
+
+    advance_time(std::chrono::milliseconds(250));
+    EXPECT_EQ(store.activeExpireCycle(), 0);
+    EXPECT_EQ(store.get("key1"), "value1");
+    advance_time(std::chrono::milliseconds(1));
+    EXPECT_EQ(store.activeExpireCycle(), 1);
+    EXPECT_EQ(store.size(), 0);
+}
+
+TEST_F(StoreTests, AddWithExpiry) {
+    EXPECT_TRUE(store.add("key1", "value1", store.deadlineIn(std::chrono::milliseconds(1500))));
+    EXPECT_EQ(store.getPTTL("key1"), std::chrono::milliseconds(1500));
+    EXPECT_EQ(store.volatileCount(), 1);
+    advance_time(std::chrono::seconds(2));
+    EXPECT_EQ(store.get("key1"), std::nullopt);
+    EXPECT_EQ(store.volatileCount(), 0);
+}
+
+TEST_F(StoreTests, ExpireAtWallClockTime) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.add("key2", "value2"));
+    EXPECT_TRUE(store.expireAt("key1", std::chrono::system_clock::now() + std::chrono::seconds(60)));
+    EXPECT_TRUE(store.expireAt("key2", std::chrono::system_clock::now() - std::chrono::seconds(60)));
+    EXPECT_FALSE(store.expireAt("missing", std::chrono::system_clock::now()));
+
+    auto ttl = store.getTTL("key1");
+    ASSERT_TRUE(ttl);
+    EXPECT_GE(ttl->count(), 59);
+    EXPECT_LE(ttl->count(), 60);
+    EXPECT_EQ(store.activeExpireCycle(), 1);
+    EXPECT_EQ(store.get("key2"), std::nullopt);
+}
+
+TEST_F(StoreTests, CleanupThread) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(1)));
+    store.startCleanupThread(std::chrono::seconds(1));
+    advance_time(std::chrono::milliseconds(1500));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(store.get("key1"), std::nullopt);
+    store.stopCleanupThread();
+}
+
+TEST_F(StoreTests, VolatileIndexTracksExpiry) {
+    EXPECT_TRUE(store.add("key1", "value1"));
+    EXPECT_TRUE(store.add("key2", "value2"));
+    EXPECT_TRUE(store.add("key3", "value3"));
+    EXPECT_EQ(store.volatileCount(), 0);
+
+    EXPECT_TRUE(store.setExpiry("key1", std::chrono::seconds(10)));
+    EXPECT_TRUE(store.setExpiry("key2", std::chrono::seconds(10)));
+    EXPECT_TRUE(store.setExpiry("key2", std::chrono::seconds(20)));
+    EXPECT_EQ(store.volatileCount(), 2);
+
+    EXPECT_TRUE(store.persist("key1"));
+    EXPECT_EQ(store.volatileCount(), 1);
+    EXPECT_TRUE(store.update("key2", "updated"));
+    EXPECT_EQ(store.volatileCount(), 0);
+
+    EXPECT_TRUE(store.setExpiry("key3", std::chrono::seconds(10)));
+    EXPECT_TRUE(store.remove("key3"));
+    EXPECT_EQ(store.volatileCount(), 0);
+}
+
+TEST_F(StoreTests, ActiveExpiryReclaimsUntouchedKeys) {
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "key" + std::to_string(i);
+        EXPECT_TRUE(store.add(key, "value"));
+        if (i % 2 == 0) {
+            EXPECT_TRUE(store.setExpiry(key, std::chrono::seconds(1)));
+        }
+    }
+    advance_time(std::chrono::milliseconds(1500));
+
+    EXPECT_EQ(store.activeExpireCycle(), 500);
+    EXPECT_EQ(store.activeExpireCycle(), 0);
+    EXPECT_EQ(store.size(), 500);
+    EXPECT_EQ(store.volatileCount(), 0);
+    EXPECT_EQ(store.expiredCount(), 500);
+    EXPECT_EQ(store.get("key1"), "value");
+    EXPECT_EQ(store.get("key0"), std::nullopt);
+}
+
+TEST_F(StoreTests, MemoryStatsFollowAllocations) {
+    const auto empty = store.memoryStats();
+    EXPECT_EQ(empty.dataset, 0);
+    const size_t allocated_before = processMemory().allocator_allocated;
+
+    const std::string value(100, 'v');
+    for (int i = 0; i < 2000; ++i) {
+        const std::string key = "a-key-too-long-to-be-stored-inline-" + std::to_string(i);
+        ASSERT_TRUE(store.add(key, value));
+        if (i % 2) {
+            EXPECT_TRUE(store.setExpiry(key, std::chrono::seconds(10)));
+        }
+    }
+    const auto stats = store.memoryStats();
+    const size_t allocated = processMemory().allocator_allocated - allocated_before;
+    // malloc sees whole value slabs, used() only the slots in use.
+    EXPECT_NEAR(static_cast<double>(stats.used() + stats.slab_free - empty.used() - empty.slab_free),
+                static_cast<double>(allocated), allocated * 0.05);
+    EXPECT_GE(stats.slab_active, 2000 * SlabAllocator::classSize(value.size()));
+    EXPECT_EQ(stats.peak, stats.used());
+    EXPECT_EQ(stats.shards.size(), store.shardCount());
+    EXPECT_EQ(store.usedMemory(), stats.used());
+
+    EXPECT_TRUE(store.update("a-key-too-long-to-be-stored-inline-0", std::string(1000, 'v')));
+    EXPECT_GT(store.memoryStats().dataset, stats.dataset);
+
+    for (int i = 0; i < 2000; ++i) {
+        EXPECT_TRUE(store.remove("a-key-too-long-to-be-stored-inline-" + std::to_string(i)));
+    }
+    const auto after = store.memoryStats();
+    EXPECT_EQ(after.dataset, 0);
+    EXPECT_GT(after.peak, stats.peak);
+}
+// Fills the store with count keys of 100 bytes and returns a limit that
+// leaves room for about half of them. Tables never shrink, so only the
+// dataset counts towards what eviction can free.
+size_t fillHalfOverLimit(Store& store, int count, bool with_ttl = false) {
+    for (int i = 0; i < count; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        EXPECT_TRUE(store.add(key, std::string(100, 'v')));
+        if (with_ttl && i % 2 == 0) {
+            EXPECT_TRUE(store.setExpiry(key, std::chrono::seconds(1000 - i)));
+        }
+    }
+    return store.usedMemory() - store.memoryStats().dataset / 2;
+}
+
+TEST_F(StoreTests, NoEvictionRefusesWrites) {
+    const size_t limit = fillHalfOverLimit(store, 100);
+    store.setEvictionConfig({limit, Store::EvictionPolicy::NoEviction});
+    EXPECT_FALSE(store.evictIfNeeded());
+    EXPECT_EQ(store.size(), 100);
+
+    store.setEvictionConfig({store.usedMemory(), Store::EvictionPolicy::NoEviction});
+    EXPECT_TRUE(store.evictIfNeeded());
+}
+
+TEST_F(StoreTests, LRUEvictsIdleKeys) {
+    Store::EvictionConfig config;
+    config.policy = Store::EvictionPolicy::AllKeysLRU;
+    store.setEvictionConfig(config);
+    for (int i = 0; i < 200; ++i) {
+        EXPECT_TRUE(store.add("key" + std::to_string(i), std::string(100, 'v')));
+        advance_time(std::chrono::milliseconds(1));
+    }
+    config.maxmemory = store.usedMemory() - 100 * 100;
+    advance_time(std::chrono::seconds(1));
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(store.get("key" + std::to_string(i)));
+    }
+    EXPECT_EQ(store.idleTime("key0"), std::chrono::milliseconds(0));
+    EXPECT_EQ(store.idleTime("key199"), std::chrono::milliseconds(1001));
+    advance_time(std::chrono::seconds(1));
+
+    store.setEvictionConfig(config);
+    std::vector<std::string> evicted;
+    EXPECT_TRUE(store.evictIfNeeded([&](const std::string& key) { evicted.push_back(key); }));
+    EXPECT_LE(store.usedMemory(), config.maxmemory);
+    EXPECT_EQ(store.evictedCount(), evicted.size());
+    EXPECT_EQ(store.size(), 200 - evicted.size());
+    for (int i = 0; i < 20; ++i) {
+        EXPECT_TRUE(store.get("key" + std::to_string(i))) << i;
+    }
+}
+
+TEST_F(StoreTests, LFUEvictsRarelyReadKeys) {
+    Store::EvictionConfig config;
+    config.policy = Store::EvictionPolicy::AllKeysLFU;
+    store.setEvictionConfig(config);
+    config.maxmemory = fillHalfOverLimit(store, 200);
+    for (int hit = 0; hit < 100; ++hit) {
+        for (int i = 100; i < 120; ++i) {
+            store.get("key" + std::to_string(i));
+        }
+    }
+    const auto frequency = store.accessFrequency("key100");
+    ASSERT_TRUE(frequency);
+    EXPECT_GT(*frequency, Store::EvictionConfig().lfu_log_factor / 2);
+    EXPECT_EQ(store.accessFrequency("key0"), 5);
+
+    // Counters decay while keys go unread.
+    advance_time(std::chrono::minutes(3));
+    EXPECT_EQ(store.accessFrequency("key0"), 2);
+    EXPECT_EQ(store.accessFrequency("key100"), *frequency - 3);
+
+    store.setEvictionConfig(config);
+    EXPECT_TRUE(store.evictIfNeeded());
+    EXPECT_LE(store.usedMemory(), config.maxmemory);
+    for (int i = 100; i < 120; ++i) {
+        EXPECT_TRUE(store.get("key" + std::to_string(i))) << i;
+    }
+}
+
+TEST_F(StoreTests, VolatileTTLEvictsSoonestExpiringKeys) {
+    const size_t limit = fillHalfOverLimit(store, 200, true) - 1000;
+    store.setEvictionConfig({limit, Store::EvictionPolicy::VolatileTTL});
+    // Only the 100 keys with a TTL may go, which is not enough.
+    EXPECT_FALSE(store.evictIfNeeded());
+    EXPECT_EQ(store.volatileCount(), 0);
+    EXPECT_EQ(store.size(), 100);
+    for (int i = 1; i < 200; i += 2) {
+        EXPECT_TRUE(store.get("key" + std::to_string(i))) << i;
+    }
+
+    store.setEvictionConfig({});
+    store.remove("key1");
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_TRUE(store.setExpiry("key" + std::to_string(2 * i + 3), std::chrono::seconds(100 + i)));
+    }
+    // Enough samples to see every candidate.
+    store.setEvictionConfig({store.usedMemory() - 1, Store::EvictionPolicy::VolatileTTL, 100});
+    EXPECT_TRUE(store.evictIfNeeded());
+    EXPECT_EQ(store.get("key3"), std::nullopt);
+    EXPECT_TRUE(store.get("key5"));
+}
+
+TEST(StoreShardTests, ActiveDefragFreesSparseSlabs) {
+    Store store(Store::Clock::now, 1);
+    for (int i = 0; i < 4000; ++i) {
+        ASSERT_TRUE(store.add("key" + std::to_string(i), std::string(100, 'a' + i % 26)));
+    }
+    for (int i = 0; i < 4000; ++i) {
+        if (i % 4) {
+            EXPECT_TRUE(store.remove("key" + std::to_string(i)));
+        }
+    }
+    const auto before = store.memoryStats();
+    EXPECT_GT(before.slab_free, before.slab_active / 2);
+
+    Store::ActiveDefragConfig config;
+    config.enabled = true;
+    config.ignore_bytes = 0;
+    // Out of time after the first batch, part way through the shard.
+    config.keys_per_loop = 16;
+    config.time_budget = std::chrono::microseconds(0);
+    store.setActiveDefragConfig(config);
+    EXPECT_FALSE(store.activeDefragRunning());
+    store.activeDefragCycle();
+    EXPECT_TRUE(store.activeDefragRunning());
+
+    config.keys_per_loop = Store::ActiveDefragConfig().keys_per_loop;
+    config.time_budget = std::chrono::seconds(10);
+    store.setActiveDefragConfig(config);
+    EXPECT_GT(store.activeDefragCycle(), 0);
+    while (store.activeDefragCycle() > 0) {
+    }
+    EXPECT_GT(store.defragHits(), 0);
+    EXPECT_FALSE(store.activeDefragRunning());
+
+    const auto after = store.memoryStats();
+    EXPECT_LT(after.slab_active, before.slab_active / 2);
+    EXPECT_EQ(after.dataset, before.dataset);
+    for (int i = 0; i < 4000; i += 4) {
+        EXPECT_EQ(store.get("key" + std::to_string(i)), std::string(100, 'a' + i % 26)) << i;
+    }
+
+    // Below the threshold nothing is examined.
+    const uint64_t examined = store.defragHits() + store.defragMisses();
+    config.threshold_lower = 100;
+    store.setActiveDefragConfig(config);
+    EXPECT_EQ(store.activeDefragCycle(), 0);
+    EXPECT_EQ(store.defragHits() + store.defragMisses(), examined);
+}
+
+TEST(StoreShardTests, ShardCountIsPowerOfTwo) {
+    EXPECT_EQ(Store(Store::Clock::now, 1).shardCount(), 1);
+    EXPECT_EQ(Store(Store::Clock::now, 5).shardCount(), 8);
+    EXPECT_EQ(Store(Store::Clock::now, 16).shardCount(), 16);
+}
+
+TEST(StoreShardTests, ConcurrentAccess) {
+    Store store(Store::Clock::now, 4);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&store, t]() {
+            for (int i = 0; i < 200; ++i) {
+                std::string key = "key" + std::to_string(t) + ":" + std::to_string(i);
+                EXPECT_TRUE(store.add(key, "value"));
+                EXPECT_EQ(store.get(key), "value");
+                EXPECT_TRUE(store.update(key, "updated"));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(store.getAll().size(), 800);
+    EXPECT_EQ(store.get("key3:199"), "updated");
+}
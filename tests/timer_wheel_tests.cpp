@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include "store/timer_wheel.hpp"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace store;
+
+namespace {
+
+std::vector<std::string> drainDue(TimerWheel& wheel) {
+    std::vector<std::string> keys;
+    TimerWheel::Handle due;
+    while ((due = wheel.nextDue()) != TimerWheel::NONE) {
+        keys.push_back(wheel.key(due));
+        wheel.cancel(due);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+}
+
+TEST(TimerWheelTest, FiresAtDeadline) {
+    TimerWheel wheel;
+    wheel.schedule("a", 1005, 1000);
+    wheel.schedule("b", 1005, 1000);
+    wheel.schedule("c", 1010, 1000);
+    EXPECT_EQ(wheel.size(), 3);
+
+    wheel.advance(1004);
+    EXPECT_EQ(wheel.nextDue(), TimerWheel::NONE);
+    wheel.advance(1005);
+    EXPECT_EQ(drainDue(wheel), (std::vector<std::string>{"a", "b"}));
+    wheel.advance(1100);
+    EXPECT_EQ(drainDue(wheel), (std::vector<std::string>{"c"}));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheelTest, PastDeadlineIsDueImmediately) {
+    TimerWheel wheel;
+    wheel.schedule("a", 500, 1000);
+    EXPECT_EQ(drainDue(wheel), (std::vector<std::string>{"a"}));
+}
+
+TEST(TimerWheelTest, CancelAndReschedule) {
+    TimerWheel wheel;
+    auto a = wheel.schedule("a", 100, 0);
+    auto b = wheel.schedule("b", 100, 0);
+    wheel.cancel(a);
+    wheel.reschedule(b, 5000);
+    wheel.advance(4999);
+    EXPECT_EQ(wheel.nextDue(), TimerWheel::NONE);
+    EXPECT_EQ(wheel.size(), 1);
+    wheel.advance(5000);
+    EXPECT_EQ(drainDue(wheel), (std::vector<std::string>{"b"}));
+
+    // Freed handles are reused.
+    EXPECT_EQ(wheel.schedule("c", 6000, 5000), b);
+}
+
+TEST(TimerWheelTest, CascadesAcrossLevels) {
+    TimerWheel wheel;
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> deadlines;
+    for (int i = 0; i < 2000; ++i) {
+        // Spread over the first four levels.
+        deadlines.push_back(rng() % (uint64_t{1} << 24));
+        wheel.schedule(std::to_string(i), deadlines.back(), 0);
+    }
+
+    uint64_t now = 0;
+    size_t fired = 0;
+    while (now < (uint64_t{1} << 24)) {
+        now += 1 + rng() % 20000;
+        wheel.advance(now);
+        TimerWheel::Handle due;
+        while ((due = wheel.nextDue()) != TimerWheel::NONE) {
+            const uint64_t deadline = deadlines[std::stoul(wheel.key(due))];
+            EXPECT_LE(deadline, now);
+            // Nothing comes due later than the advance that passed it.
+            EXPECT_GT(deadline, now - 20001);
+            EXPECT_EQ(wheel.deadline(due), deadline);
+            wheel.cancel(due);
+            ++fired;
+        }
+    }
+    EXPECT_EQ(fired, deadlines.size());
+}
+
+TEST(TimerWheelTest, DeadlineBeyondHorizon) {
+    TimerWheel wheel;
+    const uint64_t far = uint64_t{1} << 40;
+    wheel.schedule("far", far, 0);
+    wheel.advance(far - 1);
+    EXPECT_EQ(wheel.nextDue(), TimerWheel::NONE);
+    wheel.advance(far);
+    EXPECT_EQ(drainDue(wheel), (std::vector<std::string>{"far"}));
+}